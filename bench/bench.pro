@@ -0,0 +1,17 @@
+# QMake project file for the interpreter micro-benchmarks
+TEMPLATE = app
+TARGET = emu-bench
+
+QT -= core gui
+CONFIG += console c11
+CONFIG -= app_bundle qt
+
+SOURCES += \
+    emu-bench.c
+
+LIBS += \
+    -L$$OUT_PWD/../emu -lemu \
+    -L$$OUT_PWD/../util -lutil
+
+INCLUDEPATH += \
+    ..
@@ -0,0 +1,319 @@
+// Interpreter micro-benchmarks. Each one is a small hand assembled loop that
+// gets run through cpu_step32 against a standalone struct mem, with no kernel
+// involved, and the result is reported in guest instructions per second.
+//
+//     emu-bench [-n iterations] [-r runs] [name...]
+//
+// Every benchmark is run a few times and the best run is reported, since
+// that's the most stable number on a machine that's doing other things too.
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "emu/cpu.h"
+#include "emu/float80.h"
+#include "emu/interrupt.h"
+#include "emu/memory.h"
+#include "emu/modrm.h"
+#include "emu/tlb.h"
+
+#define CODE_ADDR 0x10000
+#define STACK_TOP 0x80000
+#define DATA_ADDR 0x100000
+#define DATA_SIZE (64 * 1024)
+// more pages than the tlb has entries
+#define THRASH_ADDR 0x1000000
+#define THRASH_PAGES (TLB_SIZE * 2)
+
+// emu and util call out to these, but there's no kernel here. A benchmark
+// only ever ends with int 0x80, and never gets past cpu_step32.
+void handle_interrupt(int interrupt) {}
+bool handle_interrupt_fast(int interrupt, struct tlb *tlb) {
+    return false;
+}
+int current_pid() {
+    return 0;
+}
+struct task;
+thread_local struct task *current;
+int errno_map() {
+    return -1;
+}
+void die(const char *msg, ...) {
+    va_list args;
+    va_start(args, msg);
+    vfprintf(stderr, msg, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+    abort();
+}
+
+struct code {
+    byte_t buf[512];
+    unsigned len;
+    unsigned loop;
+    // for the indirect jump benchmark, goes at DATA_ADDR
+    dword_t jump_table[4];
+};
+
+#define EMIT(code, ...) do { \
+    static const byte_t bytes_[] = {__VA_ARGS__}; \
+    emit(code, bytes_, sizeof(bytes_)); \
+} while (0)
+static void emit(struct code *code, const byte_t *bytes, unsigned size) {
+    memcpy(code->buf + code->len, bytes, size);
+    code->len += size;
+}
+static void emit32(struct code *code, dword_t val) {
+    emit(code, (byte_t *) &val, sizeof(val));
+}
+
+// everything runs ecx times around a loop
+static void loop_start(struct code *code) {
+    code->loop = code->len;
+}
+// dec ecx; jnz loop; int 0x80
+static void loop_end(struct code *code) {
+    EMIT(code, 0x49, 0x0f, 0x85);
+    emit32(code, code->loop - (code->len + 4));
+    EMIT(code, 0xcd, 0x80);
+}
+
+// Each of these writes the code and returns how many instructions one trip
+// around the loop is, including the dec and jnz.
+
+static unsigned bench_alu(struct code *code) {
+    loop_start(code);
+    EMIT(code, 0x01, 0xd8); // add eax, ebx
+    EMIT(code, 0x31, 0xc2); // xor edx, eax
+    EMIT(code, 0xd1, 0xe2); // shl edx, 1
+    EMIT(code, 0x29, 0xd3); // sub ebx, edx
+    EMIT(code, 0x46); // inc esi
+    EMIT(code, 0x21, 0xf8); // and eax, edi
+    EMIT(code, 0x83, 0xc8, 0x01); // or eax, 1
+    EMIT(code, 0x0f, 0xaf, 0xc6); // imul eax, esi
+    loop_end(code);
+    return 10;
+}
+
+static unsigned bench_memory(struct code *code) {
+    EMIT(code, 0xbe); emit32(code, DATA_ADDR); // mov esi, DATA_ADDR
+    loop_start(code);
+    EMIT(code, 0x8b, 0x06); // mov eax, [esi]
+    EMIT(code, 0x89, 0x46, 0x04); // mov [esi+4], eax
+    EMIT(code, 0x03, 0x46, 0x08); // add eax, [esi+8]
+    EMIT(code, 0x89, 0x46, 0x0c); // mov [esi+12], eax
+    EMIT(code, 0x89, 0xcb); // mov ebx, ecx
+    EMIT(code, 0x81, 0xe3); emit32(code, DATA_SIZE - 4 - 16); // and ebx, DATA_SIZE-20
+    EMIT(code, 0x8b, 0x5c, 0x1e, 0x10); // mov ebx, [esi+ebx+16]
+    EMIT(code, 0x01, 0x5e, 0x10); // add [esi+16], ebx
+    EMIT(code, 0x50); // push eax
+    EMIT(code, 0x5a); // pop edx
+    loop_end(code);
+    return 12;
+}
+
+static unsigned bench_rep(struct code *code) {
+    loop_start(code);
+    EMIT(code, 0x51); // push ecx
+    EMIT(code, 0xbe); emit32(code, DATA_ADDR); // mov esi, DATA_ADDR
+    EMIT(code, 0xbf); emit32(code, DATA_ADDR + 0x4000); // mov edi, DATA_ADDR+0x4000
+    EMIT(code, 0xb9); emit32(code, 1024); // mov ecx, 1024
+    EMIT(code, 0xf3, 0xa5); // rep movsd
+    EMIT(code, 0xbf); emit32(code, DATA_ADDR + 0x8000); // mov edi, DATA_ADDR+0x8000
+    EMIT(code, 0xb9); emit32(code, 4096); // mov ecx, 4096
+    EMIT(code, 0xf3, 0xaa); // rep stosb
+    EMIT(code, 0x59); // pop ecx
+    loop_end(code);
+    return 11;
+}
+
+static unsigned bench_x87(struct code *code) {
+    EMIT(code, 0xbe); emit32(code, DATA_ADDR); // mov esi, DATA_ADDR
+    loop_start(code);
+    EMIT(code, 0xdd, 0x06); // fld qword [esi]
+    EMIT(code, 0xdc, 0x4e, 0x08); // fmul qword [esi+8]
+    EMIT(code, 0xdc, 0x46, 0x10); // fadd qword [esi+16]
+    EMIT(code, 0xdc, 0x76, 0x08); // fdiv qword [esi+8]
+    EMIT(code, 0xd9, 0xe8); // fld1
+    EMIT(code, 0xde, 0xf9); // fdivp
+    EMIT(code, 0xdd, 0x5e, 0x18); // fstp qword [esi+24]
+    loop_end(code);
+    return 9;
+}
+
+static unsigned bench_sse(struct code *code) {
+    EMIT(code, 0xbe); emit32(code, DATA_ADDR); // mov esi, DATA_ADDR
+    loop_start(code);
+    EMIT(code, 0xf3, 0x0f, 0x6f, 0x06); // movdqu xmm0, [esi]
+    EMIT(code, 0xf3, 0x0f, 0x6f, 0x4e, 0x10); // movdqu xmm1, [esi+16]
+    EMIT(code, 0x66, 0x0f, 0xfe, 0xc1); // paddd xmm0, xmm1
+    EMIT(code, 0x66, 0x0f, 0xef, 0xc8); // pxor xmm1, xmm0
+    EMIT(code, 0x0f, 0x59, 0xc1); // mulps xmm0, xmm1
+    EMIT(code, 0x0f, 0x58, 0xc8); // addps xmm1, xmm0
+    EMIT(code, 0xf2, 0x0f, 0x58, 0xc1); // addsd xmm0, xmm1
+    EMIT(code, 0xf3, 0x0f, 0x7f, 0x46, 0x20); // movdqu [esi+32], xmm0
+    loop_end(code);
+    return 10;
+}
+
+static unsigned bench_branch(struct code *code) {
+    loop_start(code);
+    EMIT(code, 0x89, 0xc8); // mov eax, ecx
+    EMIT(code, 0x83, 0xe0, 0x03); // and eax, 3
+    EMIT(code, 0xff, 0x24, 0x85); emit32(code, DATA_ADDR); // jmp [table+eax*4]
+    unsigned targets[4];
+    unsigned jumps[4];
+    for (int i = 0; i < 4; i++) {
+        targets[i] = code->len;
+        code->jump_table[i] = CODE_ADDR + code->len;
+        EMIT(code, 0xe8); emit32(code, 0); // call function
+        jumps[i] = code->len;
+        EMIT(code, 0xe9); emit32(code, 0); // jmp tail
+    }
+    unsigned function = code->len;
+    EMIT(code, 0x01, 0xc3); // add ebx, eax
+    EMIT(code, 0xc3); // ret
+    unsigned tail = code->len;
+    loop_end(code);
+
+    for (int i = 0; i < 4; i++) {
+        dword_t call_rel = function - (targets[i] + 5);
+        memcpy(&code->buf[targets[i] + 1], &call_rel, 4);
+        dword_t jmp_rel = tail - (jumps[i] + 5);
+        memcpy(&code->buf[jumps[i] + 1], &jmp_rel, 4);
+    }
+    return 9;
+}
+
+static unsigned bench_tlb(struct code *code) {
+    EMIT(code, 0xbe); emit32(code, THRASH_ADDR); // mov esi, THRASH_ADDR
+    loop_start(code);
+    EMIT(code, 0x8b, 0x06); // mov eax, [esi]
+    EMIT(code, 0x01, 0xc3); // add ebx, eax
+    EMIT(code, 0x81, 0xc6); emit32(code, PAGE_SIZE + 64); // add esi, PAGE_SIZE+64
+    EMIT(code, 0x81, 0xe6); emit32(code, THRASH_PAGES * PAGE_SIZE - 1); // and esi, size-1
+    EMIT(code, 0x81, 0xce); emit32(code, THRASH_ADDR); // or esi, THRASH_ADDR
+    loop_end(code);
+    return 7;
+}
+
+static struct bench {
+    const char *name;
+    unsigned (*write)(struct code *code);
+    // relative to the iteration count, so each one takes about as long
+    double scale;
+} benches[] = {
+    {"alu", bench_alu, 1},
+    {"memory", bench_memory, 1},
+    {"rep", bench_rep, 0.002},
+    {"x87", bench_x87, 0.5},
+    {"sse", bench_sse, 0.5},
+    {"branch", bench_branch, 1},
+    {"tlb", bench_tlb, 1},
+};
+#define NUM_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+static void guest_write(struct mem *mem, addr_t addr, const void *data, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        *(byte_t *) mem_ptr(mem, addr + i, MEM_WRITE) = ((const byte_t *) data)[i];
+}
+
+static struct mem *bench_mem(struct bench *bench, unsigned *insns_out) {
+    struct mem *mem = mem_new();
+    if (mem == NULL ||
+            pt_map_nothing(mem, PAGE(CODE_ADDR), 1, P_READ | P_WRITE | P_EXEC) < 0 ||
+            pt_map_nothing(mem, PAGE(STACK_TOP) - 1, 1, P_READ | P_WRITE) < 0 ||
+            pt_map_nothing(mem, PAGE(DATA_ADDR), DATA_SIZE / PAGE_SIZE, P_READ | P_WRITE) < 0 ||
+            pt_map_nothing(mem, PAGE(THRASH_ADDR), THRASH_PAGES, P_READ | P_WRITE) < 0) {
+        fprintf(stderr, "couldn't set up guest memory\n");
+        exit(1);
+    }
+
+    struct code code = {};
+    *insns_out = bench->write(&code);
+    guest_write(mem, CODE_ADDR, code.buf, code.len);
+
+    if (bench->write == bench_x87) {
+        double operands[] = {1.5, 1.000001, 0.25};
+        guest_write(mem, DATA_ADDR, operands, sizeof(operands));
+    } else if (bench->write == bench_branch) {
+        guest_write(mem, DATA_ADDR, code.jump_table, sizeof(code.jump_table));
+    }
+    return mem;
+}
+
+static double run(struct bench *bench, unsigned long iterations) {
+    unsigned insns;
+    struct mem *mem = bench_mem(bench, &insns);
+
+    struct cpu_state cpu = {};
+    cpu.mem = mem;
+    cpu.eip = CODE_ADDR;
+    cpu.esp = STACK_TOP;
+    cpu.ecx = iterations;
+    cpu.fcw = 0x37f;
+    f80_rounding_mode = cpu.rc;
+    f80_precision = cpu.pc;
+    cpu.mxcsr = 0x1f80;
+
+    struct tlb tlb = {.mem = mem};
+    tlb_flush(&tlb);
+
+    struct timespec start, end;
+    read_wrlock(&mem->lock);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int interrupt;
+    while ((interrupt = cpu_step32(&cpu, &tlb)) == INT_NONE)
+        ;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    read_wrunlock(&mem->lock);
+    mem_release(mem);
+
+    if (interrupt != INT_SYSCALL) {
+        fprintf(stderr, "%s: interrupt %d at %#x\n", bench->name, interrupt, cpu.eip);
+        exit(1);
+    }
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return insns * (double) iterations / seconds;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long iterations = 10000000;
+    int runs = 5;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-n") == 0 && arg + 1 < argc) {
+            iterations = strtoul(argv[++arg], NULL, 0);
+        } else if (strcmp(argv[arg], "-r") == 0 && arg + 1 < argc) {
+            runs = atoi(argv[++arg]);
+        } else {
+            fprintf(stderr, "usage: %s [-n iterations] [-r runs] [name...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    for (unsigned i = 0; i < NUM_BENCHES; i++) {
+        struct bench *bench = &benches[i];
+        if (arg < argc) {
+            bool wanted = false;
+            for (int j = arg; j < argc; j++)
+                if (strcmp(argv[j], bench->name) == 0)
+                    wanted = true;
+            if (!wanted)
+                continue;
+        }
+        unsigned long n = iterations * bench->scale;
+        if (n == 0)
+            n = 1;
+        double best = 0;
+        for (int r = 0; r < runs; r++) {
+            double rate = run(bench, n);
+            if (rate > best)
+                best = rate;
+        }
+        printf("%-8s %10.2f Minsn/s\n", bench->name, best / 1e6);
+    }
+    return 0;
+}
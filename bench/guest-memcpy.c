@@ -0,0 +1,80 @@
+// Guest side memcpy/memset/strlen throughput benchmark. Build it as an i386
+// binary against the guest's libc, and run it inside iSL once for each cpuid
+// profile to see which string functions the libc picked and what they cost:
+//
+//     i686-linux-gnu-gcc -O2 -o guest-memcpy bench/guest-memcpy.c
+//     ISL_CPUID=i686 ...   (run guest-memcpy)
+//     ISL_CPUID=sse2 ...   (run guest-memcpy)
+//
+// It prints the profile from /proc/cpuinfo, then MB/s for each size.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TOTAL_BYTES (64 << 20)
+#define MAX_SIZE (1 << 20)
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_profile() {
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    if (f == NULL)
+        return;
+    char line[256];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "model name", 10) == 0 || strncmp(line, "flags", 5) == 0)
+            fputs(line, stdout);
+    }
+    fclose(f);
+}
+
+// called through pointers so the compiler can't inline or drop them, it's
+// libc's versions being measured
+static void *(*volatile memcpy_fn)(void *, const void *, size_t) = memcpy;
+static void *(*volatile memset_fn)(void *, int, size_t) = memset;
+static size_t (*volatile strlen_fn)(const char *) = strlen;
+static volatile size_t sink;
+
+int main() {
+    static const size_t sizes[] = {16, 64, 256, 4096, 65536, MAX_SIZE};
+    // the copies move around by up to 15 bytes to vary the alignment
+    char *src = malloc(MAX_SIZE + 16);
+    char *dst = malloc(MAX_SIZE + 16);
+    memset(src, 'x', MAX_SIZE + 16);
+
+    print_profile();
+    printf("%8s %12s %12s %12s\n", "size", "memcpy", "memset", "strlen");
+    for (unsigned i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+        size_t size = sizes[i];
+        size_t iters = TOTAL_BYTES / size;
+        double results[3];
+
+        double start = now();
+        for (size_t j = 0; j < iters; j++)
+            memcpy_fn(dst, src + (j & 15), size);
+        results[0] = now() - start;
+
+        start = now();
+        for (size_t j = 0; j < iters; j++)
+            memset_fn(dst + (j & 15), (int) j, size);
+        results[1] = now() - start;
+
+        src[size - 1] = '\0';
+        start = now();
+        for (size_t j = 0; j < iters; j++)
+            sink += strlen_fn(src);
+        results[2] = now() - start;
+        src[size - 1] = 'x';
+
+        printf("%8zu", size);
+        for (int k = 0; k < 3; k++)
+            printf(" %12.1f", TOTAL_BYTES / results[k] / (1 << 20));
+        printf("\n");
+    }
+    return 0;
+}
@@ -33,10 +33,44 @@ void cpu_run(struct cpu_state *cpu);
 int cpu_step32(struct cpu_state *cpu, struct tlb *tlb);
 int cpu_step16(struct cpu_state *cpu, struct tlb *tlb);
 
+#ifndef _MSC_VER
+// gcc vector types, arithmetic on these is done with the host's simd
+// instructions. The alignment is lowered so they don't change the layout of
+// cpu_state.
+#define XMM_VEC(name, type) \
+    typedef type name __attribute__((vector_size(16), aligned(4)))
+XMM_VEC(xmm_u8, uint8_t);
+XMM_VEC(xmm_s8, int8_t);
+XMM_VEC(xmm_u16, uint16_t);
+XMM_VEC(xmm_s16, int16_t);
+XMM_VEC(xmm_u32, uint32_t);
+XMM_VEC(xmm_s32, int32_t);
+XMM_VEC(xmm_u64, uint64_t);
+XMM_VEC(xmm_s64, int64_t);
+XMM_VEC(xmm_f32, float);
+XMM_VEC(xmm_f64, double);
+#undef XMM_VEC
+#endif
+
 union xmm_reg {
     qword_t qw[2];
     dword_t dw[4];
-    // TODO more forms
+    word_t w[8];
+    byte_t b[16];
+    float f[4];
+    double d[2];
+#ifndef _MSC_VER
+    xmm_u8 u8;
+    xmm_s8 s8;
+    xmm_u16 u16;
+    xmm_s16 s16;
+    xmm_u32 u32;
+    xmm_s32 s32;
+    xmm_u64 u64;
+    xmm_s64 s64;
+    xmm_f32 f32;
+    xmm_f64 f64;
+#endif
 };
 
 struct cpu_state {
@@ -158,6 +192,8 @@ struct cpu_state {
             bits y:1;
         };
     };
+    // sse control and status, kept so it reads back what was written
+    dword_t mxcsr;
 
     // TLS bullshit
     word_t gs;
@@ -167,6 +203,10 @@ struct cpu_state {
     addr_t segfault_addr;
 
     dword_t trapno;
+
+    // set from other threads to make cpu_run return to the kernel as soon as
+    // possible, e.g. when a signal is sent
+    atomic_bool poked;
 };
 
 // flags
@@ -0,0 +1,53 @@
+/*
+ * iSL (Subsystem for Linux) for iOS & Android
+ * Based on iSH (https://ish.app)
+ *
+ * Copyright (C) 2018 - 2019 Björn Rennfanz (bjoern@fam-rennfanz.de)
+ * Copyright (C) 2017 - 2019 Theodore Dubois (tblodt@icloud.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emu/cpuid.h"
+
+const struct cpuid_profile_info cpuid_profiles[NUM_CPUID_PROFILES] = {
+    [cpuid_profile_none] = {"none", 0, 0},
+    [cpuid_profile_i686] = {"i686", 0, CPUID_FPU | CPUID_TSC | CPUID_CMOV},
+    [cpuid_profile_sse2] = {"sse2", 0, CPUID_FPU | CPUID_TSC | CPUID_CMOV | CPUID_SSE | CPUID_SSE2},
+};
+
+enum cpuid_profile cpuid_profile = CPUID_PROFILE_DEFAULT;
+
+int cpuid_profile_from_name(const char *name) {
+    for (int i = 0; i < NUM_CPUID_PROFILES; i++) {
+        if (strcmp(cpuid_profiles[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+void cpuid_init() {
+    const char *name = getenv("ISL_CPUID");
+    if (name == NULL)
+        return;
+    int profile = cpuid_profile_from_name(name);
+    if (profile < 0) {
+        fprintf(stderr, "unknown cpuid profile %s\n", name);
+        return;
+    }
+    cpuid_profile = profile;
+}
@@ -24,6 +24,40 @@
 
 #include "util/misc.h"
 
+// What the cpu says it can do. Guest libcs pick their string and memory
+// functions based on this, so the more the interpreter can do the faster
+// they get, but nothing should be in here that the interpreter doesn't
+// actually implement. (SSSE3 and up need pshufb and friends first.) The
+// default stays at none until the sse2 instructions have been tested against
+// real hardware, set ISL_CPUID to try the others.
+enum cpuid_profile {
+    cpuid_profile_none, // the original, claims nothing at all
+    cpuid_profile_i686, // fpu, tsc, cmov
+    cpuid_profile_sse2, // i686 plus sse and sse2
+    NUM_CPUID_PROFILES,
+};
+#define CPUID_PROFILE_DEFAULT cpuid_profile_none
+
+// leaf 1 edx bits
+#define CPUID_FPU (1 << 0)
+#define CPUID_TSC (1 << 4)
+#define CPUID_CMOV (1 << 15)
+#define CPUID_SSE (1 << 25)
+#define CPUID_SSE2 (1 << 26)
+
+struct cpuid_profile_info {
+    const char *name;
+    dword_t ecx;
+    dword_t edx;
+};
+extern const struct cpuid_profile_info cpuid_profiles[NUM_CPUID_PROFILES];
+extern enum cpuid_profile cpuid_profile;
+
+// returns -1 if there's no profile with that name
+int cpuid_profile_from_name(const char *name);
+// picks the profile from the ISL_CPUID environment variable, if it's set
+void cpuid_init(void);
+
 static inline void do_cpuid(dword_t *eax, dword_t *ebx, dword_t *ecx, dword_t *edx) {
     dword_t leaf = *eax;
     switch (leaf) {
@@ -37,8 +71,8 @@ static inline void do_cpuid(dword_t *eax, dword_t *ebx, dword_t *ecx, dword_t *e
         case 1:
             *eax = 0x0; // say nothing about cpu model number
             *ebx = 0x0; // processor number 0, flushes 0 bytes on clflush
-            *ecx = 0x0; // we support none of the features in ecx
-            *edx = 0x0; // we also support none of the features in edx
+            *ecx = cpuid_profiles[cpuid_profile].ecx;
+            *edx = cpuid_profiles[cpuid_profile].edx;
             break;
     }
 }
@@ -37,6 +37,39 @@
 extern int current_pid(void);
 #define TRACEIP() TRACE("%d %08x\t", current_pid(), state->ip)
 
+// With GCC, the 32 bit decoder is threaded. Each opcode's handler has a label,
+// and instead of going back around to the switch, a handler reads the next
+// opcode itself and jumps through a table of those labels. Handlers that end
+// with a plain break still work, they go through FINISH. The 16 bit decoder
+// only ever runs one instruction so it stays a switch.
+#undef THREADED_DISPATCH
+#undef OPCODE
+#undef OPCODE_AT
+#undef OPCODE_DEFAULT
+#undef NEXT_INSN
+#if defined(__GNUC__) && OP_SIZE == 32
+#define THREADED_DISPATCH 1
+#define OPCODE(x) case x: op_##x
+#define OPCODE_AT(x, n) case x+n: op_##x##_##n
+#define OPCODE_DEFAULT default: op_undefined
+#define NEXT_INSN do { \
+    TRACE("\n"); \
+    if (CONTINUE_BLOCK) { \
+        BEGIN_INSN; \
+        TRACEIP(); \
+        READINSN; \
+        goto *dispatch[insn]; \
+    } \
+    FINISH; \
+} while (0)
+#else
+#define THREADED_DISPATCH 0
+#define OPCODE(x) case x
+#define OPCODE_AT(x, n) case x+n
+#define OPCODE_DEFAULT default
+#define NEXT_INSN break
+#endif
+
 // this will be the next PyEval_EvalFrameEx
 __no_instrument DECODER_RET glue(DECODER_NAME, OP_SIZE)(DECODER_ARGS) {
     DECLARE_LOCALS;
@@ -51,38 +84,143 @@ __no_instrument DECODER_RET glue(DECODER_NAME, OP_SIZE)(DECODER_ARGS) {
 #define READIMM8 READIMM_(imm, 8); imm = (int8_t) (uint8_t) imm
 #define READIMM16 READIMM_(imm, 16)
 #define READMODRM_MEM READMODRM; if (modrm.type == modrm_reg) UNDEFINED
+// sse instructions come in a single and a double version, the 66 prefix
+// picks double
+#undef PS_PD
+#if OP_SIZE == 16
+#define PS_PD(ps, pd) pd
+#else
+#define PS_PD(ps, pd) ps
+#endif
+
+#if THREADED_DISPATCH
+    static void *const dispatch[256] = {
+        [0x00] = &&op_0x00_0x0, [0x01] = &&op_0x00_0x1, [0x02] = &&op_0x00_0x2, [0x03] = &&op_0x00_0x3,
+        [0x04] = &&op_0x00_0x4, [0x05] = &&op_0x00_0x5, [0x06] = &&op_undefined, [0x07] = &&op_undefined,
+        [0x08] = &&op_0x08_0x0, [0x09] = &&op_0x08_0x1, [0x0a] = &&op_0x08_0x2, [0x0b] = &&op_0x08_0x3,
+        [0x0c] = &&op_0x08_0x4, [0x0d] = &&op_0x08_0x5, [0x0e] = &&op_undefined, [0x0f] = &&op_0x0f,
+        [0x10] = &&op_0x10_0x0, [0x11] = &&op_0x10_0x1, [0x12] = &&op_0x10_0x2, [0x13] = &&op_0x10_0x3,
+        [0x14] = &&op_0x10_0x4, [0x15] = &&op_0x10_0x5, [0x16] = &&op_undefined, [0x17] = &&op_undefined,
+        [0x18] = &&op_0x18_0x0, [0x19] = &&op_0x18_0x1, [0x1a] = &&op_0x18_0x2, [0x1b] = &&op_0x18_0x3,
+        [0x1c] = &&op_0x18_0x4, [0x1d] = &&op_0x18_0x5, [0x1e] = &&op_undefined, [0x1f] = &&op_undefined,
+        [0x20] = &&op_0x20_0x0, [0x21] = &&op_0x20_0x1, [0x22] = &&op_0x20_0x2, [0x23] = &&op_0x20_0x3,
+        [0x24] = &&op_0x20_0x4, [0x25] = &&op_0x20_0x5, [0x26] = &&op_undefined, [0x27] = &&op_undefined,
+        [0x28] = &&op_0x28_0x0, [0x29] = &&op_0x28_0x1, [0x2a] = &&op_0x28_0x2, [0x2b] = &&op_0x28_0x3,
+        [0x2c] = &&op_0x28_0x4, [0x2d] = &&op_0x28_0x5, [0x2e] = &&op_0x2e, [0x2f] = &&op_undefined,
+        [0x30] = &&op_0x30_0x0, [0x31] = &&op_0x30_0x1, [0x32] = &&op_0x30_0x2, [0x33] = &&op_0x30_0x3,
+        [0x34] = &&op_0x30_0x4, [0x35] = &&op_0x30_0x5, [0x36] = &&op_undefined, [0x37] = &&op_undefined,
+        [0x38] = &&op_0x38_0x0, [0x39] = &&op_0x38_0x1, [0x3a] = &&op_0x38_0x2, [0x3b] = &&op_0x38_0x3,
+        [0x3c] = &&op_0x38_0x4, [0x3d] = &&op_0x38_0x5, [0x3e] = &&op_undefined, [0x3f] = &&op_undefined,
+        [0x40] = &&op_0x40, [0x41] = &&op_0x41, [0x42] = &&op_0x42, [0x43] = &&op_0x43,
+        [0x44] = &&op_0x44, [0x45] = &&op_0x45, [0x46] = &&op_0x46, [0x47] = &&op_0x47,
+        [0x48] = &&op_0x48, [0x49] = &&op_0x49, [0x4a] = &&op_0x4a, [0x4b] = &&op_0x4b,
+        [0x4c] = &&op_0x4c, [0x4d] = &&op_0x4d, [0x4e] = &&op_0x4e, [0x4f] = &&op_0x4f,
+        [0x50] = &&op_0x50, [0x51] = &&op_0x51, [0x52] = &&op_0x52, [0x53] = &&op_0x53,
+        [0x54] = &&op_0x54, [0x55] = &&op_0x55, [0x56] = &&op_0x56, [0x57] = &&op_0x57,
+        [0x58] = &&op_0x58, [0x59] = &&op_0x59, [0x5a] = &&op_0x5a, [0x5b] = &&op_0x5b,
+        [0x5c] = &&op_0x5c, [0x5d] = &&op_0x5d, [0x5e] = &&op_0x5e, [0x5f] = &&op_0x5f,
+        [0x60] = &&op_undefined, [0x61] = &&op_undefined, [0x62] = &&op_undefined, [0x63] = &&op_undefined,
+        [0x64] = &&op_undefined, [0x65] = &&op_0x65, [0x66] = &&op_0x66, [0x67] = &&op_0x67,
+        [0x68] = &&op_0x68, [0x69] = &&op_0x69, [0x6a] = &&op_0x6a, [0x6b] = &&op_0x6b,
+        [0x6c] = &&op_undefined, [0x6d] = &&op_undefined, [0x6e] = &&op_undefined, [0x6f] = &&op_undefined,
+        [0x70] = &&op_0x70, [0x71] = &&op_0x71, [0x72] = &&op_0x72, [0x73] = &&op_0x73,
+        [0x74] = &&op_0x74, [0x75] = &&op_0x75, [0x76] = &&op_0x76, [0x77] = &&op_0x77,
+        [0x78] = &&op_0x78, [0x79] = &&op_0x79, [0x7a] = &&op_0x7a, [0x7b] = &&op_0x7b,
+        [0x7c] = &&op_0x7c, [0x7d] = &&op_0x7d, [0x7e] = &&op_0x7e, [0x7f] = &&op_0x7f,
+        [0x80] = &&op_0x80, [0x81] = &&op_0x81, [0x82] = &&op_undefined, [0x83] = &&op_0x83,
+        [0x84] = &&op_0x84, [0x85] = &&op_0x85, [0x86] = &&op_0x86, [0x87] = &&op_0x87,
+        [0x88] = &&op_0x88, [0x89] = &&op_0x89, [0x8a] = &&op_0x8a, [0x8b] = &&op_0x8b,
+        [0x8c] = &&op_0x8c, [0x8d] = &&op_0x8d, [0x8e] = &&op_0x8e, [0x8f] = &&op_0x8f,
+        [0x90] = &&op_0x90, [0x91] = &&op_0x91, [0x92] = &&op_0x92, [0x93] = &&op_0x93,
+        [0x94] = &&op_0x94, [0x95] = &&op_0x95, [0x96] = &&op_0x96, [0x97] = &&op_0x97,
+        [0x98] = &&op_0x98, [0x99] = &&op_0x99, [0x9a] = &&op_undefined, [0x9b] = &&op_0x9b,
+        [0x9c] = &&op_0x9c, [0x9d] = &&op_0x9d, [0x9e] = &&op_0x9e, [0x9f] = &&op_undefined,
+        [0xa0] = &&op_0xa0, [0xa1] = &&op_0xa1, [0xa2] = &&op_0xa2, [0xa3] = &&op_0xa3,
+        [0xa4] = &&op_0xa4, [0xa5] = &&op_0xa5, [0xa6] = &&op_0xa6, [0xa7] = &&op_0xa7,
+        [0xa8] = &&op_0xa8, [0xa9] = &&op_0xa9, [0xaa] = &&op_0xaa, [0xab] = &&op_0xab,
+        [0xac] = &&op_0xac, [0xad] = &&op_0xad, [0xae] = &&op_0xae, [0xaf] = &&op_0xaf,
+        [0xb0] = &&op_0xb0, [0xb1] = &&op_0xb1, [0xb2] = &&op_0xb2, [0xb3] = &&op_0xb3,
+        [0xb4] = &&op_0xb4, [0xb5] = &&op_0xb5, [0xb6] = &&op_0xb6, [0xb7] = &&op_0xb7,
+        [0xb8] = &&op_0xb8, [0xb9] = &&op_0xb9, [0xba] = &&op_0xba, [0xbb] = &&op_0xbb,
+        [0xbc] = &&op_0xbc, [0xbd] = &&op_0xbd, [0xbe] = &&op_0xbe, [0xbf] = &&op_0xbf,
+        [0xc0] = &&op_0xc0, [0xc1] = &&op_0xc1, [0xc2] = &&op_0xc2, [0xc3] = &&op_0xc3,
+        [0xc4] = &&op_undefined, [0xc5] = &&op_undefined, [0xc6] = &&op_0xc6, [0xc7] = &&op_0xc7,
+        [0xc8] = &&op_undefined, [0xc9] = &&op_0xc9, [0xca] = &&op_undefined, [0xcb] = &&op_undefined,
+        [0xcc] = &&op_undefined, [0xcd] = &&op_0xcd, [0xce] = &&op_undefined, [0xcf] = &&op_undefined,
+        [0xd0] = &&op_0xd0, [0xd1] = &&op_0xd1, [0xd2] = &&op_0xd2, [0xd3] = &&op_0xd3,
+        [0xd4] = &&op_undefined, [0xd5] = &&op_undefined, [0xd6] = &&op_undefined, [0xd7] = &&op_undefined,
+        [0xd8] = &&op_0xd8, [0xd9] = &&op_0xd8, [0xda] = &&op_0xd8, [0xdb] = &&op_0xd8,
+        [0xdc] = &&op_0xd8, [0xdd] = &&op_0xd8, [0xde] = &&op_0xd8, [0xdf] = &&op_0xd8,
+        [0xe0] = &&op_undefined, [0xe1] = &&op_undefined, [0xe2] = &&op_undefined, [0xe3] = &&op_0xe3,
+        [0xe4] = &&op_undefined, [0xe5] = &&op_undefined, [0xe6] = &&op_undefined, [0xe7] = &&op_undefined,
+        [0xe8] = &&op_0xe8, [0xe9] = &&op_0xe9, [0xea] = &&op_undefined, [0xeb] = &&op_0xeb,
+        [0xec] = &&op_undefined, [0xed] = &&op_undefined, [0xee] = &&op_undefined, [0xef] = &&op_undefined,
+        [0xf0] = &&op_0xf0, [0xf1] = &&op_undefined, [0xf2] = &&op_0xf2, [0xf3] = &&op_0xf3,
+        [0xf4] = &&op_undefined, [0xf5] = &&op_undefined, [0xf6] = &&op_0xf6, [0xf7] = &&op_0xf7,
+        [0xf8] = &&op_undefined, [0xf9] = &&op_undefined, [0xfa] = &&op_undefined, [0xfb] = &&op_undefined,
+        [0xfc] = &&op_0xfc, [0xfd] = &&op_0xfd, [0xfe] = &&op_0xfe, [0xff] = &&op_0xff,
+    };
+#endif
 
+next_insn:
+    BEGIN_INSN;
 restart:
     TRACEIP();
     READINSN;
+#if THREADED_DISPATCH
+    goto *dispatch[insn];
+#endif
     switch (insn) {
 #define MAKE_OP(x, OP, op) \
-        case x+0x0: TRACEI(op " reg8, modrm8"); \
-                   READMODRM; OP(modrm_reg, modrm_val,8); break; \
-        case x+0x1: TRACEI(op " reg, modrm"); \
-                   READMODRM; OP(modrm_reg, modrm_val,oz); break; \
-        case x+0x2: TRACEI(op " modrm8, reg8"); \
-                   READMODRM; OP(modrm_val, modrm_reg,8); break; \
-        case x+0x3: TRACEI(op " modrm, reg"); \
-                   READMODRM; OP(modrm_val, modrm_reg,oz); break; \
-        case x+0x4: TRACEI(op " imm8, al\t"); \
-                   READIMM8; OP(imm, reg_a,8); break; \
-        case x+0x5: TRACEI(op " imm, oax\t"); \
-                   READIMM; OP(imm, reg_a,oz); break
+        OPCODE_AT(x, 0x0): TRACEI(op " reg8, modrm8"); \
+                   READMODRM; OP(modrm_reg, modrm_val,8); NEXT_INSN; \
+        OPCODE_AT(x, 0x1): TRACEI(op " reg, modrm"); \
+                   READMODRM; OP(modrm_reg, modrm_val,oz); NEXT_INSN; \
+        OPCODE_AT(x, 0x2): TRACEI(op " modrm8, reg8"); \
+                   READMODRM; OP(modrm_val, modrm_reg,8); NEXT_INSN; \
+        OPCODE_AT(x, 0x3): TRACEI(op " modrm, reg"); \
+                   READMODRM; OP(modrm_val, modrm_reg,oz); NEXT_INSN; \
+        OPCODE_AT(x, 0x4): TRACEI(op " imm8, al\t"); \
+                   READIMM8; OP(imm, reg_a,8); NEXT_INSN; \
+        OPCODE_AT(x, 0x5): TRACEI(op " imm, oax\t"); \
+                   READIMM; OP(imm, reg_a,oz); NEXT_INSN
 
         MAKE_OP(0x00, ADD, "add");
         MAKE_OP(0x08, OR, "or");
 
-        case 0x0f:
+        OPCODE(0x0f):
             // 2-byte opcode prefix
             READINSN;
             switch (insn) {
+                case 0x10: TRACEI("movup modrm, reg");
+                           READMODRM; MOV(modrm_val, modrm_reg,128); break;
+                case 0x11: TRACEI("movup reg, modrm");
+                           READMODRM; MOV(modrm_reg, modrm_val,128); break;
+                case 0x12: TRACEI("movlp modrm, reg");
+                           READMODRM; MOVLP(modrm_val, modrm_reg); break;
+                case 0x13: TRACEI("movlp reg, modrm");
+                           READMODRM_MEM; MOVLP_STORE(modrm_reg); break;
+                case 0x14: TRACEI("unpcklp modrm, reg");
+                           READMODRM; PUNPCKL(modrm_val, modrm_reg, PS_PD(4, 8)); break;
+                case 0x15: TRACEI("unpckhp modrm, reg");
+                           READMODRM; PUNPCKH(modrm_val, modrm_reg, PS_PD(4, 8)); break;
+                case 0x16: TRACEI("movhp modrm, reg");
+                           READMODRM; MOVHP(modrm_val, modrm_reg); break;
+                case 0x17: TRACEI("movhp reg, modrm");
+                           READMODRM_MEM; MOVHP_STORE(modrm_reg); break;
+
                 case 0x18 ... 0x1f: TRACEI("nop modrm\t"); READMODRM; break;
 
-                case 0x28: TRACEI("movp modrm, reg");
+                case 0x28: TRACEI("movap modrm, reg");
                            READMODRM; MOV(modrm_val, modrm_reg,128); break;
-                case 0x29: TRACEI("movp reg, modrm");
+                case 0x29: TRACEI("movap reg, modrm");
                            READMODRM; MOV(modrm_reg, modrm_val,128); break;
+                case 0x2b: TRACEI("movntp reg, modrm");
+                           READMODRM_MEM; MOV(modrm_reg, modrm_val,128); break;
+                case 0x2e: TRACEI("ucomis modrm, reg");
+                           READMODRM; COMIS(modrm_val, modrm_reg, PS_PD(f, d), PS_PD(32, 64)); break;
+                case 0x2f: TRACEI("comis modrm, reg");
+                           READMODRM; COMIS(modrm_val, modrm_reg, PS_PD(f, d), PS_PD(32, 64)); break;
 
                 case 0x31: TRACEI("rdtsc");
                            RDTSC; break;
@@ -120,16 +258,108 @@ restart:
                 case 0x4f: TRACEI("cmovnle modrm, reg");
                            READMODRM; CMOVN(LE, modrm_val, modrm_reg,oz); break;
 
-                case 0x57: TRACEI("xorps modrm, reg");
-                           READMODRM; XORP(modrm_val, modrm_reg); break;
-                case 0x73: TRACEI("psrlq imm8, reg");
-                           // TODO I think this is actually a group
-                           READMODRM; READIMM8; PSRLQ(imm, modrm_val); break;
-                case 0x76: TRACEI("pcmpeqd reg, modrm");
-                           READMODRM; PCMPEQD(modrm_reg, modrm_val); break;
+#if OP_SIZE == 16
+                case 0x50: TRACEI("movmskpd reg, reg32");
+                           READMODRM; MOVMSKPD(modrm_val, modrm_reg); break;
+#else
+                case 0x50: TRACEI("movmskps reg, reg32");
+                           READMODRM; MOVMSKPS(modrm_val, modrm_reg); break;
+#endif
+                case 0x51: TRACEI("sqrtp modrm, reg");
+                           READMODRM; SQRTP(modrm_val, modrm_reg, PS_PD(f, d), PS_PD(4, 2), PS_PD(sqrtf, sqrt)); break;
+#if OP_SIZE != 16
+                case 0x52: TRACEI("rsqrtps modrm, reg");
+                           READMODRM; SQRTP(modrm_val, modrm_reg, f, 4, sse_rsqrt); break;
+                case 0x53: TRACEI("rcpps modrm, reg");
+                           READMODRM; SQRTP(modrm_val, modrm_reg, f, 4, sse_rcp); break;
+#endif
+                case 0x54: TRACEI("andp modrm, reg");
+                           READMODRM; PAND(modrm_val, modrm_reg); break;
+                case 0x55: TRACEI("andnp modrm, reg");
+                           READMODRM; PANDN(modrm_val, modrm_reg); break;
+                case 0x56: TRACEI("orp modrm, reg");
+                           READMODRM; POR(modrm_val, modrm_reg); break;
+                case 0x57: TRACEI("xorp modrm, reg");
+                           READMODRM; PXOR(modrm_val, modrm_reg); break;
+                case 0x58: TRACEI("addp modrm, reg");
+                           READMODRM; ADDP(modrm_val, modrm_reg, PS_PD(f32, f64)); break;
+                case 0x59: TRACEI("mulp modrm, reg");
+                           READMODRM; MULP(modrm_val, modrm_reg, PS_PD(f32, f64)); break;
+#if OP_SIZE == 16
+                case 0x5a: TRACEI("cvtpd2ps modrm, reg");
+                           READMODRM; CVTPD2PS(modrm_val, modrm_reg); break;
+                case 0x5b: TRACEI("cvtps2dq modrm, reg");
+                           READMODRM; CVTPS2DQ(modrm_val, modrm_reg, false); break;
+#else
+                case 0x5a: TRACEI("cvtps2pd modrm, reg");
+                           READMODRM; CVTPS2PD(modrm_val, modrm_reg); break;
+                case 0x5b: TRACEI("cvtdq2ps modrm, reg");
+                           READMODRM; CVTDQ2PS(modrm_val, modrm_reg); break;
+#endif
+                case 0x5c: TRACEI("subp modrm, reg");
+                           READMODRM; SUBP(modrm_val, modrm_reg, PS_PD(f32, f64)); break;
+                case 0x5d: TRACEI("minp modrm, reg");
+                           READMODRM; MINP(modrm_val, modrm_reg, PS_PD(f, d), PS_PD(4, 2)); break;
+                case 0x5e: TRACEI("divp modrm, reg");
+                           READMODRM; DIVP(modrm_val, modrm_reg, PS_PD(f32, f64)); break;
+                case 0x5f: TRACEI("maxp modrm, reg");
+                           READMODRM; MAXP(modrm_val, modrm_reg, PS_PD(f, d), PS_PD(4, 2)); break;
+
+#if OP_SIZE == 16
+                case 0x60: TRACEI("punpcklbw modrm, reg");
+                           READMODRM; PUNPCKL(modrm_val, modrm_reg, 1); break;
+                case 0x61: TRACEI("punpcklwd modrm, reg");
+                           READMODRM; PUNPCKL(modrm_val, modrm_reg, 2); break;
+                case 0x62: TRACEI("punpckldq modrm, reg");
+                           READMODRM; PUNPCKL(modrm_val, modrm_reg, 4); break;
+                case 0x63: TRACEI("packsswb modrm, reg");
+                           READMODRM; PACKSSWB(modrm_val, modrm_reg); break;
+                case 0x64: TRACEI("pcmpgtb modrm, reg");
+                           READMODRM; PCMPGT(modrm_val, modrm_reg, s8); break;
+                case 0x65: TRACEI("pcmpgtw modrm, reg");
+                           READMODRM; PCMPGT(modrm_val, modrm_reg, s16); break;
+                case 0x66: TRACEI("pcmpgtd modrm, reg");
+                           READMODRM; PCMPGT(modrm_val, modrm_reg, s32); break;
+                case 0x67: TRACEI("packuswb modrm, reg");
+                           READMODRM; PACKUSWB(modrm_val, modrm_reg); break;
+                case 0x68: TRACEI("punpckhbw modrm, reg");
+                           READMODRM; PUNPCKH(modrm_val, modrm_reg, 1); break;
+                case 0x69: TRACEI("punpckhwd modrm, reg");
+                           READMODRM; PUNPCKH(modrm_val, modrm_reg, 2); break;
+                case 0x6a: TRACEI("punpckhdq modrm, reg");
+                           READMODRM; PUNPCKH(modrm_val, modrm_reg, 4); break;
+                case 0x6b: TRACEI("packssdw modrm, reg");
+                           READMODRM; PACKSSDW(modrm_val, modrm_reg); break;
+                case 0x6c: TRACEI("punpcklqdq modrm, reg");
+                           READMODRM; PUNPCKL(modrm_val, modrm_reg, 8); break;
+                case 0x6d: TRACEI("punpckhqdq modrm, reg");
+                           READMODRM; PUNPCKH(modrm_val, modrm_reg, 8); break;
+                case 0x6e: TRACEI("movd modrm32, xmm");
+                           READMODRM; MOVD_XMM(modrm_val, modrm_reg); break;
+                case 0x6f: TRACEI("movdqa modrm, reg");
+                           READMODRM; MOV(modrm_val, modrm_reg,128); break;
+                case 0x70: TRACEI("pshufd imm8, modrm, reg");
+                           READMODRM; READIMM8; PSHUFD(modrm_val, modrm_reg, (uint8_t) imm); break;
+#endif
+                case 0x71: TRACEI("pshiftw imm8, reg");
+                           READMODRM; READIMM8; PSHIFT_GRP((uint8_t) imm, modrm_val, 16); break;
+                case 0x72: TRACEI("pshiftd imm8, reg");
+                           READMODRM; READIMM8; PSHIFT_GRP((uint8_t) imm, modrm_val, 32); break;
+                case 0x73: TRACEI("pshiftq imm8, reg");
+                           READMODRM; READIMM8; PSHIFT_GRP((uint8_t) imm, modrm_val, 64); break;
+#if OP_SIZE == 16
+                case 0x74: TRACEI("pcmpeqb modrm, reg");
+                           READMODRM; PCMPEQ(modrm_val, modrm_reg, u8); break;
+                case 0x75: TRACEI("pcmpeqw modrm, reg");
+                           READMODRM; PCMPEQ(modrm_val, modrm_reg, u16); break;
+#endif
+                case 0x76: TRACEI("pcmpeqd modrm, reg");
+                           READMODRM; PCMPEQ(modrm_val, modrm_reg, u32); break;
 #if OP_SIZE == 16
                 case 0x7e: TRACEI("movd xmm, modrm32");
                            READMODRM; MOVD(modrm_reg, modrm_val); break;
+                case 0x7f: TRACEI("movdqa reg, modrm");
+                           READMODRM; MOV(modrm_reg, modrm_val,128); break;
 #endif
 
                 case 0x80: TRACEI("jo rel\t");
@@ -216,6 +446,25 @@ restart:
                 case 0xad: TRACEI("shrd cl, reg, modrm");
                            READMODRM; SHRD(reg_c, modrm_reg, modrm_val,oz); break;
 
+#define GRP15 \
+    if (modrm.type == modrm_reg) { \
+        switch (modrm.opcode) { \
+            case 5: TRACEI("lfence"); break; \
+            case 6: TRACEI("mfence"); MFENCE; break; \
+            case 7: TRACEI("sfence"); break; \
+            default: UNDEFINED; \
+        } \
+    } else { \
+        switch (modrm.opcode) { \
+            case 2: TRACEI("ldmxcsr"); LDMXCSR(modrm_val); break; \
+            case 3: TRACEI("stmxcsr"); STMXCSR(modrm_val); break; \
+            default: UNDEFINED; \
+        } \
+    }
+                case 0xae: TRACEI("grp15 modrm");
+                           READMODRM; GRP15; break;
+#undef GRP15
+
                 case 0xaf: TRACEI("imul modrm, reg");
                            READMODRM; IMUL2(modrm_val, modrm_reg,oz); break;
 
@@ -260,6 +509,21 @@ restart:
                            READMODRM; XADD(modrm_reg, modrm_val,8); break;
                 case 0xc1: TRACEI("xadd reg, modrm");
                            READMODRM; XADD(modrm_reg, modrm_val,oz); break;
+                case 0xc2: TRACEI("cmpp imm8, modrm, reg");
+                           READMODRM; READIMM8; CMPP(modrm_val, modrm_reg, PS_PD(f, d), PS_PD(dw, qw), PS_PD(4, 2), imm); break;
+                case 0xc3: TRACEI("movnti reg32, modrm32");
+                           READMODRM_MEM; MOV(modrm_reg, modrm_val,32); break;
+#if OP_SIZE == 16
+                case 0xc4: TRACEI("pinsrw imm8, modrm16, reg");
+                           READMODRM; READIMM8; PINSRW(modrm_val, modrm_reg, imm); break;
+                case 0xc5: TRACEI("pextrw imm8, reg, reg32");
+                           READMODRM; READIMM8; PEXTRW(modrm_val, modrm_reg, imm); break;
+                case 0xc6: TRACEI("shufpd imm8, modrm, reg");
+                           READMODRM; READIMM8; SHUFPD(modrm_val, modrm_reg, imm); break;
+#else
+                case 0xc6: TRACEI("shufps imm8, modrm, reg");
+                           READMODRM; READIMM8; SHUFPS(modrm_val, modrm_reg, imm); break;
+#endif
 
 #if OP_SIZE != 16
                 case 0xc8: TRACEI("bswap eax");
@@ -281,14 +545,98 @@ restart:
 #endif
 
 #if OP_SIZE == 16
+                case 0xd1: TRACEI("psrlw modrm, reg");
+                           READMODRM; PSHIFT_XMM(PSRL, modrm_val, modrm_reg, u16, 16); break;
+                case 0xd2: TRACEI("psrld modrm, reg");
+                           READMODRM; PSHIFT_XMM(PSRL, modrm_val, modrm_reg, u32, 32); break;
+                case 0xd3: TRACEI("psrlq modrm, reg");
+                           READMODRM; PSHIFT_XMM(PSRL, modrm_val, modrm_reg, u64, 64); break;
                 case 0xd4: TRACEI("paddq modrm, reg");
-                           READMODRM; PADD(modrm_val, modrm_reg); break;
+                           READMODRM; PADD(modrm_val, modrm_reg, u64); break;
+                case 0xd5: TRACEI("pmullw modrm, reg");
+                           READMODRM; PMULLW(modrm_val, modrm_reg); break;
                 case 0xd6: TRACEI("movq xmm, modrm");
                            READMODRM; MOVQ(modrm_reg, modrm_val); break;
+                case 0xd7: TRACEI("pmovmskb reg, reg32");
+                           READMODRM; PMOVMSKB(modrm_val, modrm_reg); break;
+                case 0xd8: TRACEI("psubusb modrm, reg");
+                           READMODRM; PSUBUS(modrm_val, modrm_reg, u8); break;
+                case 0xd9: TRACEI("psubusw modrm, reg");
+                           READMODRM; PSUBUS(modrm_val, modrm_reg, u16); break;
+                case 0xda: TRACEI("pminub modrm, reg");
+                           READMODRM; PMIN(modrm_val, modrm_reg, u8); break;
+                case 0xdb: TRACEI("pand modrm, reg");
+                           READMODRM; PAND(modrm_val, modrm_reg); break;
+                case 0xdc: TRACEI("paddusb modrm, reg");
+                           READMODRM; PADDUS(modrm_val, modrm_reg, u8); break;
+                case 0xdd: TRACEI("paddusw modrm, reg");
+                           READMODRM; PADDUS(modrm_val, modrm_reg, u16); break;
+                case 0xde: TRACEI("pmaxub modrm, reg");
+                           READMODRM; PMAX(modrm_val, modrm_reg, u8); break;
+                case 0xdf: TRACEI("pandn modrm, reg");
+                           READMODRM; PANDN(modrm_val, modrm_reg); break;
+                case 0xe0: TRACEI("pavgb modrm, reg");
+                           READMODRM; PAVG(modrm_val, modrm_reg, u8); break;
+                case 0xe1: TRACEI("psraw modrm, reg");
+                           READMODRM; PSHIFT_XMM(PSRA, modrm_val, modrm_reg, s16, 16); break;
+                case 0xe2: TRACEI("psrad modrm, reg");
+                           READMODRM; PSHIFT_XMM(PSRA, modrm_val, modrm_reg, s32, 32); break;
+                case 0xe3: TRACEI("pavgw modrm, reg");
+                           READMODRM; PAVG(modrm_val, modrm_reg, u16); break;
+                case 0xe4: TRACEI("pmulhuw modrm, reg");
+                           READMODRM; PMULHUW(modrm_val, modrm_reg); break;
+                case 0xe5: TRACEI("pmulhw modrm, reg");
+                           READMODRM; PMULHW(modrm_val, modrm_reg); break;
+                case 0xe6: TRACEI("cvttpd2dq modrm, reg");
+                           READMODRM; CVTPD2DQ(modrm_val, modrm_reg, true); break;
+                case 0xe7: TRACEI("movntdq reg, modrm");
+                           READMODRM_MEM; MOV(modrm_reg, modrm_val,128); break;
+                case 0xe8: TRACEI("psubsb modrm, reg");
+                           READMODRM; PSUBS(modrm_val, modrm_reg, s8, 16, INT8_MIN, INT8_MAX); break;
+                case 0xe9: TRACEI("psubsw modrm, reg");
+                           READMODRM; PSUBS(modrm_val, modrm_reg, s16, 8, INT16_MIN, INT16_MAX); break;
+                case 0xea: TRACEI("pminsw modrm, reg");
+                           READMODRM; PMIN(modrm_val, modrm_reg, s16); break;
+                case 0xeb: TRACEI("por modrm, reg");
+                           READMODRM; POR(modrm_val, modrm_reg); break;
+                case 0xec: TRACEI("paddsb modrm, reg");
+                           READMODRM; PADDS(modrm_val, modrm_reg, s8, 16, INT8_MIN, INT8_MAX); break;
+                case 0xed: TRACEI("paddsw modrm, reg");
+                           READMODRM; PADDS(modrm_val, modrm_reg, s16, 8, INT16_MIN, INT16_MAX); break;
+                case 0xee: TRACEI("pmaxsw modrm, reg");
+                           READMODRM; PMAX(modrm_val, modrm_reg, s16); break;
+                case 0xef: TRACEI("pxor modrm, reg");
+                           READMODRM; PXOR(modrm_val, modrm_reg); break;
+                case 0xf1: TRACEI("psllw modrm, reg");
+                           READMODRM; PSHIFT_XMM(PSLL, modrm_val, modrm_reg, u16, 16); break;
+                case 0xf2: TRACEI("pslld modrm, reg");
+                           READMODRM; PSHIFT_XMM(PSLL, modrm_val, modrm_reg, u32, 32); break;
+                case 0xf3: TRACEI("psllq modrm, reg");
+                           READMODRM; PSHIFT_XMM(PSLL, modrm_val, modrm_reg, u64, 64); break;
+                case 0xf4: TRACEI("pmuludq modrm, reg");
+                           READMODRM; PMULUDQ(modrm_val, modrm_reg); break;
+                case 0xf5: TRACEI("pmaddwd modrm, reg");
+                           READMODRM; PMADDWD(modrm_val, modrm_reg); break;
+                case 0xf6: TRACEI("psadbw modrm, reg");
+                           READMODRM; PSADBW(modrm_val, modrm_reg); break;
+                case 0xf8: TRACEI("psubb modrm, reg");
+                           READMODRM; PSUB(modrm_val, modrm_reg, u8); break;
+                case 0xf9: TRACEI("psubw modrm, reg");
+                           READMODRM; PSUB(modrm_val, modrm_reg, u16); break;
+                case 0xfa: TRACEI("psubd modrm, reg");
+                           READMODRM; PSUB(modrm_val, modrm_reg, u32); break;
 #endif
 
                 case 0xfb: TRACEI("psubq modrm, reg");
-                           READMODRM; PSUB(modrm_val, modrm_reg); break;
+                           READMODRM; PSUB(modrm_val, modrm_reg, u64); break;
+#if OP_SIZE == 16
+                case 0xfc: TRACEI("paddb modrm, reg");
+                           READMODRM; PADD(modrm_val, modrm_reg, u8); break;
+                case 0xfd: TRACEI("paddw modrm, reg");
+                           READMODRM; PADD(modrm_val, modrm_reg, u16); break;
+                case 0xfe: TRACEI("paddd modrm, reg");
+                           READMODRM; PADD(modrm_val, modrm_reg, u32); break;
+#endif
                 default: TRACEI("undefined");
                          UNDEFINED;
             }
@@ -299,49 +647,49 @@ restart:
         MAKE_OP(0x20, AND, "and");
         MAKE_OP(0x28, SUB, "sub");
 
-        case 0x2e: TRACEI("segment cs (ignoring)"); goto restart;
+        OPCODE(0x2e): TRACEI("segment cs (ignoring)"); goto restart;
 
         MAKE_OP(0x30, XOR, "xor");
         MAKE_OP(0x38, CMP, "cmp");
 
-        case 0x40: TRACEI("inc oax"); INC(reg_a,oz); break;
-        case 0x41: TRACEI("inc ocx"); INC(reg_c,oz); break;
-        case 0x42: TRACEI("inc odx"); INC(reg_d,oz); break;
-        case 0x43: TRACEI("inc obx"); INC(reg_b,oz); break;
-        case 0x44: TRACEI("inc osp"); INC(reg_sp,oz); break;
-        case 0x45: TRACEI("inc obp"); INC(reg_bp,oz); break;
-        case 0x46: TRACEI("inc osi"); INC(reg_si,oz); break;
-        case 0x47: TRACEI("inc odi"); INC(reg_di,oz); break;
-        case 0x48: TRACEI("dec oax"); DEC(reg_a,oz); break;
-        case 0x49: TRACEI("dec ocx"); DEC(reg_c,oz); break;
-        case 0x4a: TRACEI("dec odx"); DEC(reg_d,oz); break;
-        case 0x4b: TRACEI("dec obx"); DEC(reg_b,oz); break;
-        case 0x4c: TRACEI("dec osp"); DEC(reg_sp,oz); break;
-        case 0x4d: TRACEI("dec obp"); DEC(reg_bp,oz); break;
-        case 0x4e: TRACEI("dec osi"); DEC(reg_si,oz); break;
-        case 0x4f: TRACEI("dec odi"); DEC(reg_di,oz); break;
-
-        case 0x50: TRACEI("push oax"); PUSH(reg_a,oz); break;
-        case 0x51: TRACEI("push ocx"); PUSH(reg_c,oz); break;
-        case 0x52: TRACEI("push odx"); PUSH(reg_d,oz); break;
-        case 0x53: TRACEI("push obx"); PUSH(reg_b,oz); break;
-        case 0x54: TRACEI("push osp"); PUSH(reg_sp,oz); break;
-        case 0x55: TRACEI("push obp"); PUSH(reg_bp,oz); break;
-        case 0x56: TRACEI("push osi"); PUSH(reg_si,oz); break;
-        case 0x57: TRACEI("push odi"); PUSH(reg_di,oz); break;
-
-        case 0x58: TRACEI("pop oax"); POP(reg_a,oz); break;
-        case 0x59: TRACEI("pop ocx"); POP(reg_c,oz); break;
-        case 0x5a: TRACEI("pop odx"); POP(reg_d,oz); break;
-        case 0x5b: TRACEI("pop obx"); POP(reg_b,oz); break;
-        case 0x5c: TRACEI("pop osp"); POP(reg_sp,oz); break;
-        case 0x5d: TRACEI("pop obp"); POP(reg_bp,oz); break;
-        case 0x5e: TRACEI("pop osi"); POP(reg_si,oz); break;
-        case 0x5f: TRACEI("pop odi"); POP(reg_di,oz); break;
-
-        case 0x65: TRACE("segment gs\n"); SEG_GS(); goto restart;
-
-        case 0x66:
+        OPCODE(0x40): TRACEI("inc oax"); INC(reg_a,oz); NEXT_INSN;
+        OPCODE(0x41): TRACEI("inc ocx"); INC(reg_c,oz); NEXT_INSN;
+        OPCODE(0x42): TRACEI("inc odx"); INC(reg_d,oz); NEXT_INSN;
+        OPCODE(0x43): TRACEI("inc obx"); INC(reg_b,oz); NEXT_INSN;
+        OPCODE(0x44): TRACEI("inc osp"); INC(reg_sp,oz); NEXT_INSN;
+        OPCODE(0x45): TRACEI("inc obp"); INC(reg_bp,oz); NEXT_INSN;
+        OPCODE(0x46): TRACEI("inc osi"); INC(reg_si,oz); NEXT_INSN;
+        OPCODE(0x47): TRACEI("inc odi"); INC(reg_di,oz); NEXT_INSN;
+        OPCODE(0x48): TRACEI("dec oax"); DEC(reg_a,oz); NEXT_INSN;
+        OPCODE(0x49): TRACEI("dec ocx"); DEC(reg_c,oz); NEXT_INSN;
+        OPCODE(0x4a): TRACEI("dec odx"); DEC(reg_d,oz); NEXT_INSN;
+        OPCODE(0x4b): TRACEI("dec obx"); DEC(reg_b,oz); NEXT_INSN;
+        OPCODE(0x4c): TRACEI("dec osp"); DEC(reg_sp,oz); NEXT_INSN;
+        OPCODE(0x4d): TRACEI("dec obp"); DEC(reg_bp,oz); NEXT_INSN;
+        OPCODE(0x4e): TRACEI("dec osi"); DEC(reg_si,oz); NEXT_INSN;
+        OPCODE(0x4f): TRACEI("dec odi"); DEC(reg_di,oz); NEXT_INSN;
+
+        OPCODE(0x50): TRACEI("push oax"); PUSH(reg_a,oz); NEXT_INSN;
+        OPCODE(0x51): TRACEI("push ocx"); PUSH(reg_c,oz); NEXT_INSN;
+        OPCODE(0x52): TRACEI("push odx"); PUSH(reg_d,oz); NEXT_INSN;
+        OPCODE(0x53): TRACEI("push obx"); PUSH(reg_b,oz); NEXT_INSN;
+        OPCODE(0x54): TRACEI("push osp"); PUSH(reg_sp,oz); NEXT_INSN;
+        OPCODE(0x55): TRACEI("push obp"); PUSH(reg_bp,oz); NEXT_INSN;
+        OPCODE(0x56): TRACEI("push osi"); PUSH(reg_si,oz); NEXT_INSN;
+        OPCODE(0x57): TRACEI("push odi"); PUSH(reg_di,oz); NEXT_INSN;
+
+        OPCODE(0x58): TRACEI("pop oax"); POP(reg_a,oz); NEXT_INSN;
+        OPCODE(0x59): TRACEI("pop ocx"); POP(reg_c,oz); NEXT_INSN;
+        OPCODE(0x5a): TRACEI("pop odx"); POP(reg_d,oz); NEXT_INSN;
+        OPCODE(0x5b): TRACEI("pop obx"); POP(reg_b,oz); NEXT_INSN;
+        OPCODE(0x5c): TRACEI("pop osp"); POP(reg_sp,oz); NEXT_INSN;
+        OPCODE(0x5d): TRACEI("pop obp"); POP(reg_bp,oz); NEXT_INSN;
+        OPCODE(0x5e): TRACEI("pop osi"); POP(reg_si,oz); NEXT_INSN;
+        OPCODE(0x5f): TRACEI("pop odi"); POP(reg_di,oz); NEXT_INSN;
+
+        OPCODE(0x65): TRACE("segment gs\n"); SEG_GS(); goto restart;
+
+        OPCODE(0x66):
 #if OP_SIZE == 32
             TRACE("entering 16 bit mode\n");
             return glue(DECODER_NAME, 16)(DECODER_PASS_ARGS);
@@ -350,49 +698,49 @@ restart:
             return glue(DECODER_NAME, 32)(DECODER_PASS_ARGS);
 #endif
 
-        case 0x67: TRACEI("address size prefix (ignored)"); goto restart;
-
-        case 0x68: TRACEI("push imm\t");
-                   READIMM; PUSH(imm,oz); break;
-        case 0x69: TRACEI("imul imm\t");
-                   READMODRM; READIMM; IMUL3(imm, modrm_val, modrm_reg,oz); break;
-        case 0x6a: TRACEI("push imm8\t");
-                   READIMM8; PUSH(imm,oz); break;
-        case 0x6b: TRACEI("imul imm8\t");
-                   READMODRM; READIMM8; IMUL3(imm, modrm_val, modrm_reg,oz); break;
-
-        case 0x70: TRACEI("jo rel8\t");
-                   READIMM8; J_REL(O, imm); break;
-        case 0x71: TRACEI("jno rel8\t");
-                   READIMM8; JN_REL(O, imm); break;
-        case 0x72: TRACEI("jb rel8\t");
-                   READIMM8; J_REL(B, imm); break;
-        case 0x73: TRACEI("jnb rel8\t");
-                   READIMM8; JN_REL(B, imm); break;
-        case 0x74: TRACEI("je rel8\t");
-                   READIMM8; J_REL(E, imm); break;
-        case 0x75: TRACEI("jne rel8\t");
-                   READIMM8; JN_REL(E, imm); break;
-        case 0x76: TRACEI("jbe rel8\t");
-                   READIMM8; J_REL(BE, imm); break;
-        case 0x77: TRACEI("ja rel8\t");
-                   READIMM8; JN_REL(BE, imm); break;
-        case 0x78: TRACEI("js rel8\t");
-                   READIMM8; J_REL(S, imm); break;
-        case 0x79: TRACEI("jns rel8\t");
-                   READIMM8; JN_REL(S, imm); break;
-        case 0x7a: TRACEI("jp rel8\t");
-                   READIMM8; J_REL(P, imm); break;
-        case 0x7b: TRACEI("jnp rel8\t");
-                   READIMM8; JN_REL(P, imm); break;
-        case 0x7c: TRACEI("jl rel8\t");
-                   READIMM8; J_REL(L, imm); break;
-        case 0x7d: TRACEI("jnl rel8\t");
-                   READIMM8; JN_REL(L, imm); break;
-        case 0x7e: TRACEI("jle rel8\t");
-                   READIMM8; J_REL(LE, imm); break;
-        case 0x7f: TRACEI("jnle rel8\t");
-                   READIMM8; JN_REL(LE, imm); break;
+        OPCODE(0x67): TRACEI("address size prefix (ignored)"); goto restart;
+
+        OPCODE(0x68): TRACEI("push imm\t");
+                   READIMM; PUSH(imm,oz); NEXT_INSN;
+        OPCODE(0x69): TRACEI("imul imm\t");
+                   READMODRM; READIMM; IMUL3(imm, modrm_val, modrm_reg,oz); NEXT_INSN;
+        OPCODE(0x6a): TRACEI("push imm8\t");
+                   READIMM8; PUSH(imm,oz); NEXT_INSN;
+        OPCODE(0x6b): TRACEI("imul imm8\t");
+                   READMODRM; READIMM8; IMUL3(imm, modrm_val, modrm_reg,oz); NEXT_INSN;
+
+        OPCODE(0x70): TRACEI("jo rel8\t");
+                   READIMM8; J_REL(O, imm); NEXT_INSN;
+        OPCODE(0x71): TRACEI("jno rel8\t");
+                   READIMM8; JN_REL(O, imm); NEXT_INSN;
+        OPCODE(0x72): TRACEI("jb rel8\t");
+                   READIMM8; J_REL(B, imm); NEXT_INSN;
+        OPCODE(0x73): TRACEI("jnb rel8\t");
+                   READIMM8; JN_REL(B, imm); NEXT_INSN;
+        OPCODE(0x74): TRACEI("je rel8\t");
+                   READIMM8; J_REL(E, imm); NEXT_INSN;
+        OPCODE(0x75): TRACEI("jne rel8\t");
+                   READIMM8; JN_REL(E, imm); NEXT_INSN;
+        OPCODE(0x76): TRACEI("jbe rel8\t");
+                   READIMM8; J_REL(BE, imm); NEXT_INSN;
+        OPCODE(0x77): TRACEI("ja rel8\t");
+                   READIMM8; JN_REL(BE, imm); NEXT_INSN;
+        OPCODE(0x78): TRACEI("js rel8\t");
+                   READIMM8; J_REL(S, imm); NEXT_INSN;
+        OPCODE(0x79): TRACEI("jns rel8\t");
+                   READIMM8; JN_REL(S, imm); NEXT_INSN;
+        OPCODE(0x7a): TRACEI("jp rel8\t");
+                   READIMM8; J_REL(P, imm); NEXT_INSN;
+        OPCODE(0x7b): TRACEI("jnp rel8\t");
+                   READIMM8; JN_REL(P, imm); NEXT_INSN;
+        OPCODE(0x7c): TRACEI("jl rel8\t");
+                   READIMM8; J_REL(L, imm); NEXT_INSN;
+        OPCODE(0x7d): TRACEI("jnl rel8\t");
+                   READIMM8; JN_REL(L, imm); NEXT_INSN;
+        OPCODE(0x7e): TRACEI("jle rel8\t");
+                   READIMM8; J_REL(LE, imm); NEXT_INSN;
+        OPCODE(0x7f): TRACEI("jnle rel8\t");
+                   READIMM8; JN_REL(LE, imm); NEXT_INSN;
 
 #define GRP1(src, dst,z) \
     switch (modrm.opcode) { \
@@ -416,133 +764,133 @@ restart:
                  UNDEFINED; \
     }
 
-        case 0x80: TRACEI("grp1 imm8, modrm8");
-                   READMODRM; READIMM8; GRP1(imm, modrm_val,8); break;
-        case 0x81: TRACEI("grp1 imm, modrm");
-                   READMODRM; READIMM; GRP1(imm, modrm_val,oz); break;
-        case 0x83: TRACEI("grp1 imm8, modrm");
-                   READMODRM; READIMM8; GRP1(imm, modrm_val,oz); break;
+        OPCODE(0x80): TRACEI("grp1 imm8, modrm8");
+                   READMODRM; READIMM8; GRP1(imm, modrm_val,8); NEXT_INSN;
+        OPCODE(0x81): TRACEI("grp1 imm, modrm");
+                   READMODRM; READIMM; GRP1(imm, modrm_val,oz); NEXT_INSN;
+        OPCODE(0x83): TRACEI("grp1 imm8, modrm");
+                   READMODRM; READIMM8; GRP1(imm, modrm_val,oz); NEXT_INSN;
 
 #undef GRP1
 
-        case 0x84: TRACEI("test reg8, modrm8");
-                   READMODRM; TEST(modrm_reg, modrm_val,8); break;
-        case 0x85: TRACEI("test reg, modrm");
-                   READMODRM; TEST(modrm_reg, modrm_val,oz); break;
+        OPCODE(0x84): TRACEI("test reg8, modrm8");
+                   READMODRM; TEST(modrm_reg, modrm_val,8); NEXT_INSN;
+        OPCODE(0x85): TRACEI("test reg, modrm");
+                   READMODRM; TEST(modrm_reg, modrm_val,oz); NEXT_INSN;
 
-        case 0x86: TRACEI("xchg reg8, modrm8");
-                   READMODRM; XCHG(modrm_reg, modrm_val,8); break;
-        case 0x87: TRACEI("xchg reg, modrm");
-                   READMODRM; XCHG(modrm_reg, modrm_val,oz); break;
+        OPCODE(0x86): TRACEI("xchg reg8, modrm8");
+                   READMODRM; ATOMIC_XCHG(modrm_reg, modrm_val,8); NEXT_INSN;
+        OPCODE(0x87): TRACEI("xchg reg, modrm");
+                   READMODRM; ATOMIC_XCHG(modrm_reg, modrm_val,oz); NEXT_INSN;
 
-        case 0x88: TRACEI("mov reg8, modrm8");
-                   READMODRM; MOV(modrm_reg, modrm_val,8); break;
-        case 0x89: TRACEI("mov reg, modrm");
-                   READMODRM; MOV(modrm_reg, modrm_val,oz); break;
-        case 0x8a: TRACEI("mov modrm8, reg8");
-                   READMODRM; MOV(modrm_val, modrm_reg,8); break;
-        case 0x8b: TRACEI("mov modrm, reg");
-                   READMODRM; MOV(modrm_val, modrm_reg,oz); break;
+        OPCODE(0x88): TRACEI("mov reg8, modrm8");
+                   READMODRM; MOV(modrm_reg, modrm_val,8); NEXT_INSN;
+        OPCODE(0x89): TRACEI("mov reg, modrm");
+                   READMODRM; MOV(modrm_reg, modrm_val,oz); NEXT_INSN;
+        OPCODE(0x8a): TRACEI("mov modrm8, reg8");
+                   READMODRM; MOV(modrm_val, modrm_reg,8); NEXT_INSN;
+        OPCODE(0x8b): TRACEI("mov modrm, reg");
+                   READMODRM; MOV(modrm_val, modrm_reg,oz); NEXT_INSN;
 
-        case 0x8d: TRACEI("lea\t\t"); READMODRM_MEM;
-                   MOV(addr, modrm_reg,oz); break;
+        OPCODE(0x8d): TRACEI("lea\t\t"); READMODRM_MEM;
+                   MOV(addr, modrm_reg,oz); NEXT_INSN;
 
         // only gs is supported, and it does nothing
         // see comment in sys/tls.c
-        case 0x8c: TRACEI("mov seg, modrm\t"); READMODRM;
+        OPCODE(0x8c): TRACEI("mov seg, modrm\t"); READMODRM;
             if (modrm.reg != reg_ebp) UNDEFINED;
-            MOV(gs, modrm_val,16); break;
-        case 0x8e: TRACEI("mov modrm, seg\t"); READMODRM;
+            MOV(gs, modrm_val,16); NEXT_INSN;
+        OPCODE(0x8e): TRACEI("mov modrm, seg\t"); READMODRM;
             if (modrm.reg != reg_ebp) UNDEFINED;
-            MOV(modrm_val, gs,16); break;
-
-        case 0x8f: TRACEI("pop modrm");
-                   READMODRM; POP(modrm_val,oz); break;
-
-        case 0x90: TRACEI("nop"); break;
-        case 0x91: TRACEI("xchg ocx, oax");
-                   XCHG(reg_c, reg_a,oz); break;
-        case 0x92: TRACEI("xchg odx, oax");
-                   XCHG(reg_d, reg_a,oz); break;
-        case 0x93: TRACEI("xchg obx, oax");
-                   XCHG(reg_b, reg_a,oz); break;
-        case 0x94: TRACEI("xchg osp, oax");
-                   XCHG(reg_sp, reg_a,oz); break;
-        case 0x95: TRACEI("xchg obp, oax");
-                   XCHG(reg_bp, reg_a,oz); break;
-        case 0x96: TRACEI("xchg osi, oax");
-                   XCHG(reg_si, reg_a,oz); break;
-        case 0x97: TRACEI("xchg odi, oax");
-                   XCHG(reg_di, reg_a,oz); break;
-
-        case 0x98: TRACEI("cvte"); CVTE; break;
-        case 0x99: TRACEI("cvt"); CVT; break;
-
-        case 0x9b: TRACEI("fwait (ignored)"); break;
-
-        case 0x9c: TRACEI("pushf"); PUSHF(); break;
-        case 0x9d: TRACEI("popf"); POPF(); break;
-        case 0x9e: TRACEI("sahf\t\t"); SAHF; break;
-
-        case 0xa0: TRACEI("mov mem, al\t");
-                   READADDR; MOV(mem_addr, reg_a,8); break;
-        case 0xa1: TRACEI("mov mem, eax\t");
-                   READADDR; MOV(mem_addr, reg_a,oz); break;
-        case 0xa2: TRACEI("mov al, mem\t");
-                   READADDR; MOV(reg_a, mem_addr,8); break;
-        case 0xa3: TRACEI("mov oax, mem\t");
-                   READADDR; MOV(reg_a, mem_addr,oz); break;
-
-        case 0xa4: TRACEI("movsb"); STR(movs, 8); break;
-        case 0xa5: TRACEI("movs"); STR(movs, oz); break;
-        case 0xa6: TRACEI("cmpsb"); STR(cmps, 8); break;
-        case 0xa7: TRACEI("cmps"); STR(cmps, oz); break;
-
-        case 0xa8: TRACEI("test imm8, al");
-                   READIMM8; TEST(imm, reg_a,8); break;
-        case 0xa9: TRACEI("test imm, oax");
-                   READIMM; TEST(imm, reg_a,oz); break;
-
-        case 0xaa: TRACEI("stosb"); STR(stos, 8); break;
-        case 0xab: TRACEI("stos"); STR(stos, oz); break;
-        case 0xac: TRACEI("lodsb"); STR(lods, 8); break;
-        case 0xad: TRACEI("lods"); STR(lods, oz); break;
-        case 0xae: TRACEI("scasb"); STR(scas, 8); break;
-        case 0xaf: TRACEI("scas"); STR(scas, oz); break;
-
-        case 0xb0: TRACEI("mov imm, al\t");
-                   READIMM8; MOV(imm, reg_a,8); break;
-        case 0xb1: TRACEI("mov imm, cl\t");
-                   READIMM8; MOV(imm, reg_c,8); break;
-        case 0xb2: TRACEI("mov imm, dl\t");
-                   READIMM8; MOV(imm, reg_d,8); break;
-        case 0xb3: TRACEI("mov imm, bl\t");
-                   READIMM8; MOV(imm, reg_b,8); break;
-        case 0xb4: TRACEI("mov imm, ah\t");
-                   READIMM8; MOV(imm, reg_ah,8); break;
-        case 0xb5: TRACEI("mov imm, ch\t");
-                   READIMM8; MOV(imm, reg_ch,8); break;
-        case 0xb6: TRACEI("mov imm, dh\t");
-                   READIMM8; MOV(imm, reg_dh,8); break;
-        case 0xb7: TRACEI("mov imm, bh\t");
-                   READIMM8; MOV(imm, reg_bh,8); break;
-
-        case 0xb8: TRACEI("mov imm, oax\t");
-                   READIMM; MOV(imm, reg_a,oz); break;
-        case 0xb9: TRACEI("mov imm, ocx\t");
-                   READIMM; MOV(imm, reg_c,oz); break;
-        case 0xba: TRACEI("mov imm, odx\t");
-                   READIMM; MOV(imm, reg_d,oz); break;
-        case 0xbb: TRACEI("mov imm, obx\t");
-                   READIMM; MOV(imm, reg_b,oz); break;
-        case 0xbc: TRACEI("mov imm, osp\t");
-                   READIMM; MOV(imm, reg_sp,oz); break;
-        case 0xbd: TRACEI("mov imm, obp\t");
-                   READIMM; MOV(imm, reg_bp,oz); break;
-        case 0xbe: TRACEI("mov imm, osi\t");
-                   READIMM; MOV(imm, reg_si,oz); break;
-        case 0xbf: TRACEI("mov imm, odi\t");
-                   READIMM; MOV(imm, reg_di,oz); break;
+            MOV(modrm_val, gs,16); NEXT_INSN;
+
+        OPCODE(0x8f): TRACEI("pop modrm");
+                   READMODRM; POP(modrm_val,oz); NEXT_INSN;
+
+        OPCODE(0x90): TRACEI("nop"); NEXT_INSN;
+        OPCODE(0x91): TRACEI("xchg ocx, oax");
+                   XCHG(reg_c, reg_a,oz); NEXT_INSN;
+        OPCODE(0x92): TRACEI("xchg odx, oax");
+                   XCHG(reg_d, reg_a,oz); NEXT_INSN;
+        OPCODE(0x93): TRACEI("xchg obx, oax");
+                   XCHG(reg_b, reg_a,oz); NEXT_INSN;
+        OPCODE(0x94): TRACEI("xchg osp, oax");
+                   XCHG(reg_sp, reg_a,oz); NEXT_INSN;
+        OPCODE(0x95): TRACEI("xchg obp, oax");
+                   XCHG(reg_bp, reg_a,oz); NEXT_INSN;
+        OPCODE(0x96): TRACEI("xchg osi, oax");
+                   XCHG(reg_si, reg_a,oz); NEXT_INSN;
+        OPCODE(0x97): TRACEI("xchg odi, oax");
+                   XCHG(reg_di, reg_a,oz); NEXT_INSN;
+
+        OPCODE(0x98): TRACEI("cvte"); CVTE; NEXT_INSN;
+        OPCODE(0x99): TRACEI("cvt"); CVT; NEXT_INSN;
+
+        OPCODE(0x9b): TRACEI("fwait (ignored)"); NEXT_INSN;
+
+        OPCODE(0x9c): TRACEI("pushf"); PUSHF(); NEXT_INSN;
+        OPCODE(0x9d): TRACEI("popf"); POPF(); NEXT_INSN;
+        OPCODE(0x9e): TRACEI("sahf\t\t"); SAHF; NEXT_INSN;
+
+        OPCODE(0xa0): TRACEI("mov mem, al\t");
+                   READADDR; MOV(mem_addr, reg_a,8); NEXT_INSN;
+        OPCODE(0xa1): TRACEI("mov mem, eax\t");
+                   READADDR; MOV(mem_addr, reg_a,oz); NEXT_INSN;
+        OPCODE(0xa2): TRACEI("mov al, mem\t");
+                   READADDR; MOV(reg_a, mem_addr,8); NEXT_INSN;
+        OPCODE(0xa3): TRACEI("mov oax, mem\t");
+                   READADDR; MOV(reg_a, mem_addr,oz); NEXT_INSN;
+
+        OPCODE(0xa4): TRACEI("movsb"); STR(movs, 8); NEXT_INSN;
+        OPCODE(0xa5): TRACEI("movs"); STR(movs, oz); NEXT_INSN;
+        OPCODE(0xa6): TRACEI("cmpsb"); STR(cmps, 8); NEXT_INSN;
+        OPCODE(0xa7): TRACEI("cmps"); STR(cmps, oz); NEXT_INSN;
+
+        OPCODE(0xa8): TRACEI("test imm8, al");
+                   READIMM8; TEST(imm, reg_a,8); NEXT_INSN;
+        OPCODE(0xa9): TRACEI("test imm, oax");
+                   READIMM; TEST(imm, reg_a,oz); NEXT_INSN;
+
+        OPCODE(0xaa): TRACEI("stosb"); STR(stos, 8); NEXT_INSN;
+        OPCODE(0xab): TRACEI("stos"); STR(stos, oz); NEXT_INSN;
+        OPCODE(0xac): TRACEI("lodsb"); STR(lods, 8); NEXT_INSN;
+        OPCODE(0xad): TRACEI("lods"); STR(lods, oz); NEXT_INSN;
+        OPCODE(0xae): TRACEI("scasb"); STR(scas, 8); NEXT_INSN;
+        OPCODE(0xaf): TRACEI("scas"); STR(scas, oz); NEXT_INSN;
+
+        OPCODE(0xb0): TRACEI("mov imm, al\t");
+                   READIMM8; MOV(imm, reg_a,8); NEXT_INSN;
+        OPCODE(0xb1): TRACEI("mov imm, cl\t");
+                   READIMM8; MOV(imm, reg_c,8); NEXT_INSN;
+        OPCODE(0xb2): TRACEI("mov imm, dl\t");
+                   READIMM8; MOV(imm, reg_d,8); NEXT_INSN;
+        OPCODE(0xb3): TRACEI("mov imm, bl\t");
+                   READIMM8; MOV(imm, reg_b,8); NEXT_INSN;
+        OPCODE(0xb4): TRACEI("mov imm, ah\t");
+                   READIMM8; MOV(imm, reg_ah,8); NEXT_INSN;
+        OPCODE(0xb5): TRACEI("mov imm, ch\t");
+                   READIMM8; MOV(imm, reg_ch,8); NEXT_INSN;
+        OPCODE(0xb6): TRACEI("mov imm, dh\t");
+                   READIMM8; MOV(imm, reg_dh,8); NEXT_INSN;
+        OPCODE(0xb7): TRACEI("mov imm, bh\t");
+                   READIMM8; MOV(imm, reg_bh,8); NEXT_INSN;
+
+        OPCODE(0xb8): TRACEI("mov imm, oax\t");
+                   READIMM; MOV(imm, reg_a,oz); NEXT_INSN;
+        OPCODE(0xb9): TRACEI("mov imm, ocx\t");
+                   READIMM; MOV(imm, reg_c,oz); NEXT_INSN;
+        OPCODE(0xba): TRACEI("mov imm, odx\t");
+                   READIMM; MOV(imm, reg_d,oz); NEXT_INSN;
+        OPCODE(0xbb): TRACEI("mov imm, obx\t");
+                   READIMM; MOV(imm, reg_b,oz); NEXT_INSN;
+        OPCODE(0xbc): TRACEI("mov imm, osp\t");
+                   READIMM; MOV(imm, reg_sp,oz); NEXT_INSN;
+        OPCODE(0xbd): TRACEI("mov imm, obp\t");
+                   READIMM; MOV(imm, reg_bp,oz); NEXT_INSN;
+        OPCODE(0xbe): TRACEI("mov imm, osi\t");
+                   READIMM; MOV(imm, reg_si,oz); NEXT_INSN;
+        OPCODE(0xbf): TRACEI("mov imm, odi\t");
+                   READIMM; MOV(imm, reg_di,oz); NEXT_INSN;
 
 #define GRP2(count, val,z) \
     switch (modrm.opcode) { \
@@ -556,39 +904,39 @@ restart:
         case 7: TRACE("sar"); SAR(count, val,z); break; \
     }
 
-        case 0xc0: TRACEI("grp2 imm8, modrm8");
-                   READMODRM; READIMM8; GRP2(imm, modrm_val,8); break;
-        case 0xc1: TRACEI("grp2 imm8, modrm");
-                   READMODRM; READIMM8; GRP2(imm, modrm_val,oz); break;
+        OPCODE(0xc0): TRACEI("grp2 imm8, modrm8");
+                   READMODRM; READIMM8; GRP2(imm, modrm_val,8); NEXT_INSN;
+        OPCODE(0xc1): TRACEI("grp2 imm8, modrm");
+                   READMODRM; READIMM8; GRP2(imm, modrm_val,oz); NEXT_INSN;
 
-        case 0xc2: TRACEI("ret near imm\t");
-                   READIMM16; RET_NEAR(imm); break;
-        case 0xc3: TRACEI("ret near");
-                   RET_NEAR(0); break;
+        OPCODE(0xc2): TRACEI("ret near imm\t");
+                   READIMM16; RET_NEAR(imm); NEXT_INSN;
+        OPCODE(0xc3): TRACEI("ret near");
+                   RET_NEAR(0); NEXT_INSN;
 
-        case 0xc9: TRACEI("leave");
-                   MOV(reg_bp, reg_sp,oz); POP(reg_bp,oz); break;
+        OPCODE(0xc9): TRACEI("leave");
+                   MOV(reg_bp, reg_sp,oz); POP(reg_bp,oz); NEXT_INSN;
 
-        case 0xcd: TRACEI("int imm8\t");
-                   READIMM8; INT(imm); break;
+        OPCODE(0xcd): TRACEI("int imm8\t");
+                   READIMM8; INT(imm); NEXT_INSN;
 
-        case 0xc6: TRACEI("mov imm8, modrm8");
-                   READMODRM; READIMM8; MOV(imm, modrm_val,8); break;
-        case 0xc7: TRACEI("mov imm, modrm");
-                   READMODRM; READIMM; MOV(imm, modrm_val,oz); break;
+        OPCODE(0xc6): TRACEI("mov imm8, modrm8");
+                   READMODRM; READIMM8; MOV(imm, modrm_val,8); NEXT_INSN;
+        OPCODE(0xc7): TRACEI("mov imm, modrm");
+                   READMODRM; READIMM; MOV(imm, modrm_val,oz); NEXT_INSN;
 
-        case 0xd0: TRACEI("grp2 1, modrm8");
-                   READMODRM; GRP2(1, modrm_val,8); break;
-        case 0xd1: TRACEI("grp2 1, modrm");
-                   READMODRM; GRP2(1, modrm_val,oz); break;
-        case 0xd2: TRACEI("grp2 cl, modrm8");
-                   READMODRM; GRP2(reg_c, modrm_val,8); break;
-        case 0xd3: TRACEI("grp2 cl, modrm");
-                   READMODRM; GRP2(reg_c, modrm_val,oz); break;
+        OPCODE(0xd0): TRACEI("grp2 1, modrm8");
+                   READMODRM; GRP2(1, modrm_val,8); NEXT_INSN;
+        OPCODE(0xd1): TRACEI("grp2 1, modrm");
+                   READMODRM; GRP2(1, modrm_val,oz); NEXT_INSN;
+        OPCODE(0xd2): TRACEI("grp2 cl, modrm8");
+                   READMODRM; GRP2(reg_c, modrm_val,8); NEXT_INSN;
+        OPCODE(0xd3): TRACEI("grp2 cl, modrm");
+                   READMODRM; GRP2(reg_c, modrm_val,oz); NEXT_INSN;
 
 #undef GRP2
 
-        case 0xd8: case 0xd9: case 0xda: case 0xdb: case 0xdc: case 0xdd: case 0xde: case 0xdf:
+        OPCODE(0xd8): case 0xd9: case 0xda: case 0xdb: case 0xdc: case 0xdd: case 0xde: case 0xdf:
             TRACEI("fpu\t\t"); READMODRM;
             if (modrm.type != modrm_reg) {
                 switch (insn << 4 | modrm.opcode) {
@@ -693,19 +1041,19 @@ restart:
             }
             break;
 
-        case 0xe3: TRACEI("jcxz rel8\t");
-                   READIMM8; JCXZ_REL(imm); break;
+        OPCODE(0xe3): TRACEI("jcxz rel8\t");
+                   READIMM8; JCXZ_REL(imm); NEXT_INSN;
 
-        case 0xe8: TRACEI("call near\t");
-                   READIMM; CALL_REL(imm); break;
+        OPCODE(0xe8): TRACEI("call near\t");
+                   READIMM; CALL_REL(imm); NEXT_INSN;
 
-        case 0xe9: TRACEI("jmp rel\t");
-                   READIMM; JMP_REL(imm); break;
-        case 0xeb: TRACEI("jmp rel8\t");
-                   READIMM8; JMP_REL(imm); break;
+        OPCODE(0xe9): TRACEI("jmp rel\t");
+                   READIMM; JMP_REL(imm); NEXT_INSN;
+        OPCODE(0xeb): TRACEI("jmp rel8\t");
+                   READIMM8; JMP_REL(imm); NEXT_INSN;
 
         // lock
-        case 0xf0:
+        OPCODE(0xf0):
             lockrestart:
             READINSN;
             switch (insn) {
@@ -779,16 +1127,45 @@ restart:
             }
             break;
 
-        case 0xf2:
+        OPCODE(0xf2):
             READINSN;
             switch (insn) {
                 case 0x0f:
                     READINSN;
                     switch (insn) {
-                        case 0x2c: TRACEI("cvttsd2si modrm64, reg32");
-                                   READMODRM_MEM; // TODO xmm
-                                   CVTTSD2SI(mem_addr_real, modrm_reg); break;
+                        case 0x10: TRACEI("movsd modrm, reg");
+                                   READMODRM; MOVS_LOAD(modrm_val, modrm_reg, 64); break;
+                        case 0x11: TRACEI("movsd reg, modrm");
+                                   READMODRM; MOVS_STORE(modrm_reg, modrm_val, 64); break;
                         case 0x18 ... 0x1f: TRACEI("rep nop modrm\t"); READMODRM; break;
+                        case 0x2a: TRACEI("cvtsi2sd modrm32, reg");
+                                   READMODRM; CVTSI2S(modrm_val, modrm_reg, d); break;
+                        case 0x2c: TRACEI("cvttsd2si modrm, reg32");
+                                   READMODRM; CVTS2SI(modrm_val, modrm_reg, d, 64, true); break;
+                        case 0x2d: TRACEI("cvtsd2si modrm, reg32");
+                                   READMODRM; CVTS2SI(modrm_val, modrm_reg, d, 64, false); break;
+                        case 0x51: TRACEI("sqrtsd modrm, reg");
+                                   READMODRM; SCALAR_OP(modrm_val, modrm_reg, d, 64, sse_sqrtsd); break;
+                        case 0x58: TRACEI("addsd modrm, reg");
+                                   READMODRM; SCALAR_OP(modrm_val, modrm_reg, d, 64, sse_add); break;
+                        case 0x59: TRACEI("mulsd modrm, reg");
+                                   READMODRM; SCALAR_OP(modrm_val, modrm_reg, d, 64, sse_mul); break;
+                        case 0x5a: TRACEI("cvtsd2ss modrm, reg");
+                                   READMODRM; CVTSD2SS(modrm_val, modrm_reg); break;
+                        case 0x5c: TRACEI("subsd modrm, reg");
+                                   READMODRM; SCALAR_OP(modrm_val, modrm_reg, d, 64, sse_sub); break;
+                        case 0x5d: TRACEI("minsd modrm, reg");
+                                   READMODRM; SCALAR_OP(modrm_val, modrm_reg, d, 64, sse_mins); break;
+                        case 0x5e: TRACEI("divsd modrm, reg");
+                                   READMODRM; SCALAR_OP(modrm_val, modrm_reg, d, 64, sse_div); break;
+                        case 0x5f: TRACEI("maxsd modrm, reg");
+                                   READMODRM; SCALAR_OP(modrm_val, modrm_reg, d, 64, sse_maxs); break;
+                        case 0x70: TRACEI("pshuflw imm8, modrm, reg");
+                                   READMODRM; READIMM8; PSHUFLW(modrm_val, modrm_reg, (uint8_t) imm); break;
+                        case 0xc2: TRACEI("cmpsd imm8, modrm, reg");
+                                   READMODRM; READIMM8; CMPS(modrm_val, modrm_reg, d, qw, 64, imm); break;
+                        case 0xe6: TRACEI("cvtpd2dq modrm, reg");
+                                   READMODRM; CVTPD2DQ(modrm_val, modrm_reg, false); break;
                         default: TRACE("undefined"); UNDEFINED;
                     }
                     break;
@@ -801,7 +1178,7 @@ restart:
             }
             break;
 
-        case 0xf3:
+        OPCODE(0xf3):
             READINSN;
             switch (insn) {
                 case 0x0f:
@@ -809,9 +1186,51 @@ restart:
                     // after a rep prefix, means we have sse/mmx insanity
                     READINSN;
                     switch (insn) {
+                        case 0x10: TRACEI("movss modrm, reg");
+                                   READMODRM; MOVS_LOAD(modrm_val, modrm_reg, 32); break;
+                        case 0x11: TRACEI("movss reg, modrm");
+                                   READMODRM; MOVS_STORE(modrm_reg, modrm_val, 32); break;
+                        case 0x18 ... 0x1f: TRACEI("repz nop modrm\t"); READMODRM; break;
+                        case 0x2a: TRACEI("cvtsi2ss modrm32, reg");
+                                   READMODRM; CVTSI2S(modrm_val, modrm_reg, f); break;
+                        case 0x2c: TRACEI("cvttss2si modrm, reg32");
+                                   READMODRM; CVTS2SI(modrm_val, modrm_reg, f, 32, true); break;
+                        case 0x2d: TRACEI("cvtss2si modrm, reg32");
+                                   READMODRM; CVTS2SI(modrm_val, modrm_reg, f, 32, false); break;
+                        case 0x51: TRACEI("sqrtss modrm, reg");
+                                   READMODRM; SCALAR_OP(modrm_val, modrm_reg, f, 32, sse_sqrtss); break;
+                        case 0x52: TRACEI("rsqrtss modrm, reg");
+                                   READMODRM; SCALAR_OP(modrm_val, modrm_reg, f, 32, sse_rsqrtss); break;
+                        case 0x53: TRACEI("rcpss modrm, reg");
+                                   READMODRM; SCALAR_OP(modrm_val, modrm_reg, f, 32, sse_rcpss); break;
+                        case 0x58: TRACEI("addss modrm, reg");
+                                   READMODRM; SCALAR_OP(modrm_val, modrm_reg, f, 32, sse_add); break;
+                        case 0x59: TRACEI("mulss modrm, reg");
+                                   READMODRM; SCALAR_OP(modrm_val, modrm_reg, f, 32, sse_mul); break;
+                        case 0x5a: TRACEI("cvtss2sd modrm, reg");
+                                   READMODRM; CVTSS2SD(modrm_val, modrm_reg); break;
+                        case 0x5b: TRACEI("cvttps2dq modrm, reg");
+                                   READMODRM; CVTPS2DQ(modrm_val, modrm_reg, true); break;
+                        case 0x5c: TRACEI("subss modrm, reg");
+                                   READMODRM; SCALAR_OP(modrm_val, modrm_reg, f, 32, sse_sub); break;
+                        case 0x5d: TRACEI("minss modrm, reg");
+                                   READMODRM; SCALAR_OP(modrm_val, modrm_reg, f, 32, sse_mins); break;
+                        case 0x5e: TRACEI("divss modrm, reg");
+                                   READMODRM; SCALAR_OP(modrm_val, modrm_reg, f, 32, sse_div); break;
+                        case 0x5f: TRACEI("maxss modrm, reg");
+                                   READMODRM; SCALAR_OP(modrm_val, modrm_reg, f, 32, sse_maxs); break;
+                        case 0x6f: TRACEI("movdqu modrm, reg");
+                                   READMODRM; MOV(modrm_val, modrm_reg,128); break;
+                        case 0x70: TRACEI("pshufhw imm8, modrm, reg");
+                                   READMODRM; READIMM8; PSHUFHW(modrm_val, modrm_reg, (uint8_t) imm); break;
                         case 0x7e: TRACEI("movq modrm, xmm");
                                    READMODRM; MOVQ(modrm_val, modrm_reg); break;
-                        case 0x18 ... 0x1f: TRACEI("repz nop modrm\t"); READMODRM; break;
+                        case 0x7f: TRACEI("movdqu reg, modrm");
+                                   READMODRM; MOV(modrm_reg, modrm_val,128); break;
+                        case 0xc2: TRACEI("cmpss imm8, modrm, reg");
+                                   READMODRM; READIMM8; CMPS(modrm_val, modrm_reg, f, dw, 32, imm); break;
+                        case 0xe6: TRACEI("cvtdq2pd modrm, reg");
+                                   READMODRM; CVTDQ2PD(modrm_val, modrm_reg); break;
 
                         // tzcnt is like bsf but the result when the input is zero is defined as the operand size
                         // for now, it can just be an alias
@@ -866,15 +1285,15 @@ restart:
         default: TRACE("undefined"); UNDEFINED; \
     }
 
-        case 0xf6: TRACEI("grp3 modrm8\t");
-                   READMODRM; GRP3(modrm_val,8); break;
-        case 0xf7: TRACEI("grp3 modrm\t");
-                   READMODRM; GRP3(modrm_val,oz); break;
+        OPCODE(0xf6): TRACEI("grp3 modrm8\t");
+                   READMODRM; GRP3(modrm_val,8); NEXT_INSN;
+        OPCODE(0xf7): TRACEI("grp3 modrm\t");
+                   READMODRM; GRP3(modrm_val,oz); NEXT_INSN;
 
 #undef GRP3
 
-        case 0xfc: TRACEI("cld"); CLD; break;
-        case 0xfd: TRACEI("std"); STD; break;
+        OPCODE(0xfc): TRACEI("cld"); CLD; NEXT_INSN;
+        OPCODE(0xfd): TRACEI("std"); STD; NEXT_INSN;
 
 #define GRP5(val,z) \
     switch (modrm.opcode) { \
@@ -893,14 +1312,14 @@ restart:
         case 7: TRACE("undefined"); UNDEFINED; \
     }
 
-        case 0xfe: TRACEI("grp5 modrm8\t");
-                   READMODRM; GRP5(modrm_val,8); break;
-        case 0xff: TRACEI("grp5 modrm\t");
-                   READMODRM; GRP5(modrm_val,oz); break;
+        OPCODE(0xfe): TRACEI("grp5 modrm8\t");
+                   READMODRM; GRP5(modrm_val,8); NEXT_INSN;
+        OPCODE(0xff): TRACEI("grp5 modrm\t");
+                   READMODRM; GRP5(modrm_val,oz); NEXT_INSN;
 
 #undef GRP5
 
-        default:
+        OPCODE_DEFAULT:
             TRACE("undefined\n");
             UNDEFINED;
     }
@@ -5,6 +5,8 @@ SOURCES += \
     memory.c \
     tlb.c \
     interp.c \
+    cpuid.c \
+    profile.c \
     uint128.c \
     float80.c \
     fpu.c
@@ -16,10 +18,12 @@ HEADERS += \
     float80.h \
     fpu.h \
     interp/fpu.h \
+    interp/rep.h \
     interp/sse.h \
     interrupt.h \
     memory.h \
     modrm.h \
+    profile.h \
     regid.h \
     tlb.h \
     uint128.h
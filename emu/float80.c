@@ -20,6 +20,7 @@
  */
 
 #include <assert.h>
+#include <float.h>
 #include <string.h>
 #include <stdint.h>
 #include <math.h>
@@ -56,6 +57,59 @@ static int unbias_denormal(unsigned int exp) {
 #define CURSED_BIT (1ull << 63)
 
 thread_local enum f80_rounding_mode f80_rounding_mode;
+thread_local enum f80_precision f80_precision = precision_extended;
+
+// On x86-64 hosts long double is exactly the same 80-bit format, so the host
+// fpu can do the arithmetic. Its control word gets the guest's rounding mode
+// and precision, which makes the results come out bit for bit the same as on
+// real hardware. 32-bit hosts are left out because they do their own double
+// math on the x87 too, and wouldn't like the control word being changed.
+#if defined(__x86_64__) && LDBL_MANT_DIG == 64
+#define F80_NATIVE
+typedef long double fast_t;
+#define fast_fn(name) name##l
+
+static thread_local uint16_t host_fcw;
+
+static inline bool fast_ok() {
+    uint16_t fcw = 0x7f | f80_precision << 8 | f80_rounding_mode << 10;
+    if (fcw != host_fcw) {
+        __asm__ volatile("fldcw %0" :: "m" (fcw));
+        host_fcw = fcw;
+    }
+    return true;
+}
+static inline fast_t fast_arg(float80 f) {
+    fast_t ld = 0;
+    memcpy(&ld, &f, 10);
+    return ld;
+}
+static inline float80 fast_result(fast_t ld) {
+    float80 f = {};
+    memcpy(&f, &ld, 10);
+    return f;
+}
+
+#else
+// Everywhere else, if the guest has set the precision to double or single and
+// is rounding to nearest, do the math with doubles. This isn't exact (the
+// operands get rounded on the way in, and the exponent range is smaller) but
+// it's close and a lot faster than doing it all in software.
+typedef double fast_t;
+#define fast_fn(name) name
+
+static inline bool fast_ok() {
+    return f80_precision != precision_extended && f80_rounding_mode == round_to_nearest;
+}
+static inline fast_t fast_arg(float80 f) {
+    return f80_to_double(f);
+}
+static inline float80 fast_result(fast_t d) {
+    if (f80_precision == precision_single)
+        d = (float) d;
+    return f80_from_double(d);
+}
+#endif
 
 // shift a 128 bit integer right but using the floating point rounding mode
 // used by f80_shift_right and to round the 128-bit result of multiplying significands
@@ -196,6 +250,9 @@ static float80 u128_normalize_round(uint128_t signif, int exp, int sign) {
 }
 
 float80 f80_from_int(int64_t i) {
+#ifdef F80_NATIVE
+    return fast_result(i);
+#endif
     // stick i in the significand, give it an exponent of 2^63 to offset the
     // implicit binary point after the first bit, and then normalize
     float80 f = {
@@ -213,6 +270,10 @@ float80 f80_from_int(int64_t i) {
 }
 
 int64_t f80_to_int(float80 f) {
+#ifdef F80_NATIVE
+    if (fast_ok())
+        return llrintl(fast_arg(f));
+#endif
     if (!f80_is_supported(f))
         return INT64_MIN; // indefinite
     // if you need an exponent greater than 2^63 to represent this number, it
@@ -238,6 +299,9 @@ struct double_bits {
 
 // unsupported?
 float80 f80_from_double(double d) {
+#ifdef F80_NATIVE
+    return fast_result(d);
+#endif
     struct double_bits db;
     memcpy(&db, &d, sizeof(db));
     float80 f;
@@ -261,6 +325,10 @@ float80 f80_from_double(double d) {
 }
 
 double f80_to_double(float80 f) {
+#ifdef F80_NATIVE
+    if (fast_ok())
+        return fast_arg(f);
+#endif
     if (!f80_is_supported(f))
         return NAN;
     struct double_bits db;
@@ -303,6 +371,8 @@ float80 f80_abs(float80 f) {
 }
 
 float80 f80_add(float80 a, float80 b) {
+    if (fast_ok())
+        return fast_result(fast_arg(a) + fast_arg(b));
     if (!f80_is_supported(a) || !f80_is_supported(b))
         return F80_NAN;
 
@@ -374,10 +444,14 @@ float80 f80_add(float80 a, float80 b) {
     return f;
 }
 float80 f80_sub(float80 a, float80 b) {
+    if (fast_ok())
+        return fast_result(fast_arg(a) - fast_arg(b));
     return f80_add(a, f80_neg(b));
 }
 
 float80 f80_mul(float80 a, float80 b) {
+    if (fast_ok())
+        return fast_result(fast_arg(a) * fast_arg(b));
     if (!f80_is_supported(a) || !f80_is_supported(b))
         return F80_NAN;
     if (f80_isnan(a))
@@ -412,6 +486,8 @@ float80 f80_mul(float80 a, float80 b) {
 
 // FIXME this is sort of broken for dividing by very small numbers (good enough for now though)
 float80 f80_div(float80 a, float80 b) {
+    if (fast_ok())
+        return fast_result(fast_arg(a) / fast_arg(b));
     if (!f80_is_supported(a) || !f80_is_supported(b))
         return F80_NAN;
     if (f80_isnan(a))
@@ -447,6 +523,8 @@ float80 f80_div(float80 a, float80 b) {
 }
 
 float80 f80_mod(float80 x, float80 y) {
+    if (fast_ok())
+        return fast_result(fast_fn(fmod)(fast_arg(x), fast_arg(y)));
     float80 quotient = f80_div(x, y);
     enum f80_rounding_mode old_mode = f80_rounding_mode;
     f80_rounding_mode = round_chop;
@@ -492,6 +570,8 @@ bool f80_gt(float80 a, float80 b) {
 }
 
 float80 f80_log2(float80 x) {
+    if (fast_ok())
+        return fast_result(fast_fn(log2)(fast_arg(x)));
     float80 zero = f80_from_int(0);
     float80 one = f80_from_int(1);
     float80 two = f80_from_int(2);
@@ -525,6 +605,8 @@ float80 f80_log2(float80 x) {
 }
 
 float80 f80_sqrt(float80 x) {
+    if (fast_ok())
+        return fast_result(fast_fn(sqrt)(fast_arg(x)));
     if (f80_isnan(x) || x.sign)
         return F80_NAN;
 
@@ -545,6 +627,10 @@ float80 f80_sqrt(float80 x) {
 }
 
 float80 f80_scale(float80 x, int scale) {
+#ifdef F80_NATIVE
+    if (fast_ok())
+        return fast_result(scalbnl(fast_arg(x), scale));
+#endif
     if (!f80_is_supported(x) || f80_isnan(x))
         return F80_NAN;
 
@@ -76,6 +76,15 @@ enum f80_rounding_mode {
 
 extern thread_local enum f80_rounding_mode f80_rounding_mode;
 
+// the precision control field of the fpu control word
+enum f80_precision {
+    precision_single = 0,
+    precision_double = 2,
+    precision_extended = 3,
+};
+
+extern thread_local enum f80_precision f80_precision;
+
 #define F80_NAN ((float80) {.signif = 0xc000000000000000, .exp = 0x7fff, .sign = 0})
 #define F80_INF ((float80) {.signif = 0x8000000000000000, .exp = 0x7fff, .sign = 0})
 
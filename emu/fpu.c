@@ -254,6 +254,7 @@ void fpu_stcw16(struct cpu_state *cpu, uint16_t *i) {
 void fpu_ldcw16(struct cpu_state *cpu, uint16_t *i) {
     cpu->fcw = *i;
     f80_rounding_mode = cpu->rc;
+    f80_precision = cpu->pc;
 }
 
 void fpu_patan(struct cpu_state *cpu) {
@@ -1,6 +1,7 @@
 #include "emu/cpu.h"
 #include "emu/cpuid.h"
 #include "emu/modrm.h"
+#include "emu/profile.h"
 #include "emu/regid.h"
 
 // TODO get rid of these
@@ -10,6 +11,7 @@
 #define DECLARE_LOCALS \
     dword_t addr_offset = 0; \
     dword_t saved_ip = cpu->eip; \
+    bool end_block = false; \
     struct regptr modrm_regptr, modrm_base; \
     dword_t addr = 0; \
     \
@@ -18,7 +20,21 @@
     \
     float80 ftmp;
 
+// Instructions run in blocks, cpu_step only goes back to cpu_run after an
+// instruction that changes eip, or an interrupt. cpu_step16 only runs the one
+// instruction with an operand size prefix, so that ends the block too.
+#define END_BLOCK end_block = true
+// cpu_step16 is always entered from cpu_step32 after the prefix, so only
+// count there
+#define BEGIN_INSN \
+    saved_ip = cpu->eip; \
+    addr = 0; \
+    if (OP_SIZE == 32 && opcode_stats_enabled) \
+        opcode_count(tlb, cpu->eip)
+#define CONTINUE_BLOCK (OP_SIZE == 32 && !end_block)
 #define FINISH \
+    if (CONTINUE_BLOCK) \
+        goto next_insn; \
     return -1 // everything is ok.
 
 #define UNDEFINED { cpu->eip = saved_ip; return INT_UNDEFINED; }
@@ -134,7 +150,7 @@ static bool modrm_compute(struct cpu_state *cpu, struct tlb *tlb, addr_t *addr_o
 #define set_reg_di(to, size) *(uint(size) *) &cpu->edi = to
 #define set_reg_bp(to, size) *(uint(size) *) &cpu->ebp = to
 #define set_reg_sp(to, size) *(uint(size) *) &cpu->esp = to
-#define set_eip(to, size) cpu->eip = to
+#define set_eip(to, size) cpu->eip = to; END_BLOCK
 #define set_eflags(to, size) cpu->eflags = to
 #define set_gs(to, size) cpu->gs = to
 
@@ -448,14 +464,20 @@ static bool modrm_compute(struct cpu_state *cpu, struct tlb *tlb, addr_t *addr_o
 
 #define STR(op, z) str_##op(z)
 
+#include "emu/interp/rep.h"
+
 #define REP(op, z) \
     while (cpu->ecx != 0) { \
+        if (rep_bulk_##op(cpu, tlb, sz(z)/8)) \
+            continue; \
         STR(op, z); \
         cpu->ecx--; \
     }
 
 #define REPNZ(op, z) \
     while (cpu->ecx != 0) { \
+        if (rep_bulk_##op(cpu, tlb, sz(z)/8, true)) \
+            continue; \
         STR(op, z); \
         cpu->ecx--; \
         if (ZF) break; \
@@ -463,6 +485,8 @@ static bool modrm_compute(struct cpu_state *cpu, struct tlb *tlb, addr_t *addr_o
 
 #define REPZ(op, z) \
     while (cpu->ecx != 0) { \
+        if (rep_bulk_##op(cpu, tlb, sz(z)/8, false)) \
+            continue; \
         STR(op, z); \
         cpu->ecx--; \
         if (!ZF) break; \
@@ -497,13 +521,15 @@ static bool modrm_compute(struct cpu_state *cpu, struct tlb *tlb, addr_t *addr_o
     if (OP_SIZE == 16) \
         cpu->eip &= 0xffff
 
-#define JMP(loc) cpu->eip = get(loc,); FIX_EIP;
-#define JMP_REL(offset) cpu->eip += get(offset,); FIX_EIP;
+#define JMP(loc) cpu->eip = get(loc,); FIX_EIP; END_BLOCK;
+#define JMP_REL(offset) cpu->eip += get(offset,); FIX_EIP; END_BLOCK;
 #define J_REL(cond, offset) \
+    END_BLOCK; \
     if (cond) { \
         cpu->eip += get(offset,); FIX_EIP; \
     }
 #define JN_REL(cond, offset) \
+    END_BLOCK; \
     if (!cond) { \
         cpu->eip += get(offset,); FIX_EIP; \
     }
@@ -545,17 +571,149 @@ static bool modrm_compute(struct cpu_state *cpu, struct tlb *tlb, addr_t *addr_o
     do_cpuid(&cpu->eax, &cpu->ebx, &cpu->ecx, &cpu->edx)
 
 // atomic
-#define ATOMIC_ADD ADD
-#define ATOMIC_OR OR
-#define ATOMIC_ADC ADC
-#define ATOMIC_SBB SBB
-#define ATOMIC_AND AND
-#define ATOMIC_SUB SUB
-#define ATOMIC_XOR XOR
-#define ATOMIC_INC INC
-#define ATOMIC_DEC DEC
-#define ATOMIC_CMPXCHG CMPXCHG
-#define ATOMIC_XADD XADD
+
+// Lock prefixed instructions are done on the host memory with host atomics,
+// so they're atomic with respect to other threads in the guest running on
+// other cores. The normal macro runs on a copy of the old value to get the
+// flags. Host atomics need an aligned pointer, or they fault or aren't
+// atomic on arm, and an operand that crosses a page isn't in one piece of
+// host memory anyway. So misaligned operands are done under
+// atomic_split_lock instead.
+static lock_t atomic_split_lock = LOCK_INITIALIZER;
+
+#define get_atomic_src(size) atomic_src
+#define get_atomic_dst(size) atomic_dst
+#define set_atomic_dst(to, size) atomic_dst = (to)
+#define is_memory_atomic_src 0
+#define is_memory_atomic_dst 0
+
+#define ATOMIC_LOCALS(src,z) \
+    uint(z) atomic_src = get(src,z); \
+    uint(z) atomic_old
+
+// sets atomic_ptr, or takes the split lock and leaves it NULL
+// faults have to happen before the lock is taken
+#define ATOMIC_START(z) \
+    uint(z) *atomic_ptr = NULL; \
+    if (addr % (z/8) != 0) { \
+        if (__tlb_write_ptr(tlb, addr) == NULL || \
+                __tlb_write_ptr(tlb, addr + z/8 - 1) == NULL) { \
+            cpu->eip = saved_ip; \
+            cpu->segfault_addr = addr; \
+            return INT_GPF; \
+        } \
+        lock(&atomic_split_lock); \
+    } else { \
+        atomic_ptr = __tlb_write_ptr(tlb, addr); \
+        if (atomic_ptr == NULL) { \
+            cpu->eip = saved_ip; \
+            cpu->segfault_addr = addr; \
+            return INT_GPF; \
+        } \
+    }
+
+// for operations that have a host atomic, fetch_op is the name of the
+// __atomic builtin without the prefix
+#define ATOMIC_FETCH(OP, fetch_op,z) \
+    uint(z) atomic_dst; \
+    ATOMIC_START(z); \
+    if (atomic_ptr != NULL) { \
+        atomic_old = __atomic_##fetch_op(atomic_ptr, atomic_src, __ATOMIC_SEQ_CST); \
+        atomic_dst = atomic_old; \
+        OP(atomic_src, atomic_dst,z); \
+    } else { \
+        (void) tlb_read(tlb, addr, &atomic_old, z/8); \
+        atomic_dst = atomic_old; \
+        OP(atomic_src, atomic_dst,z); \
+        (void) tlb_write(tlb, addr, &atomic_dst, z/8); \
+        unlock(&atomic_split_lock); \
+    }
+
+// for everything else, retry until nobody changed the memory in between
+// carry is an input to adc and sbb, so it's restored before each try
+#define ATOMIC_CAS(OP,z) \
+    uint(z) atomic_dst; \
+    int atomic_cf = cpu->cf; \
+    ATOMIC_START(z); \
+    if (atomic_ptr != NULL) { \
+        atomic_old = __atomic_load_n(atomic_ptr, __ATOMIC_RELAXED); \
+        do { \
+            atomic_dst = atomic_old; \
+            cpu->cf = atomic_cf; \
+            OP(atomic_src, atomic_dst,z); \
+        } while (!__atomic_compare_exchange_n(atomic_ptr, &atomic_old, atomic_dst, \
+                    false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)); \
+    } else { \
+        (void) tlb_read(tlb, addr, &atomic_old, z/8); \
+        atomic_dst = atomic_old; \
+        OP(atomic_src, atomic_dst,z); \
+        (void) tlb_write(tlb, addr, &atomic_dst, z/8); \
+        unlock(&atomic_split_lock); \
+    }
+
+#define ATOMIC_ADD(src, dst,z) do { ATOMIC_LOCALS(src,z); ATOMIC_FETCH(ADD, fetch_add,z); } while (0)
+#define ATOMIC_OR(src, dst,z) do { ATOMIC_LOCALS(src,z); ATOMIC_FETCH(OR, fetch_or,z); } while (0)
+#define ATOMIC_AND(src, dst,z) do { ATOMIC_LOCALS(src,z); ATOMIC_FETCH(AND, fetch_and,z); } while (0)
+#define ATOMIC_SUB(src, dst,z) do { ATOMIC_LOCALS(src,z); ATOMIC_FETCH(SUB, fetch_sub,z); } while (0)
+#define ATOMIC_XOR(src, dst,z) do { ATOMIC_LOCALS(src,z); ATOMIC_FETCH(XOR, fetch_xor,z); } while (0)
+#define ATOMIC_ADC(src, dst,z) do { ATOMIC_LOCALS(src,z); ATOMIC_CAS(ADC,z); } while (0)
+#define ATOMIC_SBB(src, dst,z) do { ATOMIC_LOCALS(src,z); ATOMIC_CAS(SBB,z); } while (0)
+
+#define ATOMIC_INC(val,z) do { \
+    int tmp = cpu->cf; \
+    ATOMIC_LOCALS(1,z); ATOMIC_FETCH(ADD, fetch_add,z); \
+    cpu->cf = tmp; \
+} while (0)
+#define ATOMIC_DEC(val,z) do { \
+    int tmp = cpu->cf; \
+    ATOMIC_LOCALS(1,z); ATOMIC_FETCH(SUB, fetch_sub,z); \
+    cpu->cf = tmp; \
+} while (0)
+
+#define ATOMIC_XADD(src, dst,z) do { \
+    ATOMIC_LOCALS(src,z); \
+    ATOMIC_FETCH(ADD, fetch_add,z); \
+    set(src, atomic_old,z); \
+} while (0)
+
+#define ATOMIC_CMPXCHG(src, dst,z) do { \
+    ATOMIC_LOCALS(src,z); \
+    uint(z) atomic_expected = get(reg_a,z); \
+    uint(z) atomic_dst; \
+    ATOMIC_START(z); \
+    if (atomic_ptr != NULL) { \
+        atomic_old = atomic_expected; \
+        __atomic_compare_exchange_n(atomic_ptr, &atomic_old, atomic_src, \
+                false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); \
+    } else { \
+        (void) tlb_read(tlb, addr, &atomic_old, z/8); \
+        if (atomic_old == atomic_expected) \
+            (void) tlb_write(tlb, addr, &atomic_src, z/8); \
+        unlock(&atomic_split_lock); \
+    } \
+    atomic_dst = atomic_old; \
+    CMP(reg_a, atomic_dst,z); \
+    if (!E) \
+        set(reg_a, atomic_old,z); \
+} while (0)
+
+// xchg with memory is always locked, even without the prefix
+#define ATOMIC_XCHG(src, dst,z) do { \
+    if (!is_memory(dst)) { \
+        XCHG(src, dst,z); \
+        break; \
+    } \
+    ATOMIC_LOCALS(src,z); \
+    ATOMIC_START(z); \
+    if (atomic_ptr != NULL) { \
+        atomic_old = __atomic_exchange_n(atomic_ptr, atomic_src, __ATOMIC_SEQ_CST); \
+    } else { \
+        (void) tlb_read(tlb, addr, &atomic_old, z/8); \
+        (void) tlb_write(tlb, addr, &atomic_src, z/8); \
+        unlock(&atomic_split_lock); \
+    } \
+    set(src, atomic_old,z); \
+} while (0)
 #include "emu/interp/sse.h"
 #include "emu/interp/fpu.h"
 
@@ -595,23 +753,42 @@ static bool modrm_compute(struct cpu_state *cpu, struct tlb *tlb, addr_t *addr_o
 
 flatten __no_instrument void cpu_run(struct cpu_state *cpu) {
     int i = 0;
+    unsigned since_sample = 0;
     struct tlb tlb = {.mem = cpu->mem};
     tlb_flush(&tlb);
     read_wrlock(&cpu->mem->lock);
     int changes = cpu->mem->changes;
+    // the fpu control word is copied from the parent on clone, but the
+    // rounding mode and precision live in this thread
+    f80_rounding_mode = cpu->rc;
+    f80_precision = cpu->pc;
     while (true) {
         int interrupt = cpu_step32(cpu, &tlb);
         if (interrupt == INT_NONE && i++ >= 100000) {
             i = 0;
             interrupt = INT_TIMER;
         }
+        if (profile_period != 0 && ++since_sample >= profile_period) {
+            since_sample = 0;
+            profile_sample(cpu, &tlb);
+        }
+        if (interrupt == INT_NONE && atomic_load_explicit(&cpu->poked, memory_order_relaxed)) {
+            atomic_exchange(&cpu->poked, false);
+            interrupt = INT_TIMER;
+        }
+        if (interrupt == INT_SYSCALL && handle_interrupt_fast(interrupt, &tlb))
+            continue;
         if (interrupt != INT_NONE) {
             cpu->trapno = interrupt;
             read_wrunlock(&cpu->mem->lock);
             handle_interrupt(interrupt);
             read_wrlock(&cpu->mem->lock);
-            if (tlb.mem != cpu->mem)
+            if (tlb.mem != cpu->mem) {
+                // changes counts from zero again for the new mem
                 tlb.mem = cpu->mem;
+                tlb_flush(&tlb);
+                changes = cpu->mem->changes;
+            }
             if (cpu->mem->changes != changes) {
                 tlb_flush(&tlb);
                 changes = cpu->mem->changes;
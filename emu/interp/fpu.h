@@ -124,7 +124,9 @@
 #define FSTCW(dst) \
     set(dst, cpu->fcw,16)
 #define FLDCW(dst) \
-    cpu->fcw = get(dst,16)
+    cpu->fcw = get(dst,16); \
+    f80_rounding_mode = cpu->rc; \
+    f80_precision = cpu->pc
 
 // there's no native atan2 for 80-bit float yet.
 #define FPATAN() \
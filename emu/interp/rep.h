@@ -0,0 +1,162 @@
+// Bulk versions of the rep string instructions. Each of these handles as many
+// elements as it can with host memory functions, stopping at page boundaries.
+// If it can't make any progress (page not mapped, element straddling pages,
+// overlap that memmove would get wrong) it returns false without touching
+// anything, and the caller runs one element the normal way, which takes care
+// of faults. Registers are only updated after a span is done, so the state is
+// always exactly right for restarting the instruction.
+
+// number of elements starting at addr that are in the same page, going in the
+// direction of df
+static forceinline dword_t rep_span(addr_t addr, unsigned size, bool df) {
+    if (PGOFFSET(addr) > PAGE_SIZE - size)
+        return 0;
+    if (!df)
+        return (PAGE_SIZE - PGOFFSET(addr)) / size;
+    else
+        return PGOFFSET(addr) / size + 1;
+}
+
+static forceinline dword_t rep_min(dword_t a, dword_t b) {
+    return a < b ? a : b;
+}
+
+static forceinline void rep_advance(dword_t *reg, dword_t count, unsigned size, bool df) {
+    if (!df)
+        *reg += count * size;
+    else
+        *reg -= count * size;
+}
+
+static forceinline bool rep_bulk_movs(struct cpu_state *cpu, struct tlb *tlb, unsigned size) {
+    dword_t count = rep_min(cpu->ecx, rep_min(rep_span(cpu->esi, size, cpu->df), rep_span(cpu->edi, size, cpu->df)));
+    if (count == 0)
+        return false;
+    // destination first, if it's copy-on-write and the source is in the same
+    // page this makes the source pointer point to the new copy too
+    char *dst = __tlb_write_ptr(tlb, cpu->edi);
+    if (dst == NULL)
+        return false;
+    const char *src = __tlb_read_ptr(tlb, cpu->esi);
+    if (src == NULL)
+        return false;
+    size_t bytes = count * size;
+    if (cpu->df) {
+        dst -= bytes - size;
+        src -= bytes - size;
+    }
+    // copying forward onto a destination just after the source repeats the
+    // start of the source over and over, memmove doesn't do that (same for
+    // backward and just before)
+    if (!cpu->df ? dst > src && dst < src + bytes : dst < src && dst + bytes > src)
+        return false;
+    memmove(dst, src, bytes);
+    rep_advance(&cpu->esi, count, size, cpu->df);
+    rep_advance(&cpu->edi, count, size, cpu->df);
+    cpu->ecx -= count;
+    return true;
+}
+
+static forceinline bool rep_bulk_stos(struct cpu_state *cpu, struct tlb *tlb, unsigned size) {
+    dword_t count = rep_min(cpu->ecx, rep_span(cpu->edi, size, cpu->df));
+    if (count == 0)
+        return false;
+    char *dst = __tlb_write_ptr(tlb, cpu->edi);
+    if (dst == NULL)
+        return false;
+    if (cpu->df)
+        dst -= (count - 1) * size;
+    dword_t val = cpu->eax;
+    if (size == 1) {
+        memset(dst, (uint8_t) val, count);
+    } else {
+        for (dword_t i = 0; i < count; i++)
+            memcpy(dst + i * size, &val, size);
+    }
+    rep_advance(&cpu->edi, count, size, cpu->df);
+    cpu->ecx -= count;
+    return true;
+}
+
+static forceinline bool rep_bulk_lods(struct cpu_state *cpu, struct tlb *tlb, unsigned size) {
+    dword_t count = rep_min(cpu->ecx, rep_span(cpu->esi, size, cpu->df));
+    if (count == 0)
+        return false;
+    const char *src = __tlb_read_ptr(tlb, cpu->esi);
+    if (src == NULL)
+        return false;
+    // only the last one matters
+    if (!cpu->df)
+        src += (count - 1) * size;
+    else
+        src -= (count - 1) * size;
+    memcpy(&cpu->eax, src, size);
+    rep_advance(&cpu->esi, count, size, cpu->df);
+    cpu->ecx -= count;
+    return true;
+}
+
+// The conditional ones skip over elements that don't end the loop, and leave
+// the one that does, or the last one, for the caller so it sets the flags.
+
+static forceinline bool rep_bulk_scas(struct cpu_state *cpu, struct tlb *tlb, unsigned size, bool stop_if_equal) {
+    dword_t count = rep_min(cpu->ecx - 1, rep_span(cpu->edi, size, cpu->df));
+    if (count == 0)
+        return false;
+    const char *ptr = __tlb_read_ptr(tlb, cpu->edi);
+    if (ptr == NULL)
+        return false;
+    dword_t val = cpu->eax;
+    if (size < 4)
+        val &= (1u << (size * 8)) - 1;
+
+    dword_t skip;
+    if (size == 1 && !cpu->df && stop_if_equal) {
+        const char *found = memchr(ptr, val, count);
+        skip = found != NULL ? found - ptr : count;
+    } else {
+        ptrdiff_t step = cpu->df ? -(ptrdiff_t) size : size;
+        for (skip = 0; skip < count; skip++) {
+            dword_t elem = 0;
+            memcpy(&elem, ptr + skip * step, size);
+            if ((elem == val) == stop_if_equal)
+                break;
+        }
+    }
+    if (skip == 0)
+        return false;
+    rep_advance(&cpu->edi, skip, size, cpu->df);
+    cpu->ecx -= skip;
+    return true;
+}
+
+static forceinline bool rep_bulk_cmps(struct cpu_state *cpu, struct tlb *tlb, unsigned size, bool stop_if_equal) {
+    dword_t count = rep_min(cpu->ecx - 1, rep_min(rep_span(cpu->esi, size, cpu->df), rep_span(cpu->edi, size, cpu->df)));
+    if (count == 0)
+        return false;
+    const char *src = __tlb_read_ptr(tlb, cpu->esi);
+    if (src == NULL)
+        return false;
+    const char *dst = __tlb_read_ptr(tlb, cpu->edi);
+    if (dst == NULL)
+        return false;
+
+    dword_t skip;
+    size_t bytes = count * size;
+    if (!stop_if_equal && memcmp(cpu->df ? src - (bytes - size) : src,
+                cpu->df ? dst - (bytes - size) : dst, bytes) == 0) {
+        skip = count;
+    } else {
+        ptrdiff_t step = cpu->df ? -(ptrdiff_t) size : size;
+        for (skip = 0; skip < count; skip++) {
+            if ((memcmp(src + skip * step, dst + skip * step, size) == 0) == stop_if_equal)
+                break;
+        }
+    }
+    if (skip == 0)
+        return false;
+    rep_advance(&cpu->esi, skip, size, cpu->df);
+    rep_advance(&cpu->edi, skip, size, cpu->df);
+    cpu->ecx -= skip;
+    return true;
+}
@@ -1,54 +1,415 @@
-#define CMPEQ(src, dst) \
-    dst = dst == src ? (typeof(dst)) -1 : src
-#define PCMPEQD(src, dst) \
+#include <math.h>
+#include <string.h>
+
+// SSE and SSE2. union xmm_reg has gcc vector forms, so most of these are a
+// single vector operation and turn into the host's simd instructions. Things
+// like shuffles, where the control byte is only known at run time, are loops.
+
+#define VEC_OP(src, dst, op) \
     xmm_src = get(src,128); \
     xmm_dst = get(dst,128); \
-    CMPEQ(xmm_src.dw[0], xmm_dst.dw[0]); \
-    CMPEQ(xmm_src.dw[1], xmm_dst.dw[1]); \
-    CMPEQ(xmm_src.dw[2], xmm_dst.dw[2]); \
-    CMPEQ(xmm_src.dw[3], xmm_dst.dw[3]); \
+    { op; } \
     set(dst, xmm_dst,128)
 
-// SRL = shift right logical
-#define SRL(count, dst) \
-    dst >>= count
-#define PSRLQ(count, dst) \
+// scalar operands are 32 or 64 bits in memory but the whole register otherwise
+#define READ_SCALAR(src, z) \
+    if (is_memory(src)) \
+        xmm_src.qw[0] = mem_read(addr, z); \
+    else \
+        xmm_src = get(src,128)
+
+static forceinline int sse_clamp(int x, int min, int max) {
+    return x < min ? min : x > max ? max : x;
+}
+
+// moves
+
+#define MOVQ(src, dst) \
     xmm_dst = get(dst,128); \
-    SRL(get(count,), xmm_dst.qw[0]); \
-    SRL(get(count,), xmm_dst.qw[1]); \
+    xmm_dst.qw[0] = get(src,128).qw[0]; \
+    if (!is_memory(dst)) \
+        xmm_dst.qw[1] = 0; \
+    set(dst, xmm_dst,128)
+
+#define MOVD(src, dst) \
+    set(dst, get(src,128).dw[0],32)
+#define MOVD_XMM(src, dst) \
+    xmm_dst.qw[0] = get(src,32); \
+    xmm_dst.qw[1] = 0; \
     set(dst, xmm_dst,128)
 
-#define XORP(src, dst) \
+// movss and movsd, loading from memory clears the rest of the register, and
+// moving between registers leaves it alone
+#define MOVS_LOAD(src, dst, z) \
+    xmm_dst = get(dst,128); \
+    if (is_memory(src)) { \
+        xmm_dst.qw[0] = mem_read(addr, z); \
+        xmm_dst.qw[1] = 0; \
+    } else { \
+        xmm_src = get(src,128); \
+        memcpy(&xmm_dst, &xmm_src, z/8); \
+    } \
+    set(dst, xmm_dst,128)
+#define MOVS_STORE(src, dst, z) \
     xmm_src = get(src,128); \
+    if (is_memory(dst)) { \
+        mem_write(addr, (ty(z)) xmm_src.qw[0], z); \
+    } else { \
+        xmm_dst = get(dst,128); \
+        memcpy(&xmm_dst, &xmm_src, z/8); \
+        set(dst, xmm_dst,128); \
+    }
+
+// movlps/movhps from memory, movhlps/movlhps between registers
+#define MOVLP(src, dst) \
     xmm_dst = get(dst,128); \
-    xmm_dst.qw[0] ^= xmm_src.qw[0]; \
-    xmm_dst.qw[1] ^= xmm_src.qw[1]; \
+    xmm_dst.qw[0] = is_memory(src) ? mem_read(addr, 64) : get(src,128).qw[1]; \
     set(dst, xmm_dst,128)
+#define MOVHP(src, dst) \
+    xmm_dst = get(dst,128); \
+    xmm_dst.qw[1] = is_memory(src) ? mem_read(addr, 64) : get(src,128).qw[0]; \
+    set(dst, xmm_dst,128)
+#define MOVLP_STORE(src) \
+    mem_write(addr, get(src,128).qw[0], 64)
+#define MOVHP_STORE(src) \
+    mem_write(addr, get(src,128).qw[1], 64)
+
+static forceinline dword_t sse_movemask8(union xmm_reg x) {
+    // gathers the top bit of each byte into the top byte
+    uint64_t lo = ((x.qw[0] & 0x8080808080808080) * 0x0002040810204081) >> 56;
+    uint64_t hi = ((x.qw[1] & 0x8080808080808080) * 0x0002040810204081) >> 56;
+    return lo | hi << 8;
+}
+#define PMOVMSKB(src, dst) \
+    set(dst, sse_movemask8(get(src,128)),32)
+#define MOVMSKPS(src, dst) \
+    xmm_src = get(src,128); \
+    set(dst, (xmm_src.dw[0] >> 31) | (xmm_src.dw[1] >> 31) << 1 | \
+            (xmm_src.dw[2] >> 31) << 2 | (xmm_src.dw[3] >> 31) << 3,32)
+#define MOVMSKPD(src, dst) \
+    xmm_src = get(src,128); \
+    set(dst, (xmm_src.qw[0] >> 63) | (xmm_src.qw[1] >> 63) << 1,32)
+
+#define MFENCE __atomic_thread_fence(__ATOMIC_SEQ_CST)
+// mxcsr is only stored. The float ops always round to nearest and never
+// raise exceptions or set the exception flags, whatever it says.
+#define LDMXCSR(src) \
+    cpu->mxcsr = get(src,32)
+#define STMXCSR(dst) \
+    set(dst, cpu->mxcsr,32)
+
+// integer arithmetic
+
+#define PADD(src, dst, t) VEC_OP(src, dst, xmm_dst.t += xmm_src.t)
+#define PSUB(src, dst, t) VEC_OP(src, dst, xmm_dst.t -= xmm_src.t)
+// it overflowed if the result is less than what was added
+#define PADDUS(src, dst, t) VEC_OP(src, dst, \
+    xmm_dst.t += xmm_src.t; \
+    xmm_dst.t |= (typeof(xmm_dst.t)) (xmm_dst.t < xmm_src.t))
+#define PSUBUS(src, dst, t) VEC_OP(src, dst, \
+    xmm_dst.t = (xmm_dst.t - xmm_src.t) & (typeof(xmm_dst.t)) (xmm_dst.t >= xmm_src.t))
+#define PADDS(src, dst, t, n, min, max) VEC_OP(src, dst, \
+    for (int i = 0; i < n; i++) \
+        xmm_dst.t[i] = sse_clamp(xmm_dst.t[i] + xmm_src.t[i], min, max))
+#define PSUBS(src, dst, t, n, min, max) VEC_OP(src, dst, \
+    for (int i = 0; i < n; i++) \
+        xmm_dst.t[i] = sse_clamp(xmm_dst.t[i] - xmm_src.t[i], min, max))
 
-#define PADD(src, dst) \
+#define PMULLW(src, dst) VEC_OP(src, dst, xmm_dst.u16 *= xmm_src.u16)
+#define PMULHW(src, dst) VEC_OP(src, dst, \
+    for (int i = 0; i < 8; i++) \
+        xmm_dst.s16[i] = (xmm_dst.s16[i] * xmm_src.s16[i]) >> 16)
+#define PMULHUW(src, dst) VEC_OP(src, dst, \
+    for (int i = 0; i < 8; i++) \
+        xmm_dst.u16[i] = ((uint32_t) xmm_dst.u16[i] * xmm_src.u16[i]) >> 16)
+#define PMULUDQ(src, dst) VEC_OP(src, dst, \
+    xmm_dst.u64 = (xmm_dst.u64 & 0xffffffff) * (xmm_src.u64 & 0xffffffff))
+#define PMADDWD(src, dst) VEC_OP(src, dst, \
+    for (int i = 0; i < 4; i++) \
+        xmm_dst.u32[i] = (uint32_t) (xmm_dst.s16[2*i] * xmm_src.s16[2*i]) + \
+                (uint32_t) (xmm_dst.s16[2*i+1] * xmm_src.s16[2*i+1]))
+#define PSADBW(src, dst) VEC_OP(src, dst, \
+    for (int i = 0; i < 2; i++) { \
+        unsigned sum = 0; \
+        for (int j = 0; j < 8; j++) \
+            sum += abs(xmm_dst.b[i*8+j] - xmm_src.b[i*8+j]); \
+        xmm_dst.qw[i] = sum; \
+    })
+// rounds up, without needing a wider type
+#define PAVG(src, dst, t) VEC_OP(src, dst, \
+    xmm_dst.t = (xmm_dst.t | xmm_src.t) - ((xmm_dst.t ^ xmm_src.t) >> 1))
+
+#define VEC_SELECT(mask, a, b) \
+    (((a) & (typeof(a)) (mask)) | ((b) & ~(typeof(a)) (mask)))
+#define PMIN(src, dst, t) VEC_OP(src, dst, \
+    xmm_dst.t = VEC_SELECT(xmm_dst.t < xmm_src.t, xmm_dst.t, xmm_src.t))
+#define PMAX(src, dst, t) VEC_OP(src, dst, \
+    xmm_dst.t = VEC_SELECT(xmm_dst.t > xmm_src.t, xmm_dst.t, xmm_src.t))
+
+#define PCMPEQ(src, dst, t) VEC_OP(src, dst, \
+    xmm_dst.t = (typeof(xmm_dst.t)) (xmm_dst.t == xmm_src.t))
+#define PCMPGT(src, dst, t) VEC_OP(src, dst, \
+    xmm_dst.t = (typeof(xmm_dst.t)) (xmm_dst.t > xmm_src.t))
+
+#define PAND(src, dst) VEC_OP(src, dst, xmm_dst.u64 &= xmm_src.u64)
+#define PANDN(src, dst) VEC_OP(src, dst, xmm_dst.u64 = ~xmm_dst.u64 & xmm_src.u64)
+#define POR(src, dst) VEC_OP(src, dst, xmm_dst.u64 |= xmm_src.u64)
+#define PXOR(src, dst) VEC_OP(src, dst, xmm_dst.u64 ^= xmm_src.u64)
+
+// shifts, the count comes from an immediate or the low qword of an xmm
+// register, and anything bigger than the element size clears it (or fills it
+// with the sign bit)
+#define PSRL(count, dst, t, w) \
+    xmm_dst = get(dst,128); \
+    if ((count) >= w) \
+        xmm_dst.qw[0] = xmm_dst.qw[1] = 0; \
+    else \
+        xmm_dst.t >>= (int) (count); \
+    set(dst, xmm_dst,128)
+#define PSLL(count, dst, t, w) \
+    xmm_dst = get(dst,128); \
+    if ((count) >= w) \
+        xmm_dst.qw[0] = xmm_dst.qw[1] = 0; \
+    else \
+        xmm_dst.t <<= (int) (count); \
+    set(dst, xmm_dst,128)
+#define PSRA(count, dst, t, w) \
+    xmm_dst = get(dst,128); \
+    xmm_dst.t >>= (int) ((count) >= w ? w - 1 : (count)); \
+    set(dst, xmm_dst,128)
+#define PSHIFT_XMM(op, src, dst, t, w) \
     xmm_src = get(src,128); \
+    op(xmm_src.qw[0], dst, t, w)
+
+#define PSRLDQ(count, dst) \
+    xmm_dst = get(dst,128); \
+    xmm_src = xmm_dst; \
+    for (unsigned i = 0; i < 16; i++) \
+        xmm_dst.b[i] = i + (count) < 16 ? xmm_src.b[i + (count)] : 0; \
+    set(dst, xmm_dst,128)
+#define PSLLDQ(count, dst) \
     xmm_dst = get(dst,128); \
-    xmm_dst.qw[0] += xmm_src.qw[0]; \
-    xmm_dst.qw[1] += xmm_src.qw[1]; \
+    xmm_src = xmm_dst; \
+    for (unsigned i = 0; i < 16; i++) \
+        xmm_dst.b[i] = i >= (count) ? xmm_src.b[i - (count)] : 0; \
     set(dst, xmm_dst,128)
 
-#define PSUB(src, dst) \
+// the shift groups, 66 0f 71, 72 and 73
+#define PSHIFT_GRP(count, dst, w) \
+    switch (modrm.opcode) { \
+        case 2: TRACE("psrl"); PSRL(count, dst, glue(u, w), w); break; \
+        case 4: TRACE("psra"); if (w == 64) UNDEFINED; PSRA(count, dst, glue(s, w), w); break; \
+        case 6: TRACE("psll"); PSLL(count, dst, glue(u, w), w); break; \
+        case 3: TRACE("psrldq"); if (w != 64) UNDEFINED; PSRLDQ(count, dst); break; \
+        case 7: TRACE("pslldq"); if (w != 64) UNDEFINED; PSLLDQ(count, dst); break; \
+        default: TRACE("undefined"); UNDEFINED; \
+    }
+
+// shuffles and friends
+
+// interleave the low (or high) elements of dst and src, size is in bytes
+static forceinline void sse_unpack(union xmm_reg *dst, union xmm_reg src, unsigned size, bool high) {
+    union xmm_reg res;
+    unsigned half = high ? 8 : 0;
+    for (unsigned i = 0; i < 8; i += size) {
+        memcpy(&res.b[i * 2], &dst->b[half + i], size);
+        memcpy(&res.b[i * 2 + size], &src.b[half + i], size);
+    }
+    *dst = res;
+}
+#define PUNPCKL(src, dst, size) VEC_OP(src, dst, sse_unpack(&xmm_dst, xmm_src, size, false))
+#define PUNPCKH(src, dst, size) VEC_OP(src, dst, sse_unpack(&xmm_dst, xmm_src, size, true))
+
+// dst fills the low half of the result and src the high half
+#define PACKSSWB(src, dst) VEC_OP(src, dst, \
+    union xmm_reg res; \
+    for (int i = 0; i < 8; i++) { \
+        res.s8[i] = sse_clamp(xmm_dst.s16[i], INT8_MIN, INT8_MAX); \
+        res.s8[i+8] = sse_clamp(xmm_src.s16[i], INT8_MIN, INT8_MAX); \
+    } \
+    xmm_dst = res)
+#define PACKUSWB(src, dst) VEC_OP(src, dst, \
+    union xmm_reg res; \
+    for (int i = 0; i < 8; i++) { \
+        res.u8[i] = sse_clamp(xmm_dst.s16[i], 0, UINT8_MAX); \
+        res.u8[i+8] = sse_clamp(xmm_src.s16[i], 0, UINT8_MAX); \
+    } \
+    xmm_dst = res)
+#define PACKSSDW(src, dst) VEC_OP(src, dst, \
+    union xmm_reg res; \
+    for (int i = 0; i < 4; i++) { \
+        res.s16[i] = sse_clamp(xmm_dst.s32[i], INT16_MIN, INT16_MAX); \
+        res.s16[i+4] = sse_clamp(xmm_src.s32[i], INT16_MIN, INT16_MAX); \
+    } \
+    xmm_dst = res)
+
+#define PSHUFD(src, dst, imm) \
+    xmm_src = get(src,128); \
+    for (int i = 0; i < 4; i++) \
+        xmm_dst.dw[i] = xmm_src.dw[((imm) >> (i * 2)) & 3]; \
+    set(dst, xmm_dst,128)
+#define PSHUFLW(src, dst, imm) \
+    xmm_src = get(src,128); \
+    for (int i = 0; i < 4; i++) \
+        xmm_dst.w[i] = xmm_src.w[((imm) >> (i * 2)) & 3]; \
+    xmm_dst.qw[1] = xmm_src.qw[1]; \
+    set(dst, xmm_dst,128)
+#define PSHUFHW(src, dst, imm) \
     xmm_src = get(src,128); \
+    xmm_dst.qw[0] = xmm_src.qw[0]; \
+    for (int i = 0; i < 4; i++) \
+        xmm_dst.w[i + 4] = xmm_src.w[4 + (((imm) >> (i * 2)) & 3)]; \
+    set(dst, xmm_dst,128)
+// the low half of the result comes from dst, the high half from src
+#define SHUFPS(src, dst, imm) VEC_OP(src, dst, \
+    union xmm_reg res; \
+    res.dw[0] = xmm_dst.dw[(imm) & 3]; \
+    res.dw[1] = xmm_dst.dw[((imm) >> 2) & 3]; \
+    res.dw[2] = xmm_src.dw[((imm) >> 4) & 3]; \
+    res.dw[3] = xmm_src.dw[((imm) >> 6) & 3]; \
+    xmm_dst = res)
+#define SHUFPD(src, dst, imm) VEC_OP(src, dst, \
+    xmm_dst.qw[0] = xmm_dst.qw[(imm) & 1]; \
+    xmm_dst.qw[1] = xmm_src.qw[((imm) >> 1) & 1])
+
+#define PINSRW(src, dst, imm) \
     xmm_dst = get(dst,128); \
-    xmm_dst.qw[0] -= xmm_src.qw[0]; \
-    xmm_dst.qw[1] -= xmm_src.qw[1]; \
+    xmm_dst.w[(imm) & 7] = get(src,16); \
     set(dst, xmm_dst,128)
+#define PEXTRW(src, dst, imm) \
+    set(dst, get(src,128).w[(imm) & 7],32)
 
-#define MOVQ(src, dst) \
+// floating point
+
+#define ADDP(src, dst, t) VEC_OP(src, dst, xmm_dst.t += xmm_src.t)
+#define SUBP(src, dst, t) VEC_OP(src, dst, xmm_dst.t -= xmm_src.t)
+#define MULP(src, dst, t) VEC_OP(src, dst, xmm_dst.t *= xmm_src.t)
+#define DIVP(src, dst, t) VEC_OP(src, dst, xmm_dst.t /= xmm_src.t)
+
+// these return the second operand if either one is nan, which is exactly what
+// the comparison does
+#define sse_min(a, b) ((a) < (b) ? (a) : (b))
+#define sse_max(a, b) ((a) > (b) ? (a) : (b))
+#define MINP(src, dst, arr, n) VEC_OP(src, dst, \
+    for (int i = 0; i < n; i++) \
+        xmm_dst.arr[i] = sse_min(xmm_dst.arr[i], xmm_src.arr[i]))
+#define MAXP(src, dst, arr, n) VEC_OP(src, dst, \
+    for (int i = 0; i < n; i++) \
+        xmm_dst.arr[i] = sse_max(xmm_dst.arr[i], xmm_src.arr[i]))
+// the real ones are approximations, exact is allowed too
+#define sse_rcp(x) (1 / (x))
+#define sse_rsqrt(x) (1 / sqrtf(x))
+#define SQRTP(src, dst, arr, n, fn) VEC_OP(src, dst, \
+    for (int i = 0; i < n; i++) \
+        xmm_dst.arr[i] = fn(xmm_src.arr[i]))
+
+// scalar ones only touch the low element
+#define SCALAR_OP(src, dst, arr, z, op) \
+    READ_SCALAR(src, z); \
     xmm_dst = get(dst,128); \
-    xmm_dst.qw[0] = get(src,128).qw[0]; \
-    if (!is_memory(dst)) \
-        xmm_dst.qw[1] = 0; \
+    op(xmm_dst.arr[0], xmm_src.arr[0]); \
     set(dst, xmm_dst,128)
+#define sse_add(d, s) d += s
+#define sse_sub(d, s) d -= s
+#define sse_mul(d, s) d *= s
+#define sse_div(d, s) d /= s
+#define sse_mins(d, s) d = sse_min(d, s)
+#define sse_maxs(d, s) d = sse_max(d, s)
+#define sse_sqrtss(d, s) d = sqrtf(s)
+#define sse_sqrtsd(d, s) d = sqrt(s)
+#define sse_rcpss(d, s) d = sse_rcp(s)
+#define sse_rsqrtss(d, s) d = sse_rsqrt(s)
 
-#define MOVD(src, dst) \
-    set(dst, get(src,128).dw[0],32)
+// float promotes to double exactly, so this works for both
+static forceinline bool sse_compare(double a, double b, int predicate) {
+    switch (predicate & 7) {
+        case 0: return a == b;
+        case 1: return a < b;
+        case 2: return a <= b;
+        case 3: return isnan(a) || isnan(b);
+        case 4: return !(a == b);
+        case 5: return !(a < b);
+        case 6: return !(a <= b);
+        default: return !isnan(a) && !isnan(b);
+    }
+}
+#define CMPP(src, dst, arr, mask, n, imm) VEC_OP(src, dst, \
+    for (int i = 0; i < n; i++) \
+        xmm_dst.mask[i] = sse_compare(xmm_dst.arr[i], xmm_src.arr[i], imm) ? -1 : 0)
+#define CMPS(src, dst, arr, mask, z, imm) \
+    READ_SCALAR(src, z); \
+    xmm_dst = get(dst,128); \
+    xmm_dst.mask[0] = sse_compare(xmm_dst.arr[0], xmm_src.arr[0], imm) ? -1 : 0; \
+    set(dst, xmm_dst,128)
 
-#include "emu/float80.h"
-#define CVTTSD2SI(src, dst) \
-    set(dst, (int32_t) get(src,64),32)
+// comiss and friends, unordered sets zf, pf and cf
+#define COMIS(src, dst, arr, z) \
+    READ_SCALAR(src, z); \
+    xmm_dst = get(dst,128); \
+    cpu->zf_res = cpu->sf_res = cpu->pf_res = cpu->af_ops = 0; \
+    cpu->pf = sse_compare(xmm_dst.arr[0], xmm_src.arr[0], 3); \
+    cpu->zf = cpu->pf || xmm_dst.arr[0] == xmm_src.arr[0]; \
+    cpu->cf = cpu->pf || xmm_dst.arr[0] < xmm_src.arr[0]; \
+    cpu->sf = cpu->af = cpu->of = 0
+
+// conversions
+
+// out of range and nan give the "integer indefinite" value. Rounding uses the
+// host's mode, which is always round to nearest, the rounding control in
+// mxcsr isn't implemented.
+static forceinline int32_t sse_to_int(double d, bool truncate) {
+    d = truncate ? trunc(d) : nearbyint(d);
+    if (!(d >= INT32_MIN && d <= INT32_MAX))
+        return INT32_MIN;
+    return (int32_t) d;
+}
+
+#define CVTSI2S(src, dst, arr) \
+    xmm_dst = get(dst,128); \
+    xmm_dst.arr[0] = (int32_t) get(src,32); \
+    set(dst, xmm_dst,128)
+#define CVTS2SI(src, dst, arr, z, truncate) \
+    READ_SCALAR(src, z); \
+    set(dst, sse_to_int(xmm_src.arr[0], truncate),32)
+#define CVTSS2SD(src, dst) \
+    READ_SCALAR(src, 32); \
+    xmm_dst = get(dst,128); \
+    xmm_dst.d[0] = xmm_src.f[0]; \
+    set(dst, xmm_dst,128)
+#define CVTSD2SS(src, dst) \
+    READ_SCALAR(src, 64); \
+    xmm_dst = get(dst,128); \
+    xmm_dst.f[0] = xmm_src.d[0]; \
+    set(dst, xmm_dst,128)
+#define CVTPS2PD(src, dst) \
+    READ_SCALAR(src, 64); \
+    xmm_dst.d[0] = xmm_src.f[0]; \
+    xmm_dst.d[1] = xmm_src.f[1]; \
+    set(dst, xmm_dst,128)
+#define CVTPD2PS(src, dst) \
+    xmm_src = get(src,128); \
+    xmm_dst.f[0] = xmm_src.d[0]; \
+    xmm_dst.f[1] = xmm_src.d[1]; \
+    xmm_dst.qw[1] = 0; \
+    set(dst, xmm_dst,128)
+#define CVTDQ2PS(src, dst) \
+    xmm_src = get(src,128); \
+    for (int i = 0; i < 4; i++) \
+        xmm_dst.f[i] = (int32_t) xmm_src.dw[i]; \
+    set(dst, xmm_dst,128)
+#define CVTPS2DQ(src, dst, truncate) \
+    xmm_src = get(src,128); \
+    for (int i = 0; i < 4; i++) \
+        xmm_dst.dw[i] = sse_to_int(xmm_src.f[i], truncate); \
+    set(dst, xmm_dst,128)
+#define CVTDQ2PD(src, dst) \
+    READ_SCALAR(src, 64); \
+    xmm_dst.d[0] = (int32_t) xmm_src.dw[0]; \
+    xmm_dst.d[1] = (int32_t) xmm_src.dw[1]; \
+    set(dst, xmm_dst,128)
+#define CVTPD2DQ(src, dst, truncate) \
+    xmm_src = get(src,128); \
+    xmm_dst.dw[0] = sse_to_int(xmm_src.d[0], truncate); \
+    xmm_dst.dw[1] = sse_to_int(xmm_src.d[1], truncate); \
+    xmm_dst.qw[1] = 0; \
+    set(dst, xmm_dst,128)
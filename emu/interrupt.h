@@ -36,3 +36,7 @@
 #define INT_SYSCALL 0x80
 
 extern void handle_interrupt(int interrupt);
+// Called from cpu_run with the memory lock still held, returns true if the
+// interrupt was completely handled and the cpu can just keep going
+struct tlb;
+extern bool handle_interrupt_fast(int interrupt, struct tlb *tlb);
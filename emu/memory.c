@@ -138,6 +138,8 @@ int pt_map(struct mem *mem, page_t start, pages_t pages, void *memory, unsigned
     data->data = memory;
     data->size = pages * PAGE_SIZE;
     data->refcount = 0;
+    data->name = NULL;
+    data->file_offset = 0;
 
     for (page_t page = start; page < start + pages; page++) {
         if (mem_pt(mem, page) != NULL)
@@ -179,6 +181,14 @@ int pt_map_nothing(struct mem *mem, page_t start, pages_t pages, unsigned flags)
     return pt_map(mem, start, pages, memory, flags | P_ANON);
 }
 
+void pt_set_name(struct mem *mem, page_t start, const char *name, size_t file_offset) {
+    struct pt_entry *pt = mem_pt(mem, start);
+    if (pt == NULL)
+        return;
+    pt->data->name = name;
+    pt->data->file_offset = file_offset - pt->offset;
+}
+
 int pt_set_flags(struct mem *mem, page_t start, pages_t pages, int flags) {
     for (page_t page = start; page < start + pages; page++)
         if (mem_pt(mem, page) == NULL)
@@ -212,7 +222,6 @@ int pt_copy_on_write(struct mem *src, page_t src_start, struct mem *dst, page_t
                 return -1;
             // TODO skip shared mappings
             entry->flags |= P_COW;
-            entry->flags &= ~P_COMPILED;
             entry->data->refcount++;
             struct pt_entry *dst_entry = mem_pt_new(dst, dst_page);
             dst_entry->data = entry->data;
@@ -257,7 +266,10 @@ void *mem_ptr(struct mem *mem, addr_t addr, int type) {
             void *copy = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE,
                     MAP_PRIVATE | MAP_ANONYMOUS, 0, 0);
             memcpy(copy, data, PAGE_SIZE);
+            const char *name = entry->data->name;
+            size_t file_offset = entry->data->file_offset + entry->offset;
             pt_map(mem, page, 1, copy, entry->flags &~ P_COW);
+            pt_set_name(mem, page, name, file_offset);
         }
     }
 
@@ -80,6 +80,10 @@ struct data {
     void *data; // immutable
     size_t size; // also immutable
     atomic_uint refcount;
+    // the file this was mapped from and the offset of the start of data in
+    // it, only kept track of when profiling
+    const char *name;
+    size_t file_offset;
 };
 struct pt_entry {
     struct data *data;
@@ -96,7 +100,6 @@ struct pt_entry {
 #define P_GROWSDOWN (1 << 3)
 #define P_COW (1 << 4)
 #define P_WRITABLE(flags) (flags & P_WRITE && !(flags & P_COW))
-#define P_COMPILED (1 << 5)
 #define P_ANON (1 << 6)
 
 bool pt_is_hole(struct mem *mem, page_t start, pages_t pages);
@@ -113,6 +116,8 @@ int pt_map_file(struct mem *mem, page_t start, pages_t pages, int fd, off_t off,
 int pt_map_nothing(struct mem *mem, page_t page, pages_t pages, unsigned flags);
 // Unmap fake memory, return -1 if any part of the range isn't mapped and 0 otherwise
 int pt_unmap(struct mem *mem, page_t start, pages_t pages, int force);
+// Record which file a mapping starting at this page came from
+void pt_set_name(struct mem *mem, page_t start, const char *name, size_t file_offset);
 // Set the flags on memory
 int pt_set_flags(struct mem *mem, page_t start, pages_t pages, int flags);
 // Copy pages from src memory to dst memory using copy-on-write
@@ -0,0 +1,211 @@
+/*
+ * iSL (Subsystem for Linux) for iOS & Android
+ * Based on iSH (https://ish.app)
+ *
+ * Copyright (C) 2018 - 2019 Björn Rennfanz (bjoern@fam-rennfanz.de)
+ * Copyright (C) 2017 - 2019 Theodore Dubois (tblodt@icloud.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emu/profile.h"
+#include "emu/memory.h"
+#include "util/sync.h"
+#include "kernel/user-errno.h"
+
+unsigned profile_period;
+
+#define PROFILE_BUCKETS (1 << 16)
+static struct profile_entry table[PROFILE_BUCKETS];
+static unsigned table_used;
+static lock_t table_lock = LOCK_INITIALIZER;
+
+struct interned {
+    struct interned *next;
+    char name[];
+};
+static struct interned *interned;
+static lock_t interned_lock = LOCK_INITIALIZER;
+
+void profile_init() {
+    const char *period = getenv("ISL_PROFILE");
+    if (period != NULL)
+        profile_period = atoi(period);
+    const char *opcodes = getenv("ISL_OPCODES");
+    if (opcodes != NULL && opcodes[0] != '\0' && strcmp(opcodes, "0") != 0)
+        opcode_stats_enabled = true;
+}
+
+const char *profile_intern(const char *name) {
+    lock(&interned_lock);
+    struct interned *in;
+    for (in = interned; in != NULL; in = in->next) {
+        if (strcmp(in->name, name) == 0)
+            break;
+    }
+    if (in == NULL) {
+        in = malloc(sizeof(struct interned) + strlen(name) + 1);
+        if (in != NULL) {
+            strcpy(in->name, name);
+            in->next = interned;
+            interned = in;
+        }
+    }
+    unlock(&interned_lock);
+    return in != NULL ? in->name : NULL;
+}
+
+static unsigned hash(const char *name, dword_t offset, byte_t opcode) {
+    uintptr_t h = (uintptr_t) name * 31 + offset * 0x9e3779b1u + opcode;
+    return (h ^ (h >> 16)) % PROFILE_BUCKETS;
+}
+
+void profile_sample(struct cpu_state *cpu, struct tlb *tlb) {
+    dword_t eip = cpu->eip;
+    byte_t opcode = 0;
+    tlb_read(tlb, eip, &opcode, 1);
+    const char *name = NULL;
+    dword_t offset = eip;
+    // cpu_run holds the mem lock
+    struct pt_entry *pt = mem_pt(cpu->mem, PAGE(eip));
+    if (pt != NULL && pt->data->name != NULL) {
+        name = pt->data->name;
+        offset = pt->data->file_offset + pt->offset + PGOFFSET(eip);
+    }
+
+    lock(&table_lock);
+    // linear probing, and once it's 3/4 full new places are just dropped
+    for (unsigned i = hash(name, offset, opcode);; i = (i + 1) % PROFILE_BUCKETS) {
+        struct profile_entry *entry = &table[i];
+        if (entry->count == 0) {
+            if (table_used >= PROFILE_BUCKETS / 4 * 3)
+                break;
+            table_used++;
+            entry->name = name;
+            entry->offset = offset;
+            entry->opcode = opcode;
+        } else if (entry->name != name || entry->offset != offset || entry->opcode != opcode) {
+            continue;
+        }
+        entry->count++;
+        break;
+    }
+    unlock(&table_lock);
+}
+
+int profile_entries(struct profile_entry **entries_out) {
+    lock(&table_lock);
+    struct profile_entry *entries = malloc(sizeof(struct profile_entry) * (table_used + 1));
+    if (entries == NULL) {
+        unlock(&table_lock);
+        return -1;
+    }
+    int n = 0;
+    for (unsigned i = 0; i < PROFILE_BUCKETS; i++) {
+        if (table[i].count != 0)
+            entries[n++] = table[i];
+    }
+    unlock(&table_lock);
+    *entries_out = entries;
+    return n;
+}
+
+struct opcode_stats opcode_stats[OPCODE_SLOTS];
+bool opcode_stats_enabled;
+
+// Returns the slot for an instruction, or -1 if there aren't enough bytes to
+// tell yet
+static int opcode_slot(const byte_t *bytes, unsigned len) {
+    unsigned table = 1;
+    for (unsigned i = 0; i < len; i++) {
+        switch (bytes[i]) {
+            // f2 and f3 win over 66 when picking the sse variant
+            case 0x66: if (table == 1) table = 2; break;
+            case 0xf2: table = 3; break;
+            case 0xf3: table = 4; break;
+            case 0x26: case 0x2e: case 0x36: case 0x3e:
+            case 0x64: case 0x65: case 0x67: case 0xf0:
+                break;
+            case 0x0f:
+                if (i + 1 >= len)
+                    return -1;
+                return table * 256 + bytes[i + 1];
+            default:
+                return bytes[i];
+        }
+    }
+    return -1;
+}
+
+void opcode_count(struct tlb *tlb, addr_t ip) {
+    byte_t bytes[16];
+    for (unsigned len = 0; len < sizeof(bytes); len++) {
+        if (!tlb_read(tlb, ip + len, &bytes[len], 1))
+            return;
+        int slot = opcode_slot(bytes, len + 1);
+        if (slot >= 0) {
+            atomic_fetch_add_explicit(&opcode_stats[slot].count, 1, memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+void opcode_count_undefined(const byte_t *bytes, unsigned len) {
+    int slot = opcode_slot(bytes, len);
+    if (slot >= 0)
+        atomic_fetch_add(&opcode_stats[slot].undefined, 1);
+}
+
+// illegal instructions first, since those are what's missing
+static int compare_slots(const void *a, const void *b) {
+    struct opcode_stats *sa = &opcode_stats[*(const int *) a];
+    struct opcode_stats *sb = &opcode_stats[*(const int *) b];
+    unsigned long ua = atomic_load(&sa->undefined), ub = atomic_load(&sb->undefined);
+    if (ua != ub)
+        return ua < ub ? 1 : -1;
+    unsigned long ca = atomic_load(&sa->count), cb = atomic_load(&sb->count);
+    if (ca != cb)
+        return ca < cb ? 1 : -1;
+    return *(const int *) a - *(const int *) b;
+}
+
+ssize_t opcode_report(char *buf, size_t size, unsigned max_lines) {
+    static const char *prefixes[] = {"", "0f ", "66 0f ", "f2 0f ", "f3 0f "};
+    int *slots = malloc(sizeof(int) * OPCODE_SLOTS);
+    if (slots == NULL)
+        return _ENOMEM;
+    unsigned used = 0;
+    for (int i = 0; i < OPCODE_SLOTS; i++) {
+        if (atomic_load(&opcode_stats[i].count) != 0 || atomic_load(&opcode_stats[i].undefined) != 0)
+            slots[used++] = i;
+    }
+    qsort(slots, used, sizeof(int), compare_slots);
+
+    size_t n = 0;
+    n += sprintf(buf + n, "%-12s %14s %10s\n", "opcode", "executed", "illegal");
+    for (unsigned i = 0; i < used && i < max_lines; i++) {
+        if (n + 64 > size)
+            break;
+        int slot = slots[i];
+        char name[16];
+        sprintf(name, "%s%02x", prefixes[slot / 256], slot % 256);
+        n += sprintf(buf + n, "%-12s %14lu %10lu\n", name,
+                atomic_load(&opcode_stats[slot].count),
+                atomic_load(&opcode_stats[slot].undefined));
+    }
+    free(slots);
+    return n;
+}
@@ -0,0 +1,65 @@
+/*
+ * iSL (Subsystem for Linux) for iOS & Android
+ * Based on iSH (https://ish.app)
+ *
+ * Copyright (C) 2018 - 2019 Björn Rennfanz (bjoern@fam-rennfanz.de)
+ * Copyright (C) 2017 - 2019 Theodore Dubois (tblodt@icloud.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef EMU_PROFILE_H
+#define EMU_PROFILE_H
+
+#include "emu/cpu.h"
+#include "emu/tlb.h"
+
+// Sampling profiler. If profile_period isn't zero, every cpu_run loop
+// records where it is every profile_period blocks. Samples are counted by
+// file and offset in the file, or by address for code that didn't come from
+// a file.
+extern unsigned profile_period;
+
+struct profile_entry {
+    const char *name; // NULL if not from a file
+    dword_t offset; // file offset, or address if name is NULL
+    byte_t opcode;
+    unsigned long count;
+};
+
+// Opcode histogram, turned on by setting ISL_OPCODES. Slots are the one byte
+// opcodes, then the 0f two byte opcodes with no prefix, 66, f2 and f3. Illegal
+// instructions are always counted.
+#define OPCODE_SLOTS (256 * 5)
+struct opcode_stats {
+    atomic_ulong count;
+    atomic_ulong undefined;
+};
+extern struct opcode_stats opcode_stats[OPCODE_SLOTS];
+extern bool opcode_stats_enabled;
+
+// Reads ISL_PROFILE and ISL_OPCODES from the environment
+void profile_init(void);
+// Returns a copy of name that lives forever, the same one for equal names
+const char *profile_intern(const char *name);
+void profile_sample(struct cpu_state *cpu, struct tlb *tlb);
+// Copies out all the entries, caller frees. Returns the count or -1.
+int profile_entries(struct profile_entry **entries_out);
+
+// Counts the instruction at ip, called before it runs
+void opcode_count(struct tlb *tlb, addr_t ip);
+void opcode_count_undefined(const byte_t *bytes, unsigned len);
+// Writes the most used slots (at most max_lines) to buf, one per line
+ssize_t opcode_report(char *buf, size_t size, unsigned max_lines);
+
+#endif
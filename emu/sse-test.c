@@ -0,0 +1,569 @@
+// Differential tests for the SSE and SSE2 instructions. Each test is a few
+// bytes of machine code that get run once through cpu_step32 and once on the
+// host cpu, starting from the same xmm0, xmm1, eax and 16 bytes of memory at
+// ebx, and everything has to come out the same. The tests only use encodings
+// that mean the same thing in 32 and 64 bit mode, so the host has to be x86.
+//
+//     cc -I.. sse-test.c -L../emu -lemu -L../util -lutil -lm -lpthread
+//
+// rcpps/rsqrtps and friends are left out, the hardware's approximations
+// aren't something to match bit for bit. So is everything that depends on the
+// rounding control in mxcsr, which isn't implemented.
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "emu/cpu.h"
+#include "emu/interrupt.h"
+#include "emu/memory.h"
+#include "emu/tlb.h"
+
+#define CODE_ADDR 0x10000
+#define DATA_ADDR 0x20000
+
+// emu and util call out to these, but there's no kernel here
+void handle_interrupt(int interrupt) {}
+bool handle_interrupt_fast(int interrupt, struct tlb *tlb) {
+    return false;
+}
+int current_pid() {
+    return 0;
+}
+struct task;
+thread_local struct task *current;
+int errno_map() {
+    return -1;
+}
+void die(const char *msg, ...) {
+    va_list args;
+    va_start(args, msg);
+    vfprintf(stderr, msg, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+    abort();
+}
+
+static int tests_passed = 0;
+static int tests_total = 0;
+static int suite_passed = 0;
+static int suite_total = 0;
+
+#define suite_start() _suite_start(__FUNCTION__)
+#define suite_end() _suite_end(__FUNCTION__)
+void _suite_start(const char *suite) {
+    printf("==== %s ====\n", suite);
+    suite_passed = 0;
+    suite_total = 0;
+}
+void _suite_end(const char *suite) {
+    printf("%s: %d/%d passed (%.0f%%)\n", suite, suite_passed, suite_total, (double) suite_passed / suite_total * 100);
+}
+
+void assertf(int cond, const char *msg, ...) {
+    tests_total++;
+    suite_total++;
+    if (cond) {
+        tests_passed++;
+        suite_passed++;
+    }
+
+    printf(cond ? "PASS ": "FAIL ");
+    char buf[1024];
+    va_list args;
+    va_start(args, msg);
+    vsprintf(buf, msg, args);
+    va_end(args);
+    puts(buf);
+}
+
+#if defined(__x86_64__)
+
+// The host side code below hardcodes these offsets
+struct state {
+    union xmm_reg xmm[2];
+    byte_t data[16];
+    dword_t eax;
+    dword_t flags;
+} __attribute__((aligned(16)));
+_Static_assert(offsetof(struct state, data) == 0x20, "state layout");
+_Static_assert(offsetof(struct state, eax) == 0x30, "state layout");
+_Static_assert(offsetof(struct state, flags) == 0x34, "state layout");
+
+#define FLAGS_MASK ((1 << 0) | (1 << 2) | (1 << 4) | (1 << 6) | (1 << 7) | (1 << 11)) // cf pf af zf sf of
+
+struct test {
+    const char *name;
+    byte_t code[16];
+    unsigned len;
+    // only the flags that the instruction sets get compared
+    dword_t flags;
+};
+#define CODE(...) {__VA_ARGS__}, sizeof((byte_t[]) {__VA_ARGS__})
+// xmm0 is the destination and xmm1 the source, or [ebx] for the ones ending in 0x03
+#define T(name, ...) {name, CODE(__VA_ARGS__), 0}
+#define T_FLAGS(name, ...) {name, CODE(__VA_ARGS__), FLAGS_MASK}
+
+static void (*host_code)(struct state *state);
+static void run_host(struct test *test, struct state *state) {
+    static const byte_t prologue[] = {
+        0x53, // push rbx
+        0xf3, 0x0f, 0x6f, 0x07, // movdqu xmm0, [rdi]
+        0xf3, 0x0f, 0x6f, 0x4f, 0x10, // movdqu xmm1, [rdi+0x10]
+        0x48, 0x8d, 0x5f, 0x20, // lea rbx, [rdi+0x20]
+        0x8b, 0x47, 0x30, // mov eax, [rdi+0x30]
+    };
+    static const byte_t epilogue[] = {
+        0xf3, 0x0f, 0x7f, 0x07, // movdqu [rdi], xmm0
+        0xf3, 0x0f, 0x7f, 0x4f, 0x10, // movdqu [rdi+0x10], xmm1
+        0x89, 0x47, 0x30, // mov [rdi+0x30], eax
+        0x9c, 0x58, // pushf; pop rax
+        0x89, 0x47, 0x34, // mov [rdi+0x34], eax
+        0x5b, // pop rbx
+        0xc3, // ret
+    };
+    byte_t *code = (byte_t *) host_code;
+    memcpy(code, prologue, sizeof(prologue));
+    code += sizeof(prologue);
+    memcpy(code, test->code, test->len);
+    code += test->len;
+    memcpy(code, epilogue, sizeof(epilogue));
+    host_code(state);
+}
+
+static void guest_write(struct mem *mem, addr_t addr, const void *data, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        *(byte_t *) mem_ptr(mem, addr + i, MEM_WRITE) = ((const byte_t *) data)[i];
+}
+
+static int run_guest(struct test *test, struct state *state) {
+    struct mem *mem = mem_new();
+    if (mem == NULL ||
+            pt_map_nothing(mem, PAGE(CODE_ADDR), 1, P_READ | P_WRITE | P_EXEC) < 0 ||
+            pt_map_nothing(mem, PAGE(DATA_ADDR), 1, P_READ | P_WRITE) < 0) {
+        fprintf(stderr, "couldn't set up guest memory\n");
+        exit(1);
+    }
+    static const byte_t int_80[] = {0xcd, 0x80};
+    guest_write(mem, CODE_ADDR, test->code, test->len);
+    guest_write(mem, CODE_ADDR + test->len, int_80, sizeof(int_80));
+    guest_write(mem, DATA_ADDR, state->data, sizeof(state->data));
+
+    struct cpu_state cpu = {};
+    cpu.mem = mem;
+    cpu.eip = CODE_ADDR;
+    cpu.eax = state->eax;
+    cpu.ebx = DATA_ADDR;
+    cpu.xmm[0] = state->xmm[0];
+    cpu.xmm[1] = state->xmm[1];
+    cpu.mxcsr = 0x1f80;
+    struct tlb tlb = {.mem = mem};
+    tlb_flush(&tlb);
+
+    read_wrlock(&mem->lock);
+    int interrupt;
+    while ((interrupt = cpu_step32(&cpu, &tlb)) == INT_NONE)
+        ;
+    for (unsigned i = 0; i < sizeof(state->data); i++)
+        state->data[i] = *(byte_t *) mem_ptr(mem, DATA_ADDR + i, MEM_READ);
+    read_wrunlock(&mem->lock);
+    mem_release(mem);
+
+    collapse_flags(&cpu);
+    state->xmm[0] = cpu.xmm[0];
+    state->xmm[1] = cpu.xmm[1];
+    state->eax = cpu.eax;
+    state->flags = cpu.eflags;
+    return interrupt;
+}
+
+static bool states_eq(struct state *a, struct state *b, dword_t flags) {
+    return memcmp(a->xmm, b->xmm, sizeof(a->xmm)) == 0 &&
+        memcmp(a->data, b->data, sizeof(a->data)) == 0 &&
+        a->eax == b->eax && ((a->flags ^ b->flags) & flags) == 0;
+}
+
+static void print_state(const char *what, struct state *state) {
+    printf("  %-6s xmm0 %016llx%016llx xmm1 %016llx%016llx\n", what,
+            (unsigned long long) state->xmm[0].qw[1], (unsigned long long) state->xmm[0].qw[0],
+            (unsigned long long) state->xmm[1].qw[1], (unsigned long long) state->xmm[1].qw[0]);
+    printf("         data %016llx%016llx eax %08x flags %08x\n",
+            (unsigned long long) ((qword_t *) state->data)[1], (unsigned long long) ((qword_t *) state->data)[0],
+            state->eax, state->flags);
+}
+
+// Starting states. Random bits catch lane and operand order mistakes, and the
+// lists of interesting numbers catch the special cases of the float ops.
+#define NUM_RANDOM 16
+#define NUM_SMALL 4
+static const double doubles[] = {
+    0, -0., 1, -1.5, 2.5, 3.75, 0.5, -2.5, 1e300, -1e-310, 2147483647.5,
+    -2147483648.75, 4294967296., __builtin_inf(), -__builtin_inf(), __builtin_nan(""),
+};
+#define NUM_DOUBLES (sizeof(doubles) / sizeof(doubles[0]))
+static const float floats[] = {
+    0, -0.f, 1, -1.5f, 2.5f, 3.75f, 0.5f, -2.5f, 1e38f, -1e-40f, 2147483520.f,
+    -2147483648.f, 4294967296.f, __builtin_inff(), -__builtin_inff(), __builtin_nanf(""),
+};
+#define NUM_FLOATS (sizeof(floats) / sizeof(floats[0]))
+#define NUM_STATES (NUM_RANDOM + NUM_SMALL + NUM_DOUBLES + NUM_FLOATS)
+
+static qword_t random_state = 0x2545f4914f6cdd1d;
+static qword_t random_qword() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+static void make_state(unsigned n, struct state *state) {
+    for (int i = 0; i < 2; i++) {
+        state->xmm[i].qw[0] = random_qword();
+        state->xmm[i].qw[1] = random_qword();
+    }
+    ((qword_t *) state->data)[0] = random_qword();
+    ((qword_t *) state->data)[1] = random_qword();
+    state->eax = random_qword();
+    state->flags = 0;
+    if (n < NUM_RANDOM)
+        return;
+    n -= NUM_RANDOM;
+
+    if (n < NUM_SMALL) {
+        // shift counts and converted ints that are in range
+        state->xmm[1].qw[0] = n * 5;
+        ((qword_t *) state->data)[0] = n * 7;
+        state->eax = (sdword_t) (n * 12345 - 20000);
+        return;
+    }
+    n -= NUM_SMALL;
+
+    if (n < NUM_DOUBLES) {
+        for (int i = 0; i < 2; i++) {
+            state->xmm[0].d[i] = doubles[(n + i * 3) % NUM_DOUBLES];
+            state->xmm[1].d[i] = doubles[(n * 5 + i * 7 + 1) % NUM_DOUBLES];
+            ((double *) state->data)[i] = doubles[(n * 3 + i + 2) % NUM_DOUBLES];
+        }
+        return;
+    }
+    n -= NUM_DOUBLES;
+
+    for (int i = 0; i < 4; i++) {
+        state->xmm[0].f[i] = floats[(n + i * 3) % NUM_FLOATS];
+        state->xmm[1].f[i] = floats[(n * 5 + i * 7 + 1) % NUM_FLOATS];
+        ((float *) state->data)[i] = floats[(n * 3 + i + 2) % NUM_FLOATS];
+    }
+}
+
+static void run_tests(struct test *tests, unsigned count) {
+    for (unsigned i = 0; i < count; i++) {
+        struct test *test = &tests[i];
+        random_state = 0x2545f4914f6cdd1d;
+        int failed = 0;
+        for (unsigned n = 0; n < NUM_STATES; n++) {
+            struct state start, host, guest;
+            make_state(n, &start);
+            host = guest = start;
+            run_host(test, &host);
+            int interrupt = run_guest(test, &guest);
+            if (interrupt != INT_SYSCALL) {
+                printf("  interrupt %d\n", interrupt);
+                failed++;
+                break;
+            }
+            if (!states_eq(&host, &guest, test->flags)) {
+                if (failed++ == 0) {
+                    print_state("start", &start);
+                    print_state("host", &host);
+                    print_state("guest", &guest);
+                }
+            }
+        }
+        assertf(failed == 0, "%s (%d/%d states differ)", test->name, failed, NUM_STATES);
+    }
+}
+#define RUN_TESTS(tests) run_tests(tests, sizeof(tests) / sizeof(tests[0]))
+
+void test_integer() {
+    suite_start();
+    struct test tests[] = {
+        T("punpcklbw", 0x66, 0x0f, 0x60, 0xc1),
+        T("punpcklwd", 0x66, 0x0f, 0x61, 0xc1),
+        T("punpckldq", 0x66, 0x0f, 0x62, 0xc1),
+        T("packsswb", 0x66, 0x0f, 0x63, 0xc1),
+        T("pcmpgtb", 0x66, 0x0f, 0x64, 0xc1),
+        T("pcmpgtw", 0x66, 0x0f, 0x65, 0xc1),
+        T("pcmpgtd", 0x66, 0x0f, 0x66, 0xc1),
+        T("packuswb", 0x66, 0x0f, 0x67, 0xc1),
+        T("punpckhbw", 0x66, 0x0f, 0x68, 0xc1),
+        T("punpckhwd", 0x66, 0x0f, 0x69, 0xc1),
+        T("punpckhdq", 0x66, 0x0f, 0x6a, 0xc1),
+        T("packssdw", 0x66, 0x0f, 0x6b, 0xc1),
+        T("punpcklqdq", 0x66, 0x0f, 0x6c, 0xc1),
+        T("punpckhqdq", 0x66, 0x0f, 0x6d, 0xc1),
+        T("pcmpeqb", 0x66, 0x0f, 0x74, 0xc1),
+        T("pcmpeqw", 0x66, 0x0f, 0x75, 0xc1),
+        T("pcmpeqd", 0x66, 0x0f, 0x76, 0xc1),
+        T("pcmpeqb same", 0x66, 0x0f, 0x74, 0xc0),
+        T("paddq", 0x66, 0x0f, 0xd4, 0xc1),
+        T("pmullw", 0x66, 0x0f, 0xd5, 0xc1),
+        T("psubusb", 0x66, 0x0f, 0xd8, 0xc1),
+        T("psubusw", 0x66, 0x0f, 0xd9, 0xc1),
+        T("pminub", 0x66, 0x0f, 0xda, 0xc1),
+        T("pand", 0x66, 0x0f, 0xdb, 0xc1),
+        T("paddusb", 0x66, 0x0f, 0xdc, 0xc1),
+        T("paddusw", 0x66, 0x0f, 0xdd, 0xc1),
+        T("pmaxub", 0x66, 0x0f, 0xde, 0xc1),
+        T("pandn", 0x66, 0x0f, 0xdf, 0xc1),
+        T("pavgb", 0x66, 0x0f, 0xe0, 0xc1),
+        T("pavgw", 0x66, 0x0f, 0xe3, 0xc1),
+        T("pmulhuw", 0x66, 0x0f, 0xe4, 0xc1),
+        T("pmulhw", 0x66, 0x0f, 0xe5, 0xc1),
+        T("psubsb", 0x66, 0x0f, 0xe8, 0xc1),
+        T("psubsw", 0x66, 0x0f, 0xe9, 0xc1),
+        T("pminsw", 0x66, 0x0f, 0xea, 0xc1),
+        T("por", 0x66, 0x0f, 0xeb, 0xc1),
+        T("paddsb", 0x66, 0x0f, 0xec, 0xc1),
+        T("paddsw", 0x66, 0x0f, 0xed, 0xc1),
+        T("pmaxsw", 0x66, 0x0f, 0xee, 0xc1),
+        T("pxor", 0x66, 0x0f, 0xef, 0xc1),
+        T("pmuludq", 0x66, 0x0f, 0xf4, 0xc1),
+        T("pmaddwd", 0x66, 0x0f, 0xf5, 0xc1),
+        T("psadbw", 0x66, 0x0f, 0xf6, 0xc1),
+        T("psubb", 0x66, 0x0f, 0xf8, 0xc1),
+        T("psubw", 0x66, 0x0f, 0xf9, 0xc1),
+        T("psubd", 0x66, 0x0f, 0xfa, 0xc1),
+        T("psubq", 0x66, 0x0f, 0xfb, 0xc1),
+        T("paddb", 0x66, 0x0f, 0xfc, 0xc1),
+        T("paddw", 0x66, 0x0f, 0xfd, 0xc1),
+        T("paddd", 0x66, 0x0f, 0xfe, 0xc1),
+        T("paddb mem", 0x66, 0x0f, 0xfc, 0x03),
+        T("pcmpgtw mem", 0x66, 0x0f, 0x65, 0x03),
+        T("pmovmskb", 0x66, 0x0f, 0xd7, 0xc1),
+    };
+    RUN_TESTS(tests);
+    suite_end();
+}
+
+void test_shift() {
+    suite_start();
+    struct test tests[] = {
+        T("psrlw", 0x66, 0x0f, 0xd1, 0xc1),
+        T("psrld", 0x66, 0x0f, 0xd2, 0xc1),
+        T("psrlq", 0x66, 0x0f, 0xd3, 0xc1),
+        T("psraw", 0x66, 0x0f, 0xe1, 0xc1),
+        T("psrad", 0x66, 0x0f, 0xe2, 0xc1),
+        T("psllw", 0x66, 0x0f, 0xf1, 0xc1),
+        T("pslld", 0x66, 0x0f, 0xf2, 0xc1),
+        T("psllq", 0x66, 0x0f, 0xf3, 0xc1),
+        T("psrlw imm", 0x66, 0x0f, 0x71, 0xd0, 3),
+        T("psrlw imm big", 0x66, 0x0f, 0x71, 0xd0, 17),
+        T("psraw imm", 0x66, 0x0f, 0x71, 0xe0, 5),
+        T("psraw imm big", 0x66, 0x0f, 0x71, 0xe0, 40),
+        T("psllw imm", 0x66, 0x0f, 0x71, 0xf0, 9),
+        T("psrld imm", 0x66, 0x0f, 0x72, 0xd0, 31),
+        T("psrad imm", 0x66, 0x0f, 0x72, 0xe0, 7),
+        T("pslld imm", 0x66, 0x0f, 0x72, 0xf0, 32),
+        T("psrlq imm", 0x66, 0x0f, 0x73, 0xd0, 33),
+        T("psrldq", 0x66, 0x0f, 0x73, 0xd8, 3),
+        T("psrldq big", 0x66, 0x0f, 0x73, 0xd8, 20),
+        T("psllq imm", 0x66, 0x0f, 0x73, 0xf0, 1),
+        T("pslldq", 0x66, 0x0f, 0x73, 0xf8, 9),
+    };
+    RUN_TESTS(tests);
+    suite_end();
+}
+
+void test_shuffle() {
+    suite_start();
+    struct test tests[] = {
+        T("pshufd", 0x66, 0x0f, 0x70, 0xc1, 0x1b),
+        T("pshufd mem", 0x66, 0x0f, 0x70, 0x03, 0xd8),
+        T("pshuflw", 0xf2, 0x0f, 0x70, 0xc1, 0x4e),
+        T("pshufhw", 0xf3, 0x0f, 0x70, 0xc1, 0x93),
+        T("pinsrw", 0x66, 0x0f, 0xc4, 0xc0, 5),
+        T("pinsrw mem", 0x66, 0x0f, 0xc4, 0x03, 2),
+        T("pextrw", 0x66, 0x0f, 0xc5, 0xc1, 3),
+        T("shufps", 0x0f, 0xc6, 0xc1, 0x1b),
+        T("shufps same", 0x0f, 0xc6, 0xc0, 0x72),
+        T("shufpd", 0x66, 0x0f, 0xc6, 0xc1, 1),
+        T("shufpd 2", 0x66, 0x0f, 0xc6, 0xc1, 2),
+        T("unpcklps", 0x0f, 0x14, 0xc1),
+        T("unpckhps", 0x0f, 0x15, 0xc1),
+        T("unpcklpd", 0x66, 0x0f, 0x14, 0xc1),
+        T("unpckhpd", 0x66, 0x0f, 0x15, 0xc1),
+        T("movmskps", 0x0f, 0x50, 0xc1),
+        T("movmskpd", 0x66, 0x0f, 0x50, 0xc1),
+    };
+    RUN_TESTS(tests);
+    suite_end();
+}
+
+void test_move() {
+    suite_start();
+    struct test tests[] = {
+        T("movd to xmm", 0x66, 0x0f, 0x6e, 0xc0),
+        T("movd from xmm", 0x66, 0x0f, 0x7e, 0xc0),
+        T("movd mem", 0x66, 0x0f, 0x6e, 0x03),
+        T("movq", 0xf3, 0x0f, 0x7e, 0xc1),
+        T("movq mem", 0xf3, 0x0f, 0x7e, 0x03),
+        T("movq store", 0x66, 0x0f, 0xd6, 0x03),
+        T("movdqa", 0x66, 0x0f, 0x6f, 0xc1),
+        T("movdqa load", 0x66, 0x0f, 0x6f, 0x03),
+        T("movdqa store", 0x66, 0x0f, 0x7f, 0x03),
+        T("movdqu load", 0xf3, 0x0f, 0x6f, 0x03),
+        T("movdqu store", 0xf3, 0x0f, 0x7f, 0x03),
+        T("movntdq", 0x66, 0x0f, 0xe7, 0x03),
+        T("movnti", 0x0f, 0xc3, 0x03),
+        T("movups", 0x0f, 0x10, 0xc1),
+        T("movups load", 0x0f, 0x10, 0x03),
+        T("movups store", 0x0f, 0x11, 0x03),
+        T("movaps", 0x0f, 0x28, 0xc1),
+        T("movaps store", 0x0f, 0x29, 0x03),
+        T("movapd", 0x66, 0x0f, 0x28, 0xc1),
+        T("movntps", 0x0f, 0x2b, 0x03),
+        T("movlps load", 0x0f, 0x12, 0x03),
+        T("movhlps", 0x0f, 0x12, 0xc1),
+        T("movlps store", 0x0f, 0x13, 0x03),
+        T("movhps load", 0x0f, 0x16, 0x03),
+        T("movlhps", 0x0f, 0x16, 0xc1),
+        T("movhps store", 0x0f, 0x17, 0x03),
+        T("movlpd load", 0x66, 0x0f, 0x12, 0x03),
+        T("movhpd load", 0x66, 0x0f, 0x16, 0x03),
+        T("movss", 0xf3, 0x0f, 0x10, 0xc1),
+        T("movss load", 0xf3, 0x0f, 0x10, 0x03),
+        T("movss store", 0xf3, 0x0f, 0x11, 0x03),
+        T("movsd", 0xf2, 0x0f, 0x10, 0xc1),
+        T("movsd load", 0xf2, 0x0f, 0x10, 0x03),
+        T("movsd store", 0xf2, 0x0f, 0x11, 0x03),
+        T("fences", 0x0f, 0xae, 0xf0, 0x0f, 0xae, 0xe8, 0x0f, 0xae, 0xf8),
+    };
+    RUN_TESTS(tests);
+    suite_end();
+}
+
+void test_float() {
+    suite_start();
+    struct test tests[] = {
+        T("sqrtps", 0x0f, 0x51, 0xc1),
+        T("andps", 0x0f, 0x54, 0xc1),
+        T("andnps", 0x0f, 0x55, 0xc1),
+        T("orps", 0x0f, 0x56, 0xc1),
+        T("xorps", 0x0f, 0x57, 0xc1),
+        T("addps", 0x0f, 0x58, 0xc1),
+        T("mulps", 0x0f, 0x59, 0xc1),
+        T("subps", 0x0f, 0x5c, 0xc1),
+        T("minps", 0x0f, 0x5d, 0xc1),
+        T("divps", 0x0f, 0x5e, 0xc1),
+        T("maxps", 0x0f, 0x5f, 0xc1),
+        T("addps mem", 0x0f, 0x58, 0x03),
+        T("sqrtpd", 0x66, 0x0f, 0x51, 0xc1),
+        T("andpd", 0x66, 0x0f, 0x54, 0xc1),
+        T("xorpd", 0x66, 0x0f, 0x57, 0xc1),
+        T("addpd", 0x66, 0x0f, 0x58, 0xc1),
+        T("mulpd", 0x66, 0x0f, 0x59, 0xc1),
+        T("subpd", 0x66, 0x0f, 0x5c, 0xc1),
+        T("minpd", 0x66, 0x0f, 0x5d, 0xc1),
+        T("divpd", 0x66, 0x0f, 0x5e, 0xc1),
+        T("maxpd", 0x66, 0x0f, 0x5f, 0xc1),
+        T("sqrtss", 0xf3, 0x0f, 0x51, 0xc1),
+        T("addss", 0xf3, 0x0f, 0x58, 0xc1),
+        T("mulss", 0xf3, 0x0f, 0x59, 0xc1),
+        T("subss", 0xf3, 0x0f, 0x5c, 0xc1),
+        T("minss", 0xf3, 0x0f, 0x5d, 0xc1),
+        T("divss", 0xf3, 0x0f, 0x5e, 0xc1),
+        T("maxss", 0xf3, 0x0f, 0x5f, 0xc1),
+        T("addss mem", 0xf3, 0x0f, 0x58, 0x03),
+        T("sqrtsd", 0xf2, 0x0f, 0x51, 0xc1),
+        T("addsd", 0xf2, 0x0f, 0x58, 0xc1),
+        T("mulsd", 0xf2, 0x0f, 0x59, 0xc1),
+        T("subsd", 0xf2, 0x0f, 0x5c, 0xc1),
+        T("minsd", 0xf2, 0x0f, 0x5d, 0xc1),
+        T("divsd", 0xf2, 0x0f, 0x5e, 0xc1),
+        T("maxsd", 0xf2, 0x0f, 0x5f, 0xc1),
+        T("divsd mem", 0xf2, 0x0f, 0x5e, 0x03),
+    };
+    RUN_TESTS(tests);
+    suite_end();
+}
+
+void test_compare() {
+    suite_start();
+    struct test tests[] = {
+        T("cmpeqps", 0x0f, 0xc2, 0xc1, 0),
+        T("cmpltps", 0x0f, 0xc2, 0xc1, 1),
+        T("cmpleps", 0x0f, 0xc2, 0xc1, 2),
+        T("cmpunordps", 0x0f, 0xc2, 0xc1, 3),
+        T("cmpneqps", 0x0f, 0xc2, 0xc1, 4),
+        T("cmpnltps", 0x0f, 0xc2, 0xc1, 5),
+        T("cmpnleps", 0x0f, 0xc2, 0xc1, 6),
+        T("cmpordps", 0x0f, 0xc2, 0xc1, 7),
+        T("cmpeqpd", 0x66, 0x0f, 0xc2, 0xc1, 0),
+        T("cmpltpd", 0x66, 0x0f, 0xc2, 0xc1, 1),
+        T("cmpunordpd", 0x66, 0x0f, 0xc2, 0xc1, 3),
+        T("cmpnlepd", 0x66, 0x0f, 0xc2, 0xc1, 6),
+        T("cmpless", 0xf3, 0x0f, 0xc2, 0xc1, 2),
+        T("cmpneqss", 0xf3, 0x0f, 0xc2, 0xc1, 4),
+        T("cmpltsd", 0xf2, 0x0f, 0xc2, 0xc1, 1),
+        T("cmpordsd", 0xf2, 0x0f, 0xc2, 0xc1, 7),
+        T_FLAGS("ucomiss", 0x0f, 0x2e, 0xc1),
+        T_FLAGS("comiss", 0x0f, 0x2f, 0xc1),
+        T_FLAGS("ucomisd", 0x66, 0x0f, 0x2e, 0xc1),
+        T_FLAGS("comisd", 0x66, 0x0f, 0x2f, 0xc1),
+        T_FLAGS("ucomisd mem", 0x66, 0x0f, 0x2e, 0x03),
+    };
+    RUN_TESTS(tests);
+    suite_end();
+}
+
+void test_convert() {
+    suite_start();
+    struct test tests[] = {
+        T("cvtsi2sd", 0xf2, 0x0f, 0x2a, 0xc0),
+        T("cvtsi2ss", 0xf3, 0x0f, 0x2a, 0xc0),
+        T("cvtsi2sd mem", 0xf2, 0x0f, 0x2a, 0x03),
+        T("cvttsd2si", 0xf2, 0x0f, 0x2c, 0xc1),
+        T("cvtsd2si", 0xf2, 0x0f, 0x2d, 0xc1),
+        T("cvttss2si", 0xf3, 0x0f, 0x2c, 0xc1),
+        T("cvtss2si", 0xf3, 0x0f, 0x2d, 0xc1),
+        T("cvtsd2ss", 0xf2, 0x0f, 0x5a, 0xc1),
+        T("cvtss2sd", 0xf3, 0x0f, 0x5a, 0xc1),
+        T("cvtps2pd", 0x0f, 0x5a, 0xc1),
+        T("cvtpd2ps", 0x66, 0x0f, 0x5a, 0xc1),
+        T("cvtdq2ps", 0x0f, 0x5b, 0xc1),
+        T("cvtps2dq", 0x66, 0x0f, 0x5b, 0xc1),
+        T("cvttps2dq", 0xf3, 0x0f, 0x5b, 0xc1),
+        T("cvttpd2dq", 0x66, 0x0f, 0xe6, 0xc1),
+        T("cvtpd2dq", 0xf2, 0x0f, 0xe6, 0xc1),
+        T("cvtdq2pd", 0xf3, 0x0f, 0xe6, 0xc1),
+    };
+    RUN_TESTS(tests);
+    suite_end();
+}
+
+int main() {
+    host_code = mmap(NULL, 4096, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (host_code == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    test_integer();
+    test_shift();
+    test_shuffle();
+    test_move();
+    test_float();
+    test_compare();
+    test_convert();
+    printf("%d/%d passed (%.0f%%)", tests_passed, tests_total, (double) tests_passed / tests_total * 100);
+    return tests_passed == tests_total ? 0 : 1;
+}
+
+#else
+
+int main() {
+    printf("the sse tests compare against the host cpu, so they only run on x86_64\n");
+    return 0;
+}
+
+#endif
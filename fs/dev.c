@@ -13,6 +13,7 @@ struct dev_ops *char_devs[] = {
     [1] = &mem_dev,
     [4] = &tty_dev,
     [5] = &tty_dev,
+    [TTY_PSEUDO_SLAVE_MAJOR] = &tty_dev,
 };
 
 int dev_open(int major, int minor, int type, struct fd *fd) {
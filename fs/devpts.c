@@ -0,0 +1,128 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "kernel/calls.h"
+#include "kernel/fs.h"
+#include "fs/dev.h"
+#include "fs/tty.h"
+
+// /dev/pts, a directory of the slave sides of the ptys that exist right now.
+// Opening /dev/ptmx makes a new one show up here.
+
+#define DEVPTS_ROOT -1
+
+// -1 for the root, the pty number otherwise, or an error
+static int devpts_parse(const char *path) {
+    if (path[0] == '\0')
+        return DEVPTS_ROOT;
+    if (path[0] != '/' || path[1] == '\0')
+        return _ENOENT;
+    int num = 0;
+    for (const char *c = path + 1; *c != '\0'; c++) {
+        if (*c < '0' || *c > '9' || num >= MAX_PTYS)
+            return _ENOENT;
+        num = num * 10 + (*c - '0');
+    }
+    return num;
+}
+
+static int devpts_stat_num(int num, struct statbuf *stat) {
+    *stat = (struct statbuf) {};
+    if (num == DEVPTS_ROOT) {
+        stat->mode = S_IFDIR | 0755;
+        stat->inode = 1;
+        stat->nlink = 2;
+        return 0;
+    }
+    uid_t_ uid, gid;
+    if (!pty_exists(num, &uid, &gid))
+        return _ENOENT;
+    stat->mode = S_IFCHR | 0620;
+    stat->inode = num + 3;
+    stat->nlink = 1;
+    stat->uid = uid;
+    stat->gid = gid;
+    stat->rdev = dev_make(TTY_PSEUDO_SLAVE_MAJOR, num);
+    return 0;
+}
+
+static const struct fd_ops devpts_fdops;
+
+static struct fd *devpts_open(struct mount *mount, const char *path, int flags, int mode) {
+    int num = devpts_parse(path);
+    if (num < DEVPTS_ROOT)
+        return ERR_PTR(num);
+    struct statbuf stat;
+    int err = devpts_stat_num(num, &stat);
+    if (err < 0)
+        return ERR_PTR(err);
+    struct fd *fd = fd_create();
+    if (fd == NULL)
+        return ERR_PTR(_ENOMEM);
+    // a pty gets opened as a device after this, and gets the tty fd ops
+    fd->ops = &devpts_fdops;
+    fd->stat = stat;
+    return fd;
+}
+
+static int devpts_stat(struct mount *mount, const char *path, struct statbuf *stat, bool follow_links) {
+    int num = devpts_parse(path);
+    if (num < DEVPTS_ROOT)
+        return num;
+    return devpts_stat_num(num, stat);
+}
+
+static int devpts_fstat(struct fd *fd, struct statbuf *stat) {
+    *stat = fd->stat;
+    return 0;
+}
+
+static int devpts_getpath(struct fd *fd, char *buf) {
+    if (S_ISDIR(fd->stat.mode))
+        buf[0] = '\0';
+    else
+        sprintf(buf, "/%d", dev_minor(fd->stat.rdev));
+    return 0;
+}
+
+static ssize_t devpts_readlink(struct mount *mount, const char *path, char *buf, size_t bufsize) {
+    return _EINVAL;
+}
+
+// fd->offset is the next pty number to look at
+static int devpts_readdir(struct fd *fd, struct dir_entry *entry) {
+    uid_t_ uid, gid;
+    while (fd->offset < MAX_PTYS) {
+        int num = fd->offset++;
+        if (pty_exists(num, &uid, &gid)) {
+            sprintf(entry->name, "%d", num);
+            entry->inode = num + 3;
+            entry->type = DT_CHR_;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static long devpts_telldir(struct fd *fd) {
+    return fd->offset;
+}
+static int devpts_seekdir(struct fd *fd, long ptr) {
+    fd->offset = ptr;
+    return 0;
+}
+
+static const struct fd_ops devpts_fdops = {
+    .readdir = devpts_readdir,
+    .telldir = devpts_telldir,
+    .seekdir = devpts_seekdir,
+};
+
+const struct fs_ops devpts = {
+    .name = "devpts", .magic = 0x1cd1,
+    .open = devpts_open,
+    .stat = devpts_stat,
+    .fstat = devpts_fstat,
+    .getpath = devpts_getpath,
+    .readlink = devpts_readlink,
+};
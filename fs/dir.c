@@ -13,6 +13,9 @@ struct linux_dirent64 {
     char name[];
 } __attribute__((packed));
 
+// no point in a buffer bigger than this, the guest just calls again
+#define GETDENTS_MAX (1 << 20)
+
 int_t sys_getdents64(fd_t f, addr_t dirents, dword_t count) {
     STRACE("getdents64(%d, %#x, %#x)", f, dirents, count);
     struct fd *fd = f_get(f);
@@ -21,7 +24,13 @@ int_t sys_getdents64(fd_t f, addr_t dirents, dword_t count) {
     if (fd->ops->readdir == NULL)
         return _ENOTDIR;
 
-    dword_t orig_count = count;
+    // The entries are put together on the host and copied out in one go
+    if (count > GETDENTS_MAX)
+        count = GETDENTS_MAX;
+    char *buf = malloc(count);
+    if (buf == NULL)
+        return _ENOMEM;
+    dword_t used = 0;
 
     long ptr;
     int err;
@@ -29,35 +38,42 @@ int_t sys_getdents64(fd_t f, addr_t dirents, dword_t count) {
     while (true) {
         ptr = fd->ops->telldir(fd);
         struct dir_entry entry;
+        entry.type = DT_UNKNOWN_;
         err = fd->ops->readdir(fd, &entry);
-        if (err < 0)
-            return err;
-        if (err == 0)
+        if (err <= 0)
             break;
 
-        dword_t reclen = offsetof(struct linux_dirent64, name) +
-            strlen(entry.name) + 4; // name, null terminator, padding, file type
-        char dirent_data[reclen];
-        struct linux_dirent64 *dirent = (struct linux_dirent64 *) dirent_data;
+        size_t name_len = strlen(entry.name);
+        // name and null terminator, padded to 8 bytes like linux does
+        dword_t reclen = (offsetof(struct linux_dirent64, name) + name_len + 1 + 7) & ~7;
+        if (reclen > count - used) {
+            if (used == 0)
+                err = _EINVAL; // not even one entry fits
+            break;
+        }
+        struct linux_dirent64 *dirent = (struct linux_dirent64 *) (buf + used);
         dirent->inode = entry.inode;
         dirent->offset = fd->ops->telldir(fd);
         dirent->reclen = reclen;
-        dirent->type = 0;
-        strcpy(dirent->name, entry.name);
+        dirent->type = entry.type;
+        memcpy(dirent->name, entry.name, name_len + 1);
+        memset(dirent->name + name_len + 1, 0, reclen - offsetof(struct linux_dirent64, name) - name_len - 1);
         if (printed < 20) {
             STRACE(" {inode=%d, offset=%d, name=%s, type=%d, reclen=%d}",
                     dirent->inode, dirent->offset, dirent->name, dirent->type, dirent->reclen);
             printed++;
         }
-
-        if (reclen > count)
-            break;
-        if (user_put(dirents, dirent_data))
-            return _EFAULT;
-        dirents += reclen;
-        count -= reclen;
+        used += reclen;
     }
 
+    // the entry that ended the loop gets read again next time
     fd->ops->seekdir(fd, ptr);
-    return orig_count - count;
+    if (err < 0 && used == 0)
+        goto out;
+    err = used;
+    if (used > 0 && user_write(dirents, buf, used))
+        err = _EFAULT;
+out:
+    free(buf);
+    return err;
 }
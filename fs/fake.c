@@ -98,10 +98,7 @@ static void delete_path(struct mount *mount, const char *path) {
     db_exec_reset(mount, mount->stmt.delete_path);
 }
 
-static bool read_stat(struct mount *mount, const char *path, struct ish_stat *stat) {
-    ino_t inode = inode_for_path(mount, path);
-    if (inode == 0)
-        return false;
+static bool read_stat_inode(struct mount *mount, ino_t inode, struct ish_stat *stat) {
     qtsql_bind_int64(mount->stmt.read_stat, 1, inode);
     db_check_error(mount);
     bool has_result = db_exec(mount, mount->stmt.read_stat);
@@ -116,6 +113,13 @@ static bool read_stat(struct mount *mount, const char *path, struct ish_stat *st
     return true;
 }
 
+static bool read_stat(struct mount *mount, const char *path, struct ish_stat *stat) {
+    ino_t inode = inode_for_path(mount, path);
+    if (inode == 0)
+        return false;
+    return read_stat_inode(mount, inode, stat);
+}
+
 static void write_stat(struct mount *mount, const char *path, struct ish_stat *stat) {
     ino_t inode = write_path(mount, path);
     assert(inode != 0);
@@ -132,10 +136,14 @@ static void delete_inode_stat(struct mount *mount, ino_t inode) {
     db_exec_reset(mount, mount->stmt.delete_stat);
 }
 
+// same as realfs_fdops except for readdir, filled in by fakefs_mount
+static struct fd_ops fakefs_fdops;
+
 static struct fd *fakefs_open(struct mount *mount, const char *path, int flags, int mode) {
     struct fd *fd = realfs.open(mount, path, flags, 0666);
     if (IS_ERR(fd))
         return fd;
+    fd->ops = &fakefs_fdops;
     if (flags & O_CREAT_) {
         db_begin(mount);
         if (!read_stat(mount, path, NULL)) {
@@ -252,7 +260,7 @@ static int fakefs_symlink(struct mount *mount, const char *target, const char *l
 
 static int fakefs_mknod(struct mount *mount, const char *path, mode_t_ mode, dev_t_ dev) {
     mode_t_ real_mode = 0666;
-    if (S_ISBLK(mode) || S_ISCHR(mode))
+    if (S_ISBLK(mode) || S_ISCHR(mode) || S_ISSOCK_(mode))
         real_mode |= S_IFREG;
     else
         real_mode |= mode & S_IFMT;
@@ -292,6 +300,28 @@ static int fakefs_stat(struct mount *mount, const char *path, struct statbuf *fa
     return 0;
 }
 
+// Devices, sockets and symlinks are all plain files on the host, so the type
+// comes from the database. Directories are real directories, and their type
+// can be trusted without a lookup. This only runs when a listing is taken,
+// cached listings keep the types.
+static byte_t fakefs_entry_type(struct mount *mount, qword_t inode, byte_t host_type) {
+    if (host_type == DT_DIR_)
+        return host_type;
+    byte_t type = DT_UNKNOWN_;
+    if (inode == 0)
+        return type;
+    struct ish_stat ishstat;
+    db_begin(mount);
+    if (read_stat_inode(mount, inode, &ishstat))
+        type = DT_FROM_MODE_(ishstat.mode);
+    db_commit(mount);
+    return type;
+}
+
+static int fakefs_readdir(struct fd *fd, struct dir_entry *entry) {
+    return realfs_readdir_typed(fd, entry, fakefs_entry_type);
+}
+
 static int fakefs_fstat(struct fd *fd, struct statbuf *fake_stat) {
     // this is truly sad, but there is no alternative
     char path[MAX_PATH];
@@ -477,6 +507,9 @@ static int fakefs_mount(struct mount *mount) {
     mount->stmt.write_path = db_prepare(mount, "replace into paths (path, inode) values (?, ?)");
     mount->stmt.delete_path = db_prepare(mount, "delete from paths where inode = ?");
 
+    fakefs_fdops = realfs_fdops;
+    fakefs_fdops.readdir = fakefs_readdir;
+
     return 0;
 }
 
@@ -7,6 +7,7 @@
 #include "kernel/fs.h"
 #include "fs/poll.h"
 #include "fs/fd.h"
+#include "fs/pipe.h"
 
 struct fd *fd_create() {
     struct fd *fd = malloc(sizeof(struct fd));
@@ -54,6 +55,8 @@ struct fdtable *fdtable_new(unsigned size) {
     fdt->size = 0;
     fdt->files = NULL;
     fdt->cloexec = NULL;
+    fdt->used = NULL;
+    fdt->full = NULL;
     int err = fdtable_resize(fdt, size);
     if (err < 0) {
         free(fdt);
@@ -68,10 +71,14 @@ void fdtable_release(struct fdtable *table) {
             f_close(f);
         free(table->files);
         free(table->cloexec);
+        free(table->used);
+        free(table->full);
         free(table);
     }
 }
 
+#define FD_WORDS(n) (((n) + 63) / 64)
+
 int fdtable_resize(struct fdtable *table, unsigned size) {
     // currently the only legitimate use of this is to expand the table
     assert(size > table->size);
@@ -92,14 +99,73 @@ int fdtable_resize(struct fdtable *table, unsigned size) {
     if (table->cloexec)
         memcpy(cloexec, table->cloexec, BITS_SIZE(table->size));
 
+    // bits past the old size are always clear, so a partial last word was
+    // never marked full and the copied summary is still right
+    uint64_t *used = calloc(FD_WORDS(size), sizeof(uint64_t));
+    uint64_t *full = calloc(FD_WORDS(FD_WORDS(size)), sizeof(uint64_t));
+    if (used == NULL || full == NULL) {
+        free(files);
+        free(cloexec);
+        free(used);
+        free(full);
+        return _ENOMEM;
+    }
+    if (table->used)
+        memcpy(used, table->used, FD_WORDS(table->size) * sizeof(uint64_t));
+    if (table->full)
+        memcpy(full, table->full, FD_WORDS(FD_WORDS(table->size)) * sizeof(uint64_t));
+
     free(table->files);
     table->files = files;
     free(table->cloexec);
     table->cloexec = cloexec;
+    free(table->used);
+    table->used = used;
+    free(table->full);
+    table->full = full;
     table->size = size;
     return 0;
 }
 
+static void fdtable_put(struct fdtable *table, fd_t f, struct fd *fd) {
+    table->files[f] = fd;
+    uint64_t *word = &table->used[f / 64];
+    uint64_t *full = &table->full[f / 64 / 64];
+    uint64_t full_bit = 1ull << (f / 64 % 64);
+    if (fd != NULL) {
+        *word |= 1ull << (f % 64);
+        if (*word == ~0ull)
+            *full |= full_bit;
+    } else {
+        *word &= ~(1ull << (f % 64));
+        *full &= ~full_bit;
+    }
+}
+
+// Returns the lowest free slot at or after start and below limit, or limit
+// if there isn't one (or start if that's already past it).
+static unsigned fdtable_find_free(struct fdtable *table, unsigned start, unsigned limit) {
+    if (start >= limit)
+        return start;
+    unsigned w = start / 64;
+    uint64_t free_bits = ~table->used[w] & (~0ull << (start % 64));
+    if (free_bits == 0) {
+        unsigned words = FD_WORDS(limit);
+        for (w++; w < words; w = (w / 64 + 1) * 64) {
+            uint64_t not_full = ~table->full[w / 64] & (~0ull << (w % 64));
+            if (not_full != 0) {
+                w = w / 64 * 64 + __builtin_ctzll(not_full);
+                break;
+            }
+        }
+        if (w >= words)
+            return limit;
+        free_bits = ~table->used[w];
+    }
+    unsigned f = w * 64 + __builtin_ctzll(free_bits);
+    return f < limit ? f : limit;
+}
+
 struct fdtable *fdtable_copy(struct fdtable *table) {
     unsigned size = table->size;
     struct fdtable *new_table = fdtable_new(size);
@@ -110,6 +176,8 @@ struct fdtable *fdtable_copy(struct fdtable *table) {
         if (new_table->files[f])
             new_table->files[f]->refcount++;
     memcpy(new_table->cloexec, table->cloexec, BITS_SIZE(size));
+    memcpy(new_table->used, table->used, FD_WORDS(size) * sizeof(uint64_t));
+    memcpy(new_table->full, table->full, FD_WORDS(FD_WORDS(size)) * sizeof(uint64_t));
     return new_table;
 }
 
@@ -130,36 +198,43 @@ void f_set_cloexec(fd_t f) {
     bit_set(f, current->files->cloexec);
 }
 
-static int fdtable_expand(struct fdtable *table, fd_t max) {
+void f_put(fd_t f, struct fd *fd) {
+    fdtable_put(current->files, f, fd);
+}
+
+static int fdtable_expand(struct fdtable *table, unsigned max) {
+    unsigned limit = rlimit(RLIMIT_NOFILE_);
+    if (max >= limit)
+        return _EMFILE;
     unsigned size = max + 1;
     if (table->size >= size)
         return 0;
-    if (size > rlimit(RLIMIT_NOFILE_))
-        return _EMFILE;
-    return fdtable_resize(table, max + 1);
+    // double the table so installing fds one by one doesn't copy it every time
+    unsigned new_size = table->size * 2;
+    if (new_size < size)
+        new_size = size;
+    if (new_size > limit)
+        new_size = limit;
+    return fdtable_resize(table, new_size);
 }
 
-static fd_t f_install_start(struct fd *fd, fd_t start) {
+static fd_t f_install_start(struct fd *fd, unsigned start) {
     struct fdtable *table = current->files;
     unsigned size = rlimit(RLIMIT_NOFILE_);
     if (size > table->size)
         size = table->size;
 
-    fd_t f;
-    for (f = start; f < size; f++)
-        if (table->files[f] == NULL)
-            break;
+    unsigned f = fdtable_find_free(table, start, size);
     if (f >= size) {
         int err = fdtable_expand(table, f);
-        if (err < 0)
-            f = err;
+        if (err < 0) {
+            fd_close(fd);
+            return err;
+        }
     }
 
-    if (f >= 0) {
-        table->files[f] = fd;
-        bit_clear(f, table->cloexec);
-    } else
-        fd_close(fd);
+    fdtable_put(table, f, fd);
+    bit_clear(f, table->cloexec);
     return f;
 }
 
@@ -184,7 +259,7 @@ int f_close(fd_t f) {
     if (fd == NULL)
         return _EBADF;
     int err = fd_close(fd);
-    table->files[f] = NULL;
+    fdtable_put(table, f, NULL);
     bit_clear(f, table->cloexec);
     return err;
 }
@@ -199,6 +274,8 @@ dword_t sys_close(fd_t f) {
 #define F_SETFD_ 2
 #define F_GETFL_ 3
 #define F_SETFL_ 4
+#define F_SETPIPE_SZ_ 1031
+#define F_GETPIPE_SZ_ 1032
 
 dword_t sys_dup(fd_t f) {
     struct fd *fd = f_get(f);
@@ -219,7 +296,7 @@ dword_t sys_dup2(fd_t f, fd_t new_f) {
         return err;
     f_close(new_f);
     fd->refcount++;
-    table->files[new_f] = fd;
+    fdtable_put(table, new_f, fd);
     return new_f;
 }
 
@@ -259,6 +336,13 @@ dword_t sys_fcntl64(fd_t f, dword_t cmd, dword_t arg) {
             }
             return fd->ops->setflags(fd, arg);
 
+        case F_SETPIPE_SZ_:
+            STRACE("fcntl(%d, F_SETPIPE_SZ, %d)", f, arg);
+            return pipe_set_size(fd, arg);
+        case F_GETPIPE_SZ_:
+            STRACE("fcntl(%d, F_GETPIPE_SZ)", f);
+            return pipe_get_size(fd);
+
         default:
             STRACE("fcntl(%d, %d)", f, cmd);
             return _EINVAL;
@@ -23,7 +23,9 @@ struct fd {
     union {
         // realfs/fakefs
         struct {
-            DIR *dir;
+            // listing of the directory taken when reading it started
+            struct dir_snapshot *dir_snapshot;
+            unsigned dir_index;
         };
         // proc
         struct {
@@ -52,6 +54,14 @@ struct fd {
             struct timer *timer;
             uint64_t expirations;
         };
+        // pipe
+        struct {
+            struct pipe *pipe;
+        };
+        // local socket
+        struct {
+            struct unix_sock *unix_sock;
+        };
     };
 
     // fs/inode data
@@ -76,8 +86,15 @@ int fd_close(struct fd *fd);
 struct dir_entry {
     qword_t inode;
     char name[NAME_MAX + 1];
+    byte_t type; // d_type, DT_UNKNOWN_ if the filesystem can't tell cheaply
 };
 
+// d_type is the file type bits of the mode, shifted down
+#define DT_UNKNOWN_ 0
+#define DT_CHR_ 2
+#define DT_DIR_ 4
+#define DT_FROM_MODE_(mode) (((mode) & 0170000) >> 12)
+
 #define LSEEK_SET 0
 #define LSEEK_CUR 1
 #define LSEEK_END 2
@@ -120,6 +137,10 @@ struct fdtable {
     unsigned size;
     struct fd **files;
     bits_t *cloexec;
+    // one bit per slot that's in use, and one bit per word of that which is
+    // completely full, so finding the lowest free fd skips 4096 slots at a time
+    uint64_t *used;
+    uint64_t *full;
 };
 
 struct fdtable *fdtable_new(unsigned size);
@@ -131,6 +152,7 @@ void fdtable_free(struct fdtable *table);
 struct fd *f_get(fd_t f);
 bool f_is_cloexec(fd_t f);
 void f_set_cloexec(fd_t f);
+// puts fd in slot f without touching refcounts or whatever was there before
 void f_put(fd_t f, struct fd *fd);
 // steals a reference to the fd, gives it to the table on success and destroys it on error
 fd_t f_install(struct fd *fd);
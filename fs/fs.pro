@@ -15,8 +15,10 @@ SOURCES += \
     proc.c \
     proc/entry.c \
     proc/root.c \
+    devpts.c \
     adhoc.c \
     sock.c \
+    unix.c \
     pipe.c \
     dev.c \
     mem.c \
@@ -29,11 +31,13 @@ HEADERS += \
     fd.h \
     mem.h \
     path.h \
+    pipe.h \
     poll.h \
     proc.h \
     sock.h \
     stat.h \
-    tty.h
+    tty.h \
+    unix.h
 
 INCLUDEPATH += \
     ..
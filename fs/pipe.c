@@ -1,23 +1,308 @@
-
-#if defined(__MINGW32__)
-#   include "util/mingw-compat.h"
-#elif defined(_MSC_VER)
-#   error MSVC Platform need to defined
-#else
-#   include <unistd.h>
-#endif
-
+#include <string.h>
+#include <sys/stat.h>
 #include "kernel/calls.h"
 #include "fs/fd.h"
+#include "fs/pipe.h"
+#include "fs/poll.h"
 #include "util/debug.h"
 
-static fd_t pipe_f_create(int pipe_fd, int flags) {
+// Pipes live entirely inside the emulator. The data goes in a ring buffer
+// shared by the two ends, so a write followed by a read is a couple of
+// memcpys instead of two trips through the host kernel.
+struct pipe {
+    char *buf;
+    size_t capacity; // always a power of two
+    size_t start; // index of the first unread byte
+    size_t size; // number of unread bytes
+    // room held for a splice into the pipe that's reading from the other fd
+    size_t reserved;
+    // A splice out of the pipe has the bytes at the front and doesn't know
+    // yet how many the other fd takes. Nobody else reads until it's done.
+    bool splicing;
+    bool open[2]; // whether the read and write ends are still open
+    dword_t inode;
+    lock_t lock;
+    // notified whenever bytes are added or removed or an end is closed
+    cond_t cond;
+
+    // The fds for the two ends, for poll_wake. They have their own lock
+    // because poll_wake can't be called with the pipe locked, since poll
+    // checks the pipe with poll locks held.
+    struct fd *ends[2];
+    lock_t ends_lock;
+};
+
+#define PIPE_READ 0
+#define PIPE_WRITE 1
+
+static struct fd_ops pipe_read_ops;
+static struct fd_ops pipe_write_ops;
+
+bool fd_is_pipe(struct fd *fd) {
+    return fd->ops == &pipe_read_ops || fd->ops == &pipe_write_ops;
+}
+
+static int pipe_end(struct fd *fd) {
+    return fd->ops == &pipe_write_ops ? PIPE_WRITE : PIPE_READ;
+}
+
+static struct pipe *pipe_new() {
+    static atomic_uint next_inode = 1;
+    struct pipe *pipe = malloc(sizeof(struct pipe));
+    if (pipe == NULL)
+        return NULL;
+    pipe->capacity = PIPE_DEFAULT_SIZE;
+    pipe->buf = malloc(pipe->capacity);
+    if (pipe->buf == NULL) {
+        free(pipe);
+        return NULL;
+    }
+    pipe->start = pipe->size = 0;
+    pipe->reserved = 0;
+    pipe->splicing = false;
+    pipe->open[PIPE_READ] = pipe->open[PIPE_WRITE] = false;
+    pipe->ends[PIPE_READ] = pipe->ends[PIPE_WRITE] = NULL;
+    pipe->inode = next_inode++;
+    lock_init(&pipe->lock);
+    cond_init(&pipe->cond);
+    lock_init(&pipe->ends_lock);
+    return pipe;
+}
+
+static void pipe_free(struct pipe *pipe) {
+    free(pipe->buf);
+    free(pipe);
+}
+
+// Copies up to size bytes from the front of the queue without removing them
+static size_t pipe_peek(struct pipe *pipe, char *buf, size_t size) {
+    if (size > pipe->size)
+        size = pipe->size;
+    size_t first = pipe->capacity - pipe->start;
+    if (first > size)
+        first = size;
+    memcpy(buf, pipe->buf + pipe->start, first);
+    memcpy(buf + first, pipe->buf, size - first);
+    return size;
+}
+
+static void pipe_consume(struct pipe *pipe, size_t size) {
+    pipe->start = (pipe->start + size) & (pipe->capacity - 1);
+    pipe->size -= size;
+}
+
+static size_t pipe_room(struct pipe *pipe) {
+    return pipe->capacity - pipe->size - pipe->reserved;
+}
+
+// there has to be room for it
+static void pipe_push(struct pipe *pipe, const char *buf, size_t size) {
+    size_t end = (pipe->start + pipe->size) & (pipe->capacity - 1);
+    size_t first = pipe->capacity - end;
+    if (first > size)
+        first = size;
+    memcpy(pipe->buf + end, buf, first);
+    memcpy(pipe->buf, buf + first, size - first);
+    pipe->size += size;
+}
+
+static void pipe_wake(struct pipe *pipe) {
+    lock(&pipe->ends_lock);
+    for (int i = 0; i < 2; i++)
+        if (pipe->ends[i] != NULL)
+            poll_wake(pipe->ends[i]);
+    unlock(&pipe->ends_lock);
+}
+
+// Waits until there's something to read, with the pipe locked. Returns 1 if
+// there is, 0 if the queue is empty and there are no writers left.
+static int pipe_wait_readable(struct pipe *pipe, bool nonblock) {
+    while (pipe->size == 0 || pipe->splicing) {
+        if (!pipe->splicing && !pipe->open[PIPE_WRITE])
+            return 0;
+        if (nonblock)
+            return _EAGAIN;
+        if (wait_for(&pipe->cond, &pipe->lock, NULL))
+            return _EINTR;
+    }
+    return 1;
+}
+
+// Adds bytes to the pipe, waiting for room if nonblock isn't set. Writes of
+// up to PIPE_BUF_ bytes go in all at once, bigger ones may be split up.
+static ssize_t pipe_add(struct pipe *pipe, const char *buf, size_t size, bool nonblock) {
+    lock(&pipe->lock);
+    size_t written = 0;
+    ssize_t err = 0;
+    while (written < size) {
+        if (!pipe->open[PIPE_READ]) {
+            err = _EPIPE;
+            break;
+        }
+        size_t room = pipe_room(pipe);
+        size_t left = size - written;
+        if (room == 0 || (size <= PIPE_BUF_ && room < left)) {
+            if (nonblock) {
+                err = _EAGAIN;
+                break;
+            }
+            if (wait_for(&pipe->cond, &pipe->lock, NULL)) {
+                err = _EINTR;
+                break;
+            }
+            continue;
+        }
+        if (room > left)
+            room = left;
+        pipe_push(pipe, buf + written, room);
+        written += room;
+        notify(&pipe->cond);
+    }
+    unlock(&pipe->lock);
+
+    if (written > 0)
+        pipe_wake(pipe);
+    if (err == _EPIPE)
+        send_signal(current, SIGPIPE_);
+    if (written > 0)
+        return written;
+    return err;
+}
+
+static ssize_t pipe_read(struct fd *fd, void *buf, size_t bufsize) {
+    struct pipe *pipe = fd->pipe;
+    if (bufsize == 0)
+        return 0;
+    lock(&pipe->lock);
+    ssize_t res = pipe_wait_readable(pipe, fd->flags & O_NONBLOCK_);
+    if (res > 0) {
+        res = pipe_peek(pipe, buf, bufsize);
+        pipe_consume(pipe, res);
+        notify(&pipe->cond);
+    }
+    unlock(&pipe->lock);
+    if (res > 0)
+        pipe_wake(pipe);
+    return res;
+}
+
+static ssize_t pipe_write(struct fd *fd, const void *buf, size_t bufsize) {
+    return pipe_add(fd->pipe, buf, bufsize, fd->flags & O_NONBLOCK_);
+}
+
+static int pipe_poll(struct fd *fd) {
+    struct pipe *pipe = fd->pipe;
+    int types = 0;
+    lock(&pipe->lock);
+    if (pipe_end(fd) == PIPE_READ) {
+        if (pipe->size > 0)
+            types |= POLL_READ;
+        if (!pipe->open[PIPE_WRITE])
+            types |= POLL_HUP;
+    } else {
+        if (pipe_room(pipe) >= PIPE_BUF_)
+            types |= POLL_WRITE;
+        if (!pipe->open[PIPE_READ])
+            types |= POLL_ERR;
+    }
+    unlock(&pipe->lock);
+    return types;
+}
+
+static ssize_t pipe_ioctl_size(struct fd *fd, int cmd) {
+    if (cmd == FIONREAD_)
+        return sizeof(dword_t);
+    return -1;
+}
+
+static int pipe_ioctl(struct fd *fd, int cmd, void *arg) {
+    struct pipe *pipe = fd->pipe;
+    if (cmd == FIONREAD_) {
+        lock(&pipe->lock);
+        *(dword_t *) arg = pipe->size;
+        unlock(&pipe->lock);
+        return 0;
+    }
+    return _EINVAL;
+}
+
+static int pipe_close(struct fd *fd) {
+    struct pipe *pipe = fd->pipe;
+    int end = pipe_end(fd);
+    // ends_lock is held the whole time so that whoever closes the second end
+    // knows nobody else is still using the pipe
+    lock(&pipe->ends_lock);
+    pipe->ends[end] = NULL;
+    lock(&pipe->lock);
+    pipe->open[end] = false;
+    notify(&pipe->cond);
+    unlock(&pipe->lock);
+    struct fd *other = pipe->ends[!end];
+    if (other != NULL)
+        poll_wake(other);
+    unlock(&pipe->ends_lock);
+    if (other == NULL)
+        pipe_free(pipe);
+    return 0;
+}
+
+int pipe_get_size(struct fd *fd) {
+    if (!fd_is_pipe(fd))
+        return _EBADF;
+    lock(&fd->pipe->lock);
+    int size = fd->pipe->capacity;
+    unlock(&fd->pipe->lock);
+    return size;
+}
+
+int pipe_set_size(struct fd *fd, dword_t size) {
+    if (!fd_is_pipe(fd))
+        return _EBADF;
+    if (size > PIPE_MAX_SIZE)
+        return _EPERM;
+    size_t capacity = PAGE_SIZE;
+    while (capacity < size)
+        capacity <<= 1;
+
+    struct pipe *pipe = fd->pipe;
+    lock(&pipe->lock);
+    if (capacity < pipe->size + pipe->reserved) {
+        unlock(&pipe->lock);
+        return _EBUSY;
+    }
+    if (capacity != pipe->capacity) {
+        char *buf = malloc(capacity);
+        if (buf == NULL) {
+            unlock(&pipe->lock);
+            return _ENOMEM;
+        }
+        pipe_peek(pipe, buf, pipe->size);
+        free(pipe->buf);
+        pipe->buf = buf;
+        pipe->capacity = capacity;
+        pipe->start = 0;
+        notify(&pipe->cond);
+    }
+    unlock(&pipe->lock);
+    pipe_wake(pipe);
+    return capacity;
+}
+
+static struct fd *pipe_fd_create(struct pipe *pipe, int end) {
     struct fd *fd = adhoc_fd_create();
     if (fd == NULL)
-        return _ENOMEM;
-    fd->real_fd = pipe_fd;
-    fd->ops = &realfs_fdops;
-    return f_install_flags(fd, flags);
+        return NULL;
+    fd->ops = end == PIPE_READ ? &pipe_read_ops : &pipe_write_ops;
+    fd->flags = end == PIPE_READ ? O_RDONLY_ : O_WRONLY_;
+    fd->pipe = pipe;
+    fd->stat.mode = S_IFIFO | 0600;
+    fd->stat.inode = pipe->inode;
+    fd->stat.uid = current->euid;
+    fd->stat.gid = current->egid;
+    fd->stat.blksize = PAGE_SIZE;
+    pipe->open[end] = true;
+    pipe->ends[end] = fd;
+    return fd;
 }
 
 int_t sys_pipe2(addr_t pipe_addr, int_t flags) {
@@ -27,35 +312,300 @@ int_t sys_pipe2(addr_t pipe_addr, int_t flags) {
         return _EINVAL;
     }
 
-    int p[2];
-    int err = pipe(p);
-    if (err < 0)
-        return err;
+    struct pipe *pipe = pipe_new();
+    if (pipe == NULL)
+        return _ENOMEM;
+    // once an end exists, closing it takes care of the pipe
+    struct fd *read_end = pipe_fd_create(pipe, PIPE_READ);
+    if (read_end == NULL) {
+        pipe_free(pipe);
+        return _ENOMEM;
+    }
+    struct fd *write_end = pipe_fd_create(pipe, PIPE_WRITE);
+    if (write_end == NULL) {
+        fd_close(read_end);
+        return _ENOMEM;
+    }
 
     int fp[2];
-    err = fp[0] = pipe_f_create(p[0], flags);
-    if (fp[0] < 0)
-        goto close_pipe;
-    err = fp[1] = pipe_f_create(p[1], flags);
+    int err = fp[0] = f_install_flags(read_end, flags);
+    if (fp[0] < 0) {
+        fd_close(write_end);
+        return err;
+    }
+    err = fp[1] = f_install_flags(write_end, flags);
     if (fp[1] < 0)
-        goto close_fake_0;
+        goto close_0;
 
     err = _EFAULT;
     if (user_put(pipe_addr, fp))
-        goto close_fake_1;
+        goto close_1;
     STRACE(" [%d %d]", fp[0], fp[1]);
     return 0;
 
-close_fake_1:
+close_1:
     f_close(fp[1]);
-close_fake_0:
+close_0:
     f_close(fp[0]);
-close_pipe:
-    close(p[0]);
-    close(p[1]);
     return err;
 }
 
 int_t sys_pipe(addr_t pipe_addr) {
     return sys_pipe2(pipe_addr, 0);
 }
+
+#define SPLICE_F_NONBLOCK_ 2
+
+// Reads or writes the non-pipe side of a splice. If off_addr isn't 0 it
+// points to the offset to use, which is updated, and the file position isn't
+// changed.
+static ssize_t splice_io(struct fd *fd, addr_t off_addr, void *buf, size_t size, bool write) {
+    if (off_addr == 0)
+        return write ? fd->ops->write(fd, buf, size) : fd->ops->read(fd, buf, size);
+
+    off_t_ off;
+    if (user_get(off_addr, off))
+        return _EFAULT;
+    if (fd->ops->lseek == NULL)
+        return _ESPIPE;
+    lock(&fd->lock);
+    off_t_ old_off = fd->ops->lseek(fd, 0, LSEEK_CUR);
+    ssize_t res = old_off;
+    if (res >= 0)
+        res = fd->ops->lseek(fd, off, LSEEK_SET);
+    if (res >= 0) {
+        res = write ? fd->ops->write(fd, buf, size) : fd->ops->read(fd, buf, size);
+        fd->ops->lseek(fd, old_off, LSEEK_SET);
+    }
+    unlock(&fd->lock);
+    if (res > 0) {
+        off += res;
+        if (user_put(off_addr, off))
+            return _EFAULT;
+    }
+    return res;
+}
+
+// Takes up to size bytes out of the pipe and hands them to out. Only what out
+// accepts is removed from the pipe.
+static ssize_t splice_from_pipe(struct pipe *pipe, struct fd *out, addr_t out_off_addr, size_t size, bool nonblock) {
+    lock(&pipe->lock);
+    ssize_t res = pipe_wait_readable(pipe, nonblock);
+    if (res <= 0) {
+        unlock(&pipe->lock);
+        return res;
+    }
+    if (size > pipe->size)
+        size = pipe->size;
+    char *buf = malloc(size);
+    if (buf == NULL) {
+        unlock(&pipe->lock);
+        return _ENOMEM;
+    }
+    pipe_peek(pipe, buf, size);
+    pipe->splicing = true;
+    unlock(&pipe->lock);
+
+    if (fd_is_pipe(out))
+        res = pipe_add(out->pipe, buf, size, nonblock);
+    else
+        res = splice_io(out, out_off_addr, buf, size, true);
+    free(buf);
+
+    // nobody else read, so the bytes out took are still at the front
+    lock(&pipe->lock);
+    if (res > 0)
+        pipe_consume(pipe, res);
+    pipe->splicing = false;
+    notify(&pipe->cond);
+    unlock(&pipe->lock);
+    if (res > 0)
+        pipe_wake(pipe);
+    return res;
+}
+
+// Reads from in straight into the pipe. Only asks in for as much room as it
+// reserves first, so nothing read has to be thrown away.
+static ssize_t splice_to_pipe(struct fd *in, addr_t in_off_addr, struct pipe *pipe, size_t size, bool nonblock) {
+    lock(&pipe->lock);
+    while (pipe_room(pipe) == 0 && pipe->open[PIPE_READ]) {
+        if (nonblock) {
+            unlock(&pipe->lock);
+            return _EAGAIN;
+        }
+        if (wait_for(&pipe->cond, &pipe->lock, NULL)) {
+            unlock(&pipe->lock);
+            return _EINTR;
+        }
+    }
+    if (!pipe->open[PIPE_READ]) {
+        unlock(&pipe->lock);
+        send_signal(current, SIGPIPE_);
+        return _EPIPE;
+    }
+    if (size > pipe_room(pipe))
+        size = pipe_room(pipe);
+    pipe->reserved += size;
+    unlock(&pipe->lock);
+
+    char *buf = malloc(size);
+    ssize_t res = _ENOMEM;
+    if (buf != NULL)
+        res = splice_io(in, in_off_addr, buf, size, false);
+
+    lock(&pipe->lock);
+    pipe->reserved -= size;
+    if (res > 0) {
+        pipe_push(pipe, buf, res);
+        notify(&pipe->cond);
+    }
+    unlock(&pipe->lock);
+    free(buf);
+    if (res > 0)
+        pipe_wake(pipe);
+    return res;
+}
+
+dword_t sys_splice(fd_t in_f, addr_t in_off_addr, fd_t out_f, addr_t out_off_addr, dword_t len, dword_t flags) {
+    STRACE("splice(%d, %#x, %d, %#x, %u, %#x)", in_f, in_off_addr, out_f, out_off_addr, len, flags);
+    struct fd *in = f_get(in_f);
+    struct fd *out = f_get(out_f);
+    if (in == NULL || out == NULL || in->ops->read == NULL || out->ops->write == NULL)
+        return _EBADF;
+    bool nonblock = flags & SPLICE_F_NONBLOCK_;
+    if (len == 0)
+        return 0;
+
+    if (fd_is_pipe(in)) {
+        if (in_off_addr != 0)
+            return _ESPIPE;
+        if (fd_is_pipe(out) && out->pipe == in->pipe)
+            return _EINVAL;
+        return splice_from_pipe(in->pipe, out, out_off_addr, len, nonblock);
+    }
+    if (fd_is_pipe(out)) {
+        if (out_off_addr != 0)
+            return _ESPIPE;
+        return splice_to_pipe(in, in_off_addr, out->pipe, len, nonblock);
+    }
+    return _EINVAL;
+}
+
+dword_t sys_tee(fd_t in_f, fd_t out_f, dword_t len, dword_t flags) {
+    STRACE("tee(%d, %d, %u, %#x)", in_f, out_f, len, flags);
+    struct fd *in = f_get(in_f);
+    struct fd *out = f_get(out_f);
+    if (in == NULL || out == NULL || in->ops->read == NULL || out->ops->write == NULL)
+        return _EBADF;
+    if (!fd_is_pipe(in) || !fd_is_pipe(out) || in->pipe == out->pipe)
+        return _EINVAL;
+    bool nonblock = flags & SPLICE_F_NONBLOCK_;
+    if (len == 0)
+        return 0;
+
+    struct pipe *pipe = in->pipe;
+    lock(&pipe->lock);
+    ssize_t res = pipe_wait_readable(pipe, nonblock);
+    if (res <= 0) {
+        unlock(&pipe->lock);
+        return res;
+    }
+    if (len > pipe->size)
+        len = pipe->size;
+    char *buf = malloc(len);
+    if (buf == NULL) {
+        unlock(&pipe->lock);
+        return _ENOMEM;
+    }
+    pipe_peek(pipe, buf, len);
+    unlock(&pipe->lock);
+
+    res = pipe_add(out->pipe, buf, len, nonblock);
+    free(buf);
+    return res;
+}
+
+dword_t sys_vmsplice(fd_t f, addr_t iovec_addr, dword_t iovec_count, dword_t flags) {
+    STRACE("vmsplice(%d, %#x, %u, %#x)", f, iovec_addr, iovec_count, flags);
+    struct fd *fd = f_get(f);
+    if (fd == NULL)
+        return _EBADF;
+    if (!fd_is_pipe(fd))
+        return _EBADF;
+    if (iovec_count > 1024)
+        return _EINVAL;
+    bool nonblock = flags & SPLICE_F_NONBLOCK_;
+
+    dword_t iovec_size = sizeof(struct io_vec) * iovec_count;
+    struct io_vec *iovecs = malloc(iovec_size);
+    if (iovecs == NULL)
+        return _ENOMEM;
+    ssize_t res = 0;
+    if (user_read(iovec_addr, iovecs, iovec_size)) {
+        res = _EFAULT;
+        goto out;
+    }
+
+    // Guest memory can't be handed to the pipe by reference, so this copies
+    // like writev, but it does it without going through a bounce buffer per
+    // syscall. Reading from a pipe is allowed too, like Linux.
+    dword_t count = 0;
+    for (unsigned i = 0; i < iovec_count; i++) {
+        if (iovecs[i].len == 0)
+            continue;
+        char *buf = malloc(iovecs[i].len);
+        if (buf == NULL) {
+            res = _ENOMEM;
+            break;
+        }
+        if (pipe_end(fd) == PIPE_WRITE) {
+            res = _EFAULT;
+            if (user_read(iovecs[i].base, buf, iovecs[i].len) == 0)
+                res = pipe_add(fd->pipe, buf, iovecs[i].len, nonblock);
+        } else {
+            struct pipe *pipe = fd->pipe;
+            lock(&pipe->lock);
+            // only wait if nothing's been read yet
+            res = pipe_wait_readable(pipe, nonblock || count > 0);
+            if (res > 0) {
+                res = pipe_peek(pipe, buf, iovecs[i].len);
+                if (user_write(iovecs[i].base, buf, res))
+                    res = _EFAULT;
+                else
+                    pipe_consume(pipe, res);
+                notify(&pipe->cond);
+            }
+            unlock(&pipe->lock);
+            if (res > 0)
+                pipe_wake(pipe);
+        }
+        free(buf);
+        if (res <= 0)
+            break;
+        count += res;
+        if ((dword_t) res < iovecs[i].len)
+            break;
+    }
+    if (count > 0)
+        res = count;
+
+out:
+    free(iovecs);
+    return res;
+}
+
+static struct fd_ops pipe_read_ops = {
+    .read = pipe_read,
+    .poll = pipe_poll,
+    .ioctl_size = pipe_ioctl_size,
+    .ioctl = pipe_ioctl,
+    .close = pipe_close,
+};
+
+static struct fd_ops pipe_write_ops = {
+    .write = pipe_write,
+    .poll = pipe_poll,
+    .ioctl_size = pipe_ioctl_size,
+    .ioctl = pipe_ioctl,
+    .close = pipe_close,
+};
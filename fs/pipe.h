@@ -0,0 +1,16 @@
+#ifndef FS_PIPE_H
+#define FS_PIPE_H
+#include "fs/fd.h"
+
+// writes of up to this many bytes are never interleaved with other writes
+#define PIPE_BUF_ 4096
+#define PIPE_DEFAULT_SIZE 65536
+// largest size an unprivileged process can ask for, like /proc/sys/fs/pipe-max-size
+#define PIPE_MAX_SIZE (1 << 20)
+
+bool fd_is_pipe(struct fd *fd);
+// F_GETPIPE_SZ and F_SETPIPE_SZ. Both return the capacity of the pipe.
+int pipe_get_size(struct fd *fd);
+int pipe_set_size(struct fd *fd, dword_t size);
+
+#endif
@@ -62,10 +62,11 @@ static int proc_fstat(struct fd *fd, struct statbuf *stat) {
 }
 
 static int proc_refresh_data(struct fd *fd) {
+    struct proc_entry entry = fd->proc_entry;
     if (fd->proc_data == NULL) {
-        fd->proc_data = malloc(4096); // FIXME choose a good number
+        size_t size = entry.meta->data_size;
+        fd->proc_data = malloc(size != 0 ? size : PROC_DATA_SIZE);
     }
-    struct proc_entry entry = fd->proc_entry;
     ssize_t size = entry.meta->show(&entry, fd->proc_data);
     if (size < 0)
         return size;
@@ -126,6 +127,7 @@ static int proc_readdir(struct fd *fd, struct dir_entry *entry) {
         return 0;
     proc_entry_getname(&proc_entry, entry->name);
     entry->inode = 0;
+    entry->type = DT_FROM_MODE_(proc_entry.meta->mode);
     return 1;
 }
 
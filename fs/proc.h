@@ -20,6 +20,8 @@ struct proc_dir_entry {
     // file with custom show data function
     // not worrying about buffer overflows for now
     ssize_t (*show)(struct proc_entry *entry, char *buf);
+    // size of the buffer passed to show, PROC_DATA_SIZE if 0
+    size_t data_size;
 
     // directory with static list
     struct proc_dir_entry *children;
@@ -29,6 +31,11 @@ struct proc_dir_entry {
     bool (*readdir)(struct proc_entry *entry, int *index, struct proc_entry *next_entry);
 };
 
+// size of the buffer passed to show, unless the entry asks for more
+#define PROC_DATA_SIZE 4096
+// for the generated reports that need more room
+#define PROC_LARGE_DATA_SIZE 65536
+
 extern struct proc_dir_entry proc_root;
 extern struct proc_dir_entry proc_pid;
 
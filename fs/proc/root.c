@@ -2,6 +2,8 @@
 #include "kernel/calls.h"
 #include "fs/proc.h"
 #include "fs/tty.h"
+#include "emu/cpuid.h"
+#include "kernel/profile.h"
 
 static ssize_t proc_show_version(struct proc_entry *entry, char *buf) {
     struct uname uts;
@@ -9,8 +11,68 @@ static ssize_t proc_show_version(struct proc_entry *entry, char *buf) {
     return sprintf(buf, "%s version %s %s\n", uts.system, uts.release, uts.version);
 }
 
+static ssize_t proc_show_syscalls(struct proc_entry *entry, char *buf) {
+    size_t n = 0;
+    n += sprintf(buf + n, "num calls total_us avg_us histogram_log2_us\n");
+    for (int num = 0; num < NUM_SYSCALLS; num++) {
+        struct syscall_stats *stats = &syscall_stats[num];
+        unsigned long count = atomic_load(&stats->count);
+        if (count == 0)
+            continue;
+        // leave room for one more full line
+        if (n > PROC_LARGE_DATA_SIZE - 512)
+            break;
+        unsigned long long total_us = atomic_load(&stats->total_ns) / 1000;
+        n += sprintf(buf + n, "%d %lu %llu %llu", num, count, total_us, total_us / count);
+        int last = SYSCALL_HIST_BUCKETS - 1;
+        while (last > 0 && atomic_load(&stats->hist[last]) == 0)
+            last--;
+        for (int i = 0; i <= last; i++)
+            n += sprintf(buf + n, " %lu", (unsigned long) atomic_load(&stats->hist[i]));
+        n += sprintf(buf + n, "\n");
+    }
+    return n;
+}
+
+static ssize_t proc_show_cpuinfo(struct proc_entry *entry, char *buf) {
+    static const struct {
+        dword_t bit;
+        const char *name;
+    } flags[] = {
+        {CPUID_FPU, "fpu"},
+        {CPUID_TSC, "tsc"},
+        {CPUID_CMOV, "cmov"},
+        {CPUID_SSE, "sse"},
+        {CPUID_SSE2, "sse2"},
+    };
+    const struct cpuid_profile_info *profile = &cpuid_profiles[cpuid_profile];
+    size_t n = 0;
+    n += sprintf(buf + n, "processor\t: 0\n");
+    n += sprintf(buf + n, "vendor_id\t: GenuineIntel\n");
+    n += sprintf(buf + n, "model name\t: iSL (%s)\n", profile->name);
+    n += sprintf(buf + n, "flags\t\t:");
+    for (unsigned i = 0; i < sizeof(flags)/sizeof(flags[0]); i++) {
+        if (profile->edx & flags[i].bit)
+            n += sprintf(buf + n, " %s", flags[i].name);
+    }
+    n += sprintf(buf + n, "\n");
+    return n;
+}
+
+static ssize_t proc_show_profile(struct proc_entry *entry, char *buf) {
+    return profile_report(buf, PROC_LARGE_DATA_SIZE);
+}
+
+static ssize_t proc_show_opcodes(struct proc_entry *entry, char *buf) {
+    return opcode_report(buf, PROC_LARGE_DATA_SIZE, OPCODE_SLOTS);
+}
+
 struct proc_dir_entry proc_root_entries[] = {
     {2, "version", S_IFREG | 0444, .show = proc_show_version},
+    {3, "syscalls", S_IFREG | 0444, .show = proc_show_syscalls, .data_size = PROC_LARGE_DATA_SIZE},
+    {4, "cpuinfo", S_IFREG | 0444, .show = proc_show_cpuinfo},
+    {5, "profile", S_IFREG | 0444, .show = proc_show_profile, .data_size = PROC_LARGE_DATA_SIZE},
+    {6, "opcodes", S_IFREG | 0444, .show = proc_show_opcodes, .data_size = PROC_LARGE_DATA_SIZE},
 };
 #define PROC_ROOT_LEN sizeof(proc_root_entries)/sizeof(proc_root_entries[0])
 
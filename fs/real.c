@@ -1,4 +1,5 @@
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <sys/stat.h>
@@ -57,6 +58,116 @@ static void unlock_fchdir() {
     unlock(&fchdir_lock);
 }
 
+// Listings of directories get cached, since build systems list the same
+// directories over and over. A cached listing is checked against the
+// directory's mtime whenever reading the directory starts over, and changes
+// made through the emulator drop it right away.
+struct dir_snapshot {
+    atomic_uint refcount;
+    struct mount *mount;
+    dev_t dev;
+    ino_t inode;
+    time_t mtime;
+    unsigned count;
+    struct dir_snapshot_entry {
+        qword_t inode;
+        unsigned name; // offset into names
+        byte_t type;
+    } *entries;
+    char *names;
+    struct list cache;
+};
+
+#define DIR_CACHE_MAX 128
+// most recently used first
+static struct list dir_cache = {&dir_cache, &dir_cache};
+static unsigned dir_cache_size;
+static lock_t dir_cache_lock = LOCK_INITIALIZER;
+
+static void dir_snapshot_release(struct dir_snapshot *snapshot) {
+    if (--snapshot->refcount > 0)
+        return;
+    free(snapshot->entries);
+    free(snapshot->names);
+    free(snapshot);
+}
+
+// these need dir_cache_lock
+
+static struct dir_snapshot *dir_cache_find(struct mount *mount, dev_t dev, ino_t inode) {
+    struct dir_snapshot *snapshot;
+    list_for_each_entry(&dir_cache, snapshot, cache) {
+        if (snapshot->mount == mount && snapshot->dev == dev && snapshot->inode == inode)
+            return snapshot;
+    }
+    return NULL;
+}
+
+static void dir_cache_remove(struct dir_snapshot *snapshot) {
+    list_remove(&snapshot->cache);
+    dir_cache_size--;
+    dir_snapshot_release(snapshot);
+}
+
+// Returns a reference to the cached listing of the directory, if it's still good
+static struct dir_snapshot *dir_cache_get(struct mount *mount, struct stat *stat) {
+    lock(&dir_cache_lock);
+    struct dir_snapshot *snapshot = dir_cache_find(mount, stat->st_dev, stat->st_ino);
+    if (snapshot != NULL) {
+        if (snapshot->mtime == stat->st_mtime) {
+            list_remove(&snapshot->cache);
+            list_add(&dir_cache, &snapshot->cache);
+            snapshot->refcount++;
+        } else {
+            dir_cache_remove(snapshot);
+            snapshot = NULL;
+        }
+    }
+    unlock(&dir_cache_lock);
+    return snapshot;
+}
+
+static void dir_cache_add(struct dir_snapshot *snapshot) {
+    lock(&dir_cache_lock);
+    struct dir_snapshot *old = dir_cache_find(snapshot->mount, snapshot->dev, snapshot->inode);
+    if (old != NULL)
+        dir_cache_remove(old);
+    if (dir_cache_size == DIR_CACHE_MAX)
+        dir_cache_remove(list_entry(dir_cache.prev, struct dir_snapshot, cache));
+    snapshot->refcount++;
+    list_add(&dir_cache, &snapshot->cache);
+    dir_cache_size++;
+    unlock(&dir_cache_lock);
+}
+
+// Drops the cached listing of the directory at path, or the directory path
+// is in if parent is set
+static void dir_cache_invalidate(struct mount *mount, const char *path, bool parent) {
+    lock(&dir_cache_lock);
+    bool empty = dir_cache_size == 0;
+    unlock(&dir_cache_lock);
+    if (empty)
+        return;
+
+    char dir[MAX_PATH];
+    strcpy(dir, path);
+    if (parent) {
+        char *slash = strrchr(dir, '/');
+        if (slash != NULL)
+            *slash = '\0';
+        else
+            dir[0] = '\0';
+    }
+    struct stat stat;
+    if (fstatat(mount->root_fd, fix_path(dir), &stat, 0) < 0)
+        return;
+    lock(&dir_cache_lock);
+    struct dir_snapshot *snapshot = dir_cache_find(mount, stat.st_dev, stat.st_ino);
+    if (snapshot != NULL)
+        dir_cache_remove(snapshot);
+    unlock(&dir_cache_lock);
+}
+
 static int open_flags_real_from_fake(int flags) {
     int real_flags = 0;
     if (flags & O_RDONLY_) real_flags |= O_RDONLY;
@@ -88,14 +199,17 @@ static struct fd *realfs_open(struct mount *mount, const char *path, int flags,
         return ERR_PTR(errno_map());
     struct fd *fd = fd_create();
     fd->real_fd = fd_no;
-    fd->dir = NULL;
+    fd->dir_snapshot = NULL;
+    fd->dir_index = 0;
     fd->ops = &realfs_fdops;
+    if (flags & O_CREAT_)
+        dir_cache_invalidate(mount, path, true);
     return fd;
 }
 
 int realfs_close(struct fd *fd) {
-    if (fd->dir != NULL)
-        closedir(fd->dir);
+    if (fd->dir_snapshot != NULL)
+        dir_snapshot_release(fd->dir_snapshot);
     int err = close(fd->real_fd);
     if (err < 0)
         return errno_map();
@@ -152,51 +266,148 @@ ssize_t realfs_write(struct fd *fd, const void *buf, size_t bufsize) {
     return res;
 }
 
-static int realfs_opendir(struct fd *fd) {
-    if (fd->dir == NULL) {
-        int dirfd = dup(fd->real_fd);
-        fd->dir = fdopendir(dirfd);
-        if (fd->dir == NULL) {
-            close(dirfd);
-            return errno_map();
+static int dir_snapshot_take(struct fd *fd, struct stat *stat, byte_t (*entry_type)(struct mount *, qword_t, byte_t), struct dir_snapshot **snapshot_out) {
+    int dirfd = dup(fd->real_fd);
+    if (dirfd < 0)
+        return errno_map();
+    DIR *dir = fdopendir(dirfd);
+    if (dir == NULL) {
+        int err = errno_map();
+        close(dirfd);
+        return err;
+    }
+    // the dup shares its position with real_fd
+    rewinddir(dir);
+
+    struct dir_snapshot *snapshot = calloc(1, sizeof(struct dir_snapshot));
+    int err = _ENOMEM;
+    if (snapshot == NULL)
+        goto out;
+    snapshot->refcount = 1;
+    snapshot->mount = fd->mount;
+    snapshot->dev = stat->st_dev;
+    snapshot->inode = stat->st_ino;
+    snapshot->mtime = stat->st_mtime;
+    unsigned entries_cap = 0;
+    size_t names_size = 0, names_cap = 0;
+
+    while (true) {
+        errno = 0;
+        struct dirent *dirent = readdir(dir);
+        if (dirent == NULL) {
+            err = errno != 0 ? errno_map() : 0;
+            break;
         }
+        size_t name_len = strlen(dirent->d_name) + 1;
+        if (snapshot->count == entries_cap) {
+            entries_cap = entries_cap ? entries_cap * 2 : 32;
+            struct dir_snapshot_entry *entries = realloc(snapshot->entries, sizeof(*entries) * entries_cap);
+            if (entries == NULL) {
+                err = _ENOMEM;
+                break;
+            }
+            snapshot->entries = entries;
+        }
+        if (names_size + name_len > names_cap) {
+            while (names_size + name_len > names_cap)
+                names_cap = names_cap ? names_cap * 2 : 512;
+            char *names = realloc(snapshot->names, names_cap);
+            if (names == NULL) {
+                err = _ENOMEM;
+                break;
+            }
+            snapshot->names = names;
+        }
+        struct dir_snapshot_entry *entry = &snapshot->entries[snapshot->count++];
+        entry->inode = dirent->d_ino;
+        entry->name = names_size;
+        memcpy(snapshot->names + names_size, dirent->d_name, name_len);
+        names_size += name_len;
+#ifdef DT_UNKNOWN
+        // the host uses the same values as linux
+        entry->type = dirent->d_type;
+#else
+        entry->type = DT_UNKNOWN_;
+#endif
+    }
+    if (err < 0) {
+        dir_snapshot_release(snapshot);
+        goto out;
     }
+    if (entry_type != NULL) {
+        for (unsigned i = 0; i < snapshot->count; i++) {
+            struct dir_snapshot_entry *entry = &snapshot->entries[i];
+            entry->type = entry_type(fd->mount, entry->inode, entry->type);
+        }
+    }
+    *snapshot_out = snapshot;
+
+out:
+    closedir(dir);
+    return err;
+}
+
+// Gets a current listing for the directory, from the cache if possible
+static int realfs_dir_start(struct fd *fd, byte_t (*entry_type)(struct mount *, qword_t, byte_t)) {
+    struct stat stat;
+    if (fstat(fd->real_fd, &stat) < 0)
+        return errno_map();
+    if (!S_ISDIR(stat.st_mode))
+        return _ENOTDIR;
+    struct dir_snapshot *snapshot = dir_cache_get(fd->mount, &stat);
+    if (snapshot == NULL) {
+        int err = dir_snapshot_take(fd, &stat, entry_type, &snapshot);
+        if (err < 0)
+            return err;
+        // A directory that changed in the last second could change again
+        // without the mtime changing, so that listing can't be trusted later.
+        if (time(NULL) > stat.st_mtime + 1)
+            dir_cache_add(snapshot);
+    }
+    if (fd->dir_snapshot != NULL)
+        dir_snapshot_release(fd->dir_snapshot);
+    fd->dir_snapshot = snapshot;
     return 0;
 }
 
-int realfs_readdir(struct fd *fd, struct dir_entry *entry) {
-    int err = realfs_opendir(fd);
-    if (err < 0)
-        return err;
-    errno = 0;
-    struct dirent *dirent = readdir(fd->dir);
-    if (dirent == NULL) {
-        if (errno != 0)
-            return errno_map();
-        else
-            return 0;
+int realfs_readdir_typed(struct fd *fd, struct dir_entry *entry, byte_t (*entry_type)(struct mount *, qword_t, byte_t)) {
+    if (fd->dir_snapshot == NULL || fd->dir_index == 0) {
+        int err = realfs_dir_start(fd, entry_type);
+        if (err < 0)
+            return err;
     }
-    entry->inode = dirent->d_ino;
-    strcpy(entry->name, dirent->d_name);
+    struct dir_snapshot *snapshot = fd->dir_snapshot;
+    if (fd->dir_index >= snapshot->count)
+        return 0;
+    struct dir_snapshot_entry *snapshot_entry = &snapshot->entries[fd->dir_index++];
+    entry->inode = snapshot_entry->inode;
+    strcpy(entry->name, snapshot->names + snapshot_entry->name);
+    entry->type = snapshot_entry->type;
     return 1;
 }
 
+int realfs_readdir(struct fd *fd, struct dir_entry *entry) {
+    return realfs_readdir_typed(fd, entry, NULL);
+}
+
+// positions in a directory are indexes into the listing
 long realfs_telldir(struct fd *fd) {
-    int err = realfs_opendir(fd);
-    if (err < 0)
-        return err;
-    return telldir(fd->dir);
+    return fd->dir_index;
 }
 
 int realfs_seekdir(struct fd *fd, long ptr) {
-    int err = realfs_opendir(fd);
-    if (err < 0)
-        return err;
-    seekdir(fd->dir, ptr);
+    fd->dir_index = ptr;
     return 0;
 }
 
 off_t realfs_lseek(struct fd *fd, off_t offset, int whence) {
+    // seekdir and rewinddir in the guest
+    if (fd->dir_snapshot != NULL && whence == LSEEK_SET) {
+        if (offset < 0)
+            return _EINVAL;
+        fd->dir_index = offset;
+        return offset;
+    }
     if (whence == LSEEK_SET)
         whence = SEEK_SET;
     else if (whence == LSEEK_CUR)
@@ -252,6 +463,7 @@ static int realfs_link(struct mount *mount, const char *src, const char *dst) {
     int res = linkat(mount->root_fd, fix_path(src), mount->root_fd, fix_path(dst), 0);
     if (res < 0)
         return errno_map();
+    dir_cache_invalidate(mount, dst, true);
     return res;
 }
 
@@ -259,6 +471,7 @@ static int realfs_unlink(struct mount *mount, const char *path) {
     int res = unlinkat(mount->root_fd, fix_path(path), 0);
     if (res < 0)
         return errno_map();
+    dir_cache_invalidate(mount, path, true);
     return res;
 }
 
@@ -266,6 +479,7 @@ static int realfs_rmdir(struct mount *mount, const char *path) {
     int err = unlinkat(mount->root_fd, fix_path(path), AT_REMOVEDIR);
     if (err < 0)
         return errno_map();
+    dir_cache_invalidate(mount, path, true);
     return 0;
 }
 
@@ -273,6 +487,8 @@ static int realfs_rename(struct mount *mount, const char *src, const char *dst)
     int err = renameat(mount->root_fd, fix_path(src), mount->root_fd, fix_path(dst));
     if (err < 0)
         return errno_map();
+    dir_cache_invalidate(mount, src, true);
+    dir_cache_invalidate(mount, dst, true);
     return err;
 }
 
@@ -280,6 +496,7 @@ static int realfs_symlink(struct mount *mount, const char *target, const char *l
     int err = symlinkat(target, mount->root_fd, link);
     if (err < 0)
         return errno_map();
+    dir_cache_invalidate(mount, link, true);
     return err;
 }
 
@@ -289,7 +506,8 @@ static int realfs_mknod(struct mount *mount, const char *path, mode_t_ mode, dev
         lock_fchdir(mount->root_fd);
         err = mkfifo(fix_path(path), mode & ~S_IFMT);
         unlock_fchdir();
-    } else if (S_ISREG(mode)) {
+    } else if (S_ISREG(mode) || S_ISSOCK_(mode)) {
+        // local sockets are emulated, all they need on the host is a file
         err = openat(mount->root_fd, fix_path(path), O_CREAT|O_EXCL|O_RDONLY, mode & ~S_IFMT);
         if (err >= 0)
             err = close(err);
@@ -298,6 +516,7 @@ static int realfs_mknod(struct mount *mount, const char *path, mode_t_ mode, dev
     }
     if (err < 0)
         return errno_map();
+    dir_cache_invalidate(mount, path, true);
     return err;
 }
 
@@ -370,6 +589,7 @@ static int realfs_mkdir(struct mount *mount, const char *path, mode_t_ mode) {
     int err = mkdirat(mount->root_fd, fix_path(path), mode);
     if (err < 0)
         return errno_map();
+    dir_cache_invalidate(mount, path, true);
     return 0;
 }
 
@@ -1,3 +1,4 @@
+#include <limits.h>
 #include <string.h>
 #include <sys/stat.h>
 
@@ -5,16 +6,19 @@
 
 #include "fs/fd.h"
 #include "fs/sock.h"
+#include "fs/unix.h"
 
 #include "util/debug.h"
+#include "util/timer.h"
 
 static struct fd_ops socket_fdops;
+static int iovecs_copy(struct iovec_ *iov, uint_t iovlen, char *buf, size_t size, int type);
 
 static fd_t sock_fd_create(int sock_fd, int flags) {
     struct fd *fd = adhoc_fd_create();
     if (fd == NULL)
         return _ENOMEM;
-    fd->stat.mode = S_IFSOCK | 0666;
+    fd->stat.mode = S_IFSOCK_ | 0666;
     fd->real_fd = sock_fd;
     fd->ops = &socket_fdops;
     fd_t f = f_install(fd);
@@ -26,6 +30,8 @@ static fd_t sock_fd_create(int sock_fd, int flags) {
 
 dword_t sys_socket(dword_t domain, dword_t type, dword_t protocol) {
     STRACE("socket(%d, %d, %d)", domain, type, protocol);
+    if (domain == PF_LOCAL_)
+        return unix_socket(type, protocol);
     int real_domain = sock_family_to_real(domain);
     if (real_domain < 0)
         return _EINVAL;
@@ -53,6 +59,21 @@ static struct fd *sock_getfd(fd_t sock_fd) {
     return sock;
 }
 
+static struct fd *unix_getfd(fd_t sock_fd) {
+    struct fd *sock = f_get(sock_fd);
+    if (sock == NULL || !fd_is_unix_socket(sock))
+        return NULL;
+    return sock;
+}
+
+// the msghdr based calls take care of both kinds of socket themselves
+static struct fd *any_sock_getfd(fd_t sock_fd) {
+    struct fd *sock = sock_getfd(sock_fd);
+    if (sock == NULL)
+        sock = unix_getfd(sock_fd);
+    return sock;
+}
+
 static int sockaddr_read(addr_t sockaddr_addr, void *sockaddr, size_t sockaddr_len) {
     if (user_read(sockaddr_addr, sockaddr, sockaddr_len))
         return _EFAULT;
@@ -91,6 +112,9 @@ static int sockaddr_write(addr_t sockaddr_addr, void *sockaddr, size_t sockaddr_
 
 dword_t sys_bind(fd_t sock_fd, addr_t sockaddr_addr, dword_t sockaddr_len) {
     STRACE("bind(%d, 0x%x, %d)", sock_fd, sockaddr_addr, sockaddr_len);
+    struct fd *unix_sock = unix_getfd(sock_fd);
+    if (unix_sock != NULL)
+        return unix_bind(unix_sock, sockaddr_addr, sockaddr_len);
     struct fd *sock = sock_getfd(sock_fd);
     if (sock == NULL)
         return _EBADF;
@@ -107,6 +131,9 @@ dword_t sys_bind(fd_t sock_fd, addr_t sockaddr_addr, dword_t sockaddr_len) {
 
 dword_t sys_connect(fd_t sock_fd, addr_t sockaddr_addr, dword_t sockaddr_len) {
     STRACE("connect(%d, 0x%x, %d)", sock_fd, sockaddr_addr, sockaddr_len);
+    struct fd *unix_sock = unix_getfd(sock_fd);
+    if (unix_sock != NULL)
+        return unix_connect(unix_sock, sockaddr_addr, sockaddr_len);
     struct fd *sock = sock_getfd(sock_fd);
     if (sock == NULL)
         return _EBADF;
@@ -123,6 +150,9 @@ dword_t sys_connect(fd_t sock_fd, addr_t sockaddr_addr, dword_t sockaddr_len) {
 
 dword_t sys_listen(fd_t sock_fd, int_t backlog) {
     STRACE("listen(%d, %d)", sock_fd, backlog);
+    struct fd *unix_sock = unix_getfd(sock_fd);
+    if (unix_sock != NULL)
+        return unix_listen(unix_sock, backlog);
     struct fd *sock = sock_getfd(sock_fd);
     if (sock == NULL)
         return _EBADF;
@@ -134,6 +164,9 @@ dword_t sys_listen(fd_t sock_fd, int_t backlog) {
 
 dword_t sys_accept(fd_t sock_fd, addr_t sockaddr_addr, addr_t sockaddr_len_addr) {
     STRACE("accept(%d, 0x%x, 0x%x)", sock_fd, sockaddr_addr, sockaddr_len_addr);
+    struct fd *unix_sock = unix_getfd(sock_fd);
+    if (unix_sock != NULL)
+        return unix_accept(unix_sock, sockaddr_addr, sockaddr_len_addr);
     struct fd *sock = sock_getfd(sock_fd);
     if (sock == NULL)
         return _EBADF;
@@ -160,6 +193,9 @@ dword_t sys_accept(fd_t sock_fd, addr_t sockaddr_addr, addr_t sockaddr_len_addr)
 
 dword_t sys_getsockname(fd_t sock_fd, addr_t sockaddr_addr, addr_t sockaddr_len_addr) {
     STRACE("getsockname(%d, 0x%x, 0x%x)", sock_fd, sockaddr_addr, sockaddr_len_addr);
+    struct fd *unix_sock = unix_getfd(sock_fd);
+    if (unix_sock != NULL)
+        return unix_getname(unix_sock, sockaddr_addr, sockaddr_len_addr, false);
     struct fd *sock = sock_getfd(sock_fd);
     if (sock == NULL)
         return _EBADF;
@@ -182,6 +218,9 @@ dword_t sys_getsockname(fd_t sock_fd, addr_t sockaddr_addr, addr_t sockaddr_len_
 
 dword_t sys_getpeername(fd_t sock_fd, addr_t sockaddr_addr, addr_t sockaddr_len_addr) {
     STRACE("getpeername(%d, 0x%x, 0x%x)", sock_fd, sockaddr_addr, sockaddr_len_addr);
+    struct fd *unix_sock = unix_getfd(sock_fd);
+    if (unix_sock != NULL)
+        return unix_getname(unix_sock, sockaddr_addr, sockaddr_len_addr, true);
     struct fd *sock = sock_getfd(sock_fd);
     if (sock == NULL)
         return _EBADF;
@@ -204,6 +243,19 @@ dword_t sys_getpeername(fd_t sock_fd, addr_t sockaddr_addr, addr_t sockaddr_len_
 
 dword_t sys_socketpair(dword_t domain, dword_t type, dword_t protocol, addr_t sockets_addr) {
     STRACE("socketpair(%d, %d, %d, 0x%x)", domain, type, protocol, sockets_addr);
+    if (domain == PF_LOCAL_) {
+        fd_t fds[2];
+        int err = unix_socketpair(type, protocol, fds);
+        if (err < 0)
+            return err;
+        if (user_put(sockets_addr, fds)) {
+            sys_close(fds[0]);
+            sys_close(fds[1]);
+            return _EFAULT;
+        }
+        STRACE(" [%d, %d]", fds[0], fds[1]);
+        return 0;
+    }
     int real_domain = sock_family_to_real(domain);
     if (real_domain < 0)
         return _EINVAL;
@@ -243,6 +295,22 @@ close_sockets:
 
 dword_t sys_sendto(fd_t sock_fd, addr_t buffer_addr, dword_t len, dword_t flags, addr_t sockaddr_addr, dword_t sockaddr_len) {
     STRACE("sendto(%d, 0x%x, %d, %d, 0x%x, %d)", sock_fd, buffer_addr, len, flags, sockaddr_addr, sockaddr_len);
+    struct fd *unix_sock = unix_getfd(sock_fd);
+    if (unix_sock != NULL) {
+        if (sock_flags_to_real(flags) < 0)
+            return _EINVAL;
+        if (len > INT_MAX)
+            return _EINVAL;
+        struct iovec_ buffer = {buffer_addr, len};
+        struct iovec iov = {.iov_base = malloc(len + 1), .iov_len = len};
+        if (iov.iov_base == NULL)
+            return _ENOMEM;
+        int err = iovecs_copy(&buffer, 1, iov.iov_base, len, MEM_READ);
+        if (err == 0)
+            err = unix_sendmsg(unix_sock, &iov, 1, sockaddr_addr, sockaddr_len, NULL, flags);
+        free(iov.iov_base);
+        return err;
+    }
     struct fd *sock = sock_getfd(sock_fd);
     if (sock == NULL)
         return _EBADF;
@@ -268,6 +336,31 @@ dword_t sys_sendto(fd_t sock_fd, addr_t buffer_addr, dword_t len, dword_t flags,
 
 dword_t sys_recvfrom(fd_t sock_fd, addr_t buffer_addr, dword_t len, dword_t flags, addr_t sockaddr_addr, addr_t sockaddr_len_addr) {
     STRACE("recvfrom(%d, 0x%x, %d, %d, 0x%x, 0x%x)", sock_fd, buffer_addr, len, flags, sockaddr_addr, sockaddr_len_addr);
+    struct fd *unix_sock = unix_getfd(sock_fd);
+    if (unix_sock != NULL) {
+        struct msghdr_ msg_fake = {};
+        if (sockaddr_addr != 0 && sockaddr_len_addr != 0) {
+            if (user_get(sockaddr_len_addr, msg_fake.msg_namelen))
+                return _EFAULT;
+            msg_fake.msg_name = sockaddr_addr;
+        }
+        if (sock_flags_to_real(flags & ~MSG_CMSG_CLOEXEC_) < 0)
+            return _EINVAL;
+        if (len > INT_MAX)
+            return _EINVAL;
+        struct iovec_ buffer = {buffer_addr, len};
+        struct iovec iov = {.iov_base = malloc(len + 1), .iov_len = len};
+        if (iov.iov_base == NULL)
+            return _ENOMEM;
+        int res = unix_recvmsg(unix_sock, &iov, 1, &msg_fake, flags);
+        if (res > 0 && iovecs_copy(&buffer, 1, iov.iov_base, (dword_t) res < len ? (dword_t) res : len, MEM_WRITE) < 0)
+            res = _EFAULT;
+        free(iov.iov_base);
+        if (res >= 0 && msg_fake.msg_name != 0)
+            if (user_put(sockaddr_len_addr, msg_fake.msg_namelen))
+                return _EFAULT;
+        return res;
+    }
     struct fd *sock = sock_getfd(sock_fd);
     if (sock == NULL)
         return _EBADF;
@@ -302,6 +395,9 @@ dword_t sys_recvfrom(fd_t sock_fd, addr_t buffer_addr, dword_t len, dword_t flag
 
 dword_t sys_shutdown(fd_t sock_fd, dword_t how) {
     STRACE("shutdown(%d, %d)", sock_fd, how);
+    struct fd *unix_sock = unix_getfd(sock_fd);
+    if (unix_sock != NULL)
+        return unix_shutdown(unix_sock, how);
     struct fd *sock = sock_getfd(sock_fd);
     if (sock == NULL)
         return _EBADF;
@@ -313,6 +409,9 @@ dword_t sys_shutdown(fd_t sock_fd, dword_t how) {
 
 dword_t sys_setsockopt(fd_t sock_fd, dword_t level, dword_t option, addr_t value_addr, dword_t value_len) {
     STRACE("setsockopt(%d, %d, %d, 0x%x, %d)", sock_fd, level, option, value_addr, value_len);
+    struct fd *unix_sock = unix_getfd(sock_fd);
+    if (unix_sock != NULL)
+        return unix_setsockopt(unix_sock, level, option, value_addr, value_len);
     struct fd *sock = sock_getfd(sock_fd);
     if (sock == NULL)
         return _EBADF;
@@ -339,6 +438,9 @@ dword_t sys_setsockopt(fd_t sock_fd, dword_t level, dword_t option, addr_t value
 
 dword_t sys_getsockopt(fd_t sock_fd, dword_t level, dword_t option, addr_t value_addr, dword_t len_addr) {
     STRACE("getsockopt(%d, %d, %d, %#x, %#x)", sock_fd, level, option, value_addr, len_addr);
+    struct fd *unix_sock = unix_getfd(sock_fd);
+    if (unix_sock != NULL)
+        return unix_getsockopt(unix_sock, level, option, value_addr, len_addr);
     struct fd *sock = sock_getfd(sock_fd);
     if (sock == NULL)
         return _EBADF;
@@ -377,125 +479,378 @@ dword_t sys_getsockopt(fd_t sock_fd, dword_t level, dword_t option, addr_t value
     return 0;
 }
 
-dword_t sys_recvmsg(fd_t sock_fd, addr_t msghdr_addr, dword_t flags) {
-    STRACE("recvmsg(%d, 0x%x, %d)", sock_fd, msghdr_addr, flags);
-    struct fd *sock = sock_getfd(sock_fd);
-    if (sock == NULL)
-        return _EBADF;
-
-    struct msghdr msg;
-    memset(&msg, 0, sizeof(msg));
-
-    struct msghdr_ msg_fake;
-    if (user_get(msghdr_addr, msg_fake)) {
-        return _EFAULT;
+// Reads an array of guest iovecs. The result comes from malloc.
+static struct iovec_ *iovecs_read(addr_t iov_addr, uint_t iovlen) {
+    if (iovlen > UIO_MAXIOV_)
+        return ERR_PTR(_EINVAL);
+    struct iovec_ *iov = malloc(sizeof(struct iovec_) * iovlen + 1);
+    if (iov == NULL)
+        return ERR_PTR(_ENOMEM);
+    if (user_read(iov_addr, iov, sizeof(struct iovec_) * iovlen)) {
+        free(iov);
+        return ERR_PTR(_EFAULT);
     }
+    return iov;
+}
 
-    // msg_name
-    struct sockaddr msg_name;
-    memset(&msg_name, 0, sizeof(msg_name));
-
-    struct sockaddr_ msg_name_fake;
-    if (msg_fake.msg_name != 0 && msg_fake.msg_namelen != 0) {
-        if (user_get(msg_fake.msg_name, msg_name_fake))
-            return _EFAULT;
-#ifdef __APPLE__
-        msg_name.sa_len = sizeof(msg_name);
-#endif
-        msg_name.sa_family = msg_name_fake.family;
-        memcpy(&msg_name.sa_data, msg_name_fake.data, sizeof(msg_name_fake.data));
-
-        msg.msg_name = (void *)&msg_name;
-        msg.msg_namelen = sizeof(msg_name);
+// Like Linux, the total can't be more than fits in a ssize_t
+static ssize_t iovecs_size(struct iovec_ *iov, uint_t iovlen) {
+    size_t size = 0;
+    for (uint_t i = 0; i < iovlen; i++) {
+        size += iov[i].iov_len;
+        if (size > INT_MAX)
+            return _EINVAL;
     }
+    return size;
+}
 
-    // msg_control (no initial content)
-    char msg_control[msg_fake.msg_controllen];
-    memset(&msg_control, 0, sizeof(msg_control));
-
-    msg.msg_control = (void *)&msg_control;
-    msg.msg_controllen = sizeof(msg_control);
-
-    // msg_iovec (no initial content)
-    struct iovec msg_iov[msg_fake.msg_iovlen];
-    memset(&msg_iov, 0, sizeof(msg_iov));
+// Copies between a host buffer and guest iovecs, a page at a time. Messages
+// go through a host buffer because the host can block in sendmsg or recvmsg,
+// and another thread could unmap the guest memory in the meantime.
+static int iovecs_copy(struct iovec_ *iov, uint_t iovlen, char *buf, size_t size, int type) {
+    for (uint_t i = 0; i < iovlen && size > 0; i++) {
+        addr_t addr = iov[i].iov_base;
+        size_t left = iov[i].iov_len < size ? iov[i].iov_len : size;
+        size -= left;
+        while (left > 0) {
+            char *ptr = mem_ptr(current->mem, addr, type);
+            if (ptr == NULL)
+                return _EFAULT;
+            size_t chunk = PAGE_SIZE - PGOFFSET(addr);
+            if (chunk > left)
+                chunk = left;
+            if (type == MEM_WRITE)
+                memcpy(ptr, buf, chunk);
+            else
+                memcpy(buf, ptr, chunk);
+            addr += chunk;
+            buf += chunk;
+            left -= chunk;
+        }
+    }
+    return 0;
+}
 
-    struct iovec_ msg_iov_fake[msg_fake.msg_iovlen];
-    if (user_get(msg_fake.msg_iov, msg_iov_fake))
-        return _EFAULT;
+void scm_release(struct scm *scm) {
+    for (unsigned i = 0; i < scm->num_fds; i++)
+        fd_close(scm->fds[i]);
+    scm->num_fds = 0;
+}
 
-    for (int i = 0; i < msg_fake.msg_iovlen; i++) {
-        char iov_base[msg_iov_fake[i].iov_len];
-        memset(&iov_base, 0, sizeof(iov_base));
+// Credentials can only be ones the sender could switch to, unless it's root
+static int scm_check_creds(struct ucred_ *creds) {
+    if (superuser())
+        return 0;
+    if (creds->pid != current->tgid)
+        return _EPERM;
+    if (creds->uid != current->uid && creds->uid != current->euid && creds->uid != current->suid)
+        return _EPERM;
+    if (creds->gid != current->gid && creds->gid != current->egid && creds->gid != current->sgid)
+        return _EPERM;
+    return 0;
+}
 
-        msg_iov[i].iov_base = (void *)&iov_base;
-        msg_iov[i].iov_len = sizeof(iov_base);
+int scm_read(addr_t control_addr, uint_t controllen, struct scm *scm) {
+    scm->num_fds = 0;
+    scm->has_creds = false;
+    if (controllen > 65536)
+        return _ENOBUFS;
+    char *control = malloc(controllen);
+    if (control == NULL)
+        return _ENOMEM;
+    int err = _EFAULT;
+    if (user_read(control_addr, control, controllen))
+        goto out;
+
+    for (uint_t off = 0; off + sizeof(struct cmsghdr_) <= controllen; ) {
+        struct cmsghdr_ *cmsg = (void *) (control + off);
+        err = _EINVAL;
+        if (cmsg->len < sizeof(struct cmsghdr_) || cmsg->len > controllen - off)
+            goto out;
+        void *data = cmsg + 1;
+        size_t data_len = cmsg->len - sizeof(struct cmsghdr_);
+
+        if (cmsg->level != SOL_SOCKET_) {
+            TRACE("unimplemented control message level %d\n", cmsg->level);
+        } else if (cmsg->type == SCM_RIGHTS_) {
+            fd_t *fds = data;
+            size_t count = data_len / sizeof(fd_t);
+            if (scm->num_fds + count > SCM_MAX_FD_)
+                goto out;
+            for (size_t i = 0; i < count; i++) {
+                struct fd *fd = f_get(fds[i]);
+                err = _EBADF;
+                if (fd == NULL)
+                    goto out;
+                scm->fds[scm->num_fds++] = fd_retain(fd);
+            }
+        } else if (cmsg->type == SCM_CREDENTIALS_) {
+            if (data_len != sizeof(struct ucred_))
+                goto out;
+            memcpy(&scm->creds, data, sizeof(scm->creds));
+            err = scm_check_creds(&scm->creds);
+            if (err < 0)
+                goto out;
+            scm->has_creds = true;
+        } else {
+            goto out;
+        }
+        off += CMSG_ALIGN_(cmsg->len);
     }
+    err = 0;
 
-    msg.msg_iov = (void *)&msg_iov;
-    msg.msg_iovlen = msg_fake.msg_iovlen;
+out:
+    if (err < 0)
+        scm_release(scm);
+    free(control);
+    return err;
+}
 
-    // msg_flags (no initial content)
-    msg.msg_flags = sock_flags_to_real(msg_fake.msg_flags);
+// Copies an address the host returned into the guest, truncated to the
+// guest's buffer, and returns the full length like Linux does. Host paths
+// for local sockets don't mean anything in the guest, so those come back
+// unnamed.
+static int sockaddr_put(addr_t sockaddr_addr, uint_t max_len, struct sockaddr_storage *sockaddr, socklen_t len) {
+    if (len == 0)
+        return 0;
+    struct sockaddr_ *fake_addr = (void *) sockaddr;
+    fake_addr->family = sock_family_from_real(((struct sockaddr *) sockaddr)->sa_family);
+    if (fake_addr->family == PF_LOCAL_)
+        len = sizeof(fake_addr->family);
+    if (user_write(sockaddr_addr, sockaddr, len < max_len ? len : max_len))
+        return _EFAULT;
+    return len;
+}
 
+// Sends the message described by a guest msghdr that's already been read
+static int sock_sendmsg(struct fd *sock, struct msghdr_ *msg_fake, int flags) {
     int real_flags = sock_flags_to_real(flags);
     if (real_flags < 0)
         return _EINVAL;
+    struct iovec_ *iov_fake = iovecs_read(msg_fake->msg_iov, msg_fake->msg_iovlen);
+    if (IS_ERR(iov_fake))
+        return PTR_ERR(iov_fake);
+
+    struct scm scm = {};
+    char *buf = NULL;
+    ssize_t size = iovecs_size(iov_fake, msg_fake->msg_iovlen);
+    int err = size;
+    if (size < 0)
+        goto out;
+    err = _ENOMEM;
+    buf = malloc(size + 1);
+    if (buf == NULL)
+        goto out;
+    err = iovecs_copy(iov_fake, msg_fake->msg_iovlen, buf, size, MEM_READ);
+    if (err < 0)
+        goto out;
+    struct iovec iov = {.iov_base = buf, .iov_len = size};
 
-    ssize_t res = recvmsg(sock->real_fd, &msg, real_flags);
-
-    // msg_name (changed)
-    memset(&msg_name_fake, 0, sizeof(msg_name_fake));
-
-    if (msg.msg_name != 0 && msg.msg_namelen != 0) {
-        struct sockaddr *msg_name = msg.msg_name;
-
-        msg_name_fake.family = msg_name->sa_family;
-        memcpy(&msg_name_fake.data, msg_name->sa_data, sizeof(msg_name->sa_data));
-
-        if (user_put(msg_fake.msg_name, msg_name_fake)) {
-            return _EFAULT;
-        }
-        msg_fake.msg_namelen = sizeof(msg_name_fake);
+    if (msg_fake->msg_control != 0 && msg_fake->msg_controllen != 0) {
+        err = scm_read(msg_fake->msg_control, msg_fake->msg_controllen, &scm);
+        if (err < 0)
+            goto out;
+    }
+    if (fd_is_unix_socket(sock)) {
+        err = unix_sendmsg(sock, &iov, 1, msg_fake->msg_name, msg_fake->msg_namelen, &scm, flags);
+        goto out;
     }
 
-    // msg_control (changed)
-    uint_t message_offset = 0;
-    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
-        void *cmsg_data = CMSG_DATA(cmsg);
-        uint_t cmsg_data_size = cmsg->cmsg_len - sizeof(cmsg);
-
-        if (user_write(msg_fake.msg_control + message_offset, cmsg, sizeof(cmsg)))
-            return _EFAULT;
-
-        if (user_write(msg_fake.msg_control + message_offset + sizeof(cmsg), cmsg_data, cmsg_data_size))
-            return _EFAULT;
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    struct sockaddr_storage name;
+    if (msg_fake->msg_name != 0 && msg_fake->msg_namelen != 0) {
+        err = _EINVAL;
+        if ((uint_t) msg_fake->msg_namelen > sizeof(name))
+            goto out;
+        err = sockaddr_read(msg_fake->msg_name, &name, msg_fake->msg_namelen);
+        if (err < 0)
+            goto out;
+        msg.msg_name = &name;
+        msg.msg_namelen = msg_fake->msg_namelen;
+    }
+    // Host sockets have no way to carry fds. Credentials are checked and
+    // then dropped, which is what Linux does for sockets that aren't local.
+    err = _EINVAL;
+    if (scm.num_fds > 0)
+        goto out;
+
+    ssize_t res = sendmsg(sock->real_fd, &msg, real_flags);
+    err = res < 0 ? errno_map() : res;
+out:
+    scm_release(&scm);
+    free(buf);
+    free(iov_fake);
+    return err;
+}
 
-        message_offset += cmsg->cmsg_len;
+// Receives into the buffers described by a guest msghdr, and updates the
+// fields recvmsg changes, without writing it back
+static int sock_recvmsg(struct fd *sock, struct msghdr_ *msg_fake, int flags) {
+    int real_flags = sock_flags_to_real(flags & ~MSG_CMSG_CLOEXEC_);
+    if (real_flags < 0)
+        return _EINVAL;
+    struct iovec_ *iov_fake = iovecs_read(msg_fake->msg_iov, msg_fake->msg_iovlen);
+    if (IS_ERR(iov_fake))
+        return PTR_ERR(iov_fake);
+
+    char *buf = NULL;
+    ssize_t size = iovecs_size(iov_fake, msg_fake->msg_iovlen);
+    int err = size;
+    if (size < 0)
+        goto out;
+    err = _ENOMEM;
+    buf = malloc(size + 1);
+    if (buf == NULL)
+        goto out;
+    struct iovec iov = {.iov_base = buf, .iov_len = size};
+    if (fd_is_unix_socket(sock)) {
+        err = unix_recvmsg(sock, &iov, 1, msg_fake, flags);
+        goto out;
     }
 
-    msg_fake.msg_controllen = message_offset;
+    struct msghdr msg = {};
+    struct sockaddr_storage name;
+    if (msg_fake->msg_name != 0) {
+        msg.msg_name = &name;
+        msg.msg_namelen = sizeof(name);
+    }
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
 
-    // msg_iovec (changed)
-    for (int i = 0; i < msg.msg_iovlen; i++) {
-        if (user_write(msg_iov_fake[i].iov_base, msg_iov[i].iov_base, msg_iov[i].iov_len))
-            return _EFAULT;
+    ssize_t res = recvmsg(sock->real_fd, &msg, real_flags);
+    if (res < 0) {
+        err = errno_map();
+        goto out;
+    }
 
-        msg_iov_fake[i].iov_len = msg_iov[i].iov_len;
+    msg_fake->msg_flags = sock_flags_from_real(msg.msg_flags);
+    // nothing that comes from a host socket has control messages
+    msg_fake->msg_controllen = 0;
+    if (msg_fake->msg_name != 0) {
+        err = sockaddr_put(msg_fake->msg_name, msg_fake->msg_namelen, &name, msg.msg_namelen);
+        if (err < 0)
+            goto out;
+        msg_fake->msg_namelen = err;
     }
+    err = res;
+out:
+    // with MSG_TRUNC the result can be more than what was received
+    if (err > 0 && iovecs_copy(iov_fake, msg_fake->msg_iovlen, buf, err < size ? err : size, MEM_WRITE) < 0)
+        err = _EFAULT;
+    free(buf);
+    free(iov_fake);
+    return err;
+}
 
-    if (user_put(msg_fake.msg_iov, msg_iov_fake))
+dword_t sys_sendmsg(fd_t sock_fd, addr_t msghdr_addr, dword_t flags) {
+    STRACE("sendmsg(%d, 0x%x, %d)", sock_fd, msghdr_addr, flags);
+    struct fd *sock = any_sock_getfd(sock_fd);
+    if (sock == NULL)
+        return _EBADF;
+    struct msghdr_ msg_fake;
+    if (user_get(msghdr_addr, msg_fake))
         return _EFAULT;
+    return sock_sendmsg(sock, &msg_fake, flags);
+}
 
-    // msg_flags (changed)
-    msg_fake.msg_flags = sock_flags_from_real(msg.msg_flags);
-
-    if (user_put(msghdr_addr, msg_fake)) {
+dword_t sys_recvmsg(fd_t sock_fd, addr_t msghdr_addr, dword_t flags) {
+    STRACE("recvmsg(%d, 0x%x, %d)", sock_fd, msghdr_addr, flags);
+    struct fd *sock = any_sock_getfd(sock_fd);
+    if (sock == NULL)
+        return _EBADF;
+    struct msghdr_ msg_fake;
+    if (user_get(msghdr_addr, msg_fake))
         return _EFAULT;
+    int res = sock_recvmsg(sock, &msg_fake, flags);
+    if (res >= 0 && user_put(msghdr_addr, msg_fake))
+        return _EFAULT;
+    return res;
+}
+
+// The whole mmsghdr array is read in one go and written back in one go.
+// Like Linux, an error after some messages went through ends the batch and
+// the count so far is returned.
+
+dword_t sys_sendmmsg(fd_t sock_fd, addr_t msgvec_addr, uint_t vlen, dword_t flags) {
+    STRACE("sendmmsg(%d, 0x%x, %u, %d)", sock_fd, msgvec_addr, vlen, flags);
+    struct fd *sock = any_sock_getfd(sock_fd);
+    if (sock == NULL)
+        return _EBADF;
+    if (vlen > UIO_MAXIOV_)
+        vlen = UIO_MAXIOV_;
+    if (vlen == 0)
+        return 0;
+    struct mmsghdr_ *msgvec = malloc(sizeof(struct mmsghdr_) * vlen);
+    if (msgvec == NULL)
+        return _ENOMEM;
+    int res = _EFAULT;
+    if (user_read(msgvec_addr, msgvec, sizeof(struct mmsghdr_) * vlen))
+        goto out;
+
+    uint_t count;
+    for (count = 0; count < vlen; count++) {
+        res = sock_sendmsg(sock, &msgvec[count].msg_hdr, flags);
+        if (res < 0)
+            break;
+        msgvec[count].msg_len = res;
+    }
+    if (count > 0) {
+        res = count;
+        if (user_write(msgvec_addr, msgvec, sizeof(struct mmsghdr_) * count))
+            res = _EFAULT;
     }
+out:
+    free(msgvec);
+    return res;
+}
 
-    if (res < 0)
-        return errno_map();
+dword_t sys_recvmmsg(fd_t sock_fd, addr_t msgvec_addr, uint_t vlen, dword_t flags, addr_t timeout_addr) {
+    STRACE("recvmmsg(%d, 0x%x, %u, %d, 0x%x)", sock_fd, msgvec_addr, vlen, flags, timeout_addr);
+    struct fd *sock = any_sock_getfd(sock_fd);
+    if (sock == NULL)
+        return _EBADF;
+    // the timeout is only checked after each message, same as Linux
+    struct timespec deadline = {};
+    if (timeout_addr != 0) {
+        struct timespec_ timeout;
+        if (user_get(timeout_addr, timeout))
+            return _EFAULT;
+        struct timespec timeout_real = {.tv_sec = timeout.sec, .tv_nsec = timeout.nsec};
+        deadline = timespec_add(timespec_now(), timeout_real);
+    }
+    if (vlen > UIO_MAXIOV_)
+        vlen = UIO_MAXIOV_;
+    if (vlen == 0)
+        return 0;
+    struct mmsghdr_ *msgvec = malloc(sizeof(struct mmsghdr_) * vlen);
+    if (msgvec == NULL)
+        return _ENOMEM;
+    int res = _EFAULT;
+    if (user_read(msgvec_addr, msgvec, sizeof(struct mmsghdr_) * vlen))
+        goto out;
+
+    uint_t count;
+    for (count = 0; count < vlen; count++) {
+        res = sock_recvmsg(sock, &msgvec[count].msg_hdr, flags & ~MSG_WAITFORONE_);
+        if (res < 0)
+            break;
+        msgvec[count].msg_len = res;
+        if (flags & MSG_WAITFORONE_)
+            flags |= MSG_DONTWAIT_;
+        if (timeout_addr != 0 && !timespec_positive(timespec_subtract(deadline, timespec_now()))) {
+            count++;
+            break;
+        }
+    }
+    if (count > 0) {
+        res = count;
+        if (user_write(msgvec_addr, msgvec, sizeof(struct mmsghdr_) * count))
+            res = _EFAULT;
+    }
+out:
+    free(msgvec);
     return res;
 }
 
@@ -527,11 +882,11 @@ static struct socket_call {
     {(syscall_t) sys_shutdown, 2},
     {(syscall_t) sys_setsockopt, 5},
     {(syscall_t) sys_getsockopt, 5},
-    {NULL}, // sendmsg
+    {(syscall_t) sys_sendmsg, 3},
     {(syscall_t) sys_recvmsg, 3},
     {NULL}, // accept4
-    {NULL}, // recvmmsg
-    {NULL}, // sendmmsg
+    {(syscall_t) sys_recvmmsg, 5},
+    {(syscall_t) sys_sendmmsg, 4},
 };
 
 dword_t sys_socketcall(dword_t call_num, addr_t args_addr) {
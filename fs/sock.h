@@ -18,6 +18,9 @@
 #include "util/debug.h"
 
 dword_t sys_socketcall(dword_t call_num, addr_t args_addr);
+// these two have their own syscall numbers as well as going through socketcall
+dword_t sys_sendmmsg(fd_t sock_fd, addr_t msgvec_addr, uint_t vlen, dword_t flags);
+dword_t sys_recvmmsg(fd_t sock_fd, addr_t msgvec_addr, uint_t vlen, dword_t flags, addr_t timeout_addr);
 
 struct sockaddr_ {
     uint16_t family;
@@ -43,6 +46,44 @@ struct iovec_ {
   uint_t iov_len;
 };
 
+struct mmsghdr_ {
+    struct msghdr_ msg_hdr;
+    uint_t msg_len;
+};
+
+struct cmsghdr_ {
+    uint_t len;
+    int_t level;
+    int_t type;
+};
+// control messages are aligned to sizeof(long), which is 4 on i386
+#define CMSG_ALIGN_(len) (((len) + sizeof(dword_t) - 1) & ~(sizeof(dword_t) - 1))
+#define CMSG_LEN_(len) (sizeof(struct cmsghdr_) + (len))
+
+#define SCM_RIGHTS_ 1
+#define SCM_CREDENTIALS_ 2
+#define SCM_MAX_FD_ 253
+
+struct ucred_ {
+    pid_t_ pid;
+    uid_t_ uid;
+    uid_t_ gid;
+};
+
+// Control messages from sendmsg, checked and turned into something that
+// doesn't depend on the guest's layout. Holds a reference to each fd.
+struct fd;
+struct scm {
+    struct fd *fds[SCM_MAX_FD_];
+    unsigned num_fds;
+    bool has_creds;
+    struct ucred_ creds;
+};
+int scm_read(addr_t control_addr, uint_t controllen, struct scm *scm);
+void scm_release(struct scm *scm);
+
+#define UIO_MAXIOV_ 1024
+
 #define PF_LOCAL_ 1
 #define PF_INET_ 2
 #define PF_INET6_ 10
@@ -98,8 +139,19 @@ static inline int sock_type_to_real(int type, int protocol) {
 #define MSG_DONTWAIT_ 0x40
 #define MSG_EOR_    0x80
 #define MSG_WAITALL_ 0x100
-
+#define MSG_NOSIGNAL_ 0x4000
+#define MSG_WAITFORONE_ 0x10000
+#define MSG_BATCH_ 0x40000
+#define MSG_ZEROCOPY_ 0x4000000
+#define MSG_FASTOPEN_ 0x20000000
+#define MSG_CMSG_CLOEXEC_ 0x40000000
+// every bit below 0x10000 is a Linux flag, and these are the rest
+#define MSG_KNOWN_ (0xffff|MSG_WAITFORONE_|MSG_BATCH_|MSG_ZEROCOPY_|MSG_FASTOPEN_|MSG_CMSG_CLOEXEC_)
+
+// Flags that aren't Linux flags at all are _EINVAL
 static inline int sock_flags_to_real(int fake) {
+    if (fake & ~MSG_KNOWN_)
+        return _EINVAL;
     int real = 0;
     if (fake & MSG_OOB_) real |= MSG_OOB;
     if (fake & MSG_PEEK_) real |= MSG_PEEK;
@@ -108,7 +160,8 @@ static inline int sock_flags_to_real(int fake) {
     if (fake & MSG_DONTWAIT_) real |= MSG_DONTWAIT;
     if (fake & MSG_EOR_) real |= MSG_EOR;
     if (fake & MSG_WAITALL_) real |= MSG_WAITALL;
-    if (fake & ~(MSG_OOB_|MSG_PEEK_|MSG_CTRUNC_|MSG_TRUNC_|MSG_DONTWAIT_|MSG_EOR_|MSG_WAITALL_))
+    // host sockets never raise SIGPIPE in the guest, so MSG_NOSIGNAL is a no-op
+    if (fake & ~(MSG_OOB_|MSG_PEEK_|MSG_CTRUNC_|MSG_TRUNC_|MSG_DONTWAIT_|MSG_EOR_|MSG_WAITALL_|MSG_NOSIGNAL_))
         TRACE("unimplemented socket flags %d\n", fake);
     return real;
 }
@@ -134,6 +187,10 @@ static inline int sock_flags_from_real(int real) {
 #define SO_BROADCAST_ 6
 #define SO_KEEPALIVE_ 9
 #define SO_SNDBUF_ 7
+#define SO_RCVBUF_ 8
+#define SO_PASSCRED_ 16
+#define SO_PEERCRED_ 17
+#define SO_ACCEPTCONN_ 30
 #define IP_TOS_ 1
 #define IP_TTL_ 2
 #define IP_HDRINCL_ 3
@@ -22,6 +22,11 @@ struct statbuf {
     dword_t ctime_nsec;
 };
 
+// Windows has no sockets in the filesystem, so the host headers can't be
+// counted on for this one
+#define S_IFSOCK_ 0140000
+#define S_ISSOCK_(mode) (((mode) & 0170000) == S_IFSOCK_)
+
 struct oldstat {
     word_t dev;
     word_t ino;
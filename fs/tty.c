@@ -5,48 +5,88 @@
 #include "fs/poll.h"
 #include "fs/tty.h"
 
-// TODO remove magic number
-struct tty_driver tty_drivers[2];
+static int pty_slave_open(struct tty *tty);
+static int pty_master_open(struct tty *tty);
+static ssize_t pty_write(struct tty *tty, const void *buf, size_t len);
+
+struct tty_driver tty_drivers[TTY_TYPES] = {
+    [TTY_PSEUDO] = {.open = pty_slave_open, .write = pty_write},
+    [TTY_PSEUDO_MASTER] = {.open = pty_master_open, .write = pty_write},
+};
 
 // currently supports 64 ptys
 // TODO replace with hashtable
-// for future reference, if you run out of ptys the error code is ENOSPC
-static struct tty *ttys[2][64];
+static struct tty *ttys[TTY_TYPES][MAX_PTYS];
 // lock this before locking a tty
 static lock_t ttys_lock = LOCK_INITIALIZER;
 
+static void tty_free(struct tty *tty) {
+    cond_destroy(&tty->produced);
+    cond_destroy(&tty->consumed);
+    free(tty->buf);
+    free(tty->buf_flag);
+    free(tty);
+}
+
+// must hold ttys_lock, the new tty has no references yet
+static struct tty *tty_create(int type, int num) {
+    struct tty *tty = malloc(sizeof(struct tty));
+    if (tty == NULL)
+        return ERR_PTR(_ENOMEM);
+    tty->buf = malloc(TTY_BUF_MIN);
+    tty->buf_flag = calloc(BITS_SIZE(TTY_BUF_MIN), 1);
+    if (tty->buf == NULL || tty->buf_flag == NULL) {
+        free(tty->buf);
+        free(tty->buf_flag);
+        free(tty);
+        return ERR_PTR(_ENOMEM);
+    }
+    tty->buf_capacity = TTY_BUF_MIN;
+    tty->refcount = 0;
+    tty->type = type;
+    tty->num = num;
+    list_init(&tty->fds);
+    // the driver fills this in
+    memset(&tty->termios, 0, sizeof(tty->termios));
+    memset(&tty->winsize, 0, sizeof(tty->winsize));
+    lock_init(&tty->lock);
+    lock_init(&tty->fds_lock);
+    cond_init(&tty->produced);
+    cond_init(&tty->consumed);
+    tty->buf_start = 0;
+    tty->bufsize = 0;
+    tty->buf_flags = 0;
+    tty->pty_other = NULL;
+    tty->pty_locked = false;
+    tty->hung_up = false;
+    tty->closed = false;
+    tty->wake_pending = false;
+
+    tty->driver = &tty_drivers[type];
+    if (tty->driver->open) {
+        int err = tty->driver->open(tty);
+        if (err < 0) {
+            tty_free(tty);
+            return ERR_PTR(err);
+        }
+    }
+
+    tty->session = 0;
+    tty->fg_group = 0;
+
+    ttys[type][num] = tty;
+    return tty;
+}
+
 static int tty_get(int type, int num, struct tty **tty_out) {
     lock(&ttys_lock);
     struct tty *tty = ttys[type][num];
     if (tty == NULL) {
-        tty = malloc(sizeof(struct tty));
-        if (tty == NULL)
-            return _ENOMEM;
-        tty->refcount = 0;
-        tty->type = type;
-        tty->num = num;
-        list_init(&tty->fds);
-        // TODO default termios
-        memset(&tty->winsize, 0, sizeof(tty->winsize));
-        lock_init(&tty->lock);
-        lock_init(&tty->fds_lock);
-        cond_init(&tty->produced);
-        memset(tty->buf_flag, false, sizeof(tty->buf_flag));
-        tty->bufsize = 0;
-
-        tty->driver = &tty_drivers[type];
-        if (tty->driver->open) {
-            int err = tty->driver->open(tty);
-            if (err < 0) {
-                unlock(&ttys_lock);
-                return err;
-            }
+        tty = tty_create(type, num);
+        if (IS_ERR(tty)) {
+            unlock(&ttys_lock);
+            return PTR_ERR(tty);
         }
-
-        tty->session = 0;
-        tty->fg_group = 0;
-
-        ttys[type][num] = tty;
     }
     lock(&tty->lock);
     tty->refcount++;
@@ -56,20 +96,190 @@ static int tty_get(int type, int num, struct tty **tty_out) {
     return 0;
 }
 
+static void tty_wake(struct tty *tty);
+static void tty_wake_fds(struct tty *tty);
+
+// The master is going away. Returns the group that should get SIGHUP.
+static dword_t pty_hangup(struct tty *slave) {
+    lock(&slave->lock);
+    slave->pty_other = NULL;
+    slave->hung_up = true;
+    dword_t fg_group = slave->fg_group;
+    tty_wake(slave);
+    unlock(&slave->lock);
+    return fg_group;
+}
+
 void tty_release(struct tty *tty) {
+    struct tty *slave = NULL;
+    dword_t hup_group = 0;
     lock(&ttys_lock);
     lock(&tty->lock);
     if (--tty->refcount == 0) {
         if (tty->driver->close)
             tty->driver->close(tty);
         ttys[tty->type][tty->num] = NULL;
+        if (tty->type == TTY_PSEUDO_MASTER)
+            slave = tty->pty_other;
         unlock(&tty->lock);
-        cond_destroy(&tty->produced);
-        free(tty);
+        // after this nothing can get to the master from the slave
+        if (slave != NULL)
+            hup_group = pty_hangup(slave);
+        tty_free(tty);
     } else {
         unlock(&tty->lock);
     }
     unlock(&ttys_lock);
+    if (slave != NULL) {
+        if (hup_group != 0)
+            send_group_signal(hup_group, SIGHUP_);
+        tty_release(slave);
+    }
+}
+
+static int ptmx_open(struct tty **tty_out) {
+    lock(&ttys_lock);
+    int num;
+    for (num = 0; num < MAX_PTYS; num++) {
+        if (ttys[TTY_PSEUDO_MASTER][num] == NULL && ttys[TTY_PSEUDO][num] == NULL)
+            break;
+    }
+    if (num == MAX_PTYS) {
+        unlock(&ttys_lock);
+        return _ENOSPC;
+    }
+
+    struct tty *slave = tty_create(TTY_PSEUDO, num);
+    if (IS_ERR(slave)) {
+        unlock(&ttys_lock);
+        return PTR_ERR(slave);
+    }
+    struct tty *master = tty_create(TTY_PSEUDO_MASTER, num);
+    if (IS_ERR(master)) {
+        ttys[TTY_PSEUDO][num] = NULL;
+        tty_free(slave);
+        unlock(&ttys_lock);
+        return PTR_ERR(master);
+    }
+    master->refcount = 1;
+    master->pty_other = slave;
+    slave->refcount = 1; // held by the master
+    slave->pty_other = master;
+    slave->pty_locked = true;
+    slave->pty_uid = current->euid;
+    slave->pty_gid = current->egid;
+    unlock(&ttys_lock);
+    *tty_out = master;
+    return 0;
+}
+
+static int pty_slave_get(int num, struct tty **tty_out) {
+    if (num >= MAX_PTYS)
+        return _ENXIO;
+    lock(&ttys_lock);
+    struct tty *slave = ttys[TTY_PSEUDO][num];
+    if (slave == NULL) {
+        unlock(&ttys_lock);
+        return _ENXIO;
+    }
+    lock(&slave->lock);
+    if (slave->pty_locked || slave->hung_up) {
+        unlock(&slave->lock);
+        unlock(&ttys_lock);
+        return _EIO;
+    }
+    slave->refcount++;
+    slave->closed = false;
+    struct tty *master = slave->pty_other;
+    lock(&master->lock);
+    master->hung_up = false;
+    unlock(&master->lock);
+    unlock(&slave->lock);
+    unlock(&ttys_lock);
+    *tty_out = slave;
+    return 0;
+}
+
+bool pty_exists(int num, uid_t_ *uid_out, uid_t_ *gid_out) {
+    if (num < 0 || num >= MAX_PTYS)
+        return false;
+    lock(&ttys_lock);
+    struct tty *slave = ttys[TTY_PSEUDO][num];
+    if (slave != NULL) {
+        *uid_out = slave->pty_uid;
+        *gid_out = slave->pty_gid;
+    }
+    unlock(&ttys_lock);
+    return slave != NULL;
+}
+
+static int pty_slave_open(struct tty *tty) {
+    // what linux gives a new pty
+    tty->termios.iflags = ICRNL_;
+    tty->termios.oflags = OPOST_ | ONLCR_;
+    tty->termios.cflags = 0xbf; // B38400 | CS8 | CREAD
+    tty->termios.lflags = ISIG_ | ICANON_ | ECHO_ | ECHOE_ | ECHOK_ | ECHOCTL_;
+    unsigned char *cc = tty->termios.cc;
+    cc[VINTR_] = '\x03';
+    cc[VQUIT_] = '\x1c';
+    cc[VERASE_] = '\x7f';
+    cc[VKILL_] = '\x15';
+    cc[VEOF_] = '\x04';
+    cc[VMIN_] = 1;
+    cc[VSTART_] = '\x11';
+    cc[VSTOP_] = '\x13';
+    cc[VSUSP_] = '\x1a';
+    cc[VREPRINT_] = '\x12';
+    cc[VDISCARD_] = '\x0f';
+    cc[VWERASE_] = '\x17';
+    cc[VLNEXT_] = '\x16';
+    return 0;
+}
+
+static int pty_master_open(struct tty *tty) {
+    // raw, so whatever the slave writes comes out as is
+    tty->termios.cc[VMIN_] = 1;
+    return 0;
+}
+
+static bool tty_input_locked(struct tty *tty, const char *input, size_t size);
+static size_t tty_room(struct tty *tty);
+
+// Only echo comes through here, writes from an fd go through pty_transfer.
+// Echo on one side of a pty is input to the other side. That side is locked,
+// and poll_wait calls tty_poll with the poll locked, so the other side's fds
+// can't be woken from here. It's left for whoever is writing to this side to
+// do once nothing is locked. Echo that doesn't fit is dropped.
+static ssize_t pty_write(struct tty *tty, const void *buf, size_t len) {
+    struct tty *other = tty->pty_other;
+    if (other == NULL)
+        return _EIO;
+    lock(&other->lock);
+    if (len > tty_room(other))
+        len = tty_room(other);
+    if (tty_input_locked(other, buf, len)) {
+        notify(&other->produced);
+        other->wake_pending = true;
+    }
+    unlock(&other->lock);
+    return len;
+}
+
+// Gets a reference to the master from the locked slave, so it can be used
+// after the slave is unlocked. NULL if the master is gone or going away.
+static struct tty *pty_master_get(struct tty *slave) {
+    struct tty *master = slave->pty_other;
+    if (master == NULL)
+        return NULL;
+    lock(&master->lock);
+    if (master->refcount == 0) {
+        // tty_release is waiting for the slave lock to hang it up
+        unlock(&master->lock);
+        return NULL;
+    }
+    master->refcount++;
+    unlock(&master->lock);
+    return master;
 }
 
 static void tty_set_controlling(struct tgroup *group, struct tty *tty) {
@@ -92,16 +302,23 @@ static int tty_open(int major, int minor, int type, struct fd *fd) {
         tty = current->group->tty;
         if (tty == NULL) {
             unlock(&current->group->lock);
+            unlock(&ttys_lock);
             return _ENXIO;
         }
         tty->refcount++;
         unlock(&current->group->lock);
         unlock(&ttys_lock);
+    } else if (major == 5 && minor == 2) {
+        int err = ptmx_open(&tty);
+        if (err < 0)
+            return err;
+    } else if (major == TTY_PSEUDO_SLAVE_MAJOR) {
+        int err = pty_slave_get(minor, &tty);
+        if (err < 0)
+            return err;
     } else {
         if (major == 4 && minor < 64)
             type = TTY_VIRTUAL;
-        else if (major >= 136 && major <= 143)
-            type = TTY_PSEUDO;
         else
             assert(false);
         int err = tty_get(type, minor, &tty);
@@ -114,8 +331,9 @@ static int tty_open(int major, int minor, int type, struct fd *fd) {
     list_add(&tty->fds, &fd->other_fds);
     unlock(&tty->fds_lock);
 
+    // a pty master can't be a controlling terminal
     lock(&pids_lock);
-    if (current->group->sid == current->pid) {
+    if (current->group->sid == current->pid && tty->type != TTY_PSEUDO_MASTER) {
         tty_set_controlling(current->group, tty);
     }
     unlock(&pids_lock);
@@ -124,36 +342,176 @@ static int tty_open(int major, int minor, int type, struct fd *fd) {
 }
 
 static int tty_close(struct fd *fd) {
-    if (fd->tty != NULL) {
-        lock(&fd->tty->fds_lock);
+    struct tty *tty = fd->tty;
+    if (tty != NULL) {
+        lock(&tty->fds_lock);
         list_remove(&fd->other_fds);
-        unlock(&fd->tty->fds_lock);
-        tty_release(fd->tty);
+        bool last = list_empty(&tty->fds);
+        unlock(&tty->fds_lock);
+        if (last && (tty->type == TTY_PSEUDO || tty->type == TTY_PSEUDO_MASTER)) {
+            struct tty *master = NULL;
+            lock(&tty->lock);
+            // writers on the other side waiting for this side to read give up
+            tty->closed = true;
+            notify(&tty->consumed);
+            if (tty->type == TTY_PSEUDO) {
+                // reads on the master get EIO until the slave is opened again
+                master = pty_master_get(tty);
+                if (master != NULL) {
+                    lock(&master->lock);
+                    master->hung_up = true;
+                    notify(&master->produced);
+                    unlock(&master->lock);
+                }
+            }
+            unlock(&tty->lock);
+            if (master != NULL) {
+                tty_wake_fds(master);
+                tty_release(master);
+            }
+        }
+        tty_release(tty);
     }
     return 0;
 }
 
-static void tty_wake(struct tty *tty) {
-    notify(&tty->produced);
-    unlock(&tty->lock);
+// tty can't be locked, or any other tty, since poll_wait locks a tty inside
+// the poll lock
+static void tty_wake_fds(struct tty *tty) {
     struct fd *fd;
     lock(&tty->fds_lock);
     list_for_each_entry(&tty->fds, fd, other_fds) {
         poll_wake(fd);
     }
     unlock(&tty->fds_lock);
+}
+
+// tty is locked, and gets unlocked for a bit to wake up the fds
+static void tty_wake(struct tty *tty) {
+    notify(&tty->produced);
+    unlock(&tty->lock);
+    tty_wake_fds(tty);
     lock(&tty->lock);
 }
 
+// Delivers the wakeup pty_write left on this side.
+static void pty_wake_pending(struct tty *tty) {
+    lock(&tty->lock);
+    if (tty->wake_pending) {
+        tty->wake_pending = false;
+        tty_wake(tty);
+    }
+    unlock(&tty->lock);
+}
+
+// index into buf of the i'th byte of queued input
+static inline size_t tty_buf_index(struct tty *tty, size_t i) {
+    return (tty->buf_start + i) & (tty->buf_capacity - 1);
+}
+static inline char tty_buf_char(struct tty *tty, size_t i) {
+    return tty->buf[tty_buf_index(tty, i)];
+}
+static inline bool tty_buf_flag(struct tty *tty, size_t i) {
+    return bit_test(tty_buf_index(tty, i), tty->buf_flag);
+}
+
+// copies queued input out without consuming it
+static void tty_buf_copy(struct tty *tty, char *dst, size_t size) {
+    size_t start = tty_buf_index(tty, 0);
+    size_t first = tty->buf_capacity - start;
+    if (first > size)
+        first = size;
+    memcpy(dst, tty->buf + start, first);
+    memcpy(dst + first, tty->buf, size - first);
+}
+
+// Replaces buf with one of the given capacity, moving the queued input to
+// the start. Returns false if that doesn't work out.
+static bool tty_buf_resize(struct tty *tty, size_t capacity) {
+    char *buf = malloc(capacity);
+    bits_t *buf_flag = calloc(BITS_SIZE(capacity), 1);
+    if (buf == NULL || buf_flag == NULL) {
+        free(buf);
+        free(buf_flag);
+        return false;
+    }
+    tty_buf_copy(tty, buf, tty->bufsize);
+    if (tty->buf_flags > 0) {
+        for (size_t i = 0; i < tty->bufsize; i++)
+            if (tty_buf_flag(tty, i))
+                bit_set(i, buf_flag);
+    }
+    free(tty->buf);
+    free(tty->buf_flag);
+    tty->buf = buf;
+    tty->buf_flag = buf_flag;
+    tty->buf_capacity = capacity;
+    tty->buf_start = 0;
+    return true;
+}
+
+// Makes room for size more bytes, or as many as will fit. Returns how many.
+static size_t tty_buf_reserve(struct tty *tty, size_t size) {
+    if (tty->bufsize + size > tty->buf_capacity) {
+        size_t capacity = tty->buf_capacity;
+        while (capacity < tty->bufsize + size && capacity < TTY_BUF_MAX)
+            capacity *= 2;
+        if (capacity != tty->buf_capacity)
+            tty_buf_resize(tty, capacity);
+    }
+    if (size > tty->buf_capacity - tty->bufsize)
+        size = tty->buf_capacity - tty->bufsize;
+    return size;
+}
+
+static void tty_buf_clear(struct tty *tty) {
+    if (tty->buf_flags > 0)
+        memset(tty->buf_flag, 0, BITS_SIZE(tty->buf_capacity));
+    tty->buf_start = 0;
+    tty->bufsize = 0;
+    tty->buf_flags = 0;
+    notify(&tty->consumed);
+}
+
+// How much more input fits in the queue. A full canonical queue without a
+// line in it would never be read from, so then input gets dropped like on
+// linux instead of waiting for room.
+static size_t tty_room(struct tty *tty) {
+    if (tty->termios.lflags & ICANON_ && tty->buf_flags == 0 && tty->bufsize >= TTY_BUF_MAX)
+        return TTY_BUF_MAX;
+    return TTY_BUF_MAX - tty->bufsize;
+}
+
+// A pty write waits until there's room for at least this much, enough for
+// the longest output processing expansion (\n to \r\n).
+#define PTY_WRITE_MIN 2
+
 static void tty_push_char(struct tty *tty, char ch, bool flag) {
-    if (tty->bufsize >= sizeof(tty->buf))
+    if (tty_buf_reserve(tty, 1) == 0)
         return;
-    tty->buf[tty->bufsize] = ch;
-    tty->buf_flag[tty->bufsize++] = flag;
+    size_t index = tty_buf_index(tty, tty->bufsize++);
+    tty->buf[index] = ch;
+    if (flag) {
+        bit_set(index, tty->buf_flag);
+        tty->buf_flags++;
+    }
 }
 
-int tty_input(struct tty *tty, const char *input, size_t size) {
-    lock(&tty->lock);
+static void tty_push(struct tty *tty, const char *input, size_t size) {
+    size = tty_buf_reserve(tty, size);
+    size_t end = tty_buf_index(tty, tty->bufsize);
+    size_t first = tty->buf_capacity - end;
+    if (first > size)
+        first = size;
+    memcpy(tty->buf + end, input, first);
+    memcpy(tty->buf, input + first, size - first);
+    tty->bufsize += size;
+}
+
+// tty must be locked. Returns whether readers should be woken up, which the
+// caller does with tty_wake once that's safe.
+static bool tty_input_locked(struct tty *tty, const char *input, size_t size) {
+    bool wake = false;
     dword_t lflags = tty->termios.lflags;
     dword_t iflags = tty->termios.iflags;
     unsigned char *cc = tty->termios.cc;
@@ -202,12 +560,12 @@ int tty_input(struct tty *tty, const char *input, size_t size) {
                     echo = false;
                 for (int i = 0; i < count; i++) {
                     // don't delete past a flag
-                    if (tty->buf_flag[tty->bufsize - 1])
+                    if (tty_buf_flag(tty, tty->bufsize - 1))
                         break;
                     tty->bufsize--;
                     if (echo) {
                         tty->driver->write(tty, "\b \b", 3);
-                        if (SHOULD_ECHOCTL(tty->buf[tty->bufsize]))
+                        if (SHOULD_ECHOCTL(tty_buf_char(tty, tty->bufsize)))
                             tty->driver->write(tty, "\b \b", 3);
                     }
                 }
@@ -222,7 +580,7 @@ int tty_input(struct tty *tty, const char *input, size_t size) {
 canon_wake:
                 tty_push_char(tty, ch, true);
                 echo = false;
-                tty_wake(tty);
+                wake = true;
             } else {
                 tty_push_char(tty, ch, false);
             }
@@ -236,30 +594,58 @@ canon_wake:
             }
         }
     } else {
-        if (size > sizeof(tty->buf) - 1 - tty->bufsize)
-            size = sizeof(tty->buf) - 1 - tty->bufsize;
-        memcpy(tty->buf + tty->bufsize, input, size);
-        tty->bufsize += size;
-        tty_wake(tty);
+        tty_push(tty, input, size);
+        wake = true;
     }
+    return wake;
+}
 
+int tty_input(struct tty *tty, const char *input, size_t size) {
+    lock(&tty->lock);
+    if (tty_input_locked(tty, input, size))
+        tty_wake(tty);
     unlock(&tty->lock);
     return 0;
 }
 
 // expects bufsize <= tty->bufsize
 static void tty_read_into_buf(struct tty *tty, void *buf, size_t bufsize) {
-    memcpy(buf, tty->buf, bufsize);
+    tty_buf_copy(tty, buf, bufsize);
+    if (tty->buf_flags > 0) {
+        for (size_t i = 0; i < bufsize; i++) {
+            size_t index = tty_buf_index(tty, i);
+            if (bit_test(index, tty->buf_flag)) {
+                bit_clear(index, tty->buf_flag);
+                tty->buf_flags--;
+            }
+        }
+    }
+    tty->buf_start = tty_buf_index(tty, bufsize);
     tty->bufsize -= bufsize;
-    memmove(tty->buf, tty->buf + bufsize, tty->bufsize); // magic!
-    memmove(tty->buf_flag, tty->buf_flag + bufsize, tty->bufsize);
+    if (tty->bufsize == 0) {
+        tty->buf_start = 0;
+        // give back the memory from a big paste
+        if (tty->buf_capacity > TTY_BUF_MIN)
+            tty_buf_resize(tty, TTY_BUF_MIN);
+    }
 }
 
 static ssize_t tty_canon_size(struct tty *tty) {
-    bool *flag_ptr = memchr(tty->buf_flag, true, tty->bufsize);
-    if (flag_ptr == NULL)
+    if (tty->buf_flags == 0)
         return -1;
-    return flag_ptr - tty->buf_flag + 1;
+    size_t i = 0;
+    while (i < tty->bufsize) {
+        size_t index = tty_buf_index(tty, i);
+        // skip over 8 at a time where there are none
+        if (index % 8 == 0 && i + 8 <= tty->bufsize && ((char *) tty->buf_flag)[index / 8] == 0) {
+            i += 8;
+            continue;
+        }
+        if (bit_test(index, tty->buf_flag))
+            return i + 1;
+        i++;
+    }
+    return -1;
 }
 
 static ssize_t tty_read(struct fd *fd, void *buf, size_t bufsize) {
@@ -267,15 +653,27 @@ static ssize_t tty_read(struct fd *fd, void *buf, size_t bufsize) {
         return 0;
 
     struct tty *tty = fd->tty;
+    ssize_t err;
     lock(&tty->lock);
     if (tty->termios.lflags & ICANON_) {
         ssize_t canon_size = -1;
         while ((canon_size = tty_canon_size(tty)) == -1) {
+            if (tty->hung_up) {
+                // no more lines are coming, take what's there
+                if (tty->bufsize == 0)
+                    goto hung_up;
+                canon_size = tty->bufsize;
+                break;
+            }
+            err = _EAGAIN;
+            if (fd->flags & O_NONBLOCK_)
+                goto error;
+            err = _EINTR;
             if (wait_for(&tty->produced, &tty->lock, NULL))
-                goto eintr;
+                goto error;
         }
         // null byte means eof was typed
-        if (tty->buf[canon_size-1] == '\0')
+        if (tty_buf_char(tty, canon_size - 1) == '\0')
             canon_size--;
 
         if (bufsize > canon_size)
@@ -287,8 +685,19 @@ static ssize_t tty_read(struct fd *fd, void *buf, size_t bufsize) {
             // no need to wait for anything
         } else if (min > 0 && time == 0) {
             while (tty->bufsize < min) {
+                if (tty->hung_up) {
+                    if (tty->bufsize == 0)
+                        goto hung_up;
+                    break;
+                }
+                err = _EAGAIN;
+                if (fd->flags & O_NONBLOCK_ && tty->bufsize == 0)
+                    goto error;
+                if (fd->flags & O_NONBLOCK_)
+                    break;
+                err = _EINTR;
                 if (wait_for(&tty->produced, &tty->lock, NULL))
-                    goto eintr;
+                    goto error;
             }
         } else {
             TODO("VTIME != 0");
@@ -297,36 +706,175 @@ static ssize_t tty_read(struct fd *fd, void *buf, size_t bufsize) {
 
     if (bufsize > tty->bufsize)
         bufsize = tty->bufsize;
+    bool was_full = tty_room(tty) < PTY_WRITE_MIN;
     tty_read_into_buf(tty, buf, bufsize);
-    if (tty->bufsize > 0 && tty->buf[0] == '\0' && tty->buf_flag[0]) {
+    if (tty->bufsize > 0 && tty_buf_char(tty, 0) == '\0' && tty_buf_flag(tty, 0)) {
         // remove the eof so the next read can succeed
         char dummy;
         tty_read_into_buf(tty, &dummy, 1);
     }
 
+    // writers on the other side of a pty can go again
+    struct tty *writer = NULL;
+    if (was_full) {
+        notify(&tty->consumed);
+        if (tty->type == TTY_PSEUDO)
+            writer = pty_master_get(tty);
+        else if (tty->type == TTY_PSEUDO_MASTER)
+            writer = tty->pty_other;
+    }
     unlock(&tty->lock);
+    if (writer != NULL) {
+        tty_wake_fds(writer);
+        if (tty->type == TTY_PSEUDO)
+            tty_release(writer);
+    }
     return bufsize;
-eintr:
+hung_up:
+    // end of file on the slave, EIO on the master like linux
+    err = tty->type == TTY_PSEUDO_MASTER ? _EIO : 0;
+error:
     unlock(&tty->lock);
-    return _EINTR;
+    return err;
+}
+
+#define TTY_OUT_BUF_SIZE 4096
+
+static const char *tty_out_find(const char *start, const char *end, char ch, bool wanted) {
+    if (!wanted)
+        return end;
+    const char *found = memchr(start, ch, end - start);
+    return found != NULL ? found : end;
+}
+
+// Output processing only ever touches \r and \n, so find those with memchr
+// and copy everything in between in as few pieces as possible. Fills out with
+// at most out_size bytes, never half of a \r\n, and returns how much of buf
+// that took.
+static size_t tty_opost(const char *buf, size_t size, dword_t oflags, char *out, size_t out_size, size_t *out_len) {
+    const char *end = buf + size;
+    bool cr_special = oflags & (ONLRET_ | OCRNL_);
+    bool nl_special = oflags & ONLCR_;
+    const char *next_cr = tty_out_find(buf, end, '\r', cr_special);
+    const char *next_nl = tty_out_find(buf, end, '\n', nl_special);
+
+    const char *p = buf;
+    size_t n = 0;
+    while (p < end) {
+        const char *special = next_cr < next_nl ? next_cr : next_nl;
+        size_t run = special - p;
+        if (run > out_size - n)
+            run = out_size - n;
+        memcpy(out + n, p, run);
+        n += run;
+        p += run;
+        if (p != special || special == end)
+            break;
+        if (*special == '\r') {
+            if (!(oflags & ONLRET_)) {
+                if (n == out_size)
+                    break;
+                out[n++] = '\n'; // OCRNL
+            }
+            next_cr = tty_out_find(special + 1, end, '\r', cr_special);
+        } else {
+            if (out_size - n < 2)
+                break;
+            out[n++] = '\r';
+            out[n++] = '\n';
+            next_nl = tty_out_find(special + 1, end, '\n', nl_special);
+        }
+        p = special + 1;
+    }
+    *out_len = n;
+    return p - buf;
+}
+
+static void tty_write_opost(struct tty *tty, const char *buf, size_t size, dword_t oflags) {
+    char out[TTY_OUT_BUF_SIZE];
+    while (size > 0) {
+        size_t out_len;
+        size_t used = tty_opost(buf, size, oflags, out, sizeof(out), &out_len);
+        tty->driver->write(tty, out, out_len);
+        buf += used;
+        size -= used;
+    }
+}
+
+// Writes from one side of a pty go into the input queue on the other side.
+// When that's full this waits for the other side to read, or fails with
+// EAGAIN if the fd is nonblocking. Nothing can be locked, and the caller
+// keeps other around.
+static ssize_t pty_transfer(struct fd *fd, struct tty *other, const char *buf, size_t size, dword_t oflags) {
+    char out[TTY_OUT_BUF_SIZE];
+    size_t done = 0;
+    ssize_t err = 0;
+    lock(&other->lock);
+    while (done < size) {
+        size_t room = tty_room(other);
+        if (room < PTY_WRITE_MIN) {
+            err = _EIO;
+            if (other->closed)
+                break;
+            err = _EAGAIN;
+            if (fd->flags & O_NONBLOCK_)
+                break;
+            // echo for this side may be pending, and this could take a while
+            unlock(&other->lock);
+            pty_wake_pending(fd->tty);
+            lock(&other->lock);
+            if (tty_room(other) < PTY_WRITE_MIN && !other->closed) {
+                err = _EINTR;
+                if (wait_for(&other->consumed, &other->lock, NULL))
+                    break;
+            }
+            continue;
+        }
+
+        const char *input = buf + done;
+        size_t input_size;
+        if (oflags & OPOST_) {
+            if (room > sizeof(out))
+                room = sizeof(out);
+            done += tty_opost(input, size - done, oflags, out, room, &input_size);
+            input = out;
+        } else {
+            input_size = size - done < room ? size - done : room;
+            done += input_size;
+        }
+        if (tty_input_locked(other, input, input_size))
+            tty_wake(other);
+    }
+    unlock(&other->lock);
+    pty_wake_pending(fd->tty);
+    if (done > 0)
+        return done;
+    return err;
 }
 
 static ssize_t tty_write(struct fd *fd, const void *buf, size_t bufsize) {
     struct tty *tty = fd->tty;
+    if (tty->type == TTY_PSEUDO_MASTER) {
+        // no output processing, and the master keeps the slave around
+        return pty_transfer(fd, tty->pty_other, buf, bufsize, 0);
+    }
     lock(&tty->lock);
+    if (tty->hung_up && tty->type == TTY_PSEUDO) {
+        unlock(&tty->lock);
+        return _EIO;
+    }
     dword_t oflags = tty->termios.oflags;
+    if (tty->type == TTY_PSEUDO) {
+        struct tty *master = pty_master_get(tty);
+        unlock(&tty->lock);
+        if (master == NULL)
+            return _EIO;
+        ssize_t res = pty_transfer(fd, master, buf, bufsize, oflags);
+        tty_release(master);
+        return res;
+    }
     if (oflags & OPOST_) {
-        const char *cbuf = buf;
-        for (size_t i = 0; i < bufsize; i++) {
-            char ch = cbuf[i];
-            if (ch == '\r' && oflags & ONLRET_)
-                continue;
-            else if (ch == '\r' && oflags & OCRNL_)
-                ch = '\n';
-            else if (ch == '\n' && oflags & ONLCR_)
-                tty->driver->write(tty, "\r", 1);
-            tty->driver->write(tty, &ch, 1);
-        }
+        tty_write_opost(tty, buf, bufsize, oflags);
     } else {
         tty->driver->write(tty, buf, bufsize);
     }
@@ -334,10 +882,20 @@ static ssize_t tty_write(struct fd *fd, const void *buf, size_t bufsize) {
     return bufsize;
 }
 
+// whether a write from the other side of a pty would go through right away
+static bool pty_writable(struct tty *other) {
+    lock(&other->lock);
+    bool writable = other->closed || tty_room(other) >= PTY_WRITE_MIN;
+    unlock(&other->lock);
+    return writable;
+}
+
 static int tty_poll(struct fd *fd) {
     struct tty *tty = fd->tty;
     lock(&tty->lock);
-    int types = POLL_WRITE;
+    int types = 0;
+    if (tty->hung_up)
+        types |= POLL_READ | POLL_HUP;
     if (tty->termios.lflags & ICANON_) {
         if (tty_canon_size(tty) != -1)
             types |= POLL_READ;
@@ -345,7 +903,17 @@ static int tty_poll(struct fd *fd) {
         if (tty->bufsize > 0)
             types |= POLL_READ;
     }
+    if (tty->type == TTY_PSEUDO) {
+        // the slave lock keeps the master around, and comes first
+        if (tty->pty_other == NULL || pty_writable(tty->pty_other))
+            types |= POLL_WRITE;
+    } else if (tty->type != TTY_PSEUDO_MASTER) {
+        types |= POLL_WRITE;
+    }
     unlock(&tty->lock);
+    // the slave has to be locked before the master
+    if (tty->type == TTY_PSEUDO_MASTER && pty_writable(tty->pty_other))
+        types |= POLL_WRITE;
     return types;
 }
 
@@ -359,6 +927,8 @@ static int tty_poll(struct fd *fd) {
 #define TIOCSPGRP_ 0x5410
 #define TIOCGWINSZ_ 0x5413
 #define TIOCSWINSZ_ 0x5414
+#define TIOCGPTN_ 0x80045430
+#define TIOCSPTLCK_ 0x40045431
 #define TCIFLUSH_ 0
 #define TCOFLUSH_ 1
 #define TCIOFLUSH_ 2
@@ -371,6 +941,7 @@ static ssize_t tty_ioctl_size(struct fd *fd, int cmd) {
         case TIOCGPRGP_: case TIOCSPGRP_: return sizeof(dword_t);
         case TIOCGWINSZ_: case TIOCSWINSZ_: return sizeof(struct winsize_);
         case FIONREAD_: return sizeof(dword_t);
+        case TIOCGPTN_: case TIOCSPTLCK_: return sizeof(dword_t);
     }
     return -1;
 }
@@ -416,9 +987,37 @@ out:
     return err;
 }
 
+static int pty_master_ioctl(struct tty *master, int cmd, void *arg) {
+    struct tty *slave = master->pty_other;
+    switch (cmd) {
+        case TIOCGPTN_:
+            *(dword_t *) arg = master->num;
+            return 0;
+        case TIOCSPTLCK_:
+            lock(&slave->lock);
+            slave->pty_locked = *(dword_t *) arg != 0;
+            unlock(&slave->lock);
+            return 0;
+    }
+    return _ENOTTY;
+}
+
 static int tty_ioctl(struct fd *fd, int cmd, void *arg) {
     int err = 0;
     struct tty *tty = fd->tty;
+    if (cmd == TIOCGPTN_ || cmd == TIOCSPTLCK_) {
+        if (tty->type != TTY_PSEUDO_MASTER)
+            return _ENOTTY;
+        return pty_master_ioctl(tty, cmd, arg);
+    }
+    // the master shares the slave's settings and window size
+    if (tty->type == TTY_PSEUDO_MASTER) {
+        switch (cmd) {
+            case TCGETS_: case TCSETS_: case TCSETSW_: case TCSETSF_:
+            case TIOCGWINSZ_: case TIOCSWINSZ_:
+                tty = tty->pty_other;
+        }
+    }
     lock(&tty->lock);
 
     switch (cmd) {
@@ -426,7 +1025,7 @@ static int tty_ioctl(struct fd *fd, int cmd, void *arg) {
             *(struct termios_ *) arg = tty->termios;
             break;
         case TCSETSF_:
-            tty->bufsize = 0;
+            tty_buf_clear(tty);
         case TCSETSW_:
             // we have no output buffer currently
         case TCSETS_:
@@ -438,7 +1037,7 @@ static int tty_ioctl(struct fd *fd, int cmd, void *arg) {
             switch ((dword_t) arg) {
                 case TCIFLUSH_:
                 case TCIOFLUSH_:
-                    tty->bufsize = 0;
+                    tty_buf_clear(tty);
                     break;
                 case TCOFLUSH_:
                     break;
@@ -473,10 +1072,10 @@ static int tty_ioctl(struct fd *fd, int cmd, void *arg) {
             break;
 
         case TIOCGWINSZ_:
-            *(struct winsize_ *) arg = fd->tty->winsize;
+            *(struct winsize_ *) arg = tty->winsize;
             break;
         case TIOCSWINSZ_:
-            tty_set_winsize(fd->tty, *(struct winsize_ *) arg);
+            tty_set_winsize(tty, *(struct winsize_ *) arg);
             break;
 
         case FIONREAD_:
@@ -506,4 +1105,3 @@ struct dev_ops tty_dev = {
     .fd.ioctl_size = tty_ioctl_size,
     .fd.ioctl = tty_ioctl,
 };
-/* struct dev_ops ptmx_dev = {.open = ptmx_open}; */
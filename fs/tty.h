@@ -3,6 +3,7 @@
 
 #include "kernel/fs.h"
 #include "fs/dev.h"
+#include "util/bits.h"
 
 struct winsize_ {
     word_t row;
@@ -57,7 +58,12 @@ struct termios_ {
 #define ONLRET_ (1 << 5)
 
 #define TTY_VIRTUAL 0
-#define TTY_PSEUDO 1
+#define TTY_PSEUDO 1 // the slave side of a pty
+#define TTY_PSEUDO_MASTER 2
+#define TTY_TYPES 3
+
+#define TTY_PSEUDO_SLAVE_MAJOR 136
+#define MAX_PTYS 64
 
 struct tty_driver {
     int (*open)(struct tty *tty);
@@ -65,21 +71,29 @@ struct tty_driver {
     void (*close)(struct tty *tty);
 };
 
-// TODO remove magic number
-extern struct tty_driver tty_drivers[2];
+extern struct tty_driver tty_drivers[TTY_TYPES];
 extern struct tty_driver real_tty_driver;
 
 struct tty {
     unsigned refcount;
     struct tty_driver *driver;
 
-#define TTY_BUF_SIZE 4096
-    char buf[TTY_BUF_SIZE];
+    // Input is queued in a ring buffer, which starts out small and doubles
+    // when it fills up, up to TTY_BUF_MAX. It shrinks back when it's empty.
+#define TTY_BUF_MIN 4096
+#define TTY_BUF_MAX (1 << 20)
+    char *buf;
     // A flag is a marker indicating the end of a canonical mode input. Flags
     // are created by EOL and EOF characters. You can't backspace past a flag.
-    bool buf_flag[TTY_BUF_SIZE];
+    // One bit per byte of buf, bits outside the queued input are always clear.
+    bits_t *buf_flag;
+    size_t buf_capacity; // always a power of two
+    size_t buf_start;
     size_t bufsize;
+    size_t buf_flags; // number of flags set
     cond_t produced;
+    // signalled when a full queue gets read from, pty writers wait on this
+    cond_t consumed;
 
     struct winsize_ winsize;
     struct termios_ termios;
@@ -95,6 +109,23 @@ struct tty {
 
     lock_t lock;
 
+    // For ptys, the other side of the pair. The master holds a reference to
+    // the slave, and the slave's pointer back is cleared when the master goes
+    // away. If both need locking, lock the slave first.
+    struct tty *pty_other;
+    bool pty_locked; // the slave can't be opened until unlockpt
+    uid_t_ pty_uid;
+    uid_t_ pty_gid;
+    // For a slave, the master is gone. For a master, nothing has the slave
+    // open anymore.
+    bool hung_up;
+    // Nothing has this side of a pty open anymore, so writes from the other
+    // side that would have to wait for it to read fail instead.
+    bool closed;
+    // Echo from the other side of a pty was queued here while that side was
+    // locked, and the fds haven't been woken up for it yet.
+    bool wake_pending;
+
     union {
         // for real tty driver
         pthread_t thread;
@@ -104,10 +135,9 @@ struct tty {
 
 int tty_input(struct tty *tty, const char *input, size_t len);
 void tty_set_winsize(struct tty *tty, struct winsize_ winsize);
+// For devpts. Returns false if there's no pty with this number.
+bool pty_exists(int num, uid_t_ *uid_out, uid_t_ *gid_out);
 
 extern struct dev_ops tty_dev;
-extern struct dev_ops ptmx_dev;
-extern struct fd_ops tty_master_fd;
-extern struct fd_ops tty_slave_fd;
 
 #endif
@@ -0,0 +1,1209 @@
+#include <stdio.h>
+#include <string.h>
+#include "kernel/calls.h"
+#include "kernel/fs.h"
+#include "fs/fd.h"
+#include "fs/path.h"
+#include "fs/poll.h"
+#include "fs/stat.h"
+#include "fs/unix.h"
+#include "util/list.h"
+#include "util/debug.h"
+
+// Each socket has a queue of messages sent to it. Stream sockets read
+// across message boundaries, but keeping the messages around means fds and
+// credentials stay attached to the bytes they were sent with.
+struct unix_msg {
+    struct list queue;
+    size_t size;
+    size_t offset; // how much a stream read already took
+    struct ucred_ creds;
+    struct fd **fds;
+    unsigned num_fds;
+    struct sockaddr_un_ from;
+    uint_t from_len;
+    char data[];
+};
+
+struct unix_sock {
+    atomic_uint refcount;
+    int type;
+
+    // these are protected by unix_lock
+    struct sockaddr_un_ name;
+    uint_t name_len; // 0 if not bound
+    qword_t name_dev;
+    dword_t name_inode;
+    struct list bound;
+
+    lock_t lock;
+    // notified when messages are added or removed, on connections and
+    // accepts, and on shutdown and close
+    cond_t cond;
+    // The other end of a stream connection, or where datagrams go by
+    // default. Holds a reference.
+    struct unix_sock *peer;
+    bool connected; // a stream socket that has ever had a peer
+    struct list queue;
+    size_t queued; // bytes in the queue
+    size_t rcvbuf;
+    bool closed;
+    bool shut_rd;
+    bool shut_wr;
+    bool rcv_eof; // the peer won't send any more
+    bool peer_closed;
+    bool passcred;
+    bool has_peer_creds;
+    struct ucred_ peer_creds;
+    bool listening;
+    // connections waiting for accept, linked by their pending field
+    struct list backlog;
+    struct list pending;
+    unsigned backlog_count;
+    unsigned backlog_max;
+
+    // For poll_wake, which can't be called with the socket locked, same as
+    // the ends of a pipe
+    struct fd *fd;
+    lock_t fd_lock;
+};
+
+#define UNIX_RCVBUF_DEFAULT 212992
+#define UNIX_RCVBUF_MIN 2048
+#define UNIX_RCVBUF_MAX (4 << 20)
+// stream writes are queued in messages of at most this size
+#define UNIX_STREAM_CHUNK 65536
+#define SOMAXCONN_ 4096
+
+static lock_t unix_lock = LOCK_INITIALIZER;
+static struct list unix_bound = {&unix_bound, &unix_bound};
+
+static struct fd_ops unix_fdops;
+static void unix_sock_hangup(struct unix_sock *sock);
+
+bool fd_is_unix_socket(struct fd *fd) {
+    return fd->ops == &unix_fdops;
+}
+
+static struct unix_sock *unix_sock_new(int type) {
+    struct unix_sock *sock = calloc(1, sizeof(struct unix_sock));
+    if (sock == NULL)
+        return NULL;
+    sock->refcount = 1;
+    sock->type = type;
+    lock_init(&sock->lock);
+    cond_init(&sock->cond);
+    list_init(&sock->queue);
+    list_init(&sock->backlog);
+    sock->rcvbuf = UNIX_RCVBUF_DEFAULT;
+    lock_init(&sock->fd_lock);
+    return sock;
+}
+
+static struct unix_sock *unix_sock_retain(struct unix_sock *sock) {
+    sock->refcount++;
+    return sock;
+}
+
+static void unix_msg_free(struct unix_msg *msg) {
+    for (unsigned i = 0; i < msg->num_fds; i++)
+        fd_close(msg->fds[i]);
+    free(msg->fds);
+    free(msg);
+}
+
+// Closing the fds in the queue can close other sockets, so this has to be
+// called without any socket locks held.
+static void unix_sock_release(struct unix_sock *sock) {
+    if (--sock->refcount > 0)
+        return;
+    struct unix_msg *msg, *tmp;
+    list_for_each_entry_safe(&sock->queue, msg, tmp, queue) {
+        list_remove(&msg->queue);
+        unix_msg_free(msg);
+    }
+    free(sock);
+}
+
+static void unix_wake(struct unix_sock *sock) {
+    lock(&sock->fd_lock);
+    if (sock->fd != NULL)
+        poll_wake(sock->fd);
+    unlock(&sock->fd_lock);
+}
+
+static struct unix_sock *unix_get_peer(struct unix_sock *sock) {
+    lock(&sock->lock);
+    struct unix_sock *peer = sock->peer;
+    if (peer != NULL)
+        unix_sock_retain(peer);
+    unlock(&sock->lock);
+    return peer;
+}
+
+static struct ucred_ unix_current_creds() {
+    return (struct ucred_) {
+        .pid = current->tgid,
+        .uid = current->euid,
+        .gid = current->egid,
+    };
+}
+
+static struct fd *unix_fd_create(struct unix_sock *sock) {
+    struct fd *fd = adhoc_fd_create();
+    if (fd == NULL)
+        return NULL;
+    fd->ops = &unix_fdops;
+    fd->unix_sock = sock;
+    fd->flags = O_RDWR_;
+    fd->stat.mode = S_IFSOCK_ | 0777;
+    fd->stat.uid = current->euid;
+    fd->stat.gid = current->egid;
+    sock->fd = fd;
+    return fd;
+}
+
+// Reads a name from the guest and returns the length of the path part,
+// which is 0 if there's only the family. Path names end at the first NUL,
+// abstract names start with one and go to the end of the address.
+static int unix_name_read(addr_t addr, uint_t addr_len, struct sockaddr_un_ *name) {
+    if (addr_len < sizeof(name->family) || addr_len > sizeof(*name))
+        return _EINVAL;
+    memset(name, 0, sizeof(*name));
+    if (user_read(addr, name, addr_len))
+        return _EFAULT;
+    if (name->family != AF_LOCAL_)
+        return _EINVAL;
+    uint_t len = addr_len - sizeof(name->family);
+    if (len > 0 && name->path[0] != '\0')
+        len = strnlen(name->path, len);
+    return len;
+}
+
+// Copies a name to the guest, truncated to *len_addr, and sets *len_addr
+// to the full length
+static int unix_name_write(addr_t addr, addr_t len_addr, struct sockaddr_un_ *name, uint_t name_len) {
+    dword_t max_len;
+    if (user_get(len_addr, max_len))
+        return _EFAULT;
+    if (name_len == 0)
+        name_len = sizeof(name->family);
+    name->family = AF_LOCAL_;
+    if (user_write(addr, name, name_len < max_len ? name_len : max_len))
+        return _EFAULT;
+    if (user_put(len_addr, name_len))
+        return _EFAULT;
+    return 0;
+}
+
+static void unix_copy_name(struct unix_sock *sock, struct sockaddr_un_ *name, uint_t *name_len) {
+    lock(&unix_lock);
+    *name = sock->name;
+    *name_len = sock->name_len;
+    unlock(&unix_lock);
+}
+
+// Finds the socket bound to a name and returns it with a reference
+static int unix_find(struct sockaddr_un_ *name, uint_t len, struct unix_sock **sock_out) {
+    bool abstract = name->path[0] == '\0';
+    struct statbuf stat;
+    if (!abstract) {
+        char path[sizeof(name->path) + 1] = {};
+        memcpy(path, name->path, len);
+        int err = generic_statat(AT_PWD, path, &stat, true);
+        if (err < 0)
+            return err;
+    }
+
+    struct unix_sock *sock;
+    lock(&unix_lock);
+    list_for_each_entry(&unix_bound, sock, bound) {
+        bool match;
+        if (abstract)
+            match = sock->name.path[0] == '\0' &&
+                sock->name_len == sizeof(name->family) + len &&
+                memcmp(sock->name.path, name->path, len) == 0;
+        else
+            match = sock->name.path[0] != '\0' &&
+                sock->name_dev == stat.dev && sock->name_inode == stat.inode;
+        if (match) {
+            *sock_out = unix_sock_retain(sock);
+            unlock(&unix_lock);
+            return 0;
+        }
+    }
+    unlock(&unix_lock);
+    return _ECONNREFUSED;
+}
+
+// Gives the socket a name and makes it findable. unix_lock has to be held.
+static int unix_bind_locked(struct unix_sock *sock, struct sockaddr_un_ *name, uint_t len) {
+    if (sock->name_len != 0)
+        return _EINVAL;
+    sock->name = *name;
+    sock->name_len = sizeof(name->family) + len;
+    list_add(&unix_bound, &sock->bound);
+    return 0;
+}
+
+// Binds to an unused abstract name, which is what happens when a socket
+// that has no name needs one
+static int unix_autobind(struct unix_sock *sock) {
+    static unsigned next_name;
+    struct sockaddr_un_ name = {.family = AF_LOCAL_};
+    lock(&unix_lock);
+    if (sock->name_len != 0) {
+        unlock(&unix_lock);
+        return 0;
+    }
+    for (unsigned tries = 0; tries < 0x100000; tries++) {
+        sprintf(name.path + 1, "%05x", next_name++ & 0xfffff);
+        struct unix_sock *other;
+        bool used = false;
+        list_for_each_entry(&unix_bound, other, bound) {
+            if (other->name.path[0] == '\0' && memcmp(other->name.path, name.path, 6) == 0) {
+                used = true;
+                break;
+            }
+        }
+        if (!used) {
+            int err = unix_bind_locked(sock, &name, 6);
+            unlock(&unix_lock);
+            return err;
+        }
+    }
+    unlock(&unix_lock);
+    return _EADDRINUSE;
+}
+
+fd_t unix_socket(dword_t type, dword_t protocol) {
+    if (protocol != 0)
+        return _EPROTONOSUPPORT;
+    if ((type & 0xff) != SOCK_STREAM_ && (type & 0xff) != SOCK_DGRAM_)
+        return _ESOCKTNOSUPPORT;
+    struct unix_sock *sock = unix_sock_new(type & 0xff);
+    if (sock == NULL)
+        return _ENOMEM;
+    struct fd *fd = unix_fd_create(sock);
+    if (fd == NULL) {
+        unix_sock_release(sock);
+        return _ENOMEM;
+    }
+    return f_install_flags(fd, type & (SOCK_CLOEXEC_|SOCK_NONBLOCK_));
+}
+
+int unix_socketpair(dword_t type, dword_t protocol, fd_t fds[2]) {
+    if (protocol != 0)
+        return _EPROTONOSUPPORT;
+    if ((type & 0xff) != SOCK_STREAM_ && (type & 0xff) != SOCK_DGRAM_)
+        return _ESOCKTNOSUPPORT;
+    struct unix_sock *socks[2] = {};
+    struct fd *sock_fds[2] = {};
+    for (int i = 0; i < 2; i++) {
+        socks[i] = unix_sock_new(type & 0xff);
+        if (socks[i] == NULL)
+            goto nomem;
+        sock_fds[i] = unix_fd_create(socks[i]);
+        if (sock_fds[i] == NULL)
+            goto nomem;
+    }
+    for (int i = 0; i < 2; i++) {
+        socks[i]->peer = unix_sock_retain(socks[!i]);
+        socks[i]->connected = true;
+        socks[i]->has_peer_creds = true;
+        socks[i]->peer_creds = unix_current_creds();
+    }
+
+    int flags = type & (SOCK_CLOEXEC_|SOCK_NONBLOCK_);
+    fds[0] = f_install_flags(sock_fds[0], flags);
+    if (fds[0] < 0) {
+        fd_close(sock_fds[1]);
+        return fds[0];
+    }
+    fds[1] = f_install_flags(sock_fds[1], flags);
+    if (fds[1] < 0) {
+        f_close(fds[0]);
+        return fds[1];
+    }
+    return 0;
+
+nomem:
+    // once a socket has an fd, closing the fd takes care of it
+    for (int i = 0; i < 2; i++) {
+        if (sock_fds[i] != NULL)
+            fd_close(sock_fds[i]);
+        else if (socks[i] != NULL)
+            unix_sock_release(socks[i]);
+    }
+    return _ENOMEM;
+}
+
+int unix_bind(struct fd *fd, addr_t addr, uint_t addr_len) {
+    struct unix_sock *sock = fd->unix_sock;
+    struct sockaddr_un_ name;
+    int len = unix_name_read(addr, addr_len, &name);
+    if (len < 0)
+        return len;
+    if (len == 0)
+        return unix_autobind(sock);
+
+    if (name.path[0] == '\0') {
+        lock(&unix_lock);
+        struct unix_sock *other;
+        list_for_each_entry(&unix_bound, other, bound) {
+            if (other->name.path[0] == '\0' &&
+                    other->name_len == sizeof(name.family) + len &&
+                    memcmp(other->name.path, name.path, len) == 0) {
+                unlock(&unix_lock);
+                return _EADDRINUSE;
+            }
+        }
+        int err = unix_bind_locked(sock, &name, len);
+        unlock(&unix_lock);
+        return err;
+    }
+
+    lock(&unix_lock);
+    bool bound = sock->name_len != 0;
+    unlock(&unix_lock);
+    if (bound)
+        return _EINVAL;
+
+    // The socket shows up in the filesystem, and connect finds it again
+    // by the device and inode of that file.
+    char path[sizeof(name.path) + 1] = {};
+    memcpy(path, name.path, len);
+    lock(&current->fs->lock);
+    mode_t_ mode = S_IFSOCK_ | (0777 & ~current->fs->umask);
+    unlock(&current->fs->lock);
+    int err = generic_mknod(path, mode, 0);
+    if (err == _EEXIST)
+        return _EADDRINUSE;
+    if (err < 0)
+        return err;
+    struct statbuf stat;
+    err = generic_statat(AT_PWD, path, &stat, false);
+    if (err < 0)
+        return err;
+
+    lock(&unix_lock);
+    // the terminating NUL counts as part of the name
+    err = unix_bind_locked(sock, &name, len + 1);
+    if (err >= 0) {
+        sock->name_dev = stat.dev;
+        sock->name_inode = stat.inode;
+    }
+    unlock(&unix_lock);
+    return err;
+}
+
+int unix_connect(struct fd *fd, addr_t addr, uint_t addr_len) {
+    struct unix_sock *sock = fd->unix_sock;
+    struct sockaddr_un_ name;
+    int len = unix_name_read(addr, addr_len, &name);
+    if (len < 0)
+        return len;
+    if (len == 0)
+        return _EINVAL;
+    struct unix_sock *target;
+    int err = unix_find(&name, len, &target);
+    if (err < 0)
+        return err;
+    if (target->type != sock->type) {
+        unix_sock_release(target);
+        return _EPROTOTYPE;
+    }
+
+    if (sock->type == SOCK_DGRAM_) {
+        lock(&sock->lock);
+        struct unix_sock *old_peer = sock->peer;
+        sock->peer = target;
+        unlock(&sock->lock);
+        if (old_peer != NULL)
+            unix_sock_release(old_peer);
+        return 0;
+    }
+
+    lock(&sock->lock);
+    err = 0;
+    if (sock->connected)
+        err = _EISCONN;
+    else if (sock->listening)
+        err = _EINVAL;
+    unlock(&sock->lock);
+    if (err < 0)
+        goto out;
+
+    // this becomes the socket accept returns
+    err = _ENOMEM;
+    struct unix_sock *server = unix_sock_new(SOCK_STREAM_);
+    if (server == NULL)
+        goto out;
+    lock(&target->lock);
+    while (target->listening && target->backlog_count > target->backlog_max) {
+        if (fd->flags & O_NONBLOCK_) {
+            err = _EAGAIN;
+            goto out_unlock;
+        }
+        if (wait_for(&target->cond, &target->lock, NULL)) {
+            err = _EINTR;
+            goto out_unlock;
+        }
+    }
+    err = _ECONNREFUSED;
+    if (!target->listening)
+        goto out_unlock;
+
+    // nobody else can see the server socket until it's on the backlog
+    server->peer = unix_sock_retain(sock);
+    server->connected = true;
+    server->has_peer_creds = true;
+    server->peer_creds = unix_current_creds();
+    lock(&unix_lock);
+    server->name = target->name;
+    server->name_len = target->name_len;
+    unlock(&unix_lock);
+    struct ucred_ listener_creds = target->peer_creds;
+    list_add_before(&target->backlog, &server->pending);
+    target->backlog_count++;
+    notify(&target->cond);
+    unlock(&target->lock);
+    unix_wake(target);
+
+    lock(&sock->lock);
+    struct unix_sock *old_peer = sock->peer;
+    sock->peer = unix_sock_retain(server);
+    sock->connected = true;
+    sock->has_peer_creds = true;
+    sock->peer_creds = listener_creds;
+    notify(&sock->cond);
+    unlock(&sock->lock);
+    unix_wake(sock);
+    if (old_peer != NULL)
+        unix_sock_release(old_peer);
+    unix_sock_release(target);
+    return 0;
+
+out_unlock:
+    unlock(&target->lock);
+    unix_sock_release(server);
+out:
+    unix_sock_release(target);
+    return err;
+}
+
+int unix_listen(struct fd *fd, int_t backlog) {
+    struct unix_sock *sock = fd->unix_sock;
+    if (sock->type != SOCK_STREAM_)
+        return _EOPNOTSUPP;
+    int err = unix_autobind(sock);
+    if (err < 0)
+        return err;
+    if (backlog < 0 || backlog > SOMAXCONN_)
+        backlog = SOMAXCONN_;
+    lock(&sock->lock);
+    if (sock->connected) {
+        unlock(&sock->lock);
+        return _EINVAL;
+    }
+    sock->listening = true;
+    sock->backlog_max = backlog;
+    // what connecting sockets see with SO_PEERCRED
+    sock->peer_creds = unix_current_creds();
+    notify(&sock->cond);
+    unlock(&sock->lock);
+    return 0;
+}
+
+fd_t unix_accept(struct fd *fd, addr_t addr, addr_t len_addr) {
+    struct unix_sock *sock = fd->unix_sock;
+    if (sock->type != SOCK_STREAM_)
+        return _EOPNOTSUPP;
+    lock(&sock->lock);
+    while (sock->listening && list_empty(&sock->backlog)) {
+        if (fd->flags & O_NONBLOCK_) {
+            unlock(&sock->lock);
+            return _EAGAIN;
+        }
+        if (wait_for(&sock->cond, &sock->lock, NULL)) {
+            unlock(&sock->lock);
+            return _EINTR;
+        }
+    }
+    if (!sock->listening) {
+        unlock(&sock->lock);
+        return _EINVAL;
+    }
+    struct unix_sock *server = list_first_entry(&sock->backlog, struct unix_sock, pending);
+    list_remove(&server->pending);
+    sock->backlog_count--;
+    notify(&sock->cond);
+    unlock(&sock->lock);
+
+    struct fd *server_fd = unix_fd_create(server);
+    if (server_fd == NULL) {
+        unix_sock_hangup(server);
+        unix_sock_release(server);
+        return _ENOMEM;
+    }
+    if (addr != 0) {
+        struct unix_sock *peer = unix_get_peer(server);
+        struct sockaddr_un_ name = {};
+        uint_t name_len = 0;
+        if (peer != NULL) {
+            unix_copy_name(peer, &name, &name_len);
+            unix_sock_release(peer);
+        }
+        int err = unix_name_write(addr, len_addr, &name, name_len);
+        if (err < 0) {
+            fd_close(server_fd);
+            return err;
+        }
+    }
+    return f_install(server_fd);
+}
+
+int unix_getname(struct fd *fd, addr_t addr, addr_t len_addr, bool peer) {
+    struct unix_sock *sock = fd->unix_sock;
+    if (peer) {
+        sock = unix_get_peer(sock);
+        if (sock == NULL)
+            return _ENOTCONN;
+    }
+    struct sockaddr_un_ name;
+    uint_t name_len;
+    unix_copy_name(sock, &name, &name_len);
+    if (peer)
+        unix_sock_release(sock);
+    return unix_name_write(addr, len_addr, &name, name_len);
+}
+
+int unix_shutdown(struct fd *fd, dword_t how) {
+    struct unix_sock *sock = fd->unix_sock;
+    if (how > 2)
+        return _EINVAL;
+    bool rd = how != 1;
+    bool wr = how != 0;
+    lock(&sock->lock);
+    if (sock->type == SOCK_STREAM_ && !sock->connected) {
+        unlock(&sock->lock);
+        return _ENOTCONN;
+    }
+    if (rd)
+        sock->shut_rd = true;
+    if (wr)
+        sock->shut_wr = true;
+    struct unix_sock *peer = sock->peer;
+    if (peer != NULL)
+        unix_sock_retain(peer);
+    notify(&sock->cond);
+    unlock(&sock->lock);
+    unix_wake(sock);
+
+    if (peer != NULL) {
+        if (sock->type == SOCK_STREAM_) {
+            lock(&peer->lock);
+            if (wr)
+                peer->rcv_eof = true;
+            notify(&peer->cond);
+            unlock(&peer->lock);
+            unix_wake(peer);
+        }
+        unix_sock_release(peer);
+    }
+    return 0;
+}
+
+static size_t iov_size(const struct iovec *iov, int iovlen) {
+    size_t size = 0;
+    for (int i = 0; i < iovlen; i++)
+        size += iov[i].iov_len;
+    return size;
+}
+
+// Copies between a buffer and iovecs, starting skip bytes into the iovecs
+static void iov_copy(const struct iovec *iov, int iovlen, size_t skip, char *buf, size_t size, bool to_iov) {
+    for (int i = 0; i < iovlen && size > 0; i++) {
+        if (skip >= iov[i].iov_len) {
+            skip -= iov[i].iov_len;
+            continue;
+        }
+        size_t chunk = iov[i].iov_len - skip;
+        if (chunk > size)
+            chunk = size;
+        char *base = (char *) iov[i].iov_base + skip;
+        if (to_iov)
+            memcpy(base, buf, chunk);
+        else
+            memcpy(buf, base, chunk);
+        buf += chunk;
+        size -= chunk;
+        skip = 0;
+    }
+}
+
+ssize_t unix_sendmsg(struct fd *fd, const struct iovec *iov, int iovlen, addr_t name_addr, uint_t name_len, struct scm *scm, int flags) {
+    struct unix_sock *sock = fd->unix_sock;
+    bool stream = sock->type == SOCK_STREAM_;
+    bool nonblock = (fd->flags & O_NONBLOCK_) || (flags & MSG_DONTWAIT_);
+    size_t size = iov_size(iov, iovlen);
+    ssize_t err;
+
+    struct unix_sock *target = NULL;
+    if (stream) {
+        target = unix_get_peer(sock);
+        if (name_addr != 0) {
+            err = target != NULL ? _EISCONN : _EOPNOTSUPP;
+            goto out;
+        }
+        err = _ENOTCONN;
+        if (target == NULL)
+            goto out;
+        lock(&sock->lock);
+        bool shut_wr = sock->shut_wr;
+        unlock(&sock->lock);
+        err = _EPIPE;
+        if (shut_wr)
+            goto out;
+        if (size == 0) {
+            err = 0;
+            goto out;
+        }
+    } else {
+        if (name_addr != 0) {
+            struct sockaddr_un_ name;
+            err = unix_name_read(name_addr, name_len, &name);
+            if (err < 0)
+                goto out;
+            if (err == 0) {
+                err = _EINVAL;
+                goto out;
+            }
+            err = unix_find(&name, err, &target);
+            if (err < 0)
+                goto out;
+            err = _EPROTOTYPE;
+            if (target->type != sock->type)
+                goto out;
+        } else {
+            target = unix_get_peer(sock);
+            err = _ENOTCONN;
+            if (target == NULL)
+                goto out;
+        }
+        err = _EMSGSIZE;
+        if (size > UNIX_RCVBUF_MAX)
+            goto out;
+    }
+
+    struct ucred_ creds = unix_current_creds();
+    if (scm != NULL && scm->has_creds)
+        creds = scm->creds;
+    struct sockaddr_un_ from;
+    uint_t from_len;
+    unix_copy_name(sock, &from, &from_len);
+
+    size_t sent = 0;
+    err = 0;
+    do {
+        size_t chunk = size - sent;
+        if (stream && chunk > UNIX_STREAM_CHUNK)
+            chunk = UNIX_STREAM_CHUNK;
+        struct unix_msg *msg = malloc(sizeof(struct unix_msg) + chunk);
+        if (msg == NULL) {
+            err = _ENOMEM;
+            break;
+        }
+        iov_copy(iov, iovlen, sent, msg->data, chunk, false);
+        msg->size = chunk;
+        msg->offset = 0;
+        msg->creds = creds;
+        msg->from = from;
+        msg->from_len = from_len;
+        msg->fds = NULL;
+        msg->num_fds = 0;
+        // fds go with the first piece
+        if (scm != NULL && scm->num_fds > 0) {
+            msg->fds = malloc(sizeof(struct fd *) * scm->num_fds);
+            if (msg->fds == NULL) {
+                free(msg);
+                err = _ENOMEM;
+                break;
+            }
+            memcpy(msg->fds, scm->fds, sizeof(struct fd *) * scm->num_fds);
+            msg->num_fds = scm->num_fds;
+            scm->num_fds = 0;
+        }
+
+        lock(&target->lock);
+        while (true) {
+            if (target->closed || target->shut_rd) {
+                err = stream ? _EPIPE : _ECONNREFUSED;
+                break;
+            }
+            // a message always fits in an empty queue
+            if (target->queued == 0 || target->queued + chunk <= target->rcvbuf)
+                break;
+            if (nonblock) {
+                err = _EAGAIN;
+                break;
+            }
+            if (wait_for(&target->cond, &target->lock, NULL)) {
+                err = _EINTR;
+                break;
+            }
+        }
+        if (err < 0) {
+            unlock(&target->lock);
+            unix_msg_free(msg);
+            break;
+        }
+        list_add_before(&target->queue, &msg->queue);
+        target->queued += chunk;
+        notify(&target->cond);
+        unlock(&target->lock);
+        unix_wake(target);
+        sent += chunk;
+    } while (sent < size);
+    if (sent > 0)
+        err = sent;
+
+out:
+    if (target != NULL)
+        unix_sock_release(target);
+    if (scm != NULL)
+        scm_release(scm);
+    if (err == _EPIPE && !(flags & MSG_NOSIGNAL_))
+        send_signal(current, SIGPIPE_);
+    return err;
+}
+
+// Puts received fds and credentials in the guest's control buffer. fds that
+// don't fit are closed and MSG_CTRUNC is set, like Linux does.
+static int scm_write(struct msghdr_ *msg_fake, struct fd **fds, unsigned num_fds, struct ucred_ *creds, int flags) {
+    uint_t controllen = msg_fake->msg_control != 0 ? msg_fake->msg_controllen : 0;
+    msg_fake->msg_controllen = 0;
+    char *control = NULL;
+    if (controllen > 0) {
+        control = calloc(1, controllen);
+        if (control == NULL) {
+            for (unsigned i = 0; i < num_fds; i++)
+                fd_close(fds[i]);
+            return _ENOMEM;
+        }
+    }
+
+    uint_t off = 0;
+    if (creds != NULL) {
+        if (controllen - off >= CMSG_LEN_(sizeof(struct ucred_))) {
+            struct cmsghdr_ *cmsg = (void *) (control + off);
+            cmsg->len = CMSG_LEN_(sizeof(struct ucred_));
+            cmsg->level = SOL_SOCKET_;
+            cmsg->type = SCM_CREDENTIALS_;
+            memcpy(cmsg + 1, creds, sizeof(struct ucred_));
+            off += CMSG_ALIGN_(cmsg->len);
+        } else {
+            msg_fake->msg_flags |= MSG_CTRUNC_;
+        }
+    }
+    if (num_fds > 0) {
+        unsigned fit = 0;
+        if (controllen - off >= CMSG_LEN_(sizeof(fd_t)))
+            fit = (controllen - off - sizeof(struct cmsghdr_)) / sizeof(fd_t);
+        if (fit > num_fds)
+            fit = num_fds;
+        struct cmsghdr_ *cmsg = NULL;
+        fd_t *fds_out = NULL;
+        if (fit > 0) {
+            cmsg = (void *) (control + off);
+            fds_out = (void *) (cmsg + 1);
+        }
+        unsigned installed = 0;
+        for (unsigned i = 0; i < num_fds; i++) {
+            if (i >= fit) {
+                fd_close(fds[i]);
+                continue;
+            }
+            fd_t f = f_install(fds[i]);
+            if (f < 0)
+                continue;
+            if (flags & MSG_CMSG_CLOEXEC_)
+                f_set_cloexec(f);
+            fds_out[installed++] = f;
+        }
+        if (fit < num_fds)
+            msg_fake->msg_flags |= MSG_CTRUNC_;
+        if (installed > 0) {
+            cmsg->len = CMSG_LEN_(sizeof(fd_t) * installed);
+            cmsg->level = SOL_SOCKET_;
+            cmsg->type = SCM_RIGHTS_;
+            off += CMSG_ALIGN_(cmsg->len);
+        }
+    }
+
+    int err = 0;
+    if (off > controllen)
+        off = controllen;
+    if (off > 0 && user_write(msg_fake->msg_control, control, off))
+        err = _EFAULT;
+    msg_fake->msg_controllen = off;
+    free(control);
+    return err;
+}
+
+ssize_t unix_recvmsg(struct fd *fd, struct iovec *iov, int iovlen, struct msghdr_ *msg_fake, int flags) {
+    struct unix_sock *sock = fd->unix_sock;
+    bool stream = sock->type == SOCK_STREAM_;
+    bool nonblock = (fd->flags & O_NONBLOCK_) || (flags & MSG_DONTWAIT_);
+    bool peek = flags & MSG_PEEK_;
+    bool waitall = stream && (flags & MSG_WAITALL_) && !peek;
+    size_t size = iov_size(iov, iovlen);
+    msg_fake->msg_flags = 0;
+
+    struct fd **fds = NULL;
+    unsigned num_fds = 0;
+    struct ucred_ creds = {};
+    struct sockaddr_un_ from = {};
+    uint_t from_len = 0;
+    size_t copied = 0;
+    ssize_t res = 0;
+    bool got_msg = false;
+
+    lock(&sock->lock);
+    if (stream && (sock->listening || !sock->connected)) {
+        unlock(&sock->lock);
+        return _EINVAL;
+    }
+    while (true) {
+        if (list_empty(&sock->queue)) {
+            if (got_msg && !(waitall && copied < size))
+                break;
+            if (sock->rcv_eof || sock->shut_rd)
+                break;
+            if (nonblock) {
+                res = _EAGAIN;
+                break;
+            }
+            if (wait_for(&sock->cond, &sock->lock, NULL)) {
+                res = _EINTR;
+                break;
+            }
+            continue;
+        }
+
+        struct unix_msg *msg = list_first_entry(&sock->queue, struct unix_msg, queue);
+        // a read doesn't go past data that came with fds, or past the end
+        // of a datagram
+        if (got_msg && (msg->num_fds > 0 || num_fds > 0))
+            break;
+        if (!got_msg) {
+            creds = msg->creds;
+            from = msg->from;
+            from_len = msg->from_len;
+        }
+        got_msg = true;
+
+        size_t avail = msg->size - msg->offset;
+        size_t n = size - copied;
+        if (n > avail)
+            n = avail;
+        iov_copy(iov, iovlen, copied, msg->data + msg->offset, n, true);
+        copied += n;
+        if (!stream && n < avail) {
+            msg_fake->msg_flags |= MSG_TRUNC_;
+            if (flags & MSG_TRUNC_)
+                res = avail;
+        }
+
+        if (msg->num_fds > 0) {
+            fds = msg->fds;
+            num_fds = msg->num_fds;
+            if (peek) {
+                struct fd **copy = malloc(sizeof(struct fd *) * num_fds);
+                if (copy != NULL) {
+                    for (unsigned i = 0; i < num_fds; i++)
+                        copy[i] = fd_retain(fds[i]);
+                } else {
+                    num_fds = 0;
+                }
+                fds = copy;
+            } else {
+                msg->fds = NULL;
+                msg->num_fds = 0;
+            }
+        }
+
+        if (peek)
+            break;
+        size_t consumed = stream ? n : avail;
+        msg->offset += consumed;
+        sock->queued -= consumed;
+        if (msg->offset == msg->size) {
+            list_remove(&msg->queue);
+            free(msg->fds);
+            free(msg);
+        }
+        notify(&sock->cond);
+        if (!stream || copied == size)
+            break;
+    }
+    bool passcred = sock->passcred;
+    struct unix_sock *peer = sock->peer;
+    if (peer != NULL)
+        unix_sock_retain(peer);
+    unlock(&sock->lock);
+
+    // let a blocked writer know there's room now
+    if (peer != NULL) {
+        if (got_msg && !peek)
+            unix_wake(peer);
+        unix_sock_release(peer);
+    }
+
+    if (!got_msg) {
+        if (res < 0)
+            return res;
+        msg_fake->msg_namelen = 0;
+        msg_fake->msg_controllen = 0;
+        return 0;
+    }
+    // unnamed senders have an empty address here, unlike getsockname
+    if (msg_fake->msg_name != 0 && from_len != 0) {
+        from.family = AF_LOCAL_;
+        uint_t max_len = msg_fake->msg_namelen;
+        if (user_write(msg_fake->msg_name, &from, from_len < max_len ? from_len : max_len))
+            res = _EFAULT;
+    }
+    msg_fake->msg_namelen = from_len;
+    int err = scm_write(msg_fake, fds, num_fds, passcred ? &creds : NULL, flags);
+    free(fds);
+    if (err < 0)
+        return err;
+    if (res < 0 && copied == 0)
+        return res;
+    if (res == _EFAULT)
+        return res;
+    return res > 0 ? res : (ssize_t) copied;
+}
+
+int unix_setsockopt(struct fd *fd, dword_t level, dword_t option, addr_t value_addr, uint_t value_len) {
+    struct unix_sock *sock = fd->unix_sock;
+    if (level != SOL_SOCKET_)
+        return _ENOPROTOOPT;
+    int_t value;
+    if (value_len < sizeof(value))
+        return _EINVAL;
+    if (user_get(value_addr, value))
+        return _EFAULT;
+
+    switch (option) {
+        case SO_PASSCRED_:
+            lock(&sock->lock);
+            sock->passcred = value != 0;
+            unlock(&sock->lock);
+            return 0;
+        case SO_RCVBUF_:
+            // linux doubles it to leave room for bookkeeping
+            if (value < UNIX_RCVBUF_MIN / 2)
+                value = UNIX_RCVBUF_MIN / 2;
+            if (value > UNIX_RCVBUF_MAX / 2)
+                value = UNIX_RCVBUF_MAX / 2;
+            lock(&sock->lock);
+            sock->rcvbuf = value * 2;
+            notify(&sock->cond);
+            unlock(&sock->lock);
+            unix_wake(sock);
+            return 0;
+        case SO_SNDBUF_:
+        case SO_REUSEADDR_:
+        case SO_KEEPALIVE_:
+        case SO_BROADCAST_:
+            return 0;
+    }
+    return _ENOPROTOOPT;
+}
+
+int unix_getsockopt(struct fd *fd, dword_t level, dword_t option, addr_t value_addr, addr_t len_addr) {
+    struct unix_sock *sock = fd->unix_sock;
+    if (level != SOL_SOCKET_)
+        return _ENOPROTOOPT;
+    dword_t len;
+    if (user_get(len_addr, len))
+        return _EFAULT;
+
+    union {
+        int_t i;
+        struct ucred_ creds;
+    } value = {};
+    dword_t value_len = sizeof(int_t);
+    lock(&sock->lock);
+    switch (option) {
+        case SO_TYPE_: value.i = sock->type; break;
+        case SO_ERROR_: value.i = 0; break;
+        case SO_PASSCRED_: value.i = sock->passcred; break;
+        case SO_RCVBUF_: value.i = sock->rcvbuf; break;
+        case SO_SNDBUF_: value.i = UNIX_RCVBUF_DEFAULT; break;
+        case SO_ACCEPTCONN_: value.i = sock->listening; break;
+        case SO_PEERCRED_:
+            if (sock->has_peer_creds)
+                value.creds = sock->peer_creds;
+            else
+                value.creds = (struct ucred_) {.pid = 0, .uid = -1, .gid = -1};
+            value_len = sizeof(struct ucred_);
+            break;
+        default:
+            unlock(&sock->lock);
+            return _ENOPROTOOPT;
+    }
+    unlock(&sock->lock);
+
+    if (len > value_len)
+        len = value_len;
+    if (user_write(value_addr, &value, len))
+        return _EFAULT;
+    if (user_put(len_addr, len))
+        return _EFAULT;
+    return 0;
+}
+
+static ssize_t unix_read(struct fd *fd, void *buf, size_t bufsize) {
+    struct iovec iov = {.iov_base = buf, .iov_len = bufsize};
+    struct msghdr_ msg = {};
+    return unix_recvmsg(fd, &iov, 1, &msg, 0);
+}
+
+static ssize_t unix_write(struct fd *fd, const void *buf, size_t bufsize) {
+    struct iovec iov = {.iov_base = (void *) buf, .iov_len = bufsize};
+    return unix_sendmsg(fd, &iov, 1, 0, 0, NULL, 0);
+}
+
+static int unix_poll(struct fd *fd) {
+    struct unix_sock *sock = fd->unix_sock;
+    int types = 0;
+    lock(&sock->lock);
+    if (sock->listening) {
+        if (!list_empty(&sock->backlog))
+            types |= POLL_READ;
+        unlock(&sock->lock);
+        return types;
+    }
+    if (!list_empty(&sock->queue) || sock->rcv_eof || sock->shut_rd)
+        types |= POLL_READ;
+    if (sock->peer_closed || (sock->shut_rd && sock->shut_wr))
+        types |= POLL_HUP;
+    if (sock->type == SOCK_STREAM_ && !sock->connected)
+        types |= POLL_HUP;
+    bool shut_wr = sock->shut_wr;
+    struct unix_sock *peer = sock->peer;
+    if (peer != NULL)
+        unix_sock_retain(peer);
+    unlock(&sock->lock);
+
+    // the two sockets are never locked at the same time
+    if (peer != NULL) {
+        lock(&peer->lock);
+        if (!shut_wr && (peer->closed || peer->queued < peer->rcvbuf))
+            types |= POLL_WRITE;
+        unlock(&peer->lock);
+        unix_sock_release(peer);
+    } else if (sock->type == SOCK_DGRAM_ && !shut_wr) {
+        types |= POLL_WRITE;
+    }
+    return types;
+}
+
+static ssize_t unix_ioctl_size(struct fd *fd, int cmd) {
+    if (cmd == FIONREAD_)
+        return sizeof(dword_t);
+    return -1;
+}
+
+static int unix_ioctl(struct fd *fd, int cmd, void *arg) {
+    struct unix_sock *sock = fd->unix_sock;
+    if (cmd == FIONREAD_) {
+        lock(&sock->lock);
+        // datagram sockets report the size of the next datagram
+        dword_t size = sock->queued;
+        if (sock->type == SOCK_DGRAM_ && !list_empty(&sock->queue))
+            size = list_first_entry(&sock->queue, struct unix_msg, queue)->size;
+        unlock(&sock->lock);
+        *(dword_t *) arg = size;
+        return 0;
+    }
+    return _EINVAL;
+}
+
+// Takes a socket out of service: pending connections get hung up on, and a
+// stream peer sees end of file. The caller still has its reference.
+static void unix_sock_hangup(struct unix_sock *sock) {
+    struct list backlog, queue;
+    list_init(&backlog);
+    list_init(&queue);
+
+    lock(&sock->lock);
+    sock->closed = true;
+    sock->listening = false;
+    struct unix_sock *peer = sock->peer;
+    sock->peer = NULL;
+    // the lists are moved out so nothing gets released with the lock held
+    while (!list_empty(&sock->backlog)) {
+        struct unix_sock *pending = list_first_entry(&sock->backlog, struct unix_sock, pending);
+        list_remove(&pending->pending);
+        list_add_before(&backlog, &pending->pending);
+    }
+    sock->backlog_count = 0;
+    while (!list_empty(&sock->queue)) {
+        struct unix_msg *msg = list_first_entry(&sock->queue, struct unix_msg, queue);
+        list_remove(&msg->queue);
+        list_add_before(&queue, &msg->queue);
+    }
+    sock->queued = 0;
+    notify(&sock->cond);
+    unlock(&sock->lock);
+
+    if (peer != NULL) {
+        if (sock->type == SOCK_STREAM_) {
+            lock(&peer->lock);
+            peer->rcv_eof = true;
+            peer->peer_closed = true;
+            notify(&peer->cond);
+            unlock(&peer->lock);
+            unix_wake(peer);
+        }
+        unix_sock_release(peer);
+    }
+    struct unix_sock *pending, *tmp_pending;
+    list_for_each_entry_safe(&backlog, pending, tmp_pending, pending) {
+        list_remove(&pending->pending);
+        unix_sock_hangup(pending);
+        unix_sock_release(pending);
+    }
+    struct unix_msg *msg, *tmp_msg;
+    list_for_each_entry_safe(&queue, msg, tmp_msg, queue) {
+        list_remove(&msg->queue);
+        unix_msg_free(msg);
+    }
+}
+
+static int unix_close(struct fd *fd) {
+    struct unix_sock *sock = fd->unix_sock;
+    lock(&sock->fd_lock);
+    sock->fd = NULL;
+    unlock(&sock->fd_lock);
+    // the file stays behind, but nothing can connect through it anymore
+    lock(&unix_lock);
+    list_remove_safe(&sock->bound);
+    unlock(&unix_lock);
+    unix_sock_hangup(sock);
+    unix_sock_release(sock);
+    return 0;
+}
+
+static struct fd_ops unix_fdops = {
+    .read = unix_read,
+    .write = unix_write,
+    .poll = unix_poll,
+    .ioctl_size = unix_ioctl_size,
+    .ioctl = unix_ioctl,
+    .close = unix_close,
+};
@@ -0,0 +1,37 @@
+#ifndef FS_UNIX_H
+#define FS_UNIX_H
+#include "fs/fd.h"
+#include "fs/sock.h"
+
+// Local sockets between guest processes never touch the host. Path names
+// are files in the guest's filesystem, and data and control messages are
+// queued in memory on the receiving socket.
+
+struct sockaddr_un_ {
+    uint16_t family;
+    char path[108];
+};
+
+bool fd_is_unix_socket(struct fd *fd);
+
+fd_t unix_socket(dword_t type, dword_t protocol);
+int unix_socketpair(dword_t type, dword_t protocol, fd_t fds[2]);
+int unix_bind(struct fd *fd, addr_t addr, uint_t addr_len);
+int unix_connect(struct fd *fd, addr_t addr, uint_t addr_len);
+int unix_listen(struct fd *fd, int_t backlog);
+fd_t unix_accept(struct fd *fd, addr_t addr, addr_t len_addr);
+int unix_getname(struct fd *fd, addr_t addr, addr_t len_addr, bool peer);
+int unix_shutdown(struct fd *fd, dword_t how);
+int unix_setsockopt(struct fd *fd, dword_t level, dword_t option, addr_t value_addr, uint_t value_len);
+int unix_getsockopt(struct fd *fd, dword_t level, dword_t option, addr_t value_addr, addr_t len_addr);
+
+// iov points at host memory, never guest memory, since these can block and
+// another thread could unmap it meanwhile. The caller copies the data in or
+// out. The fds in scm (which can be NULL) are taken over and scm->num_fds is
+// set to 0.
+ssize_t unix_sendmsg(struct fd *fd, const struct iovec *iov, int iovlen, addr_t name_addr, uint_t name_len, struct scm *scm, int flags);
+// Fills in the name and control buffers msg points to and updates
+// msg_namelen, msg_controllen and msg_flags. msg isn't written back.
+ssize_t unix_recvmsg(struct fd *fd, struct iovec *iov, int iovlen, struct msghdr_ *msg, int flags);
+
+#endif
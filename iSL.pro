@@ -3,7 +3,10 @@ TEMPLATE = subdirs
  
 SUBDIRS = \
     app \
+    bench \
     emu \
     fs \
     kernel \
     util
+
+bench.depends = emu util
@@ -1,8 +1,9 @@
+#include <stdlib.h>
+#include <string.h>
 #include "util/debug.h"
 #include "kernel/calls.h"
 #include "emu/interrupt.h"
-
-#define NUM_SYSCALLS 400
+#include "emu/profile.h"
 
 dword_t syscall_stub() {
     return _ENOSYS;
@@ -144,6 +145,7 @@ syscall_t syscall_table[] = {
     [264] = (syscall_t) sys_clock_settime,
     [265] = (syscall_t) sys_clock_gettime,
     [266] = (syscall_t) sys_clock_getres,
+    [267] = (syscall_t) sys_clock_nanosleep,
     [268] = (syscall_t) sys_statfs64,
     [269] = (syscall_t) sys_fstatfs64,
     [272] = (syscall_t) syscall_success_stub,
@@ -161,6 +163,9 @@ syscall_t syscall_table[] = {
     [307] = (syscall_t) sys_faccessat,
     [308] = (syscall_t) sys_pselect,
     [309] = (syscall_t) sys_ppoll,
+    [313] = (syscall_t) sys_splice,
+    [315] = (syscall_t) sys_tee,
+    [316] = (syscall_t) sys_vmsplice,
     [319] = (syscall_t) sys_epoll_pwait,
     [320] = (syscall_t) sys_utimensat,
     [322] = (syscall_t) sys_timerfd_create,
@@ -169,11 +174,68 @@ syscall_t syscall_table[] = {
     [328] = (syscall_t) sys_eventfd2,
     [329] = (syscall_t) sys_epoll_create,
     [331] = (syscall_t) sys_pipe2,
+    [337] = (syscall_t) sys_recvmmsg,
     [340] = (syscall_t) sys_prlimit,
+    [345] = (syscall_t) sys_sendmmsg,
     [355] = (syscall_t) sys_getrandom,
     [377] = (syscall_t) sys_copy_file_range,
 };
 
+// Syscalls that can be handled without leaving cpu_run. They get called with
+// the memory read lock held, must not block, and signals aren't checked after
+// them. Each returns false if it can't finish, and then the syscall is handled
+// normally.
+typedef bool (*fast_syscall_t)(struct cpu_state *cpu, struct tlb *tlb);
+static fast_syscall_t fast_syscall_table[NUM_SYSCALLS] = {
+    [13]  = sys_time_fast,
+    [78]  = sys_gettimeofday_fast,
+    [265] = sys_clock_gettime_fast,
+};
+
+bool handle_interrupt_fast(int interrupt, struct tlb *tlb) {
+    if (interrupt != INT_SYSCALL)
+        return false;
+    // pending signals need to go through receive_signals
+    if (current->pending)
+        return false;
+    struct cpu_state *cpu = &current->cpu;
+    dword_t syscall_num = cpu->eax;
+    if (syscall_num >= NUM_SYSCALLS || fast_syscall_table[syscall_num] == NULL)
+        return false;
+    if (!fast_syscall_table[syscall_num](cpu, tlb))
+        return false;
+    // these take well under a microsecond, not worth timing
+    if (syscall_stats_enabled) {
+        atomic_fetch_add(&syscall_stats[syscall_num].count, 1);
+        atomic_fetch_add(&syscall_stats[syscall_num].hist[0], 1);
+    }
+    return true;
+}
+
+struct syscall_stats syscall_stats[NUM_SYSCALLS];
+bool syscall_stats_enabled;
+
+void syscall_stats_init() {
+    const char *enabled = getenv("ISL_SYSCALLS");
+    if (enabled != NULL && enabled[0] != '\0' && strcmp(enabled, "0") != 0)
+        syscall_stats_enabled = true;
+}
+
+static void syscall_stats_record(int syscall_num, struct timespec start) {
+    struct timespec elapsed = timespec_subtract(timespec_now(), start);
+    uint64_t nsec = (uint64_t) elapsed.tv_sec * 1000000000 + elapsed.tv_nsec;
+    uint64_t usec = nsec / 1000;
+    int bucket = 0;
+    while (usec != 0 && bucket < SYSCALL_HIST_BUCKETS - 1) {
+        usec >>= 1;
+        bucket++;
+    }
+    struct syscall_stats *stats = &syscall_stats[syscall_num];
+    atomic_fetch_add(&stats->count, 1);
+    atomic_fetch_add(&stats->total_ns, nsec);
+    atomic_fetch_add(&stats->hist[bucket], 1);
+}
+
 void handle_interrupt(int interrupt) {
     TRACE_(instr, "\n");
     struct cpu_state *cpu = &current->cpu;
@@ -184,7 +246,14 @@ void handle_interrupt(int interrupt) {
             send_signal(current, SIGSYS_);
         } else {
             STRACE("%d call %-3d ", current->pid, syscall_num);
+            struct timespec start = {};
+            if (syscall_stats_enabled)
+                start = timespec_now();
+            atomic_store(&current->in_syscall, true);
             int result = syscall_table[syscall_num](cpu->ebx, cpu->ecx, cpu->edx, cpu->esi, cpu->edi, cpu->ebp);
+            atomic_store(&current->in_syscall, false);
+            if (syscall_stats_enabled)
+                syscall_stats_record(syscall_num, start);
             STRACE(" = 0x%x\n", result);
             cpu->eax = result;
         }
@@ -193,19 +262,25 @@ void handle_interrupt(int interrupt) {
         deliver_signal(current, SIGSEGV_);
     } else if (interrupt == INT_UNDEFINED) {
         printk("%d illegal instruction at 0x%x: ", current->pid, cpu->eip);
-        for (int i = 0; i < 8; i++) {
-            uint8_t b;
-            if (user_get(cpu->eip + i, b))
+        uint8_t bytes[16];
+        unsigned len;
+        for (len = 0; len < sizeof(bytes); len++) {
+            if (user_get(cpu->eip + len, bytes[len]))
                 break;
-            printk("%02x ", b);
+            if (len < 8)
+                printk("%02x ", bytes[len]);
         }
         printk("\n");
+        opcode_count_undefined(bytes, len);
         deliver_signal(current, SIGILL_);
     } else if (interrupt != INT_TIMER) {
         printk("%d unhandled interrupt %d\n", current->pid, interrupt);
         sys_exit(interrupt);
     }
-    receive_signals();
+    // only take the sighand lock if there's something to deliver, anything
+    // that arrives after this check gets picked up on the next interrupt
+    if (current->pending)
+        receive_signals();
 }
 
 void dump_stack() {
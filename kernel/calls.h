@@ -16,6 +16,24 @@
 
 void handle_interrupt(int interrupt);
 
+#define NUM_SYSCALLS 400
+
+// Per-syscall counters, shown in /proc/syscalls. Timing every syscall isn't
+// free, so they're only updated when ISL_SYSCALLS is set.
+// hist[0] counts calls that took under a microsecond, hist[i] counts calls
+// that took between 2^(i-1) and 2^i microseconds, and the last bucket counts
+// everything slower than that.
+#define SYSCALL_HIST_BUCKETS 24
+struct syscall_stats {
+    atomic_ulong count;
+    atomic_ullong total_ns;
+    atomic_ulong hist[SYSCALL_HIST_BUCKETS];
+};
+extern struct syscall_stats syscall_stats[NUM_SYSCALLS];
+extern bool syscall_stats_enabled;
+// Reads ISL_SYSCALLS from the environment
+void syscall_stats_init(void);
+
 int must_check user_read(addr_t addr, void *buf, size_t count);
 int must_check user_write(addr_t addr, const void *buf, size_t count);
 int must_check user_read_task(struct task *task, addr_t addr, void *buf, size_t count);
@@ -85,6 +103,9 @@ dword_t sys_fsync(fd_t f);
 dword_t sys_flock(fd_t fd, dword_t operation);
 int_t sys_pipe(addr_t pipe_addr);
 int_t sys_pipe2(addr_t pipe_addr, int_t flags);
+dword_t sys_splice(fd_t in_f, addr_t in_off_addr, fd_t out_f, addr_t out_off_addr, dword_t len, dword_t flags);
+dword_t sys_tee(fd_t in_f, fd_t out_f, dword_t len, dword_t flags);
+dword_t sys_vmsplice(fd_t f, addr_t iovec_addr, dword_t iovec_count, dword_t flags);
 struct pollfd_ {
     fd_t fd;
     word_t events;
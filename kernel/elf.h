@@ -97,6 +97,22 @@ struct dyn_ent {
 #define DT_STRTAB 5
 #define DT_SYMTAB 6
 
+struct sect_header {
+    uint32_t name;
+    uint32_t type;
+    dword_t flags;
+    addr_t addr;
+    dword_t offset;
+    dword_t size;
+    uint32_t link;
+    uint32_t info;
+    dword_t alignment;
+    dword_t entsize;
+};
+
+#define SHT_SYMTAB 2
+#define SHT_DYNSYM 11
+
 struct elf_sym {
     uint32_t name;
     addr_t value;
@@ -106,4 +122,7 @@ struct elf_sym {
     uint16_t shndx;
 };
 
+#define STT_FUNC 2
+#define ELF_ST_TYPE(info) ((info) & 0xf)
+
 #endif
@@ -12,6 +12,7 @@
 #include "fs/fd.h"
 #include "kernel/elf.h"
 #include "kernel/vdso.h"
+#include "kernel/profile.h"
 
 static inline dword_t align_stack(dword_t sp);
 static inline ssize_t user_strlen(dword_t p);
@@ -75,6 +76,7 @@ static int load_entry(struct prg_header ph, addr_t bias, struct fd *fd) {
                     PAGE_ROUND_UP(filesize + PGOFFSET(addr)),
                     offset - PGOFFSET(addr), flags, MMAP_PRIVATE)) < 0)
         return err;
+    profile_mapped(current->mem, PAGE(addr), fd, offset - PGOFFSET(addr));
 
     if (memsize > filesize) {
         // put zeroes between addr + filesize and addr + memsize, call that bss
@@ -343,6 +345,9 @@ static int elf_exec(struct fd *fd, const char *file, char *const argv[], char *c
     current->cpu.esp = sp;
     current->cpu.eip = entry;
     current->cpu.fcw = 0x37f;
+    f80_rounding_mode = current->cpu.rc;
+    f80_precision = current->cpu.pc;
+    current->cpu.mxcsr = 0x1f80;
     collapse_flags(&current->cpu);
 
     err = 0;
@@ -2,6 +2,7 @@
 #include <user-signal.h>
 #include "kernel/calls.h"
 #include "kernel/futex.h"
+#include "kernel/profile.h"
 #include "fs/fd.h"
 
 static void halt_system(int status);
@@ -122,6 +123,7 @@ static void halt_system(int status) {
     }
     unlock(&mounts_lock);
 
+    profile_exit_summary();
     if (exit_hook != NULL)
         exit_hook(status);
 }
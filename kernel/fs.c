@@ -292,6 +292,8 @@ dword_t sys_lseek(fd_t f, dword_t off, dword_t whence) {
     struct fd *fd = f_get(f);
     if (fd == NULL)
         return _EBADF;
+    if (!fd->ops->lseek)
+        return _ESPIPE;
     lock(&fd->lock);
     off_t res = fd->ops->lseek(fd, off, whence);
     unlock(&fd->lock);
@@ -305,6 +307,8 @@ dword_t sys_pread(fd_t f, addr_t buf_addr, dword_t size, off_t_ off) {
     struct fd *fd = f_get(f);
     if (fd == NULL)
         return _EBADF;
+    if (!fd->ops->lseek)
+        return _ESPIPE;
     char *buf = malloc(size+1);
     if (buf == NULL)
         return _EFAULT;
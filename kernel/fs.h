@@ -167,6 +167,10 @@ int realfs_flock(struct fd *fd, int operation);
 int realfs_getpath(struct fd *fd, char *buf);
 ssize_t realfs_read(struct fd *fd, void *buf, size_t bufsize);
 ssize_t realfs_write(struct fd *fd, const void *buf, size_t bufsize);
+int realfs_readdir(struct fd *fd, struct dir_entry *entry);
+// entry_type is asked for the type of each entry when a listing is taken,
+// for filesystems that know better than the host
+int realfs_readdir_typed(struct fd *fd, struct dir_entry *entry, byte_t (*entry_type)(struct mount *mount, qword_t inode, byte_t host_type));
 int realfs_getflags(struct fd *fd);
 int realfs_setflags(struct fd *fd, dword_t arg);
 int realfs_close(struct fd *fd);
@@ -177,6 +181,7 @@ struct fd *adhoc_fd_create(void);
 // filesystems
 extern const struct fs_ops realfs;
 extern const struct fs_ops procfs;
+extern const struct fs_ops devpts;
 extern const struct fs_ops fakefs;
 
 #endif
@@ -3,6 +3,8 @@
 #include <sys/stat.h>
 #include "kernel/init.h"
 #include "kernel/calls.h"
+#include "emu/cpuid.h"
+#include "emu/profile.h"
 #include "fs/fd.h"
 #include "fs/tty.h"
 
@@ -37,6 +39,10 @@ void create_first_process() {
     sigaction(SIGUSR1, &sigact, NULL);
     signal(SIGPIPE, SIG_IGN);
 
+    cpuid_init();
+    profile_init();
+    syscall_stats_init();
+
     current = task_create_(NULL);
     current->mem = current->cpu.mem = mem_new();
     struct tgroup *group = init_tgroup();
@@ -74,9 +80,9 @@ int create_stdio(struct tty_driver driver) {
         return err;
 
     fd->refcount = 3;
-    current->files->files[0] = fd;
-    current->files->files[1] = fd;
-    current->files->files[2] = fd;
+    f_put(0, fd);
+    f_put(1, fd);
+    f_put(2, fd);
     return 0;
 }
 
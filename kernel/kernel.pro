@@ -22,6 +22,7 @@ SOURCES += \
     random.c \
     prctl.c \
     eventfd.c \
+    profile.c \
     fs.c \
     fs_info.c \
     poll.c \
@@ -35,6 +36,7 @@ HEADERS += \
     fs.h \
     futex.h \
     init.h \
+    profile.h \
     random.h \
     resource.h \
     task.h \
@@ -2,6 +2,7 @@
 #include "kernel/calls.h"
 #include "kernel/user-errno.h"
 #include "kernel/task.h"
+#include "kernel/profile.h"
 #include "fs/fd.h"
 #include "emu/memory.h"
 
@@ -34,6 +35,7 @@ static addr_t do_mmap(addr_t addr, dword_t len, dword_t prot, dword_t flags, fd_
             return _ENODEV;
         if ((err = fd->ops->mmap(fd, current->mem, page, pages, offset, prot, flags)) < 0)
             return err;
+        profile_mapped(current->mem, page, fd, offset);
     }
     return page << PAGE_BITS;
 }
@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <string.h>
+#include "kernel/calls.h"
+#include "kernel/elf.h"
+#include "kernel/profile.h"
+#include "fs/fd.h"
+
+void profile_mapped(struct mem *mem, page_t page, struct fd *fd, size_t offset) {
+    if (profile_period == 0)
+        return;
+    char path[MAX_PATH];
+    if (generic_getpath(fd, path) < 0)
+        return;
+    pt_set_name(mem, page, profile_intern(path), offset);
+}
+
+// what's needed from an elf file to turn a file offset into a function name
+struct symbols {
+    const char *name;
+    struct prg_header *ph;
+    unsigned ph_count;
+    struct elf_sym *syms;
+    unsigned sym_count;
+    char *strtab;
+    dword_t strtab_size;
+};
+
+static void *read_at(struct fd *fd, dword_t offset, dword_t size) {
+    void *buf = malloc(size);
+    if (buf == NULL)
+        return NULL;
+    if (fd->ops->lseek(fd, offset, SEEK_SET) < 0 ||
+            fd->ops->read(fd, buf, size) != size) {
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+static void symbols_load(struct symbols *s, const char *name) {
+    *s = (struct symbols) {.name = name};
+    struct fd *fd = generic_open(name, O_RDONLY_, 0);
+    if (IS_ERR(fd))
+        return;
+    struct elf_header *header = read_at(fd, 0, sizeof(struct elf_header));
+    if (header == NULL || memcmp(&header->magic, ELF_MAGIC, sizeof(header->magic)) != 0)
+        goto out;
+    s->ph = read_at(fd, header->prghead_off, sizeof(struct prg_header) * header->phent_count);
+    if (s->ph != NULL)
+        s->ph_count = header->phent_count;
+
+    struct sect_header *sh = read_at(fd, header->secthead_off, sizeof(struct sect_header) * header->shent_count);
+    if (sh == NULL)
+        goto out;
+    // prefer the full symbol table, but stripped files only have the dynamic one
+    struct sect_header *symtab = NULL;
+    for (unsigned i = 0; i < header->shent_count; i++) {
+        if (sh[i].type == SHT_SYMTAB || (sh[i].type == SHT_DYNSYM && symtab == NULL))
+            symtab = &sh[i];
+    }
+    if (symtab != NULL && symtab->link < header->shent_count) {
+        struct sect_header *strtab = &sh[symtab->link];
+        s->syms = read_at(fd, symtab->offset, symtab->size);
+        s->strtab = read_at(fd, strtab->offset, strtab->size);
+        if (s->syms != NULL && s->strtab != NULL) {
+            s->sym_count = symtab->size / sizeof(struct elf_sym);
+            s->strtab_size = strtab->size;
+        }
+    }
+    free(sh);
+out:
+    free(header);
+    fd_close(fd);
+}
+
+static void symbols_free(struct symbols *s) {
+    free(s->ph);
+    free(s->syms);
+    free(s->strtab);
+}
+
+static const char *symbols_lookup(struct symbols *s, dword_t offset) {
+    dword_t vaddr = 0;
+    bool found = false;
+    for (unsigned i = 0; i < s->ph_count; i++) {
+        struct prg_header *ph = &s->ph[i];
+        if (ph->type == PT_LOAD && offset >= ph->offset && offset - ph->offset < ph->filesize) {
+            vaddr = offset - ph->offset + ph->vaddr;
+            found = true;
+            break;
+        }
+    }
+    if (!found || s->sym_count == 0)
+        return NULL;
+
+    // the closest function at or before vaddr
+    struct elf_sym *best = NULL;
+    for (unsigned i = 0; i < s->sym_count; i++) {
+        struct elf_sym *sym = &s->syms[i];
+        if (ELF_ST_TYPE(sym->info) != STT_FUNC || sym->value > vaddr || sym->name >= s->strtab_size)
+            continue;
+        if (best == NULL || sym->value > best->value)
+            best = sym;
+    }
+    if (best == NULL || (best->size != 0 && vaddr - best->value >= best->size))
+        return NULL;
+    return s->strtab + best->name;
+}
+
+static int compare_count(const void *a, const void *b) {
+    const struct profile_entry *ea = a, *eb = b;
+    return ea->count < eb->count ? 1 : ea->count > eb->count ? -1 : 0;
+}
+
+ssize_t profile_report(char *buf, size_t size) {
+    struct profile_entry *entries;
+    int count = profile_entries(&entries);
+    if (count < 0)
+        return _ENOMEM;
+    qsort(entries, count, sizeof(*entries), compare_count);
+
+    struct symbols *files = NULL;
+    unsigned files_count = 0;
+    size_t n = 0;
+    for (int i = 0; i < count; i++) {
+        // leave room for one more line
+        if (n + MAX_PATH + 256 > size)
+            break;
+        struct profile_entry *entry = &entries[i];
+        if (entry->name == NULL) {
+            n += sprintf(buf + n, "[unknown];%#x;%02x %lu\n", entry->offset, entry->opcode, entry->count);
+            continue;
+        }
+
+        struct symbols *file = NULL;
+        for (unsigned j = 0; j < files_count; j++) {
+            if (files[j].name == entry->name)
+                file = &files[j];
+        }
+        if (file == NULL) {
+            struct symbols *new_files = realloc(files, sizeof(struct symbols) * (files_count + 1));
+            if (new_files == NULL)
+                break;
+            files = new_files;
+            file = &files[files_count++];
+            symbols_load(file, entry->name);
+        }
+
+        const char *function = symbols_lookup(file, entry->offset);
+        n += sprintf(buf + n, "%s;", entry->name);
+        if (function != NULL)
+            n += sprintf(buf + n, "%.200s", function); // mangled c++ names can get long
+        else
+            n += sprintf(buf + n, "%#x", entry->offset);
+        n += sprintf(buf + n, ";%02x %lu\n", entry->opcode, entry->count);
+    }
+
+    for (unsigned j = 0; j < files_count; j++)
+        symbols_free(&files[j]);
+    free(files);
+    free(entries);
+    return n;
+}
+
+void profile_exit_summary() {
+    if (!opcode_stats_enabled)
+        return;
+    char *buf = malloc(4096);
+    if (buf == NULL)
+        return;
+    ssize_t n = opcode_report(buf, 4096, 40);
+    // printk can't take all of it at once
+    char *line = buf;
+    char *end;
+    while (n > 0 && (end = strchr(line, '\n')) != NULL) {
+        *end = '\0';
+        printk("%s\n", line);
+        line = end + 1;
+    }
+    free(buf);
+}
@@ -0,0 +1,15 @@
+#ifndef KERNEL_PROFILE_H
+#define KERNEL_PROFILE_H
+
+#include "emu/profile.h"
+#include "kernel/fs.h"
+
+// Remember that the mapping at page came from this file, if profiling
+void profile_mapped(struct mem *mem, page_t page, struct fd *fd, size_t offset);
+// Writes a flamegraph folded report of the samples so far, hottest first:
+// file;function;opcode count
+ssize_t profile_report(char *buf, size_t size);
+// Logs the top of the opcode histogram, if it's on
+void profile_exit_summary(void);
+
+#endif
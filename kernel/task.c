@@ -73,6 +73,10 @@ struct task *task_create_(struct task *parent) {
     task->waiting_cond = NULL;
     task->waiting_lock = NULL;
     lock_init(&task->waiting_cond_lock);
+    task->waiting_pins = 0;
+    cond_init(&task->waiting_unpinned);
+    task->in_syscall = false;
+    task->cpu.poked = false;
     return task;
 }
 
@@ -80,6 +84,7 @@ void task_destroy(struct task *task) {
     list_remove(&task->siblings);
     pid_get(task->pid)->task = NULL;
     cond_destroy(&task->vfork_cond);
+    cond_destroy(&task->waiting_unpinned);
     free(task);
 }
 
@@ -63,6 +63,14 @@ struct task {
     cond_t *waiting_cond;
     lock_t *waiting_lock;
     lock_t waiting_cond_lock;
+    // number of deliver_signal calls still using waiting_cond and
+    // waiting_lock, the waiter can't return until this drops to zero
+    unsigned waiting_pins;
+    cond_t waiting_unpinned;
+
+    // set while a syscall is running, only then can the thread be blocked
+    // in a host call that needs a host signal to interrupt it
+    atomic_bool in_syscall;
 };
 
 // current will always give the process that is currently executing
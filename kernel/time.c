@@ -9,8 +9,17 @@
 #include "kernel/calls.h"
 #include "kernel/user-errno.h"
 #include "kernel/resource.h"
+#include "emu/tlb.h"
 #include "fs/poll.h"
 
+static int clockid_to_real(dword_t clock, clockid_t *real) {
+    switch (clock) {
+        case CLOCK_REALTIME_: *real = CLOCK_REALTIME; return 0;
+        case CLOCK_MONOTONIC_: *real = CLOCK_MONOTONIC; return 0;
+        default: return _EINVAL;
+    }
+}
+
 dword_t sys_time(addr_t time_out) {
     dword_t now = time(NULL);
     if (time_out != 0)
@@ -19,9 +28,7 @@ dword_t sys_time(addr_t time_out) {
     return now;
 }
 
-dword_t sys_clock_gettime(dword_t clock, addr_t tp) {
-    STRACE("clock_gettime(%d, 0x%x)", clock, tp);
-
+static int do_clock_gettime(dword_t clock, struct timespec_ *t) {
     struct timespec ts;
     if (clock == CLOCK_PROCESS_CPUTIME_ID_) {
         // FIXME this is thread usage, not process usage
@@ -30,18 +37,24 @@ dword_t sys_clock_gettime(dword_t clock, addr_t tp) {
         ts.tv_nsec = rusage.utime.usec * 1000;
     } else {
         clockid_t clock_id;
-        switch (clock) {
-            case CLOCK_REALTIME_: clock_id = CLOCK_REALTIME; break;
-            case CLOCK_MONOTONIC_: clock_id = CLOCK_MONOTONIC; break;
-            default: return _EINVAL;
-        }
+        if (clockid_to_real(clock, &clock_id) < 0)
+            return _EINVAL;
         int err = clock_gettime(clock_id, &ts);
         if (err < 0)
             return errno_map();
     }
+    t->sec = ts.tv_sec;
+    t->nsec = ts.tv_nsec;
+    return 0;
+}
+
+dword_t sys_clock_gettime(dword_t clock, addr_t tp) {
+    STRACE("clock_gettime(%d, 0x%x)", clock, tp);
+
     struct timespec_ t;
-    t.sec = ts.tv_sec;
-    t.nsec = ts.tv_nsec;
+    int err = do_clock_gettime(clock, &t);
+    if (err < 0)
+        return err;
     if (user_put(tp, t))
         return _EFAULT;
     return 0;
@@ -50,11 +63,8 @@ dword_t sys_clock_gettime(dword_t clock, addr_t tp) {
 dword_t sys_clock_getres(dword_t clock, addr_t res_addr) {
     STRACE("clock_getres(%d, %#x)", clock, res_addr);
     clockid_t clock_id;
-    switch (clock) {
-        case CLOCK_REALTIME_: clock_id = CLOCK_REALTIME; break;
-        case CLOCK_MONOTONIC_: clock_id = CLOCK_MONOTONIC; break;
-        default: return _EINVAL;
-    }
+    if (clockid_to_real(clock, &clock_id) < 0)
+        return _EINVAL;
 
     struct timespec res;
     int err = clock_getres(clock_id, &res);
@@ -123,25 +133,82 @@ dword_t sys_setitimer(dword_t which, addr_t new_val_addr, addr_t old_val_addr) {
     return 0;
 }
 
-dword_t sys_nanosleep(addr_t req_addr, addr_t rem_addr) {
+// Sleeps until the deadline on the given clock. Since the deadline is
+// absolute, waking up early and going back to sleep doesn't cause drift.
+// Sleeping is done by waiting on a condition, so a signal being delivered to
+// the task wakes it up directly. If that happens, returns _EINTR and puts how
+// much time was left in *remaining.
+static int sleep_until(clockid_t clock, struct timespec deadline, struct timespec *remaining) {
+    lock_t lock;
+    cond_t cond;
+    lock_init(&lock);
+    cond_init(&cond);
+    lock(&lock);
+    int err = 0;
+    while (true) {
+        struct timespec now;
+        clock_gettime(clock, &now);
+        struct timespec left = timespec_subtract(deadline, now);
+        if (!timespec_positive(left))
+            break;
+        if (wait_for(&cond, &lock, &left) == _EINTR) {
+            if (remaining != NULL) {
+                clock_gettime(clock, &now);
+                *remaining = timespec_subtract(deadline, now);
+                if (!timespec_positive(*remaining))
+                    *remaining = (struct timespec) {};
+            }
+            err = _EINTR;
+            break;
+        }
+    }
+    unlock(&lock);
+    cond_destroy(&cond);
+    return err;
+}
+
+// the callers trace the start of the call, this fills in the request
+static int do_nanosleep(dword_t clock, dword_t flags, addr_t req_addr, addr_t rem_addr) {
     struct timespec_ req_ts;
     if (user_get(req_addr, req_ts))
         return _EFAULT;
-    STRACE("nanosleep({%d, %d}, 0x%x", req_ts.sec, req_ts.nsec, rem_addr);
+    STRACE("{%d, %d}, 0x%x)", req_ts.sec, req_ts.nsec, rem_addr);
+    clockid_t clock_id;
+    if (clockid_to_real(clock, &clock_id) < 0)
+        return _EINVAL;
+    if ((sdword_t) req_ts.sec < 0 || req_ts.nsec >= 1000000000)
+        return _EINVAL;
     struct timespec req;
     req.tv_sec = req_ts.sec;
     req.tv_nsec = req_ts.nsec;
+
+    struct timespec deadline = req;
+    if (!(flags & TIMER_ABSTIME_)) {
+        struct timespec now;
+        clock_gettime(clock_id, &now);
+        deadline = timespec_add(now, req);
+    }
     struct timespec rem;
-    if (nanosleep(&req, &rem) < 0)
-        return errno_map();
-    if (rem_addr != 0) {
+    int err = sleep_until(clock_id, deadline, &rem);
+    // remaining time is only reported for relative sleeps
+    if (err == _EINTR && rem_addr != 0 && !(flags & TIMER_ABSTIME_)) {
         struct timespec_ rem_ts;
         rem_ts.sec = rem.tv_sec;
         rem_ts.nsec = rem.tv_nsec;
         if (user_put(rem_addr, rem_ts))
             return _EFAULT;
     }
-    return 0;
+    return err;
+}
+
+dword_t sys_nanosleep(addr_t req_addr, addr_t rem_addr) {
+    STRACE("nanosleep(");
+    return do_nanosleep(CLOCK_MONOTONIC_, 0, req_addr, rem_addr);
+}
+
+dword_t sys_clock_nanosleep(dword_t clock, dword_t flags, addr_t req_addr, addr_t rem_addr) {
+    STRACE("clock_nanosleep(%d, %#x, ", clock, flags);
+    return do_nanosleep(clock, flags, req_addr, rem_addr);
 }
 
 dword_t sys_times(addr_t tbuf) {
@@ -159,25 +226,67 @@ dword_t sys_times(addr_t tbuf) {
     return 0;
 }
 
-dword_t sys_gettimeofday(addr_t tv, addr_t tz) {
-    STRACE("gettimeofday(0x%x, 0x%x)", tv, tz);
+static int do_gettimeofday(struct timeval_ *tv, struct timezone_ *tz) {
     struct timeval timeval;
     struct timezone timezone;
     if (gettimeofday(&timeval, &timezone) < 0) {
         return errno_map();
     }
+    tv->sec = timeval.tv_sec;
+    tv->usec = timeval.tv_usec;
+    tz->minuteswest = timezone.tz_minuteswest;
+    tz->dsttime = timezone.tz_dsttime;
+    return 0;
+}
+
+dword_t sys_gettimeofday(addr_t tv, addr_t tz) {
+    STRACE("gettimeofday(0x%x, 0x%x)", tv, tz);
     struct timeval_ tv_;
     struct timezone_ tz_;
-    tv_.sec = timeval.tv_sec;
-    tv_.usec = timeval.tv_usec;
-    tz_.minuteswest = timezone.tz_minuteswest;
-    tz_.dsttime = timezone.tz_dsttime;
+    int err = do_gettimeofday(&tv_, &tz_);
+    if (err < 0)
+        return err;
     if ((tv && user_put(tv, tv_)) || (tz && user_put(tz, tz_))) {
         return _EFAULT;
     }
     return 0;
 }
 
+// Fast versions of the above, called from inside cpu_run with the memory
+// lock held. Results are written through the tlb, and if that faults they
+// return false so the syscall is retried the slow way and gets EFAULT.
+
+bool sys_time_fast(struct cpu_state *cpu, struct tlb *tlb) {
+    dword_t now = time(NULL);
+    if (cpu->ebx != 0 && !tlb_write(tlb, cpu->ebx, &now, sizeof(now)))
+        return false;
+    cpu->eax = now;
+    return true;
+}
+
+bool sys_clock_gettime_fast(struct cpu_state *cpu, struct tlb *tlb) {
+    struct timespec_ t;
+    int err = do_clock_gettime(cpu->ebx, &t);
+    if (err == 0 && !tlb_write(tlb, cpu->ecx, &t, sizeof(t)))
+        return false;
+    cpu->eax = err;
+    return true;
+}
+
+bool sys_gettimeofday_fast(struct cpu_state *cpu, struct tlb *tlb) {
+    struct timeval_ tv_;
+    struct timezone_ tz_;
+    int err = do_gettimeofday(&tv_, &tz_);
+    if (err == 0) {
+        if (cpu->ebx != 0 && !tlb_write(tlb, cpu->ebx, &tv_, sizeof(tv_)))
+            return false;
+        if (cpu->ecx != 0 && !tlb_write(tlb, cpu->ecx, &tz_, sizeof(tz_)))
+            return false;
+    }
+    cpu->eax = err;
+    return true;
+}
+
 dword_t sys_settimeofday(addr_t tv, addr_t tz) {
     return _EPERM;
 }
@@ -205,6 +314,11 @@ fd_t sys_timerfd_create(int_t clockid, int_t flags) {
     fd->ops = &timerfd_ops;
 
     fd->timer = timer_new((timer_callback_t) timerfd_callback, fd);
+    if (IS_ERR(fd->timer)) {
+        int err = PTR_ERR(fd->timer);
+        fd_close(fd);
+        return err;
+    }
     return f_install_flags(fd, flags);
 }
 
@@ -234,7 +348,8 @@ static int timerfd_poll(struct fd *fd) {
     return res;
 }
 static int timerfd_close(struct fd *fd) {
-    timer_free(fd->timer);
+    if (!IS_ERR(fd->timer))
+        timer_free(fd->timer);
     return 0;
 }
 
@@ -44,9 +44,18 @@ dword_t sys_getitimer(dword_t which, addr_t val);
 dword_t sys_setitimer(dword_t which, addr_t new_val, addr_t old_val);
 dword_t sys_times( addr_t tbuf);
 dword_t sys_nanosleep(addr_t req, addr_t rem);
+#define TIMER_ABSTIME_ 1
+dword_t sys_clock_nanosleep(dword_t clock, dword_t flags, addr_t req, addr_t rem);
 dword_t sys_gettimeofday(addr_t tv, addr_t tz);
 dword_t sys_settimeofday(addr_t tv, addr_t tz);
 
+// versions of the above that can run inside cpu_run, see fast_syscall_table
+struct cpu_state;
+struct tlb;
+bool sys_time_fast(struct cpu_state *cpu, struct tlb *tlb);
+bool sys_clock_gettime_fast(struct cpu_state *cpu, struct tlb *tlb);
+bool sys_gettimeofday_fast(struct cpu_state *cpu, struct tlb *tlb);
+
 fd_t sys_timerfd_create(int_t clockid, int_t flags);
 
 #endif
@@ -40,27 +40,42 @@ static int signal_action(struct sighand *sighand, int sig) {
 
 void deliver_signal(struct task *task, int sig) {
     task->pending |= 1l << sig;
-    if (task != current) {
-        // actual madness, I hope to god it's correct
-retry:
-        lock(&task->waiting_cond_lock);
-        if (task->waiting_cond != NULL) {
-            bool mine = false;
-            if (pthread_mutex_trylock(&task->waiting_lock->m) == EBUSY) {
-                if (pthread_equal(task->waiting_lock->owner, pthread_self()))
-                    mine = true;
-                if (!mine) {
-                    unlock(&task->waiting_cond_lock);
-                    goto retry;
-                }
-            }
-            notify(task->waiting_cond);
-            if (!mine)
-                unlock(task->waiting_lock);
-        }
+    if (task == current)
+        return;
+
+    // if it's running guest code, this gets it back out to receive_signals
+    atomic_store(&task->cpu.poked, true);
+
+    lock(&task->waiting_cond_lock);
+    cond_t *waiting_cond = task->waiting_cond;
+    lock_t *waiting_lock = task->waiting_lock;
+    if (waiting_cond == NULL) {
+        // might be blocked in a host call, which only a host signal can stop
+        bool in_syscall = atomic_load(&task->in_syscall);
         unlock(&task->waiting_cond_lock);
-        pthread_kill(task->thread, SIGUSR1);
+        if (in_syscall)
+            pthread_kill(task->thread, SIGUSR1);
+        return;
     }
+
+    // The notify has to happen with the waiting lock held, or it could land
+    // between the task checking for signals and going to sleep. Waiting for
+    // that lock while holding waiting_cond_lock would deadlock with the task
+    // returning from wait_for, so pin the lock and condition instead, which
+    // keeps the task from returning until we're done with them.
+    task->waiting_pins++;
+    unlock(&task->waiting_cond_lock);
+    bool locked = pthread_mutex_trylock(&waiting_lock->m) == 0;
+    bool mine = !locked && pthread_equal(waiting_lock->owner, pthread_self());
+    if (!locked && !mine)
+        lock(waiting_lock);
+    notify(waiting_cond);
+    if (!mine)
+        unlock(waiting_lock);
+    lock(&task->waiting_cond_lock);
+    if (--task->waiting_pins == 0)
+        notify(&task->waiting_unpinned);
+    unlock(&task->waiting_cond_lock);
 }
 
 void send_signal(struct task *task, int sig) {
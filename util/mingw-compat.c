@@ -1 +1,115 @@
 #include "mingw-compat.h"
+#include <stdbool.h>
+
+#ifndef HAVE_RECVMSG
+#define NEED_MSG
+#endif
+#ifndef HAVE_SENDMSG
+#define NEED_MSG
+#endif
+
+#ifdef NEED_MSG
+// recvmsg and sendmsg on top of WSARecvFrom and WSASendTo, which can scatter
+// and gather but can't do control messages.
+
+static int wsa_errno(int err) {
+    switch (err) {
+        case WSAEINTR: return EINTR;
+        case WSAEWOULDBLOCK: return EAGAIN;
+        case WSAEFAULT: return EFAULT;
+        case WSAEINVAL: return EINVAL;
+        case WSAENOTSOCK: return ENOTSOCK;
+        case WSAEMSGSIZE: return EMSGSIZE;
+        case WSAEOPNOTSUPP: return EOPNOTSUPP;
+        case WSAENETDOWN: return ENETDOWN;
+        case WSAENETUNREACH: return ENETUNREACH;
+        case WSAEHOSTUNREACH: return EHOSTUNREACH;
+        case WSAECONNABORTED: return ECONNABORTED;
+        case WSAECONNRESET: return ECONNRESET;
+        case WSAENOBUFS: return ENOBUFS;
+        case WSAENOTCONN: return ENOTCONN;
+        case WSAESHUTDOWN: return EPIPE;
+        case WSAETIMEDOUT: return ETIMEDOUT;
+        case WSAECONNREFUSED: return ECONNREFUSED;
+        case WSAEDESTADDRREQ: return EDESTADDRREQ;
+        case WSAEADDRNOTAVAIL: return EADDRNOTAVAIL;
+    }
+    return EIO;
+}
+
+static int msg_bufs(const struct msghdr *msg, WSABUF *bufs) {
+    if (msg->msg_iovlen > IOV_MAX) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    for (size_t i = 0; i < msg->msg_iovlen; i++) {
+        bufs[i].buf = msg->msg_iov[i].iov_base;
+        bufs[i].len = msg->msg_iov[i].iov_len;
+    }
+    return 0;
+}
+
+// Winsock has no per-call version of O_NONBLOCK, so MSG_DONTWAIT is done by
+// checking first
+static int msg_would_block(int sock, int flags, bool write) {
+    if (!(flags & MSG_DONTWAIT))
+        return 0;
+    fd_set set;
+    FD_ZERO(&set);
+    FD_SET((SOCKET) sock, &set);
+    struct timeval timeout = {};
+    int ready = select(0, write ? NULL : &set, write ? &set : NULL, NULL, &timeout);
+    if (ready == SOCKET_ERROR) {
+        errno = wsa_errno(WSAGetLastError());
+        return -1;
+    }
+    if (ready == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+#ifndef HAVE_RECVMSG
+ssize_t iSL_recvmsg(int sock, struct msghdr *msg, int flags) {
+    WSABUF bufs[IOV_MAX];
+    if (msg_bufs(msg, bufs) < 0 || msg_would_block(sock, flags, false) < 0)
+        return -1;
+    DWORD received = 0;
+    DWORD wsa_flags = flags & ~MSG_DONTWAIT;
+    INT namelen = msg->msg_namelen;
+    if (WSARecvFrom((SOCKET) sock, bufs, msg->msg_iovlen, &received, &wsa_flags,
+                msg->msg_name, msg->msg_name != NULL ? &namelen : NULL, NULL, NULL) == SOCKET_ERROR) {
+        int err = WSAGetLastError();
+        if (err != WSAEMSGSIZE) {
+            errno = wsa_errno(err);
+            return -1;
+        }
+        // a datagram that didn't fit, the buffers are full
+        received = 0;
+        for (size_t i = 0; i < msg->msg_iovlen; i++)
+            received += bufs[i].len;
+        wsa_flags |= MSG_TRUNC;
+    }
+    msg->msg_namelen = msg->msg_name != NULL ? namelen : 0;
+    msg->msg_controllen = 0;
+    msg->msg_flags = wsa_flags & MSG_TRUNC;
+    return received;
+}
+#endif
+
+#ifndef HAVE_SENDMSG
+ssize_t iSL_sendmsg(int sock, const struct msghdr *msg, int flags) {
+    WSABUF bufs[IOV_MAX];
+    if (msg_bufs(msg, bufs) < 0 || msg_would_block(sock, flags, true) < 0)
+        return -1;
+    DWORD sent = 0;
+    if (WSASendTo((SOCKET) sock, bufs, msg->msg_iovlen, &sent, flags & ~MSG_DONTWAIT,
+                msg->msg_name, msg->msg_namelen, NULL, NULL) == SOCKET_ERROR) {
+        errno = wsa_errno(WSAGetLastError());
+        return -1;
+    }
+    return sent;
+}
+#endif
@@ -121,6 +121,12 @@ ssize_t iSL_recvmsg(int, struct msghdr *, int);
 #define recvmsg iSL_recvmsg
 #endif
 
+#ifndef HAVE_SENDMSG
+struct msghdr;
+ssize_t iSL_sendmsg(int, const struct msghdr *, int);
+#define sendmsg iSL_sendmsg
+#endif
+
 // POSIX 1003.1g - ancillary data object information
 // Ancillary data consits of a sequence of pairs of
 // (cmsghdr, cmsg_data[])
@@ -42,22 +42,50 @@ void cond_destroy(cond_t *cond) {
     pthread_cond_destroy(&cond->cond);
 }
 
+static int wait_for_internal(cond_t *cond, lock_t *lock, struct timespec *timeout, bool interruptible);
+
 int wait_for(cond_t *cond, lock_t *lock, struct timespec *timeout) {
-    if (current && current->pending)
-        return _EINTR;
-    int err = wait_for_ignore_signals(cond, lock, timeout);
+    int err = wait_for_internal(cond, lock, timeout, true);
     if (err < 0)
-        return _ETIMEDOUT;
+        return err;
     if (current && current->pending)
         return _EINTR;
     return 0;
 }
 
 int wait_for_ignore_signals(cond_t *cond, lock_t *lock, struct timespec *timeout) {
+    return wait_for_internal(cond, lock, timeout, false);
+}
+
+static void stop_waiting(lock_t *lock) {
+    lock(&current->waiting_cond_lock);
+    current->waiting_cond = NULL;
+    current->waiting_lock = NULL;
+    if (current->waiting_pins > 0) {
+        // deliver_signal is still using the lock, which it can't get while
+        // we're holding it
+        unlock(lock);
+        while (current->waiting_pins > 0)
+            pthread_cond_wait(&current->waiting_unpinned.cond, &current->waiting_cond_lock.m);
+        unlock(&current->waiting_cond_lock);
+        lock(lock);
+    } else {
+        unlock(&current->waiting_cond_lock);
+    }
+}
+
+static int wait_for_internal(cond_t *cond, lock_t *lock, struct timespec *timeout, bool interruptible) {
     if (current) {
         lock(&current->waiting_cond_lock);
         current->waiting_cond = cond;
         current->waiting_lock = lock;
+        // checked after registering, so deliver_signal either sees the
+        // condition or we see the signal
+        if (interruptible && current->pending) {
+            unlock(&current->waiting_cond_lock);
+            stop_waiting(lock);
+            return _EINTR;
+        }
         unlock(&current->waiting_cond_lock);
     }
     int rc = 0;
@@ -90,12 +118,8 @@ int wait_for_ignore_signals(cond_t *cond, lock_t *lock, struct timespec *timeout
 #error Unimplemented pthread_cond_wait relative timeout.
 #endif
     }
-    if (current) {
-        lock(&current->waiting_cond_lock);
-        current->waiting_cond = NULL;
-        current->waiting_lock = NULL;
-        unlock(&current->waiting_cond_lock);
-    }
+    if (current)
+        stop_waiting(lock);
     if (rc == ETIMEDOUT)
         return _ETIMEDOUT;
     return 0;
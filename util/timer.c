@@ -1,70 +1,244 @@
 #include <stdlib.h>
-#include <signal.h>
 #include <time.h>
 #include "util/timer.h"
+#include "kernel/user-errno.h"
 #include "misc.h"
 
-struct timer *timer_new(timer_callback_t callback, void *data) {
-    struct timer *timer = malloc(sizeof(struct timer));
-    timer->callback = callback;
-    timer->data = data;
-    timer->running = false;
-    lock_init(&timer->lock);
-    return timer;
+// A hierarchical timer wheel, serviced by a single thread. Level 0 has one
+// slot per tick, each level above that has slots which are WHEEL_SIZE times
+// as wide as the level below. When the wheel reaches the start of a slot on a
+// higher level, the timers in that slot are cascaded down to lower levels.
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 5 // 2^30 ticks, about 12 days
+#define WHEEL_TICK_NSEC 1000000 // 1ms
+#define WHEEL_TICKS_PER_SEC (1000000000 / WHEEL_TICK_NSEC)
+
+static struct {
+    struct list slots[WHEEL_LEVELS][WHEEL_SIZE];
+    struct timespec base; // time of tick 0
+    uint64_t now; // last tick that has been processed
+    uint64_t sleep_until; // tick the wheel thread will wake up at
+    unsigned count; // number of armed timers
+    struct timer *firing; // timer whose callback is running right now
+    lock_t lock;
+    cond_t cond;
+    cond_t fired; // signalled when a callback returns
+} wheel;
+
+static pthread_once_t wheel_once = PTHREAD_ONCE_INIT;
+
+static uint64_t wheel_ticks(struct timespec ts, bool round_up) {
+    struct timespec since_base = timespec_subtract(ts, wheel.base);
+    if (since_base.tv_sec < 0)
+        return 0;
+    uint64_t nsec = (uint64_t) since_base.tv_sec * 1000000000 + since_base.tv_nsec;
+    if (round_up)
+        nsec += WHEEL_TICK_NSEC - 1;
+    return nsec / WHEEL_TICK_NSEC;
 }
 
-void timer_free(struct timer *timer) {
-    free(timer);
+static struct timespec wheel_tick_time(uint64_t tick) {
+    struct timespec offset;
+    offset.tv_sec = tick / WHEEL_TICKS_PER_SEC;
+    offset.tv_nsec = (tick % WHEEL_TICKS_PER_SEC) * WHEEL_TICK_NSEC;
+    return timespec_add(wheel.base, offset);
 }
 
-static void *timer_thread(void *param) {
-    struct timer *timer = param;
-    lock(&timer->lock);
-    while (true) {
-        struct timespec remaining = timespec_subtract(timer->end, timespec_now());
-        while (timer->running && timespec_positive(remaining)) {
-            unlock(&timer->lock);
-            nanosleep(&remaining, NULL);
-            lock(&timer->lock);
-            remaining = timespec_subtract(timer->end, timespec_now());
+static void wheel_add(struct timer *timer) {
+    uint64_t expires = timer->expires;
+    if (expires <= wheel.now)
+        expires = wheel.now + 1;
+
+    // A timer goes on the lowest level where its slot comes up again in no
+    // more than one full turn of that level
+    int level;
+    for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+        int shift = level * WHEEL_BITS;
+        if ((expires >> shift) - (wheel.now >> shift) <= WHEEL_SIZE)
+            break;
+    }
+    int shift = level * WHEEL_BITS;
+    uint64_t slot = expires >> shift;
+    // too far in the future, park it in the furthest slot and it'll be
+    // cascaded and placed again when that slot comes up
+    if (slot - (wheel.now >> shift) > WHEEL_SIZE)
+        slot = (wheel.now >> shift) + WHEEL_SIZE;
+    list_add_before(&wheel.slots[level][slot & WHEEL_MASK], &timer->wheel_links);
+    wheel.count++;
+}
+
+static void wheel_remove(struct timer *timer) {
+    list_remove(&timer->wheel_links);
+    wheel.count--;
+}
+
+// Returns the next tick on which something needs to happen, either a timer
+// firing or a cascade of a non-empty slot.
+static uint64_t wheel_next_event() {
+    uint64_t next = UINT64_MAX;
+    if (wheel.count == 0)
+        return next;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        int shift = level * WHEEL_BITS;
+        for (uint64_t slot = (wheel.now >> shift) + 1; slot <= (wheel.now >> shift) + WHEEL_SIZE; slot++) {
+            if (!list_empty(&wheel.slots[level][slot & WHEEL_MASK])) {
+                if (slot << shift < next)
+                    next = slot << shift;
+                break;
+            }
         }
-        if (timer->running)
-            timer->callback(timer->data);
+    }
+    return next;
+}
+
+static void wheel_cascade(int level, uint64_t tick) {
+    struct list *slot = &wheel.slots[level][(tick >> (level * WHEEL_BITS)) & WHEEL_MASK];
+    struct timer *timer, *tmp;
+    list_for_each_entry_safe(slot, timer, tmp, wheel_links) {
+        wheel_remove(timer);
+        wheel_add(timer);
+    }
+}
+
+// Process the tick after wheel.now
+static void wheel_run_tick() {
+    uint64_t tick = wheel.now + 1;
+    // cascade from the top down, so timers which come down several levels at
+    // once end up in a slot that hasn't been processed yet
+    int levels = 0;
+    while (levels < WHEEL_LEVELS - 1 && (tick & ((1ull << ((levels + 1) * WHEEL_BITS)) - 1)) == 0)
+        levels++;
+    for (int level = levels; level > 0; level--)
+        wheel_cascade(level, tick);
+
+    // Callbacks take locks of their own (sighand, fds) which may be held by
+    // someone calling timer_set, so they're called with the wheel unlocked.
+    // Anything that gets added to this slot meanwhile is still handled here.
+    struct list *slot = &wheel.slots[0][tick & WHEEL_MASK];
+    while (!list_empty(slot)) {
+        struct timer *timer = list_first_entry(slot, struct timer, wheel_links);
+        wheel_remove(timer);
         if (timespec_positive(timer->interval)) {
             timer->start = timer->end;
             timer->end = timespec_add(timer->start, timer->interval);
+            timer->expires = wheel_ticks(timer->end, true);
+            if (timer->expires <= tick)
+                timer->expires = tick + 1;
+            wheel_add(timer);
         } else {
-            break;
+            timer->running = false;
+        }
+
+        wheel.firing = timer;
+        timer_callback_t callback = timer->callback;
+        void *data = timer->data;
+        unlock(&wheel.lock);
+        callback(data);
+        lock(&wheel.lock);
+        wheel.firing = NULL;
+        notify(&wheel.fired);
+    }
+    wheel.now = tick;
+}
+
+static void *wheel_thread(void *param) {
+    lock(&wheel.lock);
+    while (true) {
+        uint64_t target = wheel_ticks(timespec_now(), false);
+        while (wheel.now < target) {
+            // skip over ticks where nothing happens
+            uint64_t next = wheel_next_event();
+            if (next > target) {
+                wheel.now = target;
+                break;
+            }
+            wheel.now = next - 1;
+            wheel_run_tick();
+        }
+
+        wheel.sleep_until = wheel_next_event();
+        if (wheel.sleep_until == UINT64_MAX) {
+            wait_for_ignore_signals(&wheel.cond, &wheel.lock, NULL);
+        } else {
+            struct timespec timeout = timespec_subtract(wheel_tick_time(wheel.sleep_until), timespec_now());
+            if (timespec_positive(timeout))
+                wait_for_ignore_signals(&wheel.cond, &wheel.lock, &timeout);
         }
     }
-    timer->running = false;
-    unlock(&timer->lock);
     return NULL;
 }
 
+static void wheel_init() {
+    for (int level = 0; level < WHEEL_LEVELS; level++)
+        for (int i = 0; i < WHEEL_SIZE; i++)
+            list_init(&wheel.slots[level][i]);
+    wheel.base = timespec_now();
+    wheel.now = 0;
+    wheel.sleep_until = UINT64_MAX;
+    wheel.count = 0;
+    wheel.firing = NULL;
+    lock_init(&wheel.lock);
+    cond_init(&wheel.cond);
+    cond_init(&wheel.fired);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, wheel_thread, NULL) != 0)
+        abort();
+    pthread_detach(thread);
+}
+
+struct timer *timer_new(timer_callback_t callback, void *data) {
+    pthread_once(&wheel_once, wheel_init);
+    struct timer *timer = malloc(sizeof(struct timer));
+    if (timer == NULL)
+        return ERR_PTR(_ENOMEM);
+    timer->callback = callback;
+    timer->data = data;
+    timer->running = false;
+    timer->interval = (struct timespec) {};
+    return timer;
+}
+
+void timer_free(struct timer *timer) {
+    lock(&wheel.lock);
+    // the callback may still be using data
+    while (wheel.firing == timer)
+        wait_for_ignore_signals(&wheel.fired, &wheel.lock, NULL);
+    if (timer->running)
+        wheel_remove(timer);
+    unlock(&wheel.lock);
+    free(timer);
+}
+
 int timer_set(struct timer *timer, struct timer_spec spec, struct timer_spec *oldspec) {
-    lock(&timer->lock);
+    lock(&wheel.lock);
     struct timespec now = timespec_now();
     if (oldspec != NULL) {
-        oldspec->value = timespec_subtract(timer->end, now);
+        oldspec->value = (struct timespec) {};
+        if (timer->running) {
+            struct timespec remaining = timespec_subtract(timer->end, now);
+            if (timespec_positive(remaining))
+                oldspec->value = remaining;
+        }
         oldspec->interval = timer->interval;
     }
 
+    if (timer->running) {
+        wheel_remove(timer);
+        timer->running = false;
+    }
     timer->start = now;
     timer->end = timespec_add(timer->start, spec.value);
     timer->interval = spec.interval;
     if (!timespec_is_zero(spec.value)) {
-        if (!timer->running) {
-            timer->running = true;
-            pthread_create(&timer->thread, NULL, timer_thread, timer);
-            pthread_detach(timer->thread);
-        }
-    } else {
-        if (timer->running) {
-            timer->running = false;
-            pthread_kill(timer->thread, SIGUSR1);
-        }
+        timer->running = true;
+        timer->expires = wheel_ticks(timer->end, true);
+        wheel_add(timer);
+        if (timer->expires < wheel.sleep_until)
+            notify(&wheel.cond);
     }
-    unlock(&timer->lock);
+    unlock(&wheel.lock);
     return 0;
 }
@@ -5,6 +5,7 @@
 #include <pthread.h>
 #include <pthread_time.h>
 #include "util/sync.h"
+#include "util/list.h"
 
 static inline struct timespec timespec_now() {
     struct timespec now;
@@ -49,13 +50,21 @@ struct timer {
     struct timespec interval;
 
     bool running;
-    pthread_t thread;
     timer_callback_t callback;
     void *data;
-    lock_t lock;
+
+    // everything below is locked by the timer wheel
+    struct list wheel_links;
+    uint64_t expires; // in wheel ticks
 };
 
+// All timers share one host thread which runs a hierarchical timer wheel, so
+// arming or cancelling a timer is O(1) and doesn't create a thread. Callbacks
+// are called from the wheel thread without the wheel locked. They should be
+// quick, and must not call timer_free on their own timer.
 struct timer *timer_new(timer_callback_t callback, void *data);
+// Cancels the timer if it's armed and frees it. If its callback is running,
+// this waits for it to return, so don't call it holding a lock the callback takes.
 void timer_free(struct timer *timer);
 // value is how long to wait until the next fire
 // interval is how long after that to wait until the next fire (if non-zero)